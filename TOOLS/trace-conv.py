@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+import json
+import struct
+import sys
+
+"""
+This script converts the binary trace files written by mpv --trace-file (or
+the "trace write" command) to Chrome trace event JSON, which can be loaded
+into chrome://tracing.
+
+Usage: trace-conv.py <input> [<output.json>]
+
+See common/trace.c for a description of the binary format.
+"""
+
+PHASES = ["B", "E", "C", "s", "t", "f"]
+
+def convert(data):
+    if data[:8] != b"mpvtrace":
+        raise ValueError("not an mpv trace file")
+    version, = struct.unpack_from("<I", data, 8)
+    if version != 1:
+        raise ValueError("unsupported version %d" % version)
+    pos = 12
+    names = {}
+    events = []
+    while pos < len(data):
+        rtype = data[pos:pos + 1]
+        if rtype == b"N":
+            id, length = struct.unpack_from("<HH", data, pos + 1)
+            pos += 5
+            names[id] = data[pos:pos + length].decode("utf-8", "replace")
+            pos += length
+        elif rtype == b"E":
+            type, id, tid, time, value = struct.unpack_from("<BHIqq", data, pos + 1)
+            pos += 24
+            ev = {"name": names[id], "ph": PHASES[type], "ts": time,
+                  "pid": 1, "tid": tid}
+            if PHASES[type] == "C":
+                ev["args"] = {"value": value}
+            elif type >= 3:
+                ev["cat"] = "flow"
+                ev["id"] = value
+                if PHASES[type] != "s":
+                    ev["bp"] = "e"
+            events.append(ev)
+        else:
+            raise ValueError("unknown record type at offset %d" % pos)
+    return {"traceEvents": events}
+
+with open(sys.argv[1], "rb") as f:
+    result = convert(f.read())
+
+if len(sys.argv) > 2:
+    with open(sys.argv[2], "w") as f:
+        json.dump(result, f)
+else:
+    json.dump(result, sys.stdout)
@@ -173,7 +173,7 @@ static int control(struct dec_audio *da, int cmd, void *arg)
     switch (cmd) {
     case ADCTRL_RESET:
         avcodec_flush_buffers(ctx->avctx);
-        talloc_free(ctx->packet);
+        free_demux_packet(ctx->packet);
         ctx->packet = NULL;
         ctx->skip_samples = 0;
         return CONTROL_TRUE;
@@ -218,7 +218,7 @@ static int decode_packet(struct dec_audio *da, struct mp_audio **out)
             mpkt->pts = MP_NOPTS_VALUE; // don't reset PTS next time
         }
         if (mpkt->len == 0 || ret < 0) {
-            talloc_free(mpkt);
+            free_demux_packet(mpkt);
             priv->packet = NULL;
         }
         // LATM may need many packets to find mux info
@@ -231,7 +231,7 @@ static int decode_packet(struct dec_audio *da, struct mp_audio **out)
 
     /* Have to use mpg123_feed() to avoid decoding here. */
     ret = mpg123_feed(con->handle, pkt->buffer, pkt->len);
-    talloc_free(pkt);
+    free_demux_packet(pkt);
 
     if (ret != MPG123_OK)
         goto mpg123_fail;
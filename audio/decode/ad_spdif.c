@@ -206,7 +206,7 @@ static int decode_packet(struct dec_audio *da, struct mp_audio **out)
         da->pts_offset = 0;
     }
     int ret = av_write_frame(lavf_ctx, &pkt);
-    talloc_free(mpkt);
+    free_demux_packet(mpkt);
     avio_flush(lavf_ctx->pb);
     if (ret < 0)
         return AD_ERR;
@@ -18,8 +18,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <unistd.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <libavutil/mem.h>
 
@@ -28,7 +30,10 @@
 #include "config.h"
 #include "common/codecs.h"
 #include "common/msg.h"
+#include "common/trace.h"
 #include "misc/bstr.h"
+#include "osdep/threads.h"
+#include "osdep/timer.h"
 
 #include "stream/stream.h"
 #include "demux/demux.h"
@@ -150,6 +155,7 @@ void audio_uninit(struct dec_audio *d_audio)
 {
     if (!d_audio)
         return;
+    audio_stop_thread(d_audio);
     MP_VERBOSE(d_audio, "Uninit audio filters...\n");
     af_destroy(d_audio->afilter);
     uninit_decoder(d_audio);
@@ -185,6 +191,8 @@ int audio_decode(struct dec_audio *da, struct mp_audio_buffer *outbuf,
         return AD_ERR;
 
     MP_STATS(da, "start audio");
+    MP_TRACE_BEGIN(da, "decode audio");
+    int64_t cpu_start = da->measure_cpu ? mp_thread_cpu_time_us() : 0;
 
     int res = 0;
     while (res >= 0 && minsamples >= 0) {
@@ -220,17 +228,120 @@ int audio_decode(struct dec_audio *da, struct mp_audio_buffer *outbuf,
         if (mpa)
             da->waiting = NULL;
 
-        if (af_filter(afs, mpa, outbuf) < 0)
-            return AD_ERR;
+        if (af_filter(afs, mpa, outbuf) < 0) {
+            res = AD_ERR;
+            break;
+        }
     }
 
+    if (da->measure_cpu) {
+        atomic_fetch_add(&da->decode_cpu_us,
+                         mp_thread_cpu_time_us() - cpu_start);
+    }
     MP_STATS(da, "end audio");
+    MP_TRACE_END(da, "decode audio");
 
     return res;
 }
 
+// Return the pts of the end of the audio decoded so far, minus the audio
+// that was not filtered yet. *out_delay is set to the audio buffered in the
+// filters (and in the decoder thread) after this, in seconds of output.
+static double get_decoded_pts(struct dec_audio *da, double *out_delay)
+{
+    *out_delay = 0;
+
+    struct mp_audio in_format = da->decode_format;
+
+    if (!mp_audio_config_valid(&in_format) || da->afilter->initialized < 1)
+        return MP_NOPTS_VALUE;
+
+    // da->pts is the timestamp of the latest input packet with known pts that
+    // the decoder has decoded. da->pts_offset is the amount of samples the
+    // decoder has written after that timestamp.
+    double a_pts = da->pts;
+    if (a_pts == MP_NOPTS_VALUE)
+        return MP_NOPTS_VALUE;
+    a_pts += da->pts_offset / (double)in_format.rate;
+
+    // Decoded but not filtered
+    if (da->waiting)
+        a_pts -= da->waiting->samples / (double)in_format.rate;
+
+    // Data buffered in audio filters, measured in seconds of "missing" output
+    *out_delay = af_calc_delay(da->afilter);
+
+    return a_pts;
+}
+
+struct audio_decode_thread {
+    struct dec_audio *d_audio;
+    pthread_t thread;
+    // Filtered by the thread, but not yet in buffer (accessed without lock,
+    // only by the decoder thread).
+    struct mp_audio_buffer *decode_buffer;
+
+    // --- The following fields are protected by lock
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    bool terminate;
+    bool stopped;               // don't decode until the next reset
+    bool waiting;               // last decode call returned AD_WAIT
+    bool need_wakeup;           // last audio_read_decoded() call had too little
+    int status;                 // last decode call result (AD_*)
+    uint64_t requests;          // incremented by each audio_read_decoded() call
+    uint64_t generation;        // incremented by each reset
+    int target_samples;
+    int wanted_samples;         // missing samples on the last read
+
+    struct mp_audio_buffer *buffer;
+    // get_decoded_pts() results, as of the end of buffer
+    double pts;
+    double delay;
+
+    void (*wakeup_cb)(void *ctx);
+    void *wakeup_ctx;
+};
+
+// Must be called with both the filter chain lock and lock held.
+static void reset_thread(struct audio_decode_thread *t)
+{
+    mp_audio_buffer_clear(t->buffer);
+    t->generation++;
+    t->stopped = false;
+    t->waiting = false;
+    t->need_wakeup = false;
+    t->status = AD_OK;
+    t->wanted_samples = 0;
+    t->pts = MP_NOPTS_VALUE;
+    t->delay = 0;
+}
+
+// Make the decoder thread stop reading packets, and drop what it decoded,
+// until audio_reset_decoding() is called. Call this before seeking the
+// demuxer, so that no packet from after the seek is consumed and discarded.
+void audio_quiesce_decoding(struct dec_audio *d_audio)
+{
+    struct audio_decode_thread *t = d_audio->thread;
+    if (!t)
+        return;
+    af_lock(d_audio->afilter);
+    pthread_mutex_lock(&t->lock);
+    reset_thread(t);
+    t->stopped = true;
+    pthread_mutex_unlock(&t->lock);
+    af_unlock(d_audio->afilter);
+}
+
 void audio_reset_decoding(struct dec_audio *d_audio)
 {
+    struct audio_decode_thread *t = d_audio->thread;
+    af_lock(d_audio->afilter);
+    if (t) {
+        pthread_mutex_lock(&t->lock);
+        reset_thread(t);
+        pthread_mutex_unlock(&t->lock);
+    }
     if (d_audio->ad_driver)
         d_audio->ad_driver->control(d_audio, ADCTRL_RESET, NULL);
     af_control_all(d_audio->afilter, AF_CONTROL_RESET, NULL);
@@ -240,4 +351,202 @@ void audio_reset_decoding(struct dec_audio *d_audio)
         talloc_free(d_audio->waiting);
         d_audio->waiting = NULL;
     }
+    af_unlock(d_audio->afilter);
+}
+
+// Return the pts of the end of the filtered audio, minus *out_delay seconds of
+// filter output (this is data that was filtered, but not returned yet). If
+// there is a decoder thread, this is the state of the thread.
+double audio_get_pts(struct dec_audio *d_audio, double *out_delay)
+{
+    struct audio_decode_thread *t = d_audio->thread;
+    if (!t)
+        return get_decoded_pts(d_audio, out_delay);
+    pthread_mutex_lock(&t->lock);
+    double pts = t->pts;
+    *out_delay = t->delay + mp_audio_buffer_seconds(t->buffer);
+    pthread_mutex_unlock(&t->lock);
+    return pts;
+}
+
+// Move up to samples samples from src to dst.
+static void move_samples(struct mp_audio_buffer *dst,
+                         struct mp_audio_buffer *src, int samples)
+{
+    struct mp_audio data;
+    mp_audio_buffer_peek(src, &data);
+    data.samples = MPMIN(data.samples, samples);
+    mp_audio_buffer_append(dst, &data);
+    mp_audio_buffer_skip(src, data.samples);
+}
+
+static void *decode_thread(void *ptr)
+{
+    struct audio_decode_thread *t = ptr;
+    struct dec_audio *d_audio = t->d_audio;
+    struct af_stream *afs = d_audio->afilter;
+
+    mpthread_set_name("ad");
+
+    pthread_mutex_lock(&t->lock);
+    uint64_t retry_request = 0;
+    while (!t->terminate) {
+        // After a format change, the player has to reinit the filter chain
+        // (which stops this thread). On EOF, errors, or if the demuxer had no
+        // packet, retry only after the next request.
+        bool retry = t->waiting || t->status == AD_EOF || t->status == AD_ERR;
+        int target = MPMAX(t->target_samples, t->wanted_samples);
+        if (t->stopped || t->status == AD_NEW_FMT ||
+            mp_audio_buffer_samples(t->buffer) >= target ||
+            (retry && t->requests == retry_request))
+        {
+            pthread_cond_wait(&t->wakeup, &t->lock);
+            continue;
+        }
+        uint64_t generation = t->generation;
+        retry_request = t->requests;
+        pthread_mutex_unlock(&t->lock);
+
+        // Decode and filter a single packet at a time, so that the filter
+        // chain isn't locked for too long.
+        af_lock(afs);
+        pthread_mutex_lock(&t->lock);
+        bool reset = t->generation != generation;
+        pthread_mutex_unlock(&t->lock);
+
+        int r = AD_OK;
+        double pts = MP_NOPTS_VALUE, delay = 0;
+        if (!reset) {
+            r = audio_decode(d_audio, t->decode_buffer, 0);
+            pts = get_decoded_pts(d_audio, &delay);
+        }
+        af_unlock(afs);
+
+        pthread_mutex_lock(&t->lock);
+        if (reset || t->generation != generation) {
+            mp_audio_buffer_clear(t->decode_buffer);
+            continue;
+        }
+        move_samples(t->buffer, t->decode_buffer, INT_MAX);
+        t->pts = pts;
+        t->delay = delay;
+        t->waiting = r == AD_WAIT;
+        t->status = r == AD_WAIT ? AD_OK : r;
+        if (t->need_wakeup && (r < 0 || mp_audio_buffer_samples(t->buffer) >=
+                                        t->wanted_samples))
+        {
+            t->need_wakeup = false;
+            pthread_mutex_unlock(&t->lock);
+            t->wakeup_cb(t->wakeup_ctx);
+            pthread_mutex_lock(&t->lock);
+        }
+    }
+    pthread_mutex_unlock(&t->lock);
+    return NULL;
+}
+
+// Start a thread that decodes and filters audio in advance, keeping at least
+// buffer_secs of filtered audio. wakeup_cb is called when data requested by
+// audio_read_decoded() becomes available. The packets must be read from a
+// demuxer with a demuxer thread, and the filter chain must be initialized.
+// After this, audio_read_decoded() has to be used instead of audio_decode(),
+// and the filter chain must be accessed with af_lock() only.
+bool audio_start_thread(struct dec_audio *d_audio, double buffer_secs,
+                        void (*wakeup_cb)(void *ctx), void *wakeup_ctx)
+{
+    assert(!d_audio->thread);
+    struct af_stream *afs = d_audio->afilter;
+    if (afs->initialized < 1)
+        return false;
+    struct audio_decode_thread *t = talloc_ptrtype(d_audio, t);
+    *t = (struct audio_decode_thread) {
+        .d_audio = d_audio,
+        .decode_buffer = mp_audio_buffer_create(t),
+        .buffer = mp_audio_buffer_create(t),
+        .target_samples = MPMAX(buffer_secs * afs->output.rate, 1),
+        .pts = MP_NOPTS_VALUE,
+        .wakeup_cb = wakeup_cb,
+        .wakeup_ctx = wakeup_ctx,
+    };
+    mp_audio_buffer_reinit(t->decode_buffer, &afs->output);
+    mp_audio_buffer_reinit(t->buffer, &afs->output);
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->wakeup, NULL);
+    // Start from the current decoder state (written_audio_pts() mustn't jump).
+    t->pts = get_decoded_pts(d_audio, &t->delay);
+    if (pthread_create(&t->thread, NULL, decode_thread, t)) {
+        pthread_cond_destroy(&t->wakeup);
+        pthread_mutex_destroy(&t->lock);
+        talloc_free(t);
+        return false;
+    }
+    d_audio->thread = t;
+    MP_VERBOSE(d_audio, "Decoding %.3f seconds of audio ahead.\n", buffer_secs);
+    return true;
+}
+
+// Stop the decoder thread (if any). Audio decoded ahead is discarded.
+void audio_stop_thread(struct dec_audio *d_audio)
+{
+    struct audio_decode_thread *t = d_audio->thread;
+    if (!t)
+        return;
+    pthread_mutex_lock(&t->lock);
+    t->terminate = true;
+    pthread_cond_signal(&t->wakeup);
+    pthread_mutex_unlock(&t->lock);
+    pthread_join(t->thread, NULL);
+    pthread_cond_destroy(&t->wakeup);
+    pthread_mutex_destroy(&t->lock);
+    talloc_free(t);
+    d_audio->thread = NULL;
+}
+
+// Like audio_decode(), but take the audio from the decoder thread. Returns
+// AD_WAIT if not enough data is available yet (the wakeup callback will be
+// called when it is). The other return values are returned only after all
+// audio preceding them was returned.
+// Each call also lets the thread retry after EOF or if it was waiting.
+int audio_read_decoded(struct dec_audio *d_audio,
+                       struct mp_audio_buffer *outbuf, int minsamples)
+{
+    struct audio_decode_thread *t = d_audio->thread;
+    assert(t);
+
+    pthread_mutex_lock(&t->lock);
+    // audio_decode() returns with more than minsamples buffered.
+    int missing = minsamples + 1 - mp_audio_buffer_samples(outbuf);
+    int r = AD_OK;
+    if (missing > 0) {
+        move_samples(outbuf, t->buffer, missing);
+        missing = minsamples + 1 - mp_audio_buffer_samples(outbuf);
+        if (missing > 0) {
+            r = t->status == AD_OK ? AD_WAIT : t->status;
+            t->need_wakeup = r == AD_WAIT;
+        }
+    }
+    t->wanted_samples = MPMAX(missing, 0);
+    t->requests++;
+    pthread_cond_signal(&t->wakeup);
+    pthread_mutex_unlock(&t->lock);
+    return r;
+}
+
+// Return false if there is no decoder thread.
+bool audio_get_thread_stats(struct dec_audio *d_audio,
+                            struct audio_decode_stats *stats)
+{
+    struct audio_decode_thread *t = d_audio->thread;
+    if (!t)
+        return false;
+    pthread_mutex_lock(&t->lock);
+    struct mp_audio fmt;
+    mp_audio_buffer_get_format(t->buffer, &fmt);
+    *stats = (struct audio_decode_stats){
+        .buffered = mp_audio_buffer_seconds(t->buffer),
+        .target = t->target_samples / (double)fmt.rate,
+        .waiting = t->waiting,
+    };
+    pthread_mutex_unlock(&t->lock);
+    return true;
 }
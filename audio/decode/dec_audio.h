@@ -19,6 +19,7 @@
 #ifndef MPLAYER_DEC_AUDIO_H
 #define MPLAYER_DEC_AUDIO_H
 
+#include "osdep/atomics.h"
 #include "audio/chmap.h"
 #include "audio/audio.h"
 #include "demux/demux.h"
@@ -26,6 +27,7 @@
 
 struct mp_audio_buffer;
 struct mp_decoder_list;
+struct audio_decode_thread;
 
 struct dec_audio {
     struct mp_log *log;
@@ -45,10 +47,23 @@ struct dec_audio {
     double pts;
     // number of samples output by decoder after last known pts
     int pts_offset;
+    // Decoder thread (if NULL, the caller decodes with audio_decode())
+    struct audio_decode_thread *thread;
+    // CPU time spent decoding and filtering (microseconds), only measured
+    // if measure_cpu is set (--benchmark)
+    bool measure_cpu;
+    atomic_llong decode_cpu_us;
     // For free use by the ad_driver
     void *priv;
 };
 
+// State of the decoder thread, returned by audio_get_thread_stats().
+struct audio_decode_stats {
+    double buffered;            // filtered audio ready for output (seconds)
+    double target;              // amount of audio kept buffered (seconds)
+    bool waiting;               // decoder waits for demuxer packets
+};
+
 enum {
     AD_OK = 0,
     AD_ERR = -1,
@@ -62,7 +77,17 @@ int audio_init_best_codec(struct dec_audio *d_audio, char *audio_decoders);
 int audio_decode(struct dec_audio *d_audio, struct mp_audio_buffer *outbuf,
                  int minsamples);
 int initial_audio_decode(struct dec_audio *d_audio);
+double audio_get_pts(struct dec_audio *d_audio, double *out_delay);
+void audio_quiesce_decoding(struct dec_audio *d_audio);
 void audio_reset_decoding(struct dec_audio *d_audio);
 void audio_uninit(struct dec_audio *d_audio);
 
+bool audio_start_thread(struct dec_audio *d_audio, double buffer_secs,
+                        void (*wakeup_cb)(void *ctx), void *wakeup_ctx);
+void audio_stop_thread(struct dec_audio *d_audio);
+int audio_read_decoded(struct dec_audio *d_audio,
+                       struct mp_audio_buffer *outbuf, int minsamples);
+bool audio_get_thread_stats(struct dec_audio *d_audio,
+                            struct audio_decode_stats *stats);
+
 #endif /* MPLAYER_DEC_AUDIO_H */
@@ -22,11 +22,15 @@
 #include <string.h>
 #include <assert.h>
 
+#include <libavutil/buffer.h>
+
 #include "common/common.h"
 #include "common/global.h"
 
 #include "options/m_option.h"
 #include "options/m_config.h"
+#include "osdep/threads.h"
+#include "osdep/timer.h"
 
 #include "audio/audio_buffer.h"
 #include "af.h"
@@ -57,8 +61,7 @@ extern const struct af_info af_info_scaletempo;
 extern const struct af_info af_info_forcespeed;
 extern const struct af_info af_info_bs2b;
 extern const struct af_info af_info_lavfi;
-extern const struct af_info af_info_convert24;
-extern const struct af_info af_info_convertsignendian;
+extern const struct af_info af_info_convert;
 
 static const struct af_info *const filter_list[] = {
     &af_info_dummy,
@@ -74,6 +77,9 @@ static const struct af_info *const filter_list[] = {
     &af_info_drc,
     &af_info_extrastereo,
     &af_info_lavcac3enc,
+    // Preferred over lavrresample for pure format conversion (the conversion
+    // filter search picks the first filter in case of ties)
+    &af_info_convert,
     &af_info_lavrresample,
     &af_info_sweep,
     &af_info_hrtf,
@@ -91,9 +97,6 @@ static const struct af_info *const filter_list[] = {
 #if HAVE_LIBAVFILTER
     &af_info_lavfi,
 #endif
-    // Must come last, because they're fallback format conversion filter
-    &af_info_convert24,
-    &af_info_convertsignendian,
     NULL
 };
 
@@ -419,6 +422,18 @@ static int af_fix_format_conversion(struct af_stream *s,
     struct mp_audio actual = *prev->data;
     if (actual.format == in.format)
         return AF_FALSE;
+    // If the previous filter converts anyway (e.g. an auto-inserted resampler),
+    // let it output the wanted format, instead of adding another pass.
+    int prev_in = prev->prev ? prev->prev->data->format : 0;
+    if (af_is_conversion_filter(prev) &&
+        (prev_in == in.format || prev->info->test_conversion(prev_in, in.format)))
+    {
+        int fmt = in.format;
+        if (prev->control(prev, AF_CONTROL_SET_FORMAT, &fmt) == AF_OK) {
+            *p_af = prev;
+            return AF_OK;
+        }
+    }
     int dstfmt = in.format;
     char *filter = af_find_conversion_filter(actual.format, &dstfmt);
     if (!filter)
@@ -588,7 +603,10 @@ void af_uninit(struct af_stream *s)
 struct af_stream *af_new(struct mpv_global *global)
 {
     struct af_stream *s = talloc_zero(NULL, struct af_stream);
-    static const struct af_info in = { .name = "in" };
+    static const struct af_info in = {
+        .name = "in",
+        .flags = AF_FLAGS_READONLY,
+    };
     s->first = talloc(s, struct af_instance);
     *s->first = (struct af_instance) {
         .info = &in,
@@ -598,7 +616,10 @@ struct af_stream *af_new(struct mpv_global *global)
         .data = &s->input,
         .mul = 1.0,
     };
-    static const struct af_info out = { .name = "out" };
+    static const struct af_info out = {
+        .name = "out",
+        .flags = AF_FLAGS_READONLY,
+    };
     s->last = talloc(s, struct af_instance);
     *s->last = (struct af_instance) {
         .info = &out,
@@ -612,15 +633,35 @@ struct af_stream *af_new(struct mpv_global *global)
     s->last->prev = s->first;
     s->opts = global->opts;
     s->log = mp_log_new(s, global->log, "!af");
+    mpthread_mutex_init_recursive(&s->lock);
     return s;
 }
 
 void af_destroy(struct af_stream *s)
 {
     af_uninit(s);
+    for (int i = 0; i < 2; i++) {
+        for (int n = 0; n < MP_NUM_CHANNELS; n++)
+            av_buffer_unref(&s->shared[i][n]);
+    }
+    pthread_mutex_destroy(&s->lock);
     talloc_free(s);
 }
 
+// Normally, the filter chain is used by the playback thread only. If the
+// filters are run on a separate thread (like the audio decoder thread), every
+// access to the chain, including filter controls, must be done with the lock
+// held. The lock is recursive.
+void af_lock(struct af_stream *s)
+{
+    pthread_mutex_lock(&s->lock);
+}
+
+void af_unlock(struct af_stream *s)
+{
+    pthread_mutex_unlock(&s->lock);
+}
+
 /* Initialize the stream "s". This function creates a new filter list
    if necessary according to the values set in input and output. Input
    and output should contain the format of the current movie and the
@@ -713,9 +754,64 @@ int af_remove_by_label(struct af_stream *s, char *label)
     return 1;
 }
 
+// Return the index of the shared buffer the frame data is stored in, or -1.
+static int find_shared_buffer(struct af_stream *s, struct mp_audio *frame)
+{
+    uint8_t *p = frame->planes[0];
+    for (int i = 0; i < 2; i++) {
+        for (int n = 0; n < MP_NUM_CHANNELS; n++) {
+            struct AVBufferRef *ref = s->shared[i][n];
+            if (ref && p >= ref->data && p < ref->data + ref->size)
+                return i;
+        }
+    }
+    return -1;
+}
+
+// Let af->data use the shared buffer i. (It's reallocated as needed by the
+// filter.)
+static void lend_shared_buffer(struct af_stream *s, struct af_instance *af,
+                               int i)
+{
+    struct mp_audio *mpa = af->data;
+    for (int n = 0; n < MP_NUM_CHANNELS; n++) {
+        assert(!mpa->allocated[n]);
+        mpa->allocated[n] = s->shared[i][n];
+        s->shared[i][n] = NULL;
+        mpa->planes[n] = NULL;
+        if (n < mpa->num_planes && mpa->allocated[n])
+            mpa->planes[n] = mpa->allocated[n]->data;
+    }
+}
+
+static void return_shared_buffer(struct af_stream *s, struct af_instance *af,
+                                 int i)
+{
+    struct mp_audio *mpa = af->data;
+    for (int n = 0; n < MP_NUM_CHANNELS; n++) {
+        s->shared[i][n] = mpa->allocated[n];
+        mpa->allocated[n] = NULL;
+        mpa->planes[n] = NULL;
+    }
+}
+
+// Whether frame still references the data of the input frame in.
+static bool uses_input(struct mp_audio *frame, struct mp_audio *in)
+{
+    for (int n = 0; n < MP_NUM_CHANNELS; n++) {
+        if (in->planes[n] && frame->planes[0] == in->planes[n])
+            return true;
+    }
+    return false;
+}
+
 /* Feed "data" to the chain, and write results to output. "data" needs to be
  * a refcounted frame, although refcounting is not used yet.
  * data==NULL means EOF.
+ * Filters with AF_FLAGS_SHARED_OUTPUT alternate between 2 shared buffers
+ * (the one not in use by the current frame is lent), so the chain doesn't
+ * need a separate output buffer for each filter. The input data is made
+ * writeable (possibly copying it) only when an in-place filter touches it.
  */
 int af_filter(struct af_stream *s, struct mp_audio *data,
               struct mp_audio_buffer *output)
@@ -726,9 +822,9 @@ int af_filter(struct af_stream *s, struct mp_audio *data,
     int r = 0;
     struct mp_audio tmp;
     char dummy[MP_NUM_CHANNELS];
+    bool writeable = false;
     if (data) {
         assert(mp_audio_config_equals(af->data, data));
-        r = mp_audio_make_writeable(data);
     } else {
         data = &tmp;
         *data = *(af->data);
@@ -736,15 +832,36 @@ int af_filter(struct af_stream *s, struct mp_audio *data,
         flags = AF_FILTER_FLAG_EOF;
         for (int n = 0; n < MP_NUM_CHANNELS; n++)
             data->planes[n] = &dummy[n];
+        writeable = true;
     }
-    if (r < 0)
-        goto done;
     struct mp_audio frame = *data;
     for (int n = 0; n < MP_NUM_CHANNELS; n++)
         frame.allocated[n] = NULL;
     // Iterate through all filters
     while (af) {
-        r = af->filter(af, &frame, flags);
+        int af_flags = af->info->flags;
+        if (!writeable && !(af_flags & (AF_FLAGS_SHARED_OUTPUT | AF_FLAGS_READONLY))
+            && uses_input(&frame, data))
+        {
+            r = mp_audio_make_writeable(data);
+            if (r < 0)
+                goto done;
+            for (int n = 0; n < MP_NUM_CHANNELS; n++)
+                frame.planes[n] = data->planes[n];
+            writeable = true;
+        }
+        af->num_calls++;
+        af->num_samples += frame.samples;
+        int64_t start = mp_time_us();
+        if (af_flags & AF_FLAGS_SHARED_OUTPUT) {
+            int i = find_shared_buffer(s, &frame) == 0 ? 1 : 0;
+            lend_shared_buffer(s, af, i);
+            r = af->filter(af, &frame, flags);
+            return_shared_buffer(s, af, i);
+        } else {
+            r = af->filter(af, &frame, flags);
+        }
+        af->time_us += mp_time_us() - start;
         if (r < 0)
             goto done;
         assert(mp_audio_config_equals(af->data, &frame));
@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <sys/types.h>
+#include <pthread.h>
 
 #include "options/options.h"
 #include "audio/format.h"
@@ -38,6 +39,14 @@ struct mpv_global;
 // Flags used for defining the behavior of an audio filter
 #define AF_FLAGS_REENTRANT      0x00000000
 #define AF_FLAGS_NOT_REENTRANT  0x00000001
+// The filter never writes to the input data, and writes its output only to
+// af->data, which it (re)allocates with mp_audio_realloc_min() on each
+// filter() call, and doesn't access outside of filter(). af_filter() lends
+// one of 2 buffers shared by the whole chain to such filters.
+// Filters without this flag or AF_FLAGS_READONLY are assumed to work in-place.
+#define AF_FLAGS_SHARED_OUTPUT  0x00000002
+// The filter never writes to the audio data (passes it through unchanged).
+#define AF_FLAGS_READONLY       0x00000004
 
 // Flags for af->filter()
 #define AF_FILTER_FLAG_EOF 1
@@ -77,6 +86,10 @@ struct af_instance {
                  * and output, e.g. mul=4 => 1 sample becomes 4 samples) .*/
     bool auto_inserted; // inserted by af.c, such as conversion filters
     char *label;
+    // Statistics updated by af_filter()
+    int64_t time_us;        // time spent in filter()
+    int64_t num_calls;      // number of filter() calls
+    int64_t num_samples;    // number of input samples
 };
 
 // Current audio stream
@@ -95,6 +108,13 @@ struct af_stream {
     struct mp_log *log;
     struct MPOpts *opts;
     struct replaygain_data *replaygain_data;
+
+    // Output buffers shared by filters with AF_FLAGS_SHARED_OUTPUT.
+    struct AVBufferRef *shared[2][MP_NUM_CHANNELS];
+
+    // Recursive lock; must be held by all users of the stream if the filters
+    // are run on another thread (see af_lock()).
+    pthread_mutex_t lock;
 };
 
 // Return values
@@ -131,6 +151,8 @@ typedef struct af_control_ext_s {
 
 struct af_stream *af_new(struct mpv_global *global);
 void af_destroy(struct af_stream *s);
+void af_lock(struct af_stream *s);
+void af_unlock(struct af_stream *s);
 int af_init(struct af_stream *s);
 void af_uninit(struct af_stream *s);
 struct af_instance *af_add(struct af_stream *s, char *name, char **args);
@@ -153,4 +175,10 @@ int af_from_ms(int n, float *in, int *out, int rate, float mi, float ma);
 int af_to_ms(int n, int *in, float *out, int rate);
 float af_softclip(float a);
 
+bool af_sample_conv_supported(int src_format, int dst_format);
+void af_sample_conv(void *dst, int dst_format, const void *src,
+                    int src_format, int num);
+void af_gain_s16(int16_t *a, int num, int vol);
+void af_gain_float(float *a, int num, float gain, bool softclip);
+
 #endif /* MPLAYER_AF_H */
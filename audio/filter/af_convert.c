@@ -0,0 +1,144 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "common/common.h"
+#include "audio/format.h"
+#include "af.h"
+
+// Number of samples per channel converted at once when (de)interleaving.
+#define CHUNK_SAMPLES 256
+
+static bool test_conversion(int src_format, int dst_format)
+{
+    return src_format != dst_format &&
+           af_sample_conv_supported(src_format, dst_format);
+}
+
+static int control(struct af_instance *af, int cmd, void *arg)
+{
+    switch (cmd) {
+    case AF_CONTROL_REINIT: {
+        struct mp_audio *in = arg;
+        struct mp_audio orig_in = *in;
+        struct mp_audio *out = af->data;
+
+        if (!test_conversion(in->format, out->format))
+            return AF_DETACH;
+
+        out->rate = in->rate;
+        mp_audio_set_channels(out, &in->channels);
+
+        return mp_audio_config_equals(in, &orig_in) ? AF_OK : AF_FALSE;
+    }
+    case AF_CONTROL_SET_FORMAT: {
+        mp_audio_set_format(af->data, *(int*)arg);
+        return AF_OK;
+    }
+    }
+    return AF_UNKNOWN;
+}
+
+// Copy num samples of bps bytes each, with the given strides in bytes.
+static void copy_strided(uint8_t *dst, int dst_stride, const uint8_t *src,
+                         int src_stride, int bps, int num)
+{
+    switch (bps) {
+#define COPY(n)                                                 \
+    case n:                                                     \
+        for (int i = 0; i < num; i++)                           \
+            memcpy(dst + i * dst_stride, src + i * src_stride, n); \
+        break;
+    COPY(1)
+    COPY(2)
+    COPY(3)
+    COPY(4)
+#undef COPY
+    default: abort();
+    }
+}
+
+// Convert format and interleaving in a single pass. The (de)interleaving is
+// done on small chunks, so that the data stays in the cache.
+static void convert(struct mp_audio *dst, struct mp_audio *src)
+{
+    int samples = src->samples;
+    bool src_planar = af_fmt_is_planar(src->format);
+    bool dst_planar = af_fmt_is_planar(dst->format);
+
+    if (src_planar == dst_planar) {
+        for (int n = 0; n < src->num_planes; n++) {
+            af_sample_conv(dst->planes[n], dst->format, src->planes[n],
+                           src->format, samples * src->spf);
+        }
+        return;
+    }
+
+    int32_t tmp[CHUNK_SAMPLES];
+    for (int pos = 0; pos < samples; pos += CHUNK_SAMPLES) {
+        int len = MPMIN(samples - pos, CHUNK_SAMPLES);
+        for (int c = 0; c < src->nch; c++) {
+            if (dst_planar) {
+                uint8_t *s = (uint8_t *)src->planes[0] +
+                             pos * src->sstride + c * src->bps;
+                copy_strided((uint8_t *)tmp, src->bps, s, src->sstride,
+                             src->bps, len);
+                af_sample_conv((uint8_t *)dst->planes[c] + pos * dst->bps,
+                               dst->format, tmp, src->format, len);
+            } else {
+                uint8_t *d = (uint8_t *)dst->planes[0] +
+                             pos * dst->sstride + c * dst->bps;
+                af_sample_conv(tmp, dst->format,
+                               (uint8_t *)src->planes[c] + pos * src->bps,
+                               src->format, len);
+                copy_strided(d, dst->sstride, (uint8_t *)tmp, dst->bps,
+                             dst->bps, len);
+            }
+        }
+    }
+}
+
+static int filter(struct af_instance *af, struct mp_audio *data, int flags)
+{
+    struct mp_audio *out = af->data;
+
+    mp_audio_realloc_min(out, data->samples);
+    convert(out, data);
+
+    mp_audio_set_format(data, out->format);
+    for (int n = 0; n < data->num_planes; n++)
+        data->planes[n] = out->planes[n];
+    return 0;
+}
+
+static int af_open(struct af_instance *af)
+{
+    af->control = control;
+    af->filter = filter;
+    return AF_OK;
+}
+
+const struct af_info af_info_convert = {
+    .info = "Convert between sample formats",
+    .name = "convert",
+    .flags = AF_FLAGS_SHARED_OUTPUT,
+    .open = af_open,
+    .test_conversion = test_conversion,
+};
@@ -117,6 +117,7 @@ static int af_open(struct af_instance *af)
 const struct af_info af_info_format = {
     .info = "Force audio format",
     .name = "format",
+    .flags = AF_FLAGS_READONLY,
     .open = af_open,
     .priv_size = sizeof(struct priv),
     .options = (const struct m_option[]) {
@@ -30,12 +30,21 @@
 #include <math.h>
 #include <libavutil/common.h>
 
+#include "talloc.h"
 #include "af.h"
 #include "dsp.h"
 
 /* HRTF filter coefficients and adjustable parameters */
 #include "af_hrtf.h"
 
+/* Signals filtered by the FIR filters (in this order), and the LFE channel */
+enum {
+    CH_LF, CH_RF, CH_LR, CH_RR, CH_CF, CH_CR, CH_BA_L, CH_BA_R,
+    NUM_CONV_CH,
+    CH_LFE = NUM_CONV_CH,
+    NUM_BLOCK_CH,
+};
+
 typedef struct af_hrtf_s {
     /* Lengths */
     int dlbuflen, hrflen, basslen;
@@ -68,32 +77,23 @@ typedef struct af_hrtf_s {
     float lr_fwr, rr_fwr, lrprr_fwr, lrmrr_fwr;
     float adapt_lr_gain, adapt_rr_gain;
     float adapt_lrprr_gain, adapt_lrmrr_gain;
+    /* FFT convolution of the delay line signals with the filters */
+    struct af_fftconv *conv;
+    struct af_fftconv_input *conv_in[NUM_CONV_CH];
+    struct af_fftconv_kernel *cf_k, *af_k, *of_k, *ar_k, *or_k, *cr_k;
+    struct af_fftconv_kernel *ba_k, *ba_cross_k;
+    struct af_fftconv_output *left_out, *right_out;
+    /* Input block being collected, and the output of the previous block */
+    float *block[NUM_BLOCK_CH];
+    float *conv_left, *conv_right;
+    short *out_block;
+    int block_pos;
     /* Cyclic position on the ring buffer */
     int cyc_pos;
     int print_flag;
     int mode;
 } af_hrtf_t;
 
-/* Convolution on a ring buffer
- *    nx:       length of the ring buffer
- *    nk:       length of the convolution kernel
- *    sx:       ring buffer
- *    sk:       convolution kernel
- *    offset:   offset on the ring buffer, can be
- */
-static float conv(const int nx, const int nk, const float *sx, const float *sk,
-                  const int offset)
-{
-    /* k = reminder of offset / nx */
-    int k = offset >= 0 ? offset % nx : nx + (offset % nx);
-
-    if(nk + k <= nx)
-        return af_filter_fir(nk, sx + k, sk);
-    else
-        return af_filter_fir(nk + k - nx, sx, sk + nx - k) +
-            af_filter_fir(nx - k, sx + k, sk);
-}
-
 /* Detect when the impulse response starts (significantly) */
 static int pulse_detect(const float *sx)
 {
@@ -308,6 +308,10 @@ static void reset(af_hrtf_t *s)
     clear_coeff(s, s->fwrbuf_r);
     clear_coeff(s, s->fwrbuf_lr);
     clear_coeff(s, s->fwrbuf_rr);
+    for (int n = 0; n < NUM_CONV_CH; n++)
+        af_fftconv_input_reset(s->conv_in[n]);
+    memset(s->out_block, 0, 2 * CONVBLOCKLEN * sizeof(short));
+    s->block_pos = 0;
 }
 
 /* Initialization and runtime control */
@@ -320,6 +324,7 @@ static int control(struct af_instance *af, int cmd, void* arg)
     case AF_CONTROL_REINIT:
         reset(s);
         af->data->rate = 48000;
+        af->delay = CONVBLOCKLEN / (double)af->data->rate;
         mp_audio_set_channels_old(af->data, ((struct mp_audio*)arg)->nch);
         if(af->data->nch == 2) {
             /* 2 channel input */
@@ -362,6 +367,92 @@ static void uninit(struct af_instance *af)
         free(s->fwrbuf_r);
         free(s->fwrbuf_lr);
         free(s->fwrbuf_rr);
+        talloc_free(s->conv);
+}
+
+/* Filter the current input block, and mix the output into s->out_block.
+   The filtering is done in the frequency domain, where all filter outputs
+   for each output channel can be summed before the inverse FFT. */
+static void filter_block(af_hrtf_t *s)
+{
+    const int surround = s->decode_mode != HRTF_MIX_STEREO;
+    float left, right, diff;
+    int i;
+
+    for(i = 0; i < NUM_CONV_CH; i++) {
+        if(!surround && i != CH_LF && i != CH_RF &&
+           i != CH_BA_L && i != CH_BA_R)
+            continue;
+        if(i == CH_CR && !s->matrix_mode)
+            continue;
+        af_fftconv_input_push(s->conv_in[i], s->block[i]);
+    }
+
+    af_fftconv_output_clear(s->left_out);
+    af_fftconv_output_clear(s->right_out);
+
+    /* Mixer filter matrix. In matrix decoding mode, the rear channel gain is
+       renormalized (see af_open()), as there is an additional channel. */
+    af_fftconv_output_add(s->left_out,  s->conv_in[CH_LF], s->af_k);
+    af_fftconv_output_add(s->left_out,  s->conv_in[CH_RF], s->of_k);
+    af_fftconv_output_add(s->right_out, s->conv_in[CH_RF], s->af_k);
+    af_fftconv_output_add(s->right_out, s->conv_in[CH_LF], s->of_k);
+    if(surround) {
+        af_fftconv_output_add(s->left_out,  s->conv_in[CH_LR], s->ar_k);
+        af_fftconv_output_add(s->left_out,  s->conv_in[CH_RR], s->or_k);
+        af_fftconv_output_add(s->right_out, s->conv_in[CH_RR], s->ar_k);
+        af_fftconv_output_add(s->right_out, s->conv_in[CH_LR], s->or_k);
+        af_fftconv_output_add(s->left_out,  s->conv_in[CH_CF], s->cf_k);
+        af_fftconv_output_add(s->right_out, s->conv_in[CH_CF], s->cf_k);
+        if(s->matrix_mode) {
+            af_fftconv_output_add(s->left_out,  s->conv_in[CH_CR], s->cr_k);
+            af_fftconv_output_add(s->right_out, s->conv_in[CH_CR], s->cr_k);
+        }
+    }
+
+    /* Bass compensation for the lower frequency cut of the HRTF.  A
+       cross talk of the left and right channel is introduced to
+       match the directional characteristics of higher frequencies.
+       The bass will not have any real 3D perception, but that is
+       OK (note at 180 Hz, the wavelength is about 2 m, and any
+       spatial perception is impossible). */
+    af_fftconv_output_add(s->left_out,  s->conv_in[CH_BA_L], s->ba_k);
+    af_fftconv_output_add(s->left_out,  s->conv_in[CH_BA_R], s->ba_cross_k);
+    af_fftconv_output_add(s->right_out, s->conv_in[CH_BA_R], s->ba_k);
+    af_fftconv_output_add(s->right_out, s->conv_in[CH_BA_L], s->ba_cross_k);
+
+    af_fftconv_output_get(s->left_out, s->conv_left);
+    af_fftconv_output_get(s->right_out, s->conv_right);
+
+    for(i = 0; i < CONVBLOCKLEN; i++) {
+        /* Also mix the LFE channel (0 if not available) */
+        left  = s->conv_left[i]  + s->block[CH_LFE][i] * M3_01DB;
+        right = s->conv_right[i] + s->block[CH_LFE][i] * M3_01DB;
+
+        /* Amplitude renormalization. */
+        left  *= AMPLNORM;
+        right *= AMPLNORM;
+
+        switch (s->decode_mode) {
+        case HRTF_MIX_51:
+        case HRTF_MIX_STEREO:
+           /* "Cheating": linear stereo expansion to amplify the 3D
+              perception.  Note: Too much will destroy the acoustic space
+              and may even result in headaches. */
+           diff = STEXPAND2 * (left - right);
+           s->out_block[2 * i + 0] = av_clip_int16(left  + diff);
+           s->out_block[2 * i + 1] = av_clip_int16(right - diff);
+           break;
+        case HRTF_MIX_MATRIX2CH:
+           /* Do attempt any stereo expansion with matrix encoded
+              sources.  The L, R channels are already stereo expanded
+              by the steering, any further stereo expansion will sound
+              very unnatural. */
+           s->out_block[2 * i + 0] = av_clip_int16(left);
+           s->out_block[2 * i + 1] = av_clip_int16(right);
+           break;
+        }
+    }
 }
 
 /* Filter data through filter
@@ -381,8 +472,6 @@ static int filter(struct af_instance *af, struct mp_audio *data, int flags)
     short *in = data->planes[0]; // Input audio data
     short *out = NULL; // Output audio data
     short *end = in + data->samples * data->nch; // Loop end
-    float common, left, right, diff, left_b, right_b;
-    const int dblen = s->dlbuflen, hlen = s->hrflen, blen = s->basslen;
 
     mp_audio_realloc_min(af->data, data->samples);
 
@@ -434,6 +523,7 @@ static int filter(struct af_instance *af, struct mp_audio *data, int flags)
 
     while(in < end) {
         const int k = s->cyc_pos;
+        const int p = s->block_pos;
 
         update_ch(s, in, k);
 
@@ -444,103 +534,34 @@ static int filter(struct af_instance *af, struct mp_audio *data, int flags)
         s->lf[k] += CFECHOAMPL * s->cf[(k + CFECHODELAY) % s->dlbuflen];
         s->rf[k] += CFECHOAMPL * s->cf[(k + CFECHODELAY) % s->dlbuflen];
 
-        switch (s->decode_mode) {
-        case HRTF_MIX_51:
-        case HRTF_MIX_MATRIX2CH:
-           /* Mixer filter matrix */
-           common = conv(dblen, hlen, s->cf, s->cf_ir, k + s->cf_o);
-           if(s->matrix_mode) {
-              /* In matrix decoding mode, the rear channel gain must be
-                 renormalized, as there is an additional channel. */
-              matrix_decode(in, k, 2, 3, 0, s->dlbuflen,
-                            s->lr_fwr, s->rr_fwr,
-                            s->lrprr_fwr, s->lrmrr_fwr,
-                            &(s->adapt_lr_gain), &(s->adapt_rr_gain),
-                            &(s->adapt_lrprr_gain), &(s->adapt_lrmrr_gain),
-                            s->lr, s->rr, NULL, NULL, s->cr);
-              common +=
-                 conv(dblen, hlen, s->cr, s->cr_ir, k + s->cr_o) *
-                 M1_76DB;
-              left    =
-                 ( conv(dblen, hlen, s->lf, s->af_ir, k + s->af_o) +
-                   conv(dblen, hlen, s->rf, s->of_ir, k + s->of_o) +
-                   (conv(dblen, hlen, s->lr, s->ar_ir, k + s->ar_o) +
-                    conv(dblen, hlen, s->rr, s->or_ir, k + s->or_o)) *
-                   M1_76DB + common);
-              right   =
-                 ( conv(dblen, hlen, s->rf, s->af_ir, k + s->af_o) +
-                   conv(dblen, hlen, s->lf, s->of_ir, k + s->of_o) +
-                   (conv(dblen, hlen, s->rr, s->ar_ir, k + s->ar_o) +
-                    conv(dblen, hlen, s->lr, s->or_ir, k + s->or_o)) *
-                   M1_76DB + common);
-           } else {
-              left    =
-                 ( conv(dblen, hlen, s->lf, s->af_ir, k + s->af_o) +
-                   conv(dblen, hlen, s->rf, s->of_ir, k + s->of_o) +
-                   conv(dblen, hlen, s->lr, s->ar_ir, k + s->ar_o) +
-                   conv(dblen, hlen, s->rr, s->or_ir, k + s->or_o) +
-                   common);
-              right   =
-                 ( conv(dblen, hlen, s->rf, s->af_ir, k + s->af_o) +
-                   conv(dblen, hlen, s->lf, s->of_ir, k + s->of_o) +
-                   conv(dblen, hlen, s->rr, s->ar_ir, k + s->ar_o) +
-                   conv(dblen, hlen, s->lr, s->or_ir, k + s->or_o) +
-                   common);
-           }
-           break;
-        case HRTF_MIX_STEREO:
-           left    =
-              ( conv(dblen, hlen, s->lf, s->af_ir, k + s->af_o) +
-                conv(dblen, hlen, s->rf, s->of_ir, k + s->of_o));
-           right   =
-              ( conv(dblen, hlen, s->rf, s->af_ir, k + s->af_o) +
-                conv(dblen, hlen, s->lf, s->of_ir, k + s->of_o));
-           break;
-        default:
-            /* make gcc happy */
-            left = 0.0;
-            right = 0.0;
-            break;
-        }
-
-        /* Bass compensation for the lower frequency cut of the HRTF.  A
-           cross talk of the left and right channel is introduced to
-           match the directional characteristics of higher frequencies.
-           The bass will not have any real 3D perception, but that is
-           OK (note at 180 Hz, the wavelength is about 2 m, and any
-           spatial perception is impossible). */
-        left_b  = conv(dblen, blen, s->ba_l, s->ba_ir, k);
-        right_b = conv(dblen, blen, s->ba_r, s->ba_ir, k);
-        left  += (1 - BASSCROSS) * left_b  + BASSCROSS * right_b;
-        right += (1 - BASSCROSS) * right_b + BASSCROSS * left_b;
-        /* Also mix the LFE channel (if available) */
-        if(data->nch >= 6) {
-            left  += in[5] * M3_01DB;
-            right += in[5] * M3_01DB;
-        }
-
-        /* Amplitude renormalization. */
-        left  *= AMPLNORM;
-        right *= AMPLNORM;
-
-        switch (s->decode_mode) {
-        case HRTF_MIX_51:
-        case HRTF_MIX_STEREO:
-           /* "Cheating": linear stereo expansion to amplify the 3D
-              perception.  Note: Too much will destroy the acoustic space
-              and may even result in headaches. */
-           diff = STEXPAND2 * (left - right);
-           out[0] = av_clip_int16(left  + diff);
-           out[1] = av_clip_int16(right - diff);
-           break;
-        case HRTF_MIX_MATRIX2CH:
-           /* Do attempt any stereo expansion with matrix encoded
-              sources.  The L, R channels are already stereo expanded
-              by the steering, any further stereo expansion will sound
-              very unnatural. */
-           out[0] = av_clip_int16(left);
-           out[1] = av_clip_int16(right);
-           break;
+        /* In matrix decoding mode, decode the rear center channel. */
+        if(s->decode_mode != HRTF_MIX_STEREO && s->matrix_mode)
+            matrix_decode(in, k, 2, 3, 0, s->dlbuflen,
+                          s->lr_fwr, s->rr_fwr,
+                          s->lrprr_fwr, s->lrmrr_fwr,
+                          &(s->adapt_lr_gain), &(s->adapt_rr_gain),
+                          &(s->adapt_lrprr_gain), &(s->adapt_lrmrr_gain),
+                          s->lr, s->rr, NULL, NULL, s->cr);
+
+        /* The FIR filters are applied to whole blocks (see
+           filter_block()), which delays the output by one block. */
+        s->block[CH_LF][p] = s->lf[k];
+        s->block[CH_RF][p] = s->rf[k];
+        s->block[CH_LR][p] = s->lr[k];
+        s->block[CH_RR][p] = s->rr[k];
+        s->block[CH_CF][p] = s->cf[k];
+        s->block[CH_CR][p] = s->cr[k];
+        s->block[CH_BA_L][p] = s->ba_l[k];
+        s->block[CH_BA_R][p] = s->ba_r[k];
+        s->block[CH_LFE][p] = data->nch >= 6 ? in[5] : 0;
+
+        out[0] = s->out_block[2 * p + 0];
+        out[1] = s->out_block[2 * p + 1];
+
+        s->block_pos++;
+        if(s->block_pos == CONVBLOCKLEN) {
+            filter_block(s);
+            s->block_pos = 0;
         }
 
         /* Next sample... */
@@ -548,7 +569,7 @@ static int filter(struct af_instance *af, struct mp_audio *data, int flags)
         out = &out[af->data->nch];
         (s->cyc_pos)--;
         if(s->cyc_pos < 0)
-            s->cyc_pos += dblen;
+            s->cyc_pos += s->dlbuflen;
     }
 
     /* Set output data */
@@ -579,6 +600,51 @@ static int allocate(af_hrtf_t *s)
     return 0;
 }
 
+/* Create a FIR filter kernel for the (pruned) HRTF impulse response ir,
+   which is delayed by offset samples (see pulse_detect()) */
+static struct af_fftconv_kernel *create_hrtf_kernel(af_hrtf_t *s,
+                                                    const float *ir,
+                                                    int offset, float gain)
+{
+    float *taps = talloc_zero_array(NULL, float, offset + s->hrflen);
+    memcpy(taps + offset, ir, s->hrflen * sizeof(float));
+    struct af_fftconv_kernel *k =
+        af_fftconv_kernel_create(s->conv, taps, offset + s->hrflen, gain);
+    talloc_free(taps);
+    return k;
+}
+
+static void init_conv(struct af_instance *af)
+{
+    af_hrtf_t *s = af->priv;
+    const float rear_gain = s->matrix_mode ? M1_76DB : 1;
+    int i;
+
+    s->conv = af_fftconv_create(af, CONVBLOCKLEN,
+                                FFMAX(128, s->basslen));
+    for(i = 0; i < NUM_CONV_CH; i++)
+        s->conv_in[i] = af_fftconv_input_create(s->conv);
+    s->left_out = af_fftconv_output_create(s->conv);
+    s->right_out = af_fftconv_output_create(s->conv);
+
+    s->cf_k = create_hrtf_kernel(s, s->cf_ir, s->cf_o, 1);
+    s->af_k = create_hrtf_kernel(s, s->af_ir, s->af_o, 1);
+    s->of_k = create_hrtf_kernel(s, s->of_ir, s->of_o, 1);
+    s->ar_k = create_hrtf_kernel(s, s->ar_ir, s->ar_o, rear_gain);
+    s->or_k = create_hrtf_kernel(s, s->or_ir, s->or_o, rear_gain);
+    s->cr_k = create_hrtf_kernel(s, s->cr_ir, s->cr_o, rear_gain);
+    s->ba_k = af_fftconv_kernel_create(s->conv, s->ba_ir, s->basslen,
+                                       1 - BASSCROSS);
+    s->ba_cross_k = af_fftconv_kernel_create(s->conv, s->ba_ir, s->basslen,
+                                             BASSCROSS);
+
+    for(i = 0; i < NUM_BLOCK_CH; i++)
+        s->block[i] = talloc_zero_array(s->conv, float, CONVBLOCKLEN);
+    s->conv_left = talloc_zero_array(s->conv, float, CONVBLOCKLEN);
+    s->conv_right = talloc_zero_array(s->conv, float, CONVBLOCKLEN);
+    s->out_block = talloc_zero_array(s->conv, short, 2 * CONVBLOCKLEN);
+}
+
 /* Allocate memory and set function pointers */
 static int af_open(struct af_instance* af)
 {
@@ -650,6 +716,8 @@ static int af_open(struct af_instance* af)
     for(i = 0; i < s->basslen; i++)
         s->ba_ir[i] *= BASSGAIN;
 
+    init_conv(af);
+
     return AF_OK;
 }
 
@@ -657,6 +725,7 @@ static int af_open(struct af_instance* af)
 const struct af_info af_info_hrtf = {
     .info = "HRTF Headphone",
     .name = "hrtf",
+    .flags = AF_FLAGS_SHARED_OUTPUT,
     .open = af_open,
     .priv_size = sizeof(af_hrtf_t),
     .options = (const struct m_option[]) {
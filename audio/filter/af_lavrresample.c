@@ -382,6 +382,7 @@ static int af_open(struct af_instance *af)
 const struct af_info af_info_lavrresample = {
     .info = "Sample frequency conversion using libavresample",
     .name = "lavrresample",
+    .flags = AF_FLAGS_SHARED_OUTPUT,
     .open = af_open,
     .test_conversion = test_conversion,
     .priv_size = sizeof(struct af_resample),
@@ -180,6 +180,7 @@ static int af_open(struct af_instance* af){
 const struct af_info af_info_pan = {
     .info = "Panning audio filter",
     .name = "pan",
+    .flags = AF_FLAGS_SHARED_OUTPUT,
     .open = af_open,
     .priv_size = sizeof(af_pan_t),
     .options = (const struct m_option[]) {
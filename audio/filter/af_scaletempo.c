@@ -34,13 +34,33 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <float.h>
+#include <math.h>
 #include <assert.h>
 
+#include <libavcodec/avfft.h>
+#include <libavutil/cpu.h>
+#include <libavutil/mem.h>
+
 #include "common/common.h"
 
 #include "af.h"
 #include "options/m_option.h"
 
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define SCALETEMPO_X86 1
+#include <immintrin.h>
+#else
+#define SCALETEMPO_X86 0
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define SCALETEMPO_NEON 1
+#include <arm_neon.h>
+#else
+#define SCALETEMPO_NEON 0
+#endif
+
 // Data for specific instances of this filter
 typedef struct af_scaletempo_s
 {
@@ -71,12 +91,23 @@ typedef struct af_scaletempo_s
     void *buf_pre_corr;
     void *table_window;
     int (*best_overlap_offset)(struct af_scaletempo_s *s);
+    // FFT based correlation
+    RDFTContext *rdft, *irdft;
+    int fft_bits;
+    float *fft_a, *fft_b;
+    // DSP functions (selected according to CPU features)
+    float (*dot_float)(const float *a, const float *b, int n);
+    int64_t (*dot_s16)(const int32_t *a, const int16_t *b, int n);
+    void (*blend_float)(float *out, const float *a, const float *b,
+                        const float *w, int n);
+    int simd_width;         // floats processed per instruction by dot_float
     // command line
     float scale_nominal;
     float ms_stride;
     float percent_overlap;
     float ms_search;
     int speed_opt;
+    int fft_opt;
     short speed_tempo;
     short speed_pitch;
 } af_scaletempo_t;
@@ -118,10 +149,206 @@ static int fill_queue(struct af_instance *af, struct mp_audio *data, int offset)
 
 #define UNROLL_PADDING (4 * 4)
 
+// Return sum(a[i] * b[i]) for i in [0, n).
+static float dot_float_c(const float *a, const float *b, int n)
+{
+    float corr = 0;
+    for (int i = 0; i < n; i++)
+        corr += a[i] * b[i];
+    return corr;
+}
+
+static int64_t dot_s16_c(const int32_t *a, const int16_t *b, int n)
+{
+    int64_t corr = 0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        corr += a[i + 0] * b[i + 0];
+        corr += a[i + 1] * b[i + 1];
+        corr += a[i + 2] * b[i + 2];
+        corr += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; i++)
+        corr += a[i] * b[i];
+    return corr;
+}
+
+// out[i] = a[i] - w[i] * (a[i] - b[i]) for i in [0, n)
+static void blend_float_c(float *out, const float *a, const float *b,
+                          const float *w, int n)
+{
+    for (int i = 0; i < n; i++)
+        out[i] = a[i] - w[i] * (a[i] - b[i]);
+}
+
+#if SCALETEMPO_X86
+
+__attribute__((target("sse2")))
+static float dot_float_sse2(const float *a, const float *b, int n)
+{
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i),
+                                           _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4),
+                                           _mm_loadu_ps(b + i + 4)));
+    }
+    acc0 = _mm_add_ps(acc0, acc1);
+    acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+    acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+    float corr = _mm_cvtss_f32(acc0);
+    for (; i < n; i++)
+        corr += a[i] * b[i];
+    return corr;
+}
+
+__attribute__((target("sse2")))
+static void blend_float_sse2(float *out, const float *a, const float *b,
+                             const float *w, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 va = _mm_loadu_ps(a + i);
+        __m128 d = _mm_sub_ps(va, _mm_loadu_ps(b + i));
+        _mm_storeu_ps(out + i, _mm_sub_ps(va, _mm_mul_ps(_mm_loadu_ps(w + i), d)));
+    }
+    blend_float_c(out + i, a + i, b + i, w + i, n - i);
+}
+
+__attribute__((target("avx")))
+static float dot_float_avx(const float *a, const float *b, int n)
+{
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + i),
+                                                 _mm256_loadu_ps(b + i)));
+        acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8),
+                                                 _mm256_loadu_ps(b + i + 8)));
+    }
+    acc0 = _mm256_add_ps(acc0, acc1);
+    __m128 r = _mm_add_ps(_mm256_castps256_ps128(acc0),
+                          _mm256_extractf128_ps(acc0, 1));
+    r = _mm_add_ps(r, _mm_movehl_ps(r, r));
+    r = _mm_add_ss(r, _mm_shuffle_ps(r, r, 1));
+    float corr = _mm_cvtss_f32(r);
+    for (; i < n; i++)
+        corr += a[i] * b[i];
+    return corr;
+}
+
+__attribute__((target("avx")))
+static void blend_float_avx(float *out, const float *a, const float *b,
+                            const float *w, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 va = _mm256_loadu_ps(a + i);
+        __m256 d = _mm256_sub_ps(va, _mm256_loadu_ps(b + i));
+        _mm256_storeu_ps(out + i, _mm256_sub_ps(va,
+                                    _mm256_mul_ps(_mm256_loadu_ps(w + i), d)));
+    }
+    blend_float_c(out + i, a + i, b + i, w + i, n - i);
+}
+
+// The products fit into 32 bits: a[i] is at most 2^16 in magnitude (see how
+// table_window is setup), and b[i] at most 2^15.
+__attribute__((target("avx2")))
+static int64_t dot_s16_avx2(const int32_t *a, const int16_t *b, int n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(b + i)));
+        __m256i p = _mm256_mullo_epi32(va, vb);
+        acc = _mm256_add_epi64(acc,
+                    _mm256_cvtepi32_epi64(_mm256_castsi256_si128(p)));
+        acc = _mm256_add_epi64(acc,
+                    _mm256_cvtepi32_epi64(_mm256_extracti128_si256(p, 1)));
+    }
+    int64_t t[4];
+    _mm256_storeu_si256((__m256i *)t, acc);
+    return t[0] + t[1] + t[2] + t[3] + dot_s16_c(a + i, b + i, n - i);
+}
+
+#endif /* SCALETEMPO_X86 */
+
+#if SCALETEMPO_NEON
+
+static float dot_float_neon(const float *a, const float *b, int n)
+{
+    float32x4_t acc = vdupq_n_f32(0);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+        acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+    float32x2_t r = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    float corr = vget_lane_f32(vpadd_f32(r, r), 0);
+    for (; i < n; i++)
+        corr += a[i] * b[i];
+    return corr;
+}
+
+static void blend_float_neon(float *out, const float *a, const float *b,
+                             const float *w, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t va = vld1q_f32(a + i);
+        float32x4_t d = vsubq_f32(va, vld1q_f32(b + i));
+        vst1q_f32(out + i, vmlsq_f32(va, vld1q_f32(w + i), d));
+    }
+    blend_float_c(out + i, a + i, b + i, w + i, n - i);
+}
+
+static int64_t dot_s16_neon(const int32_t *a, const int16_t *b, int n)
+{
+    int64x2_t acc = vdupq_n_s64(0);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        int32x4_t p = vmulq_s32(vld1q_s32(a + i), vmovl_s16(vld1_s16(b + i)));
+        acc = vpadalq_s32(acc, p);
+    }
+    return vgetq_lane_s64(acc, 0) + vgetq_lane_s64(acc, 1) +
+           dot_s16_c(a + i, b + i, n - i);
+}
+
+#endif /* SCALETEMPO_NEON */
+
+static void init_dsp(af_scaletempo_t *s)
+{
+    s->dot_float = dot_float_c;
+    s->dot_s16 = dot_s16_c;
+    s->blend_float = blend_float_c;
+    s->simd_width = 1;
+#if SCALETEMPO_X86
+    int flags = av_get_cpu_flags();
+    if (flags & AV_CPU_FLAG_SSE2) {
+        s->dot_float = dot_float_sse2;
+        s->blend_float = blend_float_sse2;
+        s->simd_width = 4;
+    }
+    if (flags & AV_CPU_FLAG_AVX) {
+        s->dot_float = dot_float_avx;
+        s->blend_float = blend_float_avx;
+        s->simd_width = 8;
+    }
+    if (flags & AV_CPU_FLAG_AVX2)
+        s->dot_s16 = dot_s16_avx2;
+#elif SCALETEMPO_NEON
+    s->dot_float = dot_float_neon;
+    s->blend_float = blend_float_neon;
+    s->dot_s16 = dot_s16_neon;
+    s->simd_width = 4;
+#endif
+}
+
 static int best_overlap_offset_float(af_scaletempo_t *s)
 {
     float best_corr = INT_MIN;
     int best_off = 0;
+    int n = s->samples_overlap - s->num_channels;
 
     float *pw  = s->table_window;
     float *po  = s->buf_overlap;
@@ -132,11 +359,7 @@ static int best_overlap_offset_float(af_scaletempo_t *s)
 
     float *search_start = (float *)s->buf_queue + s->num_channels;
     for (int off = 0; off < s->frames_search; off++) {
-        float corr = 0;
-        float *ps = search_start;
-        ppc = s->buf_pre_corr;
-        for (int i = s->num_channels; i < s->samples_overlap; i++)
-            corr += *ppc++ **ps++;
+        float corr = s->dot_float(s->buf_pre_corr, search_start, n);
         if (corr > best_corr) {
             best_corr = corr;
             best_off  = off;
@@ -147,10 +370,61 @@ static int best_overlap_offset_float(af_scaletempo_t *s)
     return best_off * 4 * s->num_channels;
 }
 
+// Same as best_overlap_offset_float(), but compute the cross-correlation for
+// all offsets at once with FFTs. This is faster for large search windows.
+static int best_overlap_offset_float_fft(af_scaletempo_t *s)
+{
+    int nch = s->num_channels;
+    int n = s->samples_overlap - nch;
+    int len = n + (s->frames_search - 1) * nch;
+    int size = 1 << s->fft_bits;
+    float *a = s->fft_a;
+    float *b = s->fft_b;
+
+    float *pw = s->table_window;
+    float *po = (float *)s->buf_overlap + nch;
+    for (int i = 0; i < n; i++)
+        a[i] = pw[i] * po[i];
+    memset(a + n, 0, (size - n) * sizeof(float));
+    memcpy(b, (float *)s->buf_queue + nch, len * sizeof(float));
+    memset(b + len, 0, (size - len) * sizeof(float));
+
+    av_rdft_calc(s->rdft, a);
+    av_rdft_calc(s->rdft, b);
+
+    // b = conj(a) * b; the first two entries are the (real) DC and Nyquist
+    // coefficients.
+    b[0] *= a[0];
+    b[1] *= a[1];
+    for (int i = 2; i < size; i += 2) {
+        float re = a[i] * b[i] + a[i + 1] * b[i + 1];
+        float im = a[i] * b[i + 1] - a[i + 1] * b[i];
+        b[i] = re;
+        b[i + 1] = im;
+    }
+
+    // b[k] is now the (scaled) correlation for an offset of k samples. The
+    // buffers are large enough to avoid circular wrap-around.
+    av_rdft_calc(s->irdft, b);
+
+    float best_corr = -FLT_MAX;
+    int best_off = 0;
+    for (int off = 0; off < s->frames_search; off++) {
+        float corr = b[off * nch];
+        if (corr > best_corr) {
+            best_corr = corr;
+            best_off  = off;
+        }
+    }
+
+    return best_off * 4 * nch;
+}
+
 static int best_overlap_offset_s16(af_scaletempo_t *s)
 {
     int64_t best_corr = INT64_MIN;
     int best_off = 0;
+    int n = s->samples_overlap - s->num_channels;
 
     int32_t *pw  = s->table_window;
     int16_t *po  = s->buf_overlap;
@@ -161,19 +435,7 @@ static int best_overlap_offset_s16(af_scaletempo_t *s)
 
     int16_t *search_start = (int16_t *)s->buf_queue + s->num_channels;
     for (int off = 0; off < s->frames_search; off++) {
-        int64_t corr = 0;
-        int16_t *ps = search_start;
-        ppc = s->buf_pre_corr;
-        ppc += s->samples_overlap - s->num_channels;
-        ps  += s->samples_overlap - s->num_channels;
-        long i  = -(s->samples_overlap - s->num_channels);
-        do {
-            corr += ppc[i + 0] * ps[i + 0];
-            corr += ppc[i + 1] * ps[i + 1];
-            corr += ppc[i + 2] * ps[i + 2];
-            corr += ppc[i + 3] * ps[i + 3];
-            i += 4;
-        } while (i < 0);
+        int64_t corr = s->dot_s16(s->buf_pre_corr, search_start, n);
         if (corr > best_corr) {
             best_corr = corr;
             best_off  = off;
@@ -187,14 +449,9 @@ static int best_overlap_offset_s16(af_scaletempo_t *s)
 static void output_overlap_float(af_scaletempo_t *s, void *buf_out,
                                  int bytes_off)
 {
-    float *pout = buf_out;
-    float *pb   = s->table_blend;
-    float *po   = s->buf_overlap;
-    float *pin  = (float *)(s->buf_queue + bytes_off);
-    for (int i = 0; i < s->samples_overlap; i++) {
-        *pout++ = *po - *pb++ *(*po - *pin++);
-        po++;
-    }
+    s->blend_float(buf_out, s->buf_overlap,
+                   (float *)(s->buf_queue + bytes_off), s->table_blend,
+                   s->samples_overlap);
 }
 
 static void output_overlap_s16(af_scaletempo_t *s, void *buf_out,
@@ -210,6 +467,57 @@ static void output_overlap_s16(af_scaletempo_t *s, void *buf_out,
     }
 }
 
+static void uninit_fft(af_scaletempo_t *s)
+{
+    if (s->rdft)
+        av_rdft_end(s->rdft);
+    if (s->irdft)
+        av_rdft_end(s->irdft);
+    s->rdft = s->irdft = NULL;
+    av_freep(&s->fft_a);
+    av_freep(&s->fft_b);
+}
+
+// Decide whether the FFT based search should be used, and set it up if so.
+static bool init_fft(struct af_instance *af)
+{
+    af_scaletempo_t *s = af->priv;
+
+    uninit_fft(s);
+
+    if (!s->fft_opt)
+        return false;
+
+    int n = s->samples_overlap - s->num_channels;
+    int len = n + (s->frames_search - 1) * s->num_channels;
+    int bits = 1;
+    while ((1 << bits) < len)
+        bits++;
+    // av_rdft_init() supports only up to 2^16 points.
+    if (bits > 16)
+        return false;
+
+    if (s->fft_opt < 0) {
+        // Rough cost estimate: 3 transforms vs. direct dot products.
+        double size = 1 << bits;
+        double fft_cost = 3 * size * bits;
+        double direct_cost = (double)s->frames_search * n / s->simd_width;
+        if (fft_cost >= direct_cost)
+            return false;
+    }
+
+    s->fft_bits = bits;
+    s->rdft = av_rdft_init(bits, DFT_R2C);
+    s->irdft = av_rdft_init(bits, IDFT_C2R);
+    s->fft_a = av_malloc((1 << bits) * sizeof(float));
+    s->fft_b = av_malloc((1 << bits) * sizeof(float));
+    if (!s->rdft || !s->irdft || !s->fft_a || !s->fft_b) {
+        uninit_fft(s);
+        return false;
+    }
+    return true;
+}
+
 // Filter data through filter
 static int filter(struct af_instance *af, struct mp_audio *data, int flags)
 {
@@ -387,6 +695,15 @@ static int control(struct af_instance *af, int cmd, void *arg)
         s->bytes_per_frame = bps * nch;
         s->num_channels    = nch;
 
+        bool use_fft = false;
+        if (s->best_overlap_offset == best_overlap_offset_float) {
+            use_fft = init_fft(af);
+            if (use_fft)
+                s->best_overlap_offset = best_overlap_offset_float_fft;
+        } else {
+            uninit_fft(s);
+        }
+
         s->bytes_queue = (s->frames_search + s->frames_stride + frames_overlap)
                          * bps * nch;
         s->buf_queue = realloc(s->buf_queue, s->bytes_queue + UNROLL_PADDING);
@@ -400,14 +717,14 @@ static int control(struct af_instance *af, int cmd, void *arg)
 
         MP_DBG(af, ""
                "%.2f stride_in, %i stride_out, %i standing, "
-               "%i overlap, %i search, %i queue, %s mode\n",
+               "%i overlap, %i search, %i queue, %s mode%s\n",
                s->frames_stride_scaled,
                (int)(s->bytes_stride / nch / bps),
                (int)(s->bytes_standing / nch / bps),
                (int)(s->bytes_overlap / nch / bps),
                s->frames_search,
                (int)(s->bytes_queue / nch / bps),
-               (use_int ? "s16" : "float"));
+               (use_int ? "s16" : "float"), use_fft ? " (FFT search)" : "");
 
         return af_test_output(af, (struct mp_audio *)arg);
     }
@@ -444,6 +761,7 @@ static void uninit(struct af_instance *af)
     free(s->buf_pre_corr);
     free(s->table_blend);
     free(s->table_window);
+    uninit_fft(s);
 }
 
 #define SCALE_TEMPO 1
@@ -458,6 +776,8 @@ static int af_open(struct af_instance *af)
     af->uninit    = uninit;
     af->filter    = filter;
 
+    init_dsp(s);
+
     s->speed_tempo = !!(s->speed_opt & SCALE_TEMPO);
     s->speed_pitch = !!(s->speed_opt & SCALE_PITCH);
 
@@ -479,6 +799,7 @@ const struct af_info af_info_scaletempo = {
         .speed_opt = SCALE_TEMPO,
         .speed = 1.0,
         .scale_nominal = 1.0,
+        .fft_opt = -1,
     },
     .options = (const struct m_option[]) {
         OPT_FLOAT("scale", scale_nominal, M_OPT_MIN, .min = 0.01),
@@ -490,6 +811,10 @@ const struct af_info af_info_scaletempo = {
                     {"tempo", SCALE_TEMPO},
                     {"none", 0},
                     {"both", SCALE_TEMPO | SCALE_PITCH})),
+        OPT_CHOICE("fft", fft_opt, 0,
+                   ({"no", 0},
+                    {"yes", 1},
+                    {"auto", -1})),
         {0}
     },
 };
@@ -233,7 +233,7 @@ const struct af_info af_info_surround =
 {
     .info = "Surround decoder filter",
     .name = "surround",
-    .flags = AF_FLAGS_NOT_REENTRANT,
+    .flags = AF_FLAGS_SHARED_OUTPUT | AF_FLAGS_NOT_REENTRANT,
     .open = af_open,
     .priv_size = sizeof(af_surround_t),
     .options = (const struct m_option[]) {
@@ -100,23 +100,12 @@ static void filter_plane(struct af_instance *af, void *ptr, int num_samples)
     float level = s->level * s->rgain;
 
     if (af_fmt_from_planar(af->data->format) == AF_FORMAT_S16) {
-        int16_t *a = ptr;
         int vol = 256.0 * level;
-        if (vol != 256) {
-            for (int i = 0; i < num_samples; i++) {
-                int x = (a[i] * vol) >> 8;
-                a[i] = MPCLAMP(x, SHRT_MIN, SHRT_MAX);
-            }
-        }
+        if (vol != 256)
+            af_gain_s16(ptr, num_samples, vol);
     } else if (af_fmt_from_planar(af->data->format) == AF_FORMAT_FLOAT) {
-        float *a = ptr;
-        float vol = level;
-        if (vol != 1.0) {
-            for (int i = 0; i < num_samples; i++) {
-                float x = a[i] * vol;
-                a[i] = s->soft ? af_softclip(x) : MPCLAMP(x, -1.0, 1.0);
-            }
-        }
+        if (level != 1.0)
+            af_gain_float(ptr, num_samples, level, s->soft);
     }
 }
 
@@ -28,5 +28,6 @@
 
 #include "window.h"
 #include "filter.h"
+#include "fftconv.h"
 
 #endif /* MPLAYER_DSP_H */
@@ -0,0 +1,221 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <libavcodec/avfft.h>
+#include <libavutil/mem.h>
+
+#include "common/common.h"
+#include "talloc.h"
+#include "dsp.h"
+
+/* The FFT size is twice the block size. Each transformed segment consists of
+   the previous and the current input block; the kernel partitions are zero
+   padded to the FFT size. After the inverse transform, the second half is the
+   (non-circular) convolution result for the current block.
+
+   Spectra use the packed format of av_rdft_calc(): the real DC and Nyquist
+   coefficients, followed by (re, im) pairs. */
+
+struct af_fftconv {
+    int block_size;
+    int fft_size;
+    int num_parts;      // maximum number of kernel partitions
+    RDFTContext *rdft, *irdft;
+    FLOAT_TYPE *tmp;    // fft_size
+};
+
+struct af_fftconv_kernel {
+    struct af_fftconv *c;
+    int num_parts;
+    FLOAT_TYPE *spectra; // num_parts * fft_size
+};
+
+struct af_fftconv_input {
+    struct af_fftconv *c;
+    FLOAT_TYPE *segment; // fft_size (time domain)
+    FLOAT_TYPE *spectra; // c->num_parts * fft_size
+    int pos;             // index of the spectrum of the current block
+};
+
+struct af_fftconv_output {
+    struct af_fftconv *c;
+    FLOAT_TYPE *spectrum; // fft_size
+};
+
+// The FFT code requires aligned memory.
+static FLOAT_TYPE *alloc_floats(int num)
+{
+    FLOAT_TYPE *p = av_mallocz(num * sizeof(FLOAT_TYPE));
+    if (!p)
+        abort();
+    return p;
+}
+
+static void destroy_ctx(void *ptr)
+{
+    struct af_fftconv *c = ptr;
+    av_rdft_end(c->rdft);
+    av_rdft_end(c->irdft);
+    av_free(c->tmp);
+}
+
+struct af_fftconv *af_fftconv_create(void *ta_parent, int block_size,
+                                     int max_len)
+{
+    assert(block_size > 0 && !(block_size & (block_size - 1)));
+    int bits = 1;
+    while ((1 << bits) < block_size * 2)
+        bits++;
+
+    struct af_fftconv *c = talloc_zero(ta_parent, struct af_fftconv);
+    c->block_size = block_size;
+    c->fft_size = block_size * 2;
+    c->num_parts = MPMAX((max_len + block_size - 1) / block_size, 1);
+    c->rdft = av_rdft_init(bits, DFT_R2C);
+    c->irdft = av_rdft_init(bits, IDFT_C2R);
+    if (!c->rdft || !c->irdft)
+        abort();
+    c->tmp = alloc_floats(c->fft_size);
+    talloc_set_destructor(c, destroy_ctx);
+    return c;
+}
+
+int af_fftconv_block_size(struct af_fftconv *c)
+{
+    return c->block_size;
+}
+
+static void destroy_kernel(void *ptr)
+{
+    struct af_fftconv_kernel *k = ptr;
+    av_free(k->spectra);
+}
+
+struct af_fftconv_kernel *af_fftconv_kernel_create(struct af_fftconv *c,
+                                                   const FLOAT_TYPE *taps,
+                                                   int len, FLOAT_TYPE gain)
+{
+    int bs = c->block_size;
+    struct af_fftconv_kernel *k = talloc_zero(c, struct af_fftconv_kernel);
+    k->c = c;
+    k->num_parts = MPMIN((len + bs - 1) / bs, c->num_parts);
+    k->spectra = alloc_floats(k->num_parts * c->fft_size);
+    talloc_set_destructor(k, destroy_kernel);
+
+    // The inverse transform scales the result by fft_size / 2.
+    gain *= 2.0 / c->fft_size;
+    for (int p = 0; p < k->num_parts; p++) {
+        FLOAT_TYPE *dst = k->spectra + p * c->fft_size;
+        int n = MPMIN(len - p * bs, bs);
+        for (int i = 0; i < n; i++)
+            dst[i] = taps[p * bs + i] * gain;
+        av_rdft_calc(c->rdft, dst);
+    }
+    return k;
+}
+
+static void destroy_input(void *ptr)
+{
+    struct af_fftconv_input *in = ptr;
+    av_free(in->segment);
+    av_free(in->spectra);
+}
+
+struct af_fftconv_input *af_fftconv_input_create(struct af_fftconv *c)
+{
+    struct af_fftconv_input *in = talloc_zero(c, struct af_fftconv_input);
+    in->c = c;
+    in->segment = alloc_floats(c->fft_size);
+    in->spectra = alloc_floats(c->num_parts * c->fft_size);
+    talloc_set_destructor(in, destroy_input);
+    return in;
+}
+
+void af_fftconv_input_push(struct af_fftconv_input *in,
+                           const FLOAT_TYPE *block)
+{
+    struct af_fftconv *c = in->c;
+    int bs = c->block_size;
+    memmove(in->segment, in->segment + bs, bs * sizeof(FLOAT_TYPE));
+    memcpy(in->segment + bs, block, bs * sizeof(FLOAT_TYPE));
+
+    in->pos = (in->pos + c->num_parts - 1) % c->num_parts;
+    FLOAT_TYPE *dst = in->spectra + in->pos * c->fft_size;
+    memcpy(dst, in->segment, c->fft_size * sizeof(FLOAT_TYPE));
+    av_rdft_calc(c->rdft, dst);
+}
+
+void af_fftconv_input_reset(struct af_fftconv_input *in)
+{
+    struct af_fftconv *c = in->c;
+    memset(in->segment, 0, c->fft_size * sizeof(FLOAT_TYPE));
+    memset(in->spectra, 0, c->num_parts * c->fft_size * sizeof(FLOAT_TYPE));
+    in->pos = 0;
+}
+
+static void destroy_output(void *ptr)
+{
+    struct af_fftconv_output *out = ptr;
+    av_free(out->spectrum);
+}
+
+struct af_fftconv_output *af_fftconv_output_create(struct af_fftconv *c)
+{
+    struct af_fftconv_output *out = talloc_zero(c, struct af_fftconv_output);
+    out->c = c;
+    out->spectrum = alloc_floats(c->fft_size);
+    talloc_set_destructor(out, destroy_output);
+    return out;
+}
+
+void af_fftconv_output_clear(struct af_fftconv_output *out)
+{
+    memset(out->spectrum, 0, out->c->fft_size * sizeof(FLOAT_TYPE));
+}
+
+void af_fftconv_output_add(struct af_fftconv_output *out,
+                           struct af_fftconv_input *in,
+                           struct af_fftconv_kernel *k)
+{
+    struct af_fftconv *c = out->c;
+    assert(in->c == c && k->c == c);
+    FLOAT_TYPE *acc = out->spectrum;
+    for (int p = 0; p < k->num_parts; p++) {
+        // Partition p of the kernel applies to the input from p blocks ago.
+        int part = (in->pos + p) % c->num_parts;
+        const FLOAT_TYPE *x = in->spectra + part * c->fft_size;
+        const FLOAT_TYPE *h = k->spectra + p * c->fft_size;
+        acc[0] += x[0] * h[0];
+        acc[1] += x[1] * h[1];
+        for (int i = 2; i < c->fft_size; i += 2) {
+            acc[i]     += x[i] * h[i]     - x[i + 1] * h[i + 1];
+            acc[i + 1] += x[i] * h[i + 1] + x[i + 1] * h[i];
+        }
+    }
+}
+
+void af_fftconv_output_get(struct af_fftconv_output *out, FLOAT_TYPE *dst)
+{
+    struct af_fftconv *c = out->c;
+    memcpy(c->tmp, out->spectrum, c->fft_size * sizeof(FLOAT_TYPE));
+    av_rdft_calc(c->irdft, c->tmp);
+    memcpy(dst, c->tmp + c->block_size, c->block_size * sizeof(FLOAT_TYPE));
+}
@@ -0,0 +1,82 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Uniformly partitioned FFT convolution (overlap-save).
+
+   Signals are processed in blocks of a fixed size. Each kernel is split
+   into partitions of the block size, whose spectra are computed once. Each
+   input keeps the spectra of its most recent blocks. Since convolution is
+   linear, the products of any number of input/kernel pairs can be summed
+   in the frequency domain, and transformed back with a single inverse FFT:
+
+     af_fftconv_input_push(in_a, block_a);
+     af_fftconv_input_push(in_b, block_b);
+     af_fftconv_output_clear(out);
+     af_fftconv_output_add(out, in_a, kernel_1);
+     af_fftconv_output_add(out, in_b, kernel_2);
+     af_fftconv_output_get(out, result);
+
+   computes result = in_a * kernel_1 + in_b * kernel_2 for the current block.
+   result[i] depends on the input samples up to block_x[i] only, so the output
+   is not delayed if the caller buffers a full block first. The cost per
+   sample is O(log(block_size) + kernel_length / block_size).
+
+   All objects are talloc children of the af_fftconv context. Memory
+   allocation failures abort.
+*/
+
+#if !defined MPLAYER_DSP_H
+# error Never use fftconv.h directly; include dsp.h instead.
+#endif
+
+#ifndef MPLAYER_FFTCONV_H
+#define MPLAYER_FFTCONV_H
+
+struct af_fftconv;
+struct af_fftconv_kernel;
+struct af_fftconv_input;
+struct af_fftconv_output;
+
+// block_size must be a power of 2. max_len is the maximum length of the
+// kernels used with this context.
+struct af_fftconv *af_fftconv_create(void *ta_parent, int block_size,
+                                     int max_len);
+int af_fftconv_block_size(struct af_fftconv *c);
+
+// Precompute the spectra of the kernel taps[0..len-1] (len <= max_len),
+// multiplied by gain.
+struct af_fftconv_kernel *af_fftconv_kernel_create(struct af_fftconv *c,
+                                                   const FLOAT_TYPE *taps,
+                                                   int len, FLOAT_TYPE gain);
+
+struct af_fftconv_input *af_fftconv_input_create(struct af_fftconv *c);
+// Feed the next block_size samples.
+void af_fftconv_input_push(struct af_fftconv_input *in,
+                           const FLOAT_TYPE *block);
+// Forget the past input (as if only 0s were pushed).
+void af_fftconv_input_reset(struct af_fftconv_input *in);
+
+struct af_fftconv_output *af_fftconv_output_create(struct af_fftconv *c);
+void af_fftconv_output_clear(struct af_fftconv_output *out);
+// Add the convolution of the input with the kernel for the current block.
+void af_fftconv_output_add(struct af_fftconv_output *out,
+                           struct af_fftconv_input *in,
+                           struct af_fftconv_kernel *k);
+// Write the block_size output samples of the current block to dst.
+void af_fftconv_output_get(struct af_fftconv_output *out, FLOAT_TYPE *dst);
+
+#endif /* MPLAYER_FFTCONV_H */
@@ -0,0 +1,477 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Sample format conversion and gain kernels.
+ *
+ * Conversions between the common formats have direct kernels (with SIMD
+ * versions on x86). All other integer and float formats are converted through
+ * s32 as intermediate format, in cache-sized chunks. The integer conversions
+ * are done by shifting (the LSBs are dropped when reducing the bit depth), and
+ * the float conversions use the same scaling and rounding as libavresample.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+
+#include <libavutil/common.h>
+#include <libavutil/cpu.h>
+
+#include "common/common.h"
+#include "osdep/endian.h"
+#include "af.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define HAVE_X86_KERNELS 1
+#include <emmintrin.h>
+#else
+#define HAVE_X86_KERNELS 0
+#endif
+
+#define CHUNK_SAMPLES 256
+
+typedef void (*conv_fn)(void *dst, const void *src, int num);
+
+static void s16_to_float_c(void *dst, const void *src, int num)
+{
+    const int16_t *s = src;
+    float *d = dst;
+    for (int i = 0; i < num; i++)
+        d[i] = s[i] * (1.0f / (1 << 15));
+}
+
+static void float_to_s16_c(void *dst, const void *src, int num)
+{
+    const float *s = src;
+    int16_t *d = dst;
+    // Clip before converting, because lrintf() overflows for huge values.
+    // NaN becomes INT16_MIN, as with the SIMD version.
+    for (int i = 0; i < num; i++) {
+        float v = s[i] * (1 << 15);
+        d[i] = v >= INT16_MAX ? INT16_MAX : v > INT16_MIN ? lrintf(v) : INT16_MIN;
+    }
+}
+
+static void s32_to_float_c(void *dst, const void *src, int num)
+{
+    const int32_t *s = src;
+    float *d = dst;
+    for (int i = 0; i < num; i++)
+        d[i] = s[i] * (1.0f / (1U << 31));
+}
+
+static void float_to_s32_c(void *dst, const void *src, int num)
+{
+    const float *s = src;
+    int32_t *d = dst;
+    for (int i = 0; i < num; i++) {
+        float v = s[i] * (1U << 31);
+        d[i] = v >= 2147483648.0f ? INT32_MAX :
+               v > -2147483648.0f ? llrintf(v) : INT32_MIN;
+    }
+}
+
+static void s16_to_s32_c(void *dst, const void *src, int num)
+{
+    const int16_t *s = src;
+    int32_t *d = dst;
+    for (int i = 0; i < num; i++)
+        d[i] = (int32_t)((uint32_t)s[i] << 16);
+}
+
+static void s32_to_s16_c(void *dst, const void *src, int num)
+{
+    const int32_t *s = src;
+    int16_t *d = dst;
+    for (int i = 0; i < num; i++)
+        d[i] = s[i] >> 16;
+}
+
+// The LSB is always ignored.
+#if BYTE_ORDER == BIG_ENDIAN
+#define SHIFT24(x) ((3-(x))*8)
+#else
+#define SHIFT24(x) (((x)+1)*8)
+#endif
+
+// Convert any integer format to s32. The unsigned formats are converted by
+// flipping the sign bit.
+#define TO_S32(name, type, expr)                                    \
+    static void name(void *dst, const void *src, int num)           \
+    {                                                               \
+        const type *s = src;                                        \
+        uint32_t *d = dst;                                          \
+        for (int i = 0; i < num; i++)                               \
+            d[i] = (expr);                                          \
+    }
+
+#define FROM_S32(name, type, expr)                                  \
+    static void name(void *dst, const void *src, int num)           \
+    {                                                               \
+        const uint32_t *s = src;                                    \
+        type *d = dst;                                              \
+        for (int i = 0; i < num; i++)                               \
+            d[i] = (expr);                                          \
+    }
+
+TO_S32(u8_to_s32,  uint8_t,  (uint32_t)(s[i] ^ 0x80) << 24)
+TO_S32(s8_to_s32,  uint8_t,  (uint32_t)s[i] << 24)
+TO_S32(u16_to_s32, uint16_t, (uint32_t)(s[i] ^ 0x8000) << 16)
+TO_S32(u32_to_s32, uint32_t, s[i] ^ 0x80000000)
+
+FROM_S32(s32_to_u8,  uint8_t,  (s[i] >> 24) ^ 0x80)
+FROM_S32(s32_to_s8,  uint8_t,  s[i] >> 24)
+FROM_S32(s32_to_u16, uint16_t, (s[i] >> 16) ^ 0x8000)
+FROM_S32(s32_to_u32, uint32_t, s[i] ^ 0x80000000)
+
+static void s24_to_s32(void *dst, const void *src, int num)
+{
+    const uint8_t *s = src;
+    uint32_t *d = dst;
+    for (int i = 0; i < num; i++) {
+        d[i] = (uint32_t)s[0] << SHIFT24(0) |
+               (uint32_t)s[1] << SHIFT24(1) |
+               (uint32_t)s[2] << SHIFT24(2);
+        s += 3;
+    }
+}
+
+static void u24_to_s32(void *dst, const void *src, int num)
+{
+    uint32_t *d = dst;
+    s24_to_s32(dst, src, num);
+    for (int i = 0; i < num; i++)
+        d[i] ^= 0x80000000;
+}
+
+static void s32_to_s24(void *dst, const void *src, int num)
+{
+    const uint32_t *s = src;
+    uint8_t *d = dst;
+    for (int i = 0; i < num; i++) {
+        d[0] = s[i] >> SHIFT24(0);
+        d[1] = s[i] >> SHIFT24(1);
+        d[2] = s[i] >> SHIFT24(2);
+        d += 3;
+    }
+}
+
+static void s32_to_u24(void *dst, const void *src, int num)
+{
+    const uint32_t *s = src;
+    uint8_t *d = dst;
+    for (int i = 0; i < num; i++) {
+        uint32_t v = s[i] ^ 0x80000000;
+        d[0] = v >> SHIFT24(0);
+        d[1] = v >> SHIFT24(1);
+        d[2] = v >> SHIFT24(2);
+        d += 3;
+    }
+}
+
+#if HAVE_X86_KERNELS
+
+__attribute__((target("sse2")))
+static void s16_to_float_sse2(void *dst, const void *src, int num)
+{
+    const int16_t *s = src;
+    float *d = dst;
+    const __m128 scale = _mm_set1_ps(1.0f / (1 << 15));
+    int i = 0;
+    for (; i + 8 <= num; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(d + i,     _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(d + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    s16_to_float_c(d + i, s + i, num - i);
+}
+
+// cvtps2dq returns INT32_MIN on overflow; flip it to INT32_MAX for positive
+// values to get the same clipping as the C versions.
+__attribute__((target("sse2")))
+static __m128i cvt_float_to_s32_sse2(__m128 v)
+{
+    const __m128 limit = _mm_set1_ps(1U << 31);
+    __m128i r = _mm_cvtps_epi32(v);
+    return _mm_xor_si128(r, _mm_castps_si128(_mm_cmpge_ps(v, limit)));
+}
+
+// Rounds to nearest (like lrintf() with the default rounding mode), and
+// saturates like av_clip_int16().
+__attribute__((target("sse2")))
+static void float_to_s16_sse2(void *dst, const void *src, int num)
+{
+    const float *s = src;
+    int16_t *d = dst;
+    const __m128 scale = _mm_set1_ps(1 << 15);
+    int i = 0;
+    for (; i + 8 <= num; i += 8) {
+        __m128i lo = cvt_float_to_s32_sse2(_mm_mul_ps(_mm_loadu_ps(s + i), scale));
+        __m128i hi = cvt_float_to_s32_sse2(_mm_mul_ps(_mm_loadu_ps(s + i + 4),
+                                                      scale));
+        _mm_storeu_si128((__m128i *)(d + i), _mm_packs_epi32(lo, hi));
+    }
+    float_to_s16_c(d + i, s + i, num - i);
+}
+
+__attribute__((target("sse2")))
+static void s32_to_float_sse2(void *dst, const void *src, int num)
+{
+    const int32_t *s = src;
+    float *d = dst;
+    const __m128 scale = _mm_set1_ps(1.0f / (1U << 31));
+    int i = 0;
+    for (; i + 4 <= num; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        _mm_storeu_ps(d + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+    }
+    s32_to_float_c(d + i, s + i, num - i);
+}
+
+__attribute__((target("sse2")))
+static void float_to_s32_sse2(void *dst, const void *src, int num)
+{
+    const float *s = src;
+    int32_t *d = dst;
+    const __m128 scale = _mm_set1_ps(1U << 31);
+    int i = 0;
+    for (; i + 4 <= num; i += 4) {
+        __m128 v = _mm_mul_ps(_mm_loadu_ps(s + i), scale);
+        _mm_storeu_si128((__m128i *)(d + i), cvt_float_to_s32_sse2(v));
+    }
+    float_to_s32_c(d + i, s + i, num - i);
+}
+
+__attribute__((target("sse2")))
+static void s16_to_s32_sse2(void *dst, const void *src, int num)
+{
+    const int16_t *s = src;
+    int32_t *d = dst;
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 8 <= num; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        _mm_storeu_si128((__m128i *)(d + i),     _mm_unpacklo_epi16(zero, v));
+        _mm_storeu_si128((__m128i *)(d + i + 4), _mm_unpackhi_epi16(zero, v));
+    }
+    s16_to_s32_c(d + i, s + i, num - i);
+}
+
+__attribute__((target("sse2")))
+static void s32_to_s16_sse2(void *dst, const void *src, int num)
+{
+    const int32_t *s = src;
+    int16_t *d = dst;
+    int i = 0;
+    for (; i + 8 <= num; i += 8) {
+        __m128i lo = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(s + i)), 16);
+        __m128i hi = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(s + i + 4)), 16);
+        _mm_storeu_si128((__m128i *)(d + i), _mm_packs_epi32(lo, hi));
+    }
+    s32_to_s16_c(d + i, s + i, num - i);
+}
+
+// The gain kernels process a multiple of the vector size, and return the
+// number of samples done.
+__attribute__((target("sse2")))
+static int gain_s16_sse2(int16_t *a, int num, int vol)
+{
+    const __m128i v = _mm_set1_epi16(vol);
+    int i = 0;
+    for (; i + 8 <= num; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i plo = _mm_mullo_epi16(x, v);
+        __m128i phi = _mm_mulhi_epi16(x, v);
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(plo, phi), 8);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(plo, phi), 8);
+        _mm_storeu_si128((__m128i *)(a + i), _mm_packs_epi32(lo, hi));
+    }
+    return i;
+}
+
+__attribute__((target("sse2")))
+static int gain_float_sse2(float *a, int num, float gain)
+{
+    const __m128 g = _mm_set1_ps(gain);
+    const __m128 max = _mm_set1_ps(1.0f), min = _mm_set1_ps(-1.0f);
+    int i = 0;
+    for (; i + 4 <= num; i += 4) {
+        __m128 x = _mm_mul_ps(_mm_loadu_ps(a + i), g);
+        _mm_storeu_ps(a + i, _mm_max_ps(_mm_min_ps(x, max), min));
+    }
+    return i;
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+// Direct conversions; the function pointers are replaced with SIMD versions
+// (if available) on first use.
+static struct conv_entry {
+    int src, dst;
+    conv_fn fn;
+} conv_table[] = {
+    {AF_FORMAT_S16,   AF_FORMAT_FLOAT, s16_to_float_c},
+    {AF_FORMAT_FLOAT, AF_FORMAT_S16,   float_to_s16_c},
+    {AF_FORMAT_S32,   AF_FORMAT_FLOAT, s32_to_float_c},
+    {AF_FORMAT_FLOAT, AF_FORMAT_S32,   float_to_s32_c},
+    {AF_FORMAT_S16,   AF_FORMAT_S32,   s16_to_s32_c},
+    {AF_FORMAT_S32,   AF_FORMAT_S16,   s32_to_s16_c},
+    {0}
+};
+
+// Conversions to and from the s32 intermediate format.
+static const struct intermediate_entry {
+    int format;
+    conv_fn to_s32, from_s32;
+} intermediate_table[] = {
+    {AF_FORMAT_U8,    u8_to_s32,      s32_to_u8},
+    {AF_FORMAT_S8,    s8_to_s32,      s32_to_s8},
+    {AF_FORMAT_U16,   u16_to_s32,     s32_to_u16},
+    {AF_FORMAT_S16,   s16_to_s32_c,   s32_to_s16_c},
+    {AF_FORMAT_U24,   u24_to_s32,     s32_to_u24},
+    {AF_FORMAT_S24,   s24_to_s32,     s32_to_s24},
+    {AF_FORMAT_U32,   u32_to_s32,     s32_to_u32},
+    {AF_FORMAT_FLOAT, float_to_s32_c, s32_to_float_c},
+    {0}
+};
+
+static int (*gain_s16_simd)(int16_t *a, int num, int vol);
+static int (*gain_float_simd)(float *a, int num, float gain);
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void init_kernels(void)
+{
+#if HAVE_X86_KERNELS
+    if (av_get_cpu_flags() & AV_CPU_FLAG_SSE2) {
+        gain_s16_simd = gain_s16_sse2;
+        gain_float_simd = gain_float_sse2;
+        for (struct conv_entry *e = conv_table; e->fn; e++) {
+            if (e->fn == s16_to_float_c) e->fn = s16_to_float_sse2;
+            if (e->fn == float_to_s16_c) e->fn = float_to_s16_sse2;
+            if (e->fn == s32_to_float_c) e->fn = s32_to_float_sse2;
+            if (e->fn == float_to_s32_c) e->fn = float_to_s32_sse2;
+            if (e->fn == s16_to_s32_c)   e->fn = s16_to_s32_sse2;
+            if (e->fn == s32_to_s16_c)   e->fn = s32_to_s16_sse2;
+        }
+    }
+#endif
+}
+
+static conv_fn find_direct(int src_format, int dst_format)
+{
+    pthread_once(&init_once, init_kernels);
+    for (int n = 0; conv_table[n].fn; n++) {
+        if (conv_table[n].src == src_format && conv_table[n].dst == dst_format)
+            return conv_table[n].fn;
+    }
+    return NULL;
+}
+
+static const struct intermediate_entry *find_intermediate(int format)
+{
+    for (int n = 0; intermediate_table[n].format; n++) {
+        if (intermediate_table[n].format == format)
+            return &intermediate_table[n];
+    }
+    return NULL;
+}
+
+// Whether af_sample_conv() supports the given formats. The planar flag is
+// ignored (the conversion is done per plane).
+bool af_sample_conv_supported(int src_format, int dst_format)
+{
+    src_format = af_fmt_from_planar(src_format);
+    dst_format = af_fmt_from_planar(dst_format);
+    return (src_format == AF_FORMAT_S32 || find_intermediate(src_format)) &&
+           (dst_format == AF_FORMAT_S32 || find_intermediate(dst_format));
+}
+
+// Convert num samples from src to dst. dst and src must not overlap.
+void af_sample_conv(void *dst, int dst_format, const void *src,
+                    int src_format, int num)
+{
+    src_format = af_fmt_from_planar(src_format);
+    dst_format = af_fmt_from_planar(dst_format);
+
+    if (src_format == dst_format) {
+        memcpy(dst, src, num * (size_t)af_fmt2bps(src_format));
+        return;
+    }
+
+    conv_fn direct = find_direct(src_format, dst_format);
+    if (direct) {
+        direct(dst, src, num);
+        return;
+    }
+
+    const struct intermediate_entry *in = find_intermediate(src_format);
+    const struct intermediate_entry *out = find_intermediate(dst_format);
+    if (src_format == AF_FORMAT_S32) {
+        out->from_s32(dst, src, num);
+        return;
+    }
+    if (dst_format == AF_FORMAT_S32) {
+        in->to_s32(dst, src, num);
+        return;
+    }
+
+    int src_bps = af_fmt2bps(src_format);
+    int dst_bps = af_fmt2bps(dst_format);
+    int32_t tmp[CHUNK_SAMPLES];
+    for (int pos = 0; pos < num; pos += CHUNK_SAMPLES) {
+        int len = MPMIN(num - pos, CHUNK_SAMPLES);
+        in->to_s32(tmp, (const char *)src + pos * src_bps, len);
+        out->from_s32((char *)dst + pos * dst_bps, tmp, len);
+    }
+}
+
+// Apply gain (vol / 256) in-place, and clip.
+void af_gain_s16(int16_t *a, int num, int vol)
+{
+    pthread_once(&init_once, init_kernels);
+    int i = 0;
+    if (gain_s16_simd && vol >= 0 && vol <= INT16_MAX)
+        i = gain_s16_simd(a, num, vol);
+    for (; i < num; i++) {
+        int x = (a[i] * vol) >> 8;
+        a[i] = MPCLAMP(x, SHRT_MIN, SHRT_MAX);
+    }
+}
+
+// Apply gain in-place, and clip to [-1, 1] (with soft clipping if softclip
+// is set).
+void af_gain_float(float *a, int num, float gain, bool softclip)
+{
+    pthread_once(&init_once, init_kernels);
+    int i = 0;
+    if (softclip) {
+        for (; i < num; i++)
+            a[i] = af_softclip(a[i] * gain);
+        return;
+    }
+    if (gain_float_simd)
+        i = gain_float_simd(a, num, gain);
+    for (; i < num; i++) {
+        float x = a[i] * gain;
+        a[i] = MPCLAMP(x, -1.0, 1.0);
+    }
+}
@@ -83,8 +83,10 @@ static void checkvolume(struct mixer *mixer)
     ao_control_vol_t vol = {mixer->vol_l, mixer->vol_r};
     if (mixer->softvol) {
         float gain;
+        af_lock(mixer->af);
         if (!af_control_any_rev(mixer->af, AF_CONTROL_GET_VOLUME, &gain))
             gain = 1.0;
+        af_unlock(mixer->af);
         vol.left = (gain / (mixer->opts->softvol_max / 100.0)) * 100.0;
         vol.right = (gain / (mixer->opts->softvol_max / 100.0)) * 100.0;
     } else {
@@ -128,12 +130,14 @@ static void setvolume_internal(struct mixer *mixer, float l, float r)
         return;
     }
     float gain = (l + r) / 2.0 / 100.0 * mixer->opts->softvol_max / 100.0;
+    af_lock(mixer->af);
     if (!af_control_any_rev(mixer->af, AF_CONTROL_SET_VOLUME, &gain)) {
         MP_VERBOSE(mixer, "Inserting volume filter.\n");
         if (!(af_add(mixer->af, "volume", NULL)
               && af_control_any_rev(mixer->af, AF_CONTROL_SET_VOLUME, &gain)))
             MP_ERR(mixer, "No volume control available.\n");
     }
+    af_unlock(mixer->af);
 }
 
 void mixer_setvolume(struct mixer *mixer, float l, float r)
@@ -189,8 +193,11 @@ void mixer_addvolume(struct mixer *mixer, float step)
 
 void mixer_getbalance(struct mixer *mixer, float *val)
 {
-    if (mixer->af)
+    if (mixer->af) {
+        af_lock(mixer->af);
         af_control_any_rev(mixer->af, AF_CONTROL_GET_PAN_BALANCE, &mixer->balance);
+        af_unlock(mixer->af);
+    }
     *val = mixer->balance;
 }
 
@@ -203,15 +210,10 @@ void mixer_getbalance(struct mixer *mixer, float *val)
  * values is completely wrong.
  */
 
-void mixer_setbalance(struct mixer *mixer, float val)
+static void setbalance_af(struct mixer *mixer, float val)
 {
     struct af_instance *af_pan_balance;
 
-    mixer->balance = val;
-
-    if (!mixer->af)
-        return;
-
     if (af_control_any_rev(mixer->af, AF_CONTROL_SET_PAN_BALANCE, &val))
         return;
 
@@ -235,6 +237,18 @@ void mixer_setbalance(struct mixer *mixer, float val)
     af_pan_balance->control(af_pan_balance, AF_CONTROL_SET_PAN_BALANCE, &val);
 }
 
+void mixer_setbalance(struct mixer *mixer, float val)
+{
+    mixer->balance = val;
+
+    if (!mixer->af)
+        return;
+
+    af_lock(mixer->af);
+    setbalance_af(mixer, val);
+    af_unlock(mixer->af);
+}
+
 char *mixer_get_volume_restore_data(struct mixer *mixer)
 {
     if (!mixer->driver[0])
@@ -30,6 +30,7 @@
 
 #include "common/msg.h"
 #include "common/common.h"
+#include "common/trace.h"
 
 #include "input/input.h"
 
@@ -262,10 +263,12 @@ static void ao_play_data(struct ao *ao)
     if (p->final_chunk && data.samples == max)
         flags |= AOPLAY_FINAL_CHUNK;
     MP_STATS(ao, "start ao fill");
+    MP_TRACE_BEGIN(ao, "ao fill");
     int r = 0;
     if (data.samples)
         r = ao->driver->play(ao, data.planes, data.samples, flags);
     MP_STATS(ao, "end ao fill");
+    MP_TRACE_END(ao, "ao fill");
     if (r > data.samples) {
         MP_WARN(ao, "Audio device returned non-sense value.\n");
         r = data.samples;
@@ -311,6 +314,7 @@ static void *playthread(void *arg)
 
         if (!p->need_wakeup) {
             MP_STATS(ao, "start audio wait");
+            MP_TRACE_BEGIN(ao, "audio wait");
             if (!p->wait_on_ao || p->paused) {
                 // Avoid busy waiting, because the audio API will still report
                 // that it needs new data, even if we're not ready yet, or if
@@ -357,6 +361,7 @@ static void *playthread(void *arg)
                 }
             }
             MP_STATS(ao, "end audio wait");
+            MP_TRACE_END(ao, "audio wait");
         }
         p->need_wakeup = false;
     }
@@ -31,6 +31,7 @@
 #include "osdep/atomics.h"
 #include "common/common.h"
 #include "common/global.h"
+#include "common/trace.h"
 #include "misc/ring.h"
 #include "options/options.h"
 #include "osdep/terminal.h"
@@ -61,6 +62,8 @@ struct mp_log_root {
     struct mp_log_buffer **buffers;
     int num_buffers;
     FILE *stats_file;
+    // --- thread-safe, set at init
+    struct mp_trace *trace;
     // --- semi-atomic access
     bool mute;
     // --- must be accessed atomically
@@ -428,6 +431,7 @@ void mp_msg_init(struct mpv_global *global)
     *root = (struct mp_log_root){
         .global = global,
         .reload_counter = ATOMIC_VAR_INIT(1),
+        .trace = mp_trace_create(),
     };
 
     struct mp_log dummy = { .root = root };
@@ -483,6 +487,7 @@ void mp_msg_uninit(struct mpv_global *global)
     struct mp_log_root *root = global->log->root;
     if (root->stats_file)
         fclose(root->stats_file);
+    mp_trace_destroy(root->trace);
     talloc_free(root);
     global->log = NULL;
 }
@@ -581,6 +586,20 @@ int mp_msg_open_stats_file(struct mpv_global *global, const char *path)
     return r;
 }
 
+// Return the tracing state (see common/trace.h), or NULL if unavailable.
+struct mp_trace *mp_msg_get_trace(struct mpv_global *global)
+{
+    return global->log->root->trace;
+}
+
+void mp_trace_event(struct mp_log *log, int type, const char *name,
+                    int64_t value)
+{
+    struct mp_log_root *root = log->root;
+    if (root && root->trace)
+        mp_trace_record(root->trace, type, name, value);
+}
+
 // Thread-safety: fully thread-safe, but keep in mind that the lifetime of
 //                log must be guaranteed during the call.
 //                Never call this from signal handlers.
@@ -28,6 +28,9 @@ struct mp_log_buffer_entry *mp_msg_log_buffer_read(struct mp_log_buffer *buffer)
 
 int mp_msg_open_stats_file(struct mpv_global *global, const char *path);
 
+struct mp_trace;
+struct mp_trace *mp_msg_get_trace(struct mpv_global *global);
+
 struct bstr;
 int mp_msg_split_msglevel(struct bstr *s, struct bstr *out_mod, int *out_level);
 
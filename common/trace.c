@@ -0,0 +1,344 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Low overhead event tracing.
+ *
+ * Each thread writes its events into its own ring buffer. Only the thread
+ * itself writes to the ring, so recording an event doesn't need locks. If a
+ * ring is full, the oldest events are overwritten. Readers copy the events,
+ * and then check whether the writer overwrote them in the meantime (and drop
+ * them if so). Rings of exited threads are reused by new threads.
+ *
+ * Events are written either as Chrome trace event JSON (chrome://tracing,
+ * or other tools which can read this format), or in a compact binary format
+ * (see TOOLS/trace-conv.py). The binary format is:
+ *
+ *   "mpvtrace"  magic
+ *   u32         version (1)
+ *   records, each starting with an u8 record type:
+ *     'N': name definition: u16 name ID, u16 length, string bytes
+ *     'E': event: u8 type (enum mp_trace_type), u16 name ID, u32 thread ID,
+ *          i64 time (microseconds), i64 value (counter value or flow ID)
+ *
+ * All integers are little endian. Name definitions always precede the first
+ * event using them.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include <libavutil/intreadwrite.h>
+
+#include "talloc.h"
+#include "common/common.h"
+#include "osdep/atomics.h"
+#include "osdep/timer.h"
+#include "misc/bstr.h"
+
+#include "trace.h"
+
+// Number of events per thread; must be a power of 2.
+#define RING_SIZE (1 << 15)
+
+struct trace_event {
+    int64_t time;
+    int64_t value;
+    const char *name;
+    uint32_t tid;
+    uint8_t type;
+};
+
+struct trace_ring {
+    struct mp_trace *owner;
+    struct trace_event *events;
+    // Number of events ever written. Written by the owning thread only.
+    atomic_ullong head;
+    // --- protected by mp_trace.lock
+    uint64_t read_pos;          // events before this were returned already
+    uint32_t tid;               // thread ID of the current owner
+    bool in_use;                // owned by a running thread
+};
+
+struct mp_trace {
+    atomic_bool enabled;
+    pthread_key_t ring_key;
+
+    pthread_mutex_t lock;
+    struct trace_ring **rings;
+    int num_rings;
+    uint32_t tid_counter;
+};
+
+// Called on thread exit (only while the mp_trace exists).
+static void release_ring(void *p)
+{
+    struct trace_ring *ring = p;
+    pthread_mutex_lock(&ring->owner->lock);
+    ring->in_use = false;
+    pthread_mutex_unlock(&ring->owner->lock);
+}
+
+struct mp_trace *mp_trace_create(void)
+{
+    struct mp_trace *t = talloc_zero(NULL, struct mp_trace);
+    atomic_store(&t->enabled, false);
+    if (pthread_key_create(&t->ring_key, release_ring)) {
+        talloc_free(t);
+        return NULL;
+    }
+    pthread_mutex_init(&t->lock, NULL);
+    return t;
+}
+
+void mp_trace_destroy(struct mp_trace *t)
+{
+    if (!t)
+        return;
+    pthread_key_delete(t->ring_key);
+    pthread_mutex_destroy(&t->lock);
+    talloc_free(t);
+}
+
+static struct trace_ring *get_thread_ring(struct mp_trace *t)
+{
+    struct trace_ring *ring = pthread_getspecific(t->ring_key);
+    if (ring)
+        return ring;
+
+    pthread_mutex_lock(&t->lock);
+    for (int n = 0; n < t->num_rings; n++) {
+        if (!t->rings[n]->in_use) {
+            ring = t->rings[n];
+            break;
+        }
+    }
+    if (!ring) {
+        ring = talloc_zero(t, struct trace_ring);
+        ring->owner = t;
+        ring->events = talloc_zero_array(ring, struct trace_event, RING_SIZE);
+        atomic_store(&ring->head, 0);
+        MP_TARRAY_APPEND(t, t->rings, t->num_rings, ring);
+    }
+    // Events of the previous owner keep their thread ID.
+    ring->in_use = true;
+    ring->tid = ++t->tid_counter;
+    pthread_mutex_unlock(&t->lock);
+
+    pthread_setspecific(t->ring_key, ring);
+    return ring;
+}
+
+void mp_trace_record(struct mp_trace *t, int type, const char *name,
+                     int64_t value)
+{
+    if (!atomic_load(&t->enabled))
+        return;
+    if (type >= MP_TRACE_FLOW_START && type <= MP_TRACE_FLOW_END && !value)
+        return;
+
+    struct trace_ring *ring = get_thread_ring(t);
+    uint64_t head = atomic_load(&ring->head);
+    ring->events[head & (RING_SIZE - 1)] = (struct trace_event){
+        .time = mp_time_us(),
+        .value = value,
+        .name = name,
+        .tid = ring->tid,
+        .type = type,
+    };
+    atomic_store(&ring->head, head + 1);
+}
+
+// Microseconds, wrapped to 52 bits, with bit 52 always set. This keeps 0 free
+// for "no flow", and the IDs exactly representable as JSON (double) numbers.
+int64_t mp_trace_pts_id(double pts)
+{
+    if (pts == MP_NOPTS_VALUE || !isfinite(pts))
+        return 0;
+    int64_t mask = (1LL << 52) - 1;
+    return (llrint(pts * 1e6) & mask) | (1LL << 52);
+}
+
+// Drop all events recorded so far, and enable recording.
+void mp_trace_start(struct mp_trace *t)
+{
+    pthread_mutex_lock(&t->lock);
+    for (int n = 0; n < t->num_rings; n++)
+        t->rings[n]->read_pos = atomic_load(&t->rings[n]->head);
+    pthread_mutex_unlock(&t->lock);
+    atomic_store(&t->enabled, true);
+}
+
+void mp_trace_stop(struct mp_trace *t)
+{
+    atomic_store(&t->enabled, false);
+}
+
+bool mp_trace_is_enabled(struct mp_trace *t)
+{
+    return atomic_load(&t->enabled);
+}
+
+// Copy the events not returned yet, and mark them as returned. Events which
+// were overwritten by the time they were copied are dropped.
+// t->lock must be held.
+static void read_ring(struct trace_ring *ring, struct trace_event **events,
+                      int *num_events)
+{
+    // The writer fills the slot of event "head" before it publishes head + 1,
+    // so event head - RING_SIZE (in the same slot) might be half-overwritten.
+    uint64_t head = atomic_load(&ring->head);
+    uint64_t start = MPMAX(ring->read_pos,
+                           head >= RING_SIZE ? head - RING_SIZE + 1 : 0);
+    int first = *num_events;
+    for (uint64_t n = start; n < head; n++) {
+        MP_TARRAY_APPEND(NULL, *events, *num_events,
+                         ring->events[n & (RING_SIZE - 1)]);
+    }
+    atomic_thread_fence(memory_order_acquire);
+    // The writer might have continued and overwritten copied events. Events
+    // up to new_head - RING_SIZE are possibly invalid.
+    uint64_t new_head = atomic_load(&ring->head);
+    if (new_head >= RING_SIZE && new_head - RING_SIZE + 1 > start) {
+        int lost = MPMIN(new_head - RING_SIZE + 1 - start, head - start);
+        memmove(&(*events)[first], &(*events)[first + lost],
+                (*num_events - first - lost) * sizeof((*events)[0]));
+        *num_events -= lost;
+    }
+    ring->read_pos = head;
+}
+
+static void write_json_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(f, "\\%c", *s);
+        } else if ((unsigned char)*s < 0x20) {
+            fprintf(f, "\\u%04x", *s);
+        } else {
+            fputc(*s, f);
+        }
+    }
+    fputc('"', f);
+}
+
+static void write_json(FILE *f, struct trace_event *events, int num_events)
+{
+    static const char *const phase[] = {
+        [MP_TRACE_BEGIN]        = "B",
+        [MP_TRACE_END]          = "E",
+        [MP_TRACE_COUNTER]      = "C",
+        [MP_TRACE_FLOW_START]   = "s",
+        [MP_TRACE_FLOW_STEP]    = "t",
+        [MP_TRACE_FLOW_END]     = "f",
+    };
+    fprintf(f, "{\"traceEvents\":[\n");
+    for (int n = 0; n < num_events; n++) {
+        struct trace_event *e = &events[n];
+        fprintf(f, "{\"name\":");
+        write_json_string(f, e->name);
+        fprintf(f, ",\"ph\":\"%s\",\"ts\":%"PRId64",\"pid\":1,\"tid\":%u",
+                phase[e->type], e->time, (unsigned)e->tid);
+        if (e->type == MP_TRACE_COUNTER) {
+            fprintf(f, ",\"args\":{\"value\":%"PRId64"}", e->value);
+        } else if (e->type >= MP_TRACE_FLOW_START) {
+            // Bind flow steps to the enclosing span.
+            fprintf(f, ",\"cat\":\"flow\",\"id\":%"PRId64"%s", e->value,
+                    e->type != MP_TRACE_FLOW_START ? ",\"bp\":\"e\"" : "");
+        }
+        fprintf(f, "}%s\n", n + 1 < num_events ? "," : "");
+    }
+    fprintf(f, "]}\n");
+}
+
+static void write_binary(FILE *f, struct trace_event *events, int num_events)
+{
+    const char **names = NULL;
+    int num_names = 0;
+    uint8_t buf[32];
+
+    fwrite("mpvtrace", 8, 1, f);
+    AV_WL32(buf, 1);
+    fwrite(buf, 4, 1, f);
+
+    for (int n = 0; n < num_events; n++) {
+        struct trace_event *e = &events[n];
+        // Names are string constants, so comparing pointers mostly works,
+        // and duplicate definitions for equal strings are harmless.
+        int id = -1;
+        for (int i = 0; i < num_names; i++) {
+            if (names[i] == e->name) {
+                id = i;
+                break;
+            }
+        }
+        if (id < 0) {
+            if (num_names > UINT16_MAX)
+                continue;
+            id = num_names;
+            MP_TARRAY_APPEND(NULL, names, num_names, e->name);
+            size_t len = MPMIN(strlen(e->name), UINT16_MAX);
+            buf[0] = 'N';
+            AV_WL16(buf + 1, id);
+            AV_WL16(buf + 3, len);
+            fwrite(buf, 5, 1, f);
+            fwrite(e->name, len, 1, f);
+        }
+        buf[0] = 'E';
+        buf[1] = e->type;
+        AV_WL16(buf + 2, id);
+        AV_WL32(buf + 4, e->tid);
+        AV_WL64(buf + 8, e->time);
+        AV_WL64(buf + 16, e->value);
+        fwrite(buf, 24, 1, f);
+    }
+
+    talloc_free(names);
+}
+
+// Write all events recorded since the last call (or mp_trace_start()) to the
+// file. If the filename ends with ".json", Chrome trace event JSON is
+// written, otherwise the binary format.
+// Returns 0 on success, -1 on error.
+int mp_trace_write(struct mp_trace *t, const char *filename)
+{
+    struct trace_event *events = NULL;
+    int num_events = 0;
+
+    pthread_mutex_lock(&t->lock);
+    for (int n = 0; n < t->num_rings; n++)
+        read_ring(t->rings[n], &events, &num_events);
+    pthread_mutex_unlock(&t->lock);
+
+    int r = -1;
+    FILE *f = fopen(filename, "wb");
+    if (f) {
+        if (bstr_endswith0(bstr0(filename), ".json")) {
+            write_json(f, events, num_events);
+        } else {
+            write_binary(f, events, num_events);
+        }
+        r = ferror(f) ? -1 : 0;
+        if (fclose(f))
+            r = -1;
+    }
+
+    talloc_free(events);
+    return r;
+}
@@ -0,0 +1,67 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_TRACE_H
+#define MP_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct mp_log;
+
+enum mp_trace_type {
+    MP_TRACE_BEGIN,         // start of a span
+    MP_TRACE_END,           // end of the span started last on this thread
+    MP_TRACE_COUNTER,       // value is the new counter value
+    MP_TRACE_FLOW_START,    // value is the flow ID
+    MP_TRACE_FLOW_STEP,
+    MP_TRACE_FLOW_END,
+};
+
+// Record a trace event, if tracing is enabled. This is cheap if tracing is
+// disabled, and doesn't take locks otherwise. name must be a string constant
+// (or otherwise stay valid until the player is destroyed).
+// Thread-safety: same as mp_msg().
+void mp_trace_event(struct mp_log *log, int type, const char *name,
+                    int64_t value);
+
+#define MP_TRACE_BEGIN(obj, name) \
+    mp_trace_event((obj)->log, MP_TRACE_BEGIN, name, 0)
+#define MP_TRACE_END(obj, name) \
+    mp_trace_event((obj)->log, MP_TRACE_END, name, 0)
+#define MP_TRACE_COUNTER(obj, name, value) \
+    mp_trace_event((obj)->log, MP_TRACE_COUNTER, name, value)
+// Flows connect events on different threads, e.g. the stages of a frame
+// from the demuxer packet to the display. The ID identifies the flow.
+#define MP_TRACE_FLOW(obj, type, name, id) \
+    mp_trace_event((obj)->log, MP_TRACE_FLOW_ ## type, name, id)
+
+// Flow ID for a timestamp (MP_NOPTS_VALUE gives 0, which is ignored). Use the
+// timestamps as returned by the demuxer, without the player's offsets.
+int64_t mp_trace_pts_id(double pts);
+
+struct mp_trace;
+struct mp_trace *mp_trace_create(void);
+void mp_trace_destroy(struct mp_trace *t);
+void mp_trace_record(struct mp_trace *t, int type, const char *name,
+                     int64_t value);
+void mp_trace_start(struct mp_trace *t);
+void mp_trace_stop(struct mp_trace *t);
+bool mp_trace_is_enabled(struct mp_trace *t);
+int mp_trace_write(struct mp_trace *t, const char *filename);
+
+#endif
@@ -33,7 +33,11 @@
 #include "talloc.h"
 #include "common/msg.h"
 #include "common/global.h"
+#include "common/trace.h"
 #include "osdep/threads.h"
+#include "osdep/atomics.h"
+#include "osdep/timer.h"
+#include "misc/ring.h"
 
 #include "stream/stream.h"
 #include "demux.h"
@@ -92,18 +96,39 @@ struct demux_internal {
     struct demuxer *d_user;     // accessed by player (consumer)
     struct demuxer *d_buffer;   // protected by lock; used to sync d_user/thread
 
-    // The lock protects the packet queues (struct demux_stream), d_buffer,
-    // and some minor fields like thread_paused.
+    // The lock protects d_buffer, the packet queue overflow lists, and some
+    // minor fields like thread_paused. Normal packet handoff between demuxer
+    // thread and player is lock-free (see struct demux_stream).
     pthread_mutex_t lock;
     pthread_cond_t wakeup;
     pthread_t thread;
 
+    // Number of times a thread had to block on the lock.
+    atomic_llong lock_contended;
+    // CPU time used by the demuxer implementation reading packets (only
+    // measured with --benchmark).
+    bool measure_cpu;
+    atomic_llong cpu_time;
+    // Number of packets added by the demuxer implementation (including ones
+    // that are discarded because the stream is not selected).
+    atomic_llong packets_read;
+
+    // Set while a thread waits on the wakeup condition for packets (reader)
+    // or for queue space (demuxer thread). The other side takes the lock and
+    // signals only if this is set.
+    atomic_bool reader_waiting;
+    atomic_bool thread_waiting;
+    // Set by the demuxer thread if it stopped because of MAX_PACKS etc.
+    atomic_bool queues_full;
+
     // -- All the following fields are protected by lock.
 
     bool thread_paused;
     int thread_request_pause;   // counter, if >0, make demuxer thread pause
     bool thread_terminate;
     bool threading;
+    // Set before the thread is started, so the demuxer thread may read them
+    // without holding the lock.
     void (*wakeup_cb)(void *ctx);
     void *wakeup_cb_ctx;
 
@@ -112,13 +137,14 @@ struct demux_internal {
     bool eof;                   // whether we're in EOF state (reset for retry)
     bool idle;
     bool autoselect;
+    // Set on init only, and can be read without the lock.
     double min_secs;
     int min_packs;
     int min_bytes;
 
     bool tracks_switched;       // thread needs to inform demuxer of this
 
-    bool seeking;               // there's a seek queued
+    atomic_bool seeking;        // there's a seek queued (written with lock held)
     int seek_flags;             // flags for next seek (if seeking==true)
     double seek_pts;
 
@@ -131,26 +157,66 @@ struct demux_internal {
     int64_t stream_cache_size;
     int64_t stream_cache_fill;
     int stream_cache_idle;
+    bool have_cache_ranges;
+    struct stream_cache_ranges stream_cache_ranges;
     // Updated during init only.
     char *stream_base_filename;
+
+    // -- Seek cache state, protected by lock. (With decoder threads, several
+    //    consumers add to the stream caches, and pruning touches all of them.)
+    int64_t seek_cache_max;     // byte limit, 0 if disabled
+    int64_t seek_cache_bytes;   // sum of packet sizes in all stream caches
+    int64_t seek_cache_hits;
+    int64_t seek_cache_misses;
+};
+
+// Number of packets the lock-free queue of a stream can hold. Further packets
+// go to the (locked) overflow list.
+#define QUEUE_SLOTS 1024
+
+struct queue_entry {
+    struct demux_packet *pkt;
+    int generation;
 };
 
+// Packets are passed from the demuxer thread (producer) to the player
+// (consumer) through a SPSC ringbuffer. All consumer-side operations on a
+// stream must be done by the same thread.
 struct demux_stream {
     struct demux_internal *in;
     enum stream_type type;
-    // all fields are protected by in->lock
-    bool selected;          // user wants packets from this stream
+    // -- Lock-free fields.
+    atomic_bool selected;   // user wants packets from this stream (written
+                            // with lock held)
+    struct mp_ring *queue;  // struct queue_entry items
+    atomic_int generation;  // incremented on flush; older entries are dropped
+    atomic_llong packs;     // number of packets in buffer
+    atomic_llong bytes;     // total bytes of packets in buffer
+    atomic_ullong base_ts;  // timestamp of the last packet returned to decoder
+    atomic_ullong last_ts;  // timestamp of the last packet added to queue
+    atomic_int num_overflow;// number of entries in overflow list
+    atomic_int replay_packs;// number of seek cache packets still to replay
+    atomic_int consumers;   // consumer-side calls in progress (must be <= 1)
+    // -- Fields protected by in->lock.
     bool active;            // try to keep at least 1 packet queued
     bool eof;               // end of demuxed stream? (true if all buffer empty)
-    size_t packs;           // number of packets in buffer
-    size_t bytes;           // total bytes of packets in buffer
-    double base_ts;         // timestamp of the last packet returned to decoder
-    double last_ts;         // timestamp of the last packet added to queue
+    // Used if the queue is full. Only the producer adds, and only if the
+    // list is not empty or the queue is full, so this is always newer than
+    // everything in the queue.
+    struct queue_entry *overflow;
+    int overflow_pos, overflow_num;
+    // -- Accessed by the consumer only.
+    struct demux_packet *reader_head; // packet taken from queue, not returned yet
     double last_br_ts;      // timestamp of last packet bitrate was calculated
     size_t last_br_bytes;   // summed packet sizes since last bitrate calculation
     double bitrate;
-    struct demux_packet *head;
-    struct demux_packet *tail;
+    // Seek cache (protected by in->lock): copies of packets returned to the
+    // decoder, in demuxing order. Entries before cache_start were evicted. If cache_pos is less
+    // than cache_num, packets are replayed from cache_pos after a cached
+    // seek, before the queue is read again.
+    struct demux_packet **cache;
+    int cache_start, cache_pos, cache_num;
+    int cache_seek_pos;     // temporary for seek_cache_seek()
 };
 
 // Return "a", or if that is NOPTS, return "def".
@@ -163,23 +229,298 @@ static void demuxer_sort_chapters(demuxer_t *demuxer);
 static void *demux_thread(void *pctx);
 static void update_cache(struct demux_internal *in);
 
-// called locked
-static void ds_flush(struct demux_stream *ds)
+static void lock_internal(struct demux_internal *in)
+{
+    if (pthread_mutex_trylock(&in->lock) != 0) {
+        atomic_fetch_add(&in->lock_contended, 1);
+        pthread_mutex_lock(&in->lock);
+    }
+}
+
+static void unlock_internal(struct demux_internal *in)
+{
+    pthread_mutex_unlock(&in->lock);
+}
+
+// Wake up whoever waits on in->wakeup, if waiting is set. Call unlocked.
+static void wakeup_waiter(struct demux_internal *in, atomic_bool *waiting)
+{
+    if (atomic_load(waiting)) {
+        lock_internal(in);
+        pthread_cond_broadcast(&in->wakeup);
+        unlock_internal(in);
+    }
+}
+
+// Timestamps are stored as bit patterns, because there are no atomic doubles.
+static double ts_load(atomic_ullong *ts)
+{
+    unsigned long long v = atomic_load(ts);
+    double r;
+    memcpy(&r, &v, sizeof(r));
+    return r;
+}
+
+static void ts_store(atomic_ullong *ts, double val)
+{
+    unsigned long long v = 0;
+    memcpy(&v, &val, sizeof(val));
+    atomic_store(ts, v);
+}
+
+static bool ds_has_packets(struct demux_stream *ds)
+{
+    return atomic_load(&ds->packs) > 0;
+}
+
+// Consumer side. Take the oldest entry from the queue or overflow list.
+static bool queue_pop(struct demux_stream *ds, struct queue_entry *e)
+{
+    if (mp_ring_buffered(ds->queue) >= sizeof(*e)) {
+        mp_ring_read(ds->queue, (unsigned char *)e, sizeof(*e));
+        return true;
+    }
+    if (atomic_load(&ds->num_overflow) < 1)
+        return false;
+    // The producer adds to the queue only if the overflow list is empty, so
+    // anything that got into the queue meanwhile is older than the overflow.
+    if (mp_ring_buffered(ds->queue) >= sizeof(*e)) {
+        mp_ring_read(ds->queue, (unsigned char *)e, sizeof(*e));
+        return true;
+    }
+    lock_internal(ds->in);
+    assert(ds->overflow_pos < ds->overflow_num);
+    *e = ds->overflow[ds->overflow_pos++];
+    if (ds->overflow_pos == ds->overflow_num)
+        ds->overflow_pos = ds->overflow_num = 0;
+    atomic_fetch_add(&ds->num_overflow, -1);
+    unlock_internal(ds->in);
+    return true;
+}
+
+// Producer side.
+static void queue_push(struct demux_stream *ds, struct queue_entry *e)
+{
+    if (atomic_load(&ds->num_overflow) == 0 &&
+        mp_ring_available(ds->queue) >= sizeof(*e))
+    {
+        mp_ring_write(ds->queue, (unsigned char *)e, sizeof(*e));
+        return;
+    }
+    lock_internal(ds->in);
+    MP_TARRAY_APPEND(ds, ds->overflow, ds->overflow_num, *e);
+    atomic_fetch_add(&ds->num_overflow, 1);
+    unlock_internal(ds->in);
+}
+
+static void drop_entry(struct demux_stream *ds, struct demux_packet *pkt)
+{
+    atomic_fetch_add(&ds->bytes, -pkt->len);
+    atomic_fetch_add(&ds->packs, -1);
+    free_demux_packet(pkt);
+}
+
+// Bracket consumer-side operations, to catch callers that use a stream from
+// two threads at the same time (e.g. the player thread while a decoder thread
+// is reading packets).
+static void consumer_enter(struct demux_stream *ds)
+{
+    int prev = atomic_fetch_add(&ds->consumers, 1);
+    assert(prev == 0);
+}
+
+static void consumer_leave(struct demux_stream *ds)
+{
+    atomic_fetch_add(&ds->consumers, -1);
+}
+
+// Consumer side. Return the oldest valid packet without removing it.
+static struct demux_packet *ds_peek(struct demux_stream *ds)
 {
-    demux_packet_t *dp = ds->head;
-    while (dp) {
-        demux_packet_t *dn = dp->next;
+    if (ds->in->seek_cache_max > 0) {
+        // Packets still to be replayed are never pruned, so the pointer stays
+        // valid after unlocking.
+        struct demux_packet *cached = NULL;
+        lock_internal(ds->in);
+        if (ds->cache_pos < ds->cache_num)
+            cached = ds->cache[ds->cache_pos];
+        unlock_internal(ds->in);
+        if (cached)
+            return cached;
+    }
+    while (!ds->reader_head) {
+        struct queue_entry e;
+        if (!queue_pop(ds, &e))
+            break;
+        if (e.generation != atomic_load(&ds->generation)) {
+            drop_entry(ds, e.pkt); // added before the last flush
+            continue;
+        }
+        ds->reader_head = e.pkt;
+    }
+    return ds->reader_head;
+}
+
+static double packet_ts(struct demux_packet *dp)
+{
+    return PTS_OR_DEF(dp->pts, dp->dts);
+}
+
+// Called locked.
+static void seek_cache_clear(struct demux_stream *ds)
+{
+    for (int n = ds->cache_start; n < ds->cache_num; n++) {
+        ds->in->seek_cache_bytes -= ds->cache[n]->len;
+        free_demux_packet(ds->cache[n]);
+    }
+    ds->cache_start = ds->cache_pos = ds->cache_num = 0;
+    atomic_store(&ds->replay_packs, 0);
+}
+
+// Called locked. Evict the oldest packets until the limit is met. Packets
+// which still have to be replayed are never removed.
+static void seek_cache_prune(struct demux_internal *in)
+{
+    struct demuxer *d = in->d_user;
+    while (in->seek_cache_bytes > in->seek_cache_max) {
+        struct demux_stream *oldest = NULL;
+        for (int n = 0; n < d->num_streams; n++) {
+            struct demux_stream *ds = d->streams[n]->ds;
+            if (ds->cache_start < ds->cache_pos &&
+                (!oldest || packet_ts(ds->cache[ds->cache_start]) <
+                            packet_ts(oldest->cache[oldest->cache_start])))
+                oldest = ds;
+        }
+        if (!oldest)
+            break;
+        struct demux_packet *dp = oldest->cache[oldest->cache_start++];
+        in->seek_cache_bytes -= dp->len;
         free_demux_packet(dp);
-        dp = dn;
+        // Compact the array once the unused head is large enough.
+        if (oldest->cache_start > oldest->cache_num / 2) {
+            int start = oldest->cache_start;
+            memmove(oldest->cache, oldest->cache + start,
+                    (oldest->cache_num - start) * sizeof(oldest->cache[0]));
+            oldest->cache_num -= start;
+            oldest->cache_pos -= start;
+            oldest->cache_start = 0;
+        }
+    }
+}
+
+// Consumer side. Remember a packet that is returned to the decoder.
+static void seek_cache_add(struct demux_stream *ds, struct demux_packet *dp)
+{
+    struct demux_internal *in = ds->in;
+    struct demux_packet *copy =
+        demux_copy_packet_pooled(in->d_user->packet_pool, dp);
+    if (!copy)
+        return;
+    lock_internal(in);
+    MP_TARRAY_APPEND(ds, ds->cache, ds->cache_num, copy);
+    ds->cache_pos = ds->cache_num;
+    in->seek_cache_bytes += copy->len;
+    seek_cache_prune(in);
+    unlock_internal(in);
+}
+
+// Called locked. Try to position all selected streams on cached packets, so
+// that the seek can be done without touching the demuxer. Returns false if
+// the target is not covered by the cache.
+static bool seek_cache_seek(struct demux_internal *in, double pts, int flags)
+{
+    struct demuxer *d = in->d_user;
+    if (!in->seek_cache_max || !(flags & SEEK_ABSOLUTE) || (flags & SEEK_FACTOR))
+        return false;
+
+    bool have_av = false;
+    for (int n = 0; n < d->num_streams; n++) {
+        struct demux_stream *ds = d->streams[n]->ds;
+        ds->cache_seek_pos = ds->cache_num;
+        if (!atomic_load(&ds->selected))
+            continue;
+        if (ds->type == STREAM_SUB) {
+            // Start with the first subtitle still visible at the target.
+            for (int i = ds->cache_start; i < ds->cache_num; i++) {
+                struct demux_packet *dp = ds->cache[i];
+                double end = packet_ts(dp);
+                if (end != MP_NOPTS_VALUE && dp->duration > 0)
+                    end += dp->duration;
+                if (end != MP_NOPTS_VALUE && end >= pts) {
+                    ds->cache_seek_pos = i;
+                    break;
+                }
+            }
+            continue;
+        }
+        if (ds->cache_start == ds->cache_num)
+            return false;
+        double last = packet_ts(ds->cache[ds->cache_num - 1]);
+        if (last == MP_NOPTS_VALUE || pts > last)
+            return false;
+        int found = -1;
+        for (int i = ds->cache_start; i < ds->cache_num; i++) {
+            struct demux_packet *dp = ds->cache[i];
+            double ts = packet_ts(dp);
+            if (ts == MP_NOPTS_VALUE || (ds->type == STREAM_VIDEO && !dp->keyframe))
+                continue;
+            if (flags & SEEK_FORWARD) {
+                if (ts >= pts) {
+                    found = i;
+                    break;
+                }
+            } else if (ts <= pts) {
+                // Keep going: video timestamps can be out of order.
+                found = i;
+            }
+        }
+        if (found < 0)
+            return false;
+        ds->cache_seek_pos = found;
+        have_av = true;
+    }
+    if (!have_av)
+        return false;
+
+    for (int n = 0; n < d->num_streams; n++) {
+        struct demux_stream *ds = d->streams[n]->ds;
+        if (!atomic_load(&ds->selected))
+            continue;
+        ds->cache_pos = ds->cache_seek_pos;
+        atomic_store(&ds->replay_packs, ds->cache_num - ds->cache_pos);
+    }
+    in->seek_cache_hits++;
+    return true;
+}
+
+// called locked, from the consumer thread
+static void ds_flush(struct demux_stream *ds)
+{
+    consumer_enter(ds);
+    // Entries the producer is adding concurrently still have the old
+    // generation, and are dropped when they are read.
+    atomic_fetch_add(&ds->generation, 1);
+    if (ds->reader_head)
+        drop_entry(ds, ds->reader_head);
+    ds->reader_head = NULL;
+    struct queue_entry e;
+    while (mp_ring_buffered(ds->queue) >= sizeof(e)) {
+        mp_ring_read(ds->queue, (unsigned char *)&e, sizeof(e));
+        drop_entry(ds, e.pkt);
     }
-    ds->head = ds->tail = NULL;
-    ds->packs = 0;
-    ds->bytes = 0;
-    ds->last_ts = ds->base_ts = ds->last_br_ts = MP_NOPTS_VALUE;
+    for (int n = ds->overflow_pos; n < ds->overflow_num; n++)
+        drop_entry(ds, ds->overflow[n].pkt);
+    atomic_fetch_add(&ds->num_overflow, -(ds->overflow_num - ds->overflow_pos));
+    ds->overflow_pos = ds->overflow_num = 0;
+    ts_store(&ds->last_ts, MP_NOPTS_VALUE);
+    ts_store(&ds->base_ts, MP_NOPTS_VALUE);
+    ds->last_br_ts = MP_NOPTS_VALUE;
     ds->last_br_bytes = 0;
     ds->bitrate = -1;
     ds->eof = false;
     ds->active = false;
+    seek_cache_clear(ds);
+    consumer_leave(ds);
 }
 
 struct sh_stream *new_sh_stream(demuxer_t *demuxer, enum stream_type type)
@@ -208,8 +549,11 @@ struct sh_stream *new_sh_stream(demuxer_t *demuxer, enum stream_type type)
     *sh->ds = (struct demux_stream) {
         .in = demuxer->in,
         .type = sh->type,
-        .selected = demuxer->in->autoselect,
+        .selected = ATOMIC_VAR_INIT(demuxer->in->autoselect),
+        .queue = mp_ring_new(sh, QUEUE_SLOTS * sizeof(struct queue_entry)),
     };
+    ts_store(&sh->ds->base_ts, MP_NOPTS_VALUE);
+    ts_store(&sh->ds->last_ts, MP_NOPTS_VALUE);
     MP_TARRAY_APPEND(demuxer, demuxer->streams, demuxer->num_streams, sh);
     switch (sh->type) {
     case STREAM_VIDEO: sh->video = talloc_zero(demuxer, struct sh_video); break;
@@ -233,6 +577,7 @@ void free_demuxer(demuxer_t *demuxer)
         demuxer->desc->close(in->d_thread);
     for (int n = 0; n < demuxer->num_streams; n++)
         ds_flush(demuxer->streams[n]->ds);
+    demux_packet_pool_destroy(demuxer->packet_pool);
     pthread_mutex_destroy(&in->lock);
     pthread_cond_destroy(&in->wakeup);
     talloc_free(in->nav_event);
@@ -258,10 +603,10 @@ void demux_stop_thread(struct demuxer *demuxer)
     assert(demuxer == in->d_user);
 
     if (in->threading) {
-        pthread_mutex_lock(&in->lock);
+        lock_internal(in);
         in->thread_terminate = true;
         pthread_cond_signal(&in->wakeup);
-        pthread_mutex_unlock(&in->lock);
+        unlock_internal(in);
         pthread_join(in->thread, NULL);
         in->threading = false;
         in->thread_terminate = false;
@@ -269,13 +614,15 @@ void demux_stop_thread(struct demuxer *demuxer)
 }
 
 // The demuxer thread will call cb(ctx) if there's a new packet, or EOF is reached.
+// Must be called before demux_start_thread().
 void demux_set_wakeup_cb(struct demuxer *demuxer, void (*cb)(void *ctx), void *ctx)
 {
     struct demux_internal *in = demuxer->in;
-    pthread_mutex_lock(&in->lock);
+    assert(!in->threading);
+    lock_internal(in);
     in->wakeup_cb = cb;
     in->wakeup_cb_ctx = ctx;
-    pthread_mutex_unlock(&in->lock);
+    unlock_internal(in);
 }
 
 const char *stream_type_name(enum stream_type type)
@@ -289,38 +636,27 @@ const char *stream_type_name(enum stream_type type)
 }
 
 // Returns the same value as demuxer->fill_buffer: 1 ok, 0 EOF/not selected.
+// Called by the demuxer implementation (producer); doesn't take the lock.
 int demux_add_packet(struct sh_stream *stream, demux_packet_t *dp)
 {
     struct demux_stream *ds = stream ? stream->ds : NULL;
     if (!dp || !ds) {
-        talloc_free(dp);
+        free_demux_packet(dp);
         return 0;
     }
     struct demux_internal *in = ds->in;
-    pthread_mutex_lock(&in->lock);
-    if (!ds->selected || in->seeking) {
-        pthread_mutex_unlock(&in->lock);
-        talloc_free(dp);
+    atomic_fetch_add(&in->packets_read, 1);
+    // The generation must be read before the other flags: ds_flush() is
+    // called after they're set, and increments the generation.
+    int generation = atomic_load(&ds->generation);
+    if (!atomic_load(&ds->selected) || atomic_load(&in->seeking)) {
+        free_demux_packet(dp);
         return 0;
     }
 
     dp->stream = stream->index;
     dp->next = NULL;
-
-    ds->packs++;
-    ds->bytes += dp->len;
-    if (ds->tail) {
-        // next packet in stream
-        ds->tail->next = dp;
-        ds->tail = dp;
-    } else {
-        // first packet in stream
-        ds->head = ds->tail = dp;
-    }
-
-    // obviously not true anymore
-    ds->eof = false;
-    in->last_eof = in->eof = false;
+    dp->demux_time = mp_time_us();
 
     // For video, PTS determination is not trivial, but for other media types
     // distinguishing PTS and DTS is not useful.
@@ -328,19 +664,35 @@ int demux_add_packet(struct sh_stream *stream, demux_packet_t *dp)
         dp->pts = dp->dts;
 
     double ts = dp->dts == MP_NOPTS_VALUE ? dp->pts : dp->dts;
-    if (ts != MP_NOPTS_VALUE && (ts > ds->last_ts || ts + 10 < ds->last_ts))
-        ds->last_ts = ts;
-    if (ds->base_ts == MP_NOPTS_VALUE)
-        ds->base_ts = ds->last_ts;
-
-    MP_DBG(in, "append packet to %s: size=%d pts=%f dts=%f pos=%"PRIi64" "
-           "[num=%zd size=%zd]\n", stream_type_name(stream->type),
-           dp->len, dp->pts, dp->dts, dp->pos, ds->packs, ds->bytes);
-
-    if (ds->in->wakeup_cb && !ds->head->next)
-        ds->in->wakeup_cb(ds->in->wakeup_cb_ctx);
-    pthread_cond_signal(&in->wakeup);
-    pthread_mutex_unlock(&in->lock);
+    double last_ts = ts_load(&ds->last_ts);
+    if (ts != MP_NOPTS_VALUE && (ts > last_ts || ts + 10 < last_ts))
+        ts_store(&ds->last_ts, ts);
+    // Set base_ts only if the reader hasn't set it yet.
+    double nopts = MP_NOPTS_VALUE, new_ts = ts_load(&ds->last_ts);
+    unsigned long long nopts_bits, new_bits;
+    memcpy(&nopts_bits, &nopts, sizeof(nopts));
+    memcpy(&new_bits, &new_ts, sizeof(new_ts));
+    atomic_compare_exchange_strong(&ds->base_ts, &nopts_bits, new_bits);
+
+    if (stream->type == STREAM_VIDEO)
+        MP_TRACE_FLOW(in, START, "video frame", mp_trace_pts_id(dp->pts));
+
+    int len = dp->len;
+    struct queue_entry e = {dp, generation};
+    queue_push(ds, &e);
+
+    // Account after adding: if ds_has_packets() returns true, the packet can
+    // be read. (The reader might briefly make the counters negative.)
+    atomic_fetch_add(&ds->bytes, len);
+    bool was_empty = atomic_fetch_add(&ds->packs, 1) <= 0;
+
+    MP_DBG(in, "append packet to %s: size=%d [num=%lld size=%lld]\n",
+           stream_type_name(stream->type), len,
+           (long long)atomic_load(&ds->packs), (long long)atomic_load(&ds->bytes));
+
+    if (in->wakeup_cb && was_empty)
+        in->wakeup_cb(in->wakeup_cb_ctx);
+    wakeup_waiter(in, &in->reader_waiting);
     return 1;
 }
 
@@ -354,17 +706,18 @@ static bool read_packet(struct demux_internal *in)
     // the minimum, or if a stream explicitly needs new packets. Also includes
     // safe-guards against packet queue overflow.
     bool active = false, read_more = false;
-    size_t packs = 0, bytes = 0;
+    long long packs = 0, bytes = 0;
     for (int n = 0; n < in->d_buffer->num_streams; n++) {
         struct demux_stream *ds = in->d_buffer->streams[n]->ds;
         active |= ds->active;
-        read_more |= ds->active && !ds->head;
-        packs += ds->packs;
-        bytes += ds->bytes;
-        if (ds->active && ds->last_ts != MP_NOPTS_VALUE && in->min_secs > 0)
-            read_more |= ds->last_ts - ds->base_ts < in->min_secs;
+        read_more |= ds->active && !ds_has_packets(ds);
+        packs += atomic_load(&ds->packs);
+        bytes += atomic_load(&ds->bytes);
+        double last_ts = ts_load(&ds->last_ts);
+        if (ds->active && last_ts != MP_NOPTS_VALUE && in->min_secs > 0)
+            read_more |= last_ts - ts_load(&ds->base_ts) < in->min_secs;
     }
-    MP_DBG(in, "packets=%zd, bytes=%zd, active=%d, more=%d\n",
+    MP_DBG(in, "packets=%lld, bytes=%lld, active=%d, more=%d\n",
            packs, bytes, active, read_more);
     if (packs >= MAX_PACKS || bytes >= MAX_PACK_BYTES) {
         if (!in->warned_queue_overflow) {
@@ -372,19 +725,23 @@ static bool read_packet(struct demux_internal *in)
             MP_ERR(in, "Too many packets in the demuxer packet queues:\n");
             for (int n = 0; n < in->d_buffer->num_streams; n++) {
                 struct demux_stream *ds = in->d_buffer->streams[n]->ds;
-                if (ds->selected) {
-                    MP_ERR(in, "  %s/%d: %zd packets, %zd bytes\n",
-                           stream_type_name(ds->type), n, ds->packs, ds->bytes);
+                if (atomic_load(&ds->selected)) {
+                    MP_ERR(in, "  %s/%d: %lld packets, %lld bytes\n",
+                           stream_type_name(ds->type), n,
+                           (long long)atomic_load(&ds->packs),
+                           (long long)atomic_load(&ds->bytes));
                 }
             }
         }
         for (int n = 0; n < in->d_buffer->num_streams; n++) {
             struct demux_stream *ds = in->d_buffer->streams[n]->ds;
-            ds->eof |= !ds->head;
+            ds->eof |= !ds_has_packets(ds);
         }
-        pthread_cond_signal(&in->wakeup);
+        atomic_store(&in->queues_full, true);
+        pthread_cond_broadcast(&in->wakeup);
         return false;
     }
+    atomic_store(&in->queues_full, false);
     if (packs < in->min_packs && bytes < in->min_bytes)
         read_more |= active;
 
@@ -394,11 +751,23 @@ static bool read_packet(struct demux_internal *in)
     // Actually read a packet. Drop the lock while doing so, because waiting
     // for disk or network I/O can take time.
     in->idle = false;
-    pthread_mutex_unlock(&in->lock);
+    atomic_store(&in->thread_waiting, false);
+    unlock_internal(in);
     struct demuxer *demux = in->d_thread;
+    MP_TRACE_BEGIN(in, "demux read");
+    int64_t cpu_start = in->measure_cpu ? mp_thread_cpu_time_us() : 0;
     bool eof = !demux->desc->fill_buffer || demux->desc->fill_buffer(demux) <= 0;
+    if (in->measure_cpu)
+        atomic_fetch_add(&in->cpu_time, mp_thread_cpu_time_us() - cpu_start);
+    MP_TRACE_END(in, "demux read");
     update_cache(in);
-    pthread_mutex_lock(&in->lock);
+    lock_internal(in);
+
+    for (int n = 0; n < in->d_buffer->num_streams; n++) {
+        struct demux_stream *ds = in->d_buffer->streams[n]->ds;
+        if (ds_has_packets(ds))
+            ds->eof = false;
+    }
 
     if (eof) {
         for (int n = 0; n < in->d_buffer->num_streams; n++) {
@@ -410,7 +779,7 @@ static bool read_packet(struct demux_internal *in)
         if (!in->last_eof) {
             if (in->wakeup_cb)
                 in->wakeup_cb(in->wakeup_cb_ctx);
-            pthread_cond_signal(&in->wakeup);
+            pthread_cond_broadcast(&in->wakeup);
             MP_VERBOSE(in, "EOF reached.\n");
         }
     }
@@ -426,54 +795,58 @@ static void ds_get_packets(struct demux_stream *ds)
     MP_DBG(in, "reading packet for %s\n", t);
     in->eof = false; // force retry
     ds->eof = false;
-    while (ds->selected && !ds->head && !ds->eof) {
+    atomic_store(&in->reader_waiting, in->threading);
+    while (atomic_load(&ds->selected) && !ds_has_packets(ds) && !ds->eof) {
         ds->active = true;
         // Note: the following code marks EOF if it can't continue
         if (in->threading) {
             MP_VERBOSE(in, "waiting for demux thread (%s)\n", t);
-            pthread_cond_signal(&in->wakeup);
+            pthread_cond_broadcast(&in->wakeup);
             pthread_cond_wait(&in->wakeup, &in->lock);
         } else {
             read_packet(in);
         }
     }
+    atomic_store(&in->reader_waiting, false);
 }
 
 static void execute_trackswitch(struct demux_internal *in)
 {
     in->tracks_switched = false;
 
-    pthread_mutex_unlock(&in->lock);
+    unlock_internal(in);
 
     if (in->d_thread->desc->control)
         in->d_thread->desc->control(in->d_thread, DEMUXER_CTRL_SWITCHED_TRACKS, 0);
 
-    pthread_mutex_lock(&in->lock);
+    lock_internal(in);
 }
 
 static void execute_seek(struct demux_internal *in)
 {
     int flags = in->seek_flags;
     double pts = in->seek_pts;
-    in->seeking = false;
 
-    pthread_mutex_unlock(&in->lock);
+    unlock_internal(in);
 
     if (in->d_thread->desc->seek)
         in->d_thread->desc->seek(in->d_thread, pts, flags);
 
-    pthread_mutex_lock(&in->lock);
+    lock_internal(in);
+
+    // Clear this only now: packets added during seeking are dropped.
+    atomic_store(&in->seeking, false);
 }
 
 static void *demux_thread(void *pctx)
 {
     struct demux_internal *in = pctx;
     mpthread_set_name("demux");
-    pthread_mutex_lock(&in->lock);
+    lock_internal(in);
     while (!in->thread_terminate) {
         in->thread_paused = in->thread_request_pause > 0;
         if (in->thread_paused) {
-            pthread_cond_signal(&in->wakeup);
+            pthread_cond_broadcast(&in->wakeup);
             pthread_cond_wait(&in->wakeup, &in->lock);
             continue;
         }
@@ -481,43 +854,63 @@ static void *demux_thread(void *pctx)
             execute_trackswitch(in);
             continue;
         }
-        if (in->seeking) {
+        if (atomic_load(&in->seeking)) {
             execute_seek(in);
             continue;
         }
+        // Must be set before read_packet() checks the queue state, so that
+        // the reader wakes us up when it takes packets from the queue.
+        atomic_store(&in->thread_waiting, true);
         if (!in->eof) {
             if (read_packet(in))
                 continue; // read_packet unlocked, so recheck conditions
         }
         if (in->force_cache_update) {
-            pthread_mutex_unlock(&in->lock);
+            unlock_internal(in);
             update_cache(in);
-            pthread_mutex_lock(&in->lock);
+            lock_internal(in);
             in->force_cache_update = false;
             continue;
         }
-        pthread_cond_signal(&in->wakeup);
+        pthread_cond_broadcast(&in->wakeup);
         pthread_cond_wait(&in->wakeup, &in->lock);
     }
-    pthread_mutex_unlock(&in->lock);
+    unlock_internal(in);
     return NULL;
 }
 
-static struct demux_packet *dequeue_packet(struct demux_stream *ds)
+// Consumer side; doesn't need the lock.
+static struct demux_packet *do_dequeue_packet(struct demux_stream *ds)
 {
-    if (!ds->head)
+    // After a cached seek, replay packets the decoder has seen before. This
+    // doesn't change the readahead state; the queue is not touched.
+    if (ds->in->seek_cache_max > 0) {
+        struct demux_packet *replay = NULL;
+        bool replaying = false;
+        lock_internal(ds->in);
+        if (ds->cache_pos < ds->cache_num) {
+            struct demux_packet *cached = ds->cache[ds->cache_pos++];
+            atomic_fetch_add(&ds->replay_packs, -1);
+            replay = demux_copy_packet_pooled(ds->in->d_user->packet_pool,
+                                              cached);
+            replaying = true;
+        }
+        unlock_internal(ds->in);
+        if (replaying)
+            return replay;
+    }
+
+    struct demux_packet *pkt = ds_peek(ds);
+    if (!pkt)
         return NULL;
-    struct demux_packet *pkt = ds->head;
-    ds->head = pkt->next;
+    ds->reader_head = NULL;
     pkt->next = NULL;
-    if (!ds->head)
-        ds->tail = NULL;
-    ds->bytes -= pkt->len;
-    ds->packs--;
+    atomic_fetch_add(&ds->bytes, -pkt->len);
+    atomic_fetch_add(&ds->packs, -1);
 
     double ts = pkt->dts == MP_NOPTS_VALUE ? pkt->pts : pkt->dts;
     if (ts != MP_NOPTS_VALUE)
-        ds->base_ts = ts;
+        ts_store(&ds->base_ts, ts);
 
     if (pkt->keyframe) {
         // Update bitrate - only at keyframe points, because we use the
@@ -539,22 +932,49 @@ static struct demux_packet *dequeue_packet(struct demux_stream *ds)
     if (pkt->pos >= ds->in->d_user->filepos)
         ds->in->d_user->filepos = pkt->pos;
 
+    // The demuxer thread might be waiting until the queues need refilling.
+    // Wake it up only if this could have changed its decision (see
+    // read_packet()), so that the lock is not taken for every packet.
+    struct demux_internal *in = ds->in;
+    double last_ts = ts_load(&ds->last_ts);
+    if (!ds_has_packets(ds) || atomic_load(&in->queues_full) ||
+        atomic_load(&ds->packs) < in->min_packs ||
+        atomic_load(&ds->bytes) < in->min_bytes ||
+        (last_ts != MP_NOPTS_VALUE && ts != MP_NOPTS_VALUE &&
+         last_ts - ts < in->min_secs))
+        wakeup_waiter(in, &in->thread_waiting);
+
+    if (in->seek_cache_max > 0)
+        seek_cache_add(ds, pkt);
+
+    return pkt;
+}
+
+static struct demux_packet *dequeue_packet(struct demux_stream *ds)
+{
+    consumer_enter(ds);
+    struct demux_packet *pkt = do_dequeue_packet(ds);
+    consumer_leave(ds);
     return pkt;
 }
 
 // Read a packet from the given stream. The returned packet belongs to the
-// caller, who has to free it with talloc_free(). Might block. Returns NULL
-// on EOF.
+// caller, who has to free it with free_demux_packet(). Might block. Returns
+// NULL on EOF.
 struct demux_packet *demux_read_packet(struct sh_stream *sh)
 {
     struct demux_stream *ds = sh ? sh->ds : NULL;
     struct demux_packet *pkt = NULL;
-    if (ds) {
-        pthread_mutex_lock(&ds->in->lock);
-        ds_get_packets(ds);
+    while (ds) {
         pkt = dequeue_packet(ds);
-        pthread_cond_signal(&ds->in->wakeup); // possibly read more
-        pthread_mutex_unlock(&ds->in->lock);
+        if (pkt)
+            break;
+        lock_internal(ds->in);
+        ds_get_packets(ds);
+        unlock_internal(ds->in);
+        // Retry if there are packets, which might have been stale entries.
+        if (!ds_has_packets(ds))
+            break;
     }
     return pkt;
 }
@@ -575,13 +995,20 @@ int demux_read_packet_async(struct sh_stream *sh, struct demux_packet **out_pkt)
     *out_pkt = NULL;
     if (ds) {
         if (ds->in->threading) {
-            pthread_mutex_lock(&ds->in->lock);
+            // Fast path: no locking if a packet is available. Readahead was
+            // enabled when the queue ran empty the last time (or at a flush).
             *out_pkt = dequeue_packet(ds);
-            r = *out_pkt ? 1 : (ds->eof ? -1 : 0);
-            ds->active = ds->selected; // enable readahead
+            if (*out_pkt)
+                return 1;
+            lock_internal(ds->in);
+            bool eof = ds->eof;
+            ds->active = atomic_load(&ds->selected); // enable readahead
             ds->in->eof = false; // force retry
-            pthread_cond_signal(&ds->in->wakeup); // possibly read more
-            pthread_mutex_unlock(&ds->in->lock);
+            pthread_cond_broadcast(&ds->in->wakeup); // possibly read more
+            unlock_internal(ds->in);
+            // A packet might have been added meanwhile.
+            *out_pkt = dequeue_packet(ds);
+            r = *out_pkt ? 1 : (eof ? -1 : 0);
         } else {
             *out_pkt = demux_read_packet(sh);
             r = *out_pkt ? 1 : -1;
@@ -590,32 +1017,43 @@ int demux_read_packet_async(struct sh_stream *sh, struct demux_packet **out_pkt)
     return r;
 }
 
+// Return the timestamp of the packet last returned to the reader (or of the
+// first queued packet, if none was returned yet). Unlike demux_get_next_pts(),
+// this is safe to call while another thread reads from the stream.
+double demux_get_reader_pts(struct sh_stream *sh)
+{
+    return sh ? ts_load(&sh->ds->base_ts) : MP_NOPTS_VALUE;
+}
+
 // Return the pts of the next packet that demux_read_packet() would return.
 // Might block. Sometimes used to force a packet read, without removing any
 // packets from the queue.
 double demux_get_next_pts(struct sh_stream *sh)
 {
     double res = MP_NOPTS_VALUE;
-    if (sh) {
-        pthread_mutex_lock(&sh->ds->in->lock);
+    while (sh) {
+        consumer_enter(sh->ds);
+        struct demux_packet *pkt = ds_peek(sh->ds);
+        if (pkt)
+            res = pkt->pts;
+        consumer_leave(sh->ds);
+        if (pkt)
+            break;
+        lock_internal(sh->ds->in);
         ds_get_packets(sh->ds);
-        if (sh->ds->head)
-            res = sh->ds->head->pts;
-        pthread_mutex_unlock(&sh->ds->in->lock);
+        unlock_internal(sh->ds->in);
+        if (!ds_has_packets(sh->ds))
+            break;
     }
     return res;
 }
 
 // Return whether a packet is queued. Never blocks, never forces any reads.
+// Can be called from any thread.
 bool demux_has_packet(struct sh_stream *sh)
 {
-    bool has_packet = false;
-    if (sh) {
-        pthread_mutex_lock(&sh->ds->in->lock);
-        has_packet = sh->ds->head;
-        pthread_mutex_unlock(&sh->ds->in->lock);
-    }
-    return has_packet;
+    return sh && (ds_has_packets(sh->ds) ||
+                  atomic_load(&sh->ds->replay_packs) > 0);
 }
 
 // Read and return any packet we find.
@@ -626,16 +1064,16 @@ struct demux_packet *demux_read_any_packet(struct demuxer *demuxer)
     while (read_more) {
         for (int n = 0; n < demuxer->num_streams; n++) {
             struct sh_stream *sh = demuxer->streams[n];
-            sh->ds->active = sh->ds->selected; // force read_packet() to read
+            sh->ds->active = atomic_load(&sh->ds->selected); // force read_packet() to read
             struct demux_packet *pkt = dequeue_packet(sh->ds);
             if (pkt)
                 return pkt;
         }
         // retry after calling this
-        pthread_mutex_lock(&demuxer->in->lock);
+        lock_internal(demuxer->in);
         read_more = read_packet(demuxer->in);
         read_more &= !demuxer->in->eof;
-        pthread_mutex_unlock(&demuxer->in->lock);
+        unlock_internal(demuxer->in);
     }
     return NULL;
 }
@@ -789,7 +1227,7 @@ void demux_changed(demuxer_t *demuxer, int events)
 
     update_cache(in);
 
-    pthread_mutex_lock(&in->lock);
+    lock_internal(in);
 
     if (demuxer->events & DEMUX_EVENT_INIT)
         demuxer_sort_chapters(demuxer);
@@ -800,7 +1238,7 @@ void demux_changed(demuxer_t *demuxer, int events)
 
     if (in->wakeup_cb)
         in->wakeup_cb(in->wakeup_cb_ctx);
-    pthread_mutex_unlock(&in->lock);
+    unlock_internal(in);
 }
 
 // Called by the user thread (i.e. player) to update metadata and other things
@@ -813,11 +1251,11 @@ void demux_update(demuxer_t *demuxer)
     if (!in->threading)
         update_cache(in);
 
-    pthread_mutex_lock(&in->lock);
+    lock_internal(in);
     demux_copy(demuxer, in->d_buffer);
     if (in->stream_metadata && (demuxer->events & DEMUX_EVENT_METADATA))
         mp_tags_merge(demuxer->metadata, in->stream_metadata);
-    pthread_mutex_unlock(&in->lock);
+    unlock_internal(in);
 }
 
 static void demux_init_cache(struct demuxer *demuxer)
@@ -850,6 +1288,7 @@ static struct demuxer *open_given_type(struct mpv_global *global,
         .glog = log,
         .filename = talloc_strdup(demuxer, stream->url),
         .events = DEMUX_EVENT_ALL,
+        .packet_pool = demux_packet_pool_create(),
     };
     demuxer->seekable = stream->seekable;
     if (demuxer->stream->uncached_stream &&
@@ -865,6 +1304,8 @@ static struct demuxer *open_given_type(struct mpv_global *global,
         .min_secs = demuxer->opts->demuxer_min_secs,
         .min_packs = demuxer->opts->demuxer_min_packs,
         .min_bytes = demuxer->opts->demuxer_min_bytes,
+        .seek_cache_max = demuxer->opts->demuxer_seek_cache_bytes,
+        .measure_cpu = demuxer->opts->benchmark,
     };
     pthread_mutex_init(&in->lock, NULL);
     pthread_cond_init(&in->wakeup, NULL);
@@ -983,9 +1424,9 @@ static void flush_locked(demuxer_t *demuxer)
 // clear the packet queues
 void demux_flush(demuxer_t *demuxer)
 {
-    pthread_mutex_lock(&demuxer->in->lock);
+    lock_internal(demuxer->in);
     flush_locked(demuxer);
-    pthread_mutex_unlock(&demuxer->in->lock);
+    unlock_internal(demuxer->in);
 }
 
 int demux_seek(demuxer_t *demuxer, double rel_seek_secs, int flags)
@@ -1014,10 +1455,20 @@ int demux_seek(demuxer_t *demuxer, double rel_seek_secs, int flags)
         }
     }
 
-    pthread_mutex_lock(&in->lock);
+    lock_internal(in);
 
+    if (seek_cache_seek(in, rel_seek_secs, flags)) {
+        unlock_internal(in);
+        MP_VERBOSE(in, "Seek to %f served from the seek cache.\n", rel_seek_secs);
+        return 1;
+    }
+    if (in->seek_cache_max)
+        in->seek_cache_misses++;
+
+    // Set before flushing, so that the demuxer thread can't add packets
+    // with the new queue generation before the seek is executed.
+    atomic_store(&in->seeking, true);
     flush_locked(demuxer);
-    in->seeking = true;
     in->seek_flags = flags;
     in->seek_pts = rel_seek_secs;
 
@@ -1025,11 +1476,57 @@ int demux_seek(demuxer_t *demuxer, double rel_seek_secs, int flags)
         execute_seek(in);
 
     pthread_cond_signal(&in->wakeup);
-    pthread_mutex_unlock(&in->lock);
+    unlock_internal(in);
 
     return 1;
 }
 
+// Must be called from the user thread.
+void demux_get_seek_cache_state(struct demuxer *demuxer,
+                                struct demux_seek_cache_state *s)
+{
+    struct demux_internal *in = demuxer->in;
+    assert(demuxer == in->d_user);
+
+    lock_internal(in);
+    *s = (struct demux_seek_cache_state){
+        .bytes = in->seek_cache_bytes,
+        .max_bytes = in->seek_cache_max,
+        .hits = in->seek_cache_hits,
+        .misses = in->seek_cache_misses,
+        .start = MP_NOPTS_VALUE,
+        .end = MP_NOPTS_VALUE,
+    };
+    // Intersection of the ranges of all selected audio/video streams.
+    for (int n = 0; n < demuxer->num_streams; n++) {
+        struct demux_stream *ds = demuxer->streams[n]->ds;
+        if (!atomic_load(&ds->selected) || ds->type == STREAM_SUB)
+            continue;
+        double start = MP_NOPTS_VALUE, end = MP_NOPTS_VALUE;
+        for (int i = ds->cache_start; i < ds->cache_num; i++) {
+            struct demux_packet *dp = ds->cache[i];
+            if (packet_ts(dp) != MP_NOPTS_VALUE &&
+                (ds->type != STREAM_VIDEO || dp->keyframe))
+            {
+                start = packet_ts(dp);
+                break;
+            }
+        }
+        if (ds->cache_num > ds->cache_start)
+            end = packet_ts(ds->cache[ds->cache_num - 1]);
+        if (start == MP_NOPTS_VALUE || end == MP_NOPTS_VALUE) {
+            s->start = s->end = MP_NOPTS_VALUE;
+            break;
+        }
+        s->start = MP_PTS_MAX(s->start, start);
+        s->end = MP_PTS_MIN(s->end, end);
+    }
+    if (s->start == MP_NOPTS_VALUE || s->end == MP_NOPTS_VALUE ||
+        s->start > s->end)
+        s->start = s->end = MP_NOPTS_VALUE;
+    unlock_internal(in);
+}
+
 struct sh_stream *demuxer_stream_by_demuxer_id(struct demuxer *d,
                                                enum stream_type t, int id)
 {
@@ -1057,15 +1554,15 @@ void demuxer_select_track(struct demuxer *demuxer, struct sh_stream *stream,
                           bool selected)
 {
     // don't flush buffers if stream is already selected / unselected
-    pthread_mutex_lock(&demuxer->in->lock);
+    lock_internal(demuxer->in);
     bool update = false;
-    if (stream->ds->selected != selected) {
-        stream->ds->selected = selected;
+    if (atomic_load(&stream->ds->selected) != selected) {
+        atomic_store(&stream->ds->selected, selected);
         stream->ds->active = false;
         ds_flush(stream->ds);
         update = true;
     }
-    pthread_mutex_unlock(&demuxer->in->lock);
+    unlock_internal(demuxer->in);
     if (update)
         demux_control(demuxer, DEMUXER_CTRL_SWITCHED_TRACKS, NULL);
 }
@@ -1080,11 +1577,7 @@ bool demux_stream_is_selected(struct sh_stream *stream)
 {
     if (!stream)
         return false;
-    bool r = false;
-    pthread_mutex_lock(&stream->ds->in->lock);
-    r = stream->ds->selected;
-    pthread_mutex_unlock(&stream->ds->in->lock);
-    return r;
+    return atomic_load(&stream->ds->selected);
 }
 
 int demuxer_add_attachment(demuxer_t *demuxer, struct bstr name,
@@ -1160,11 +1653,12 @@ static void update_cache(struct demux_internal *in)
     int64_t stream_cache_size = -1;
     int64_t stream_cache_fill = -1;
     int stream_cache_idle = -1;
+    struct stream_cache_ranges stream_cache_ranges = {0};
     struct mp_nav_event *nav_event = NULL;
 
-    pthread_mutex_lock(&in->lock);
+    lock_internal(in);
     bool need_nav_event = !in->nav_event;;
-    pthread_mutex_unlock(&in->lock);
+    unlock_internal(in);
 
     if (demuxer->desc->control) {
         demuxer->desc->control(demuxer, DEMUXER_CTRL_GET_TIME_LENGTH,
@@ -1178,20 +1672,26 @@ static void update_cache(struct demux_internal *in)
     stream_control(stream, STREAM_CTRL_GET_CACHE_SIZE, &stream_cache_size);
     stream_control(stream, STREAM_CTRL_GET_CACHE_FILL, &stream_cache_fill);
     stream_control(stream, STREAM_CTRL_GET_CACHE_IDLE, &stream_cache_idle);
+    bool have_cache_ranges = stream_control(stream, STREAM_CTRL_GET_CACHE_RANGES,
+                                            &stream_cache_ranges) == STREAM_OK;
 
-    pthread_mutex_lock(&in->lock);
+    lock_internal(in);
     in->time_length = time_length;
     in->stream_size = stream_size;
     in->stream_cache_size = stream_cache_size;
     in->stream_cache_fill = stream_cache_fill;
     in->stream_cache_idle = stream_cache_idle;
+    talloc_free(in->stream_cache_ranges.ranges);
+    in->stream_cache_ranges = stream_cache_ranges;
+    talloc_steal(in, in->stream_cache_ranges.ranges);
+    in->have_cache_ranges = have_cache_ranges;
     if (stream_metadata) {
         talloc_free(in->stream_metadata);
         in->stream_metadata = talloc_steal(in, stream_metadata);
         in->d_buffer->events |= DEMUX_EVENT_METADATA;
     }
     in->nav_event = nav_event ? nav_event : in->nav_event;
-    pthread_mutex_unlock(&in->lock);
+    unlock_internal(in);
 }
 
 // must be called locked
@@ -1219,6 +1719,15 @@ static int cached_stream_control(struct demux_internal *in, int cmd, void *arg)
             return STREAM_UNSUPPORTED;
         *(int *)arg = in->stream_cache_idle;
         return STREAM_OK;
+    case STREAM_CTRL_GET_CACHE_RANGES: {
+        if (!in->have_cache_ranges)
+            return STREAM_UNSUPPORTED;
+        struct stream_cache_ranges *r = arg;
+        *r = in->stream_cache_ranges;
+        r->ranges = r->num_ranges ? talloc_memdup(NULL, r->ranges,
+                                    r->num_ranges * sizeof(r->ranges[0])) : NULL;
+        return STREAM_OK;
+    }
     case STREAM_CTRL_GET_SIZE:
         if (in->stream_size < 0)
             return STREAM_UNSUPPORTED;
@@ -1275,19 +1784,21 @@ static int cached_demux_control(struct demux_internal *in, int cmd, void *arg)
         for (int n = 0; n < in->d_user->num_streams; n++) {
             struct demux_stream *ds = in->d_user->streams[n]->ds;
             if (ds->active) {
-                r->underrun |= !ds->head && !ds->eof;
+                r->underrun |= !ds_has_packets(ds) && !ds->eof;
                 if (!ds->eof) {
-                    r->ts_range[0] = MP_PTS_MAX(r->ts_range[0], ds->base_ts);
-                    r->ts_range[1] = MP_PTS_MIN(r->ts_range[1], ds->last_ts);
+                    r->ts_range[0] = MP_PTS_MAX(r->ts_range[0],
+                                                ts_load(&ds->base_ts));
+                    r->ts_range[1] = MP_PTS_MIN(r->ts_range[1],
+                                                ts_load(&ds->last_ts));
                 }
-                num_packets += ds->packs;
+                num_packets += MPMAX(atomic_load(&ds->packs), 0);
             }
         }
         r->idle = (in->idle && !r->underrun) || r->eof;
         r->underrun &= !r->idle;
         if (r->ts_range[0] != MP_NOPTS_VALUE && r->ts_range[1] != MP_NOPTS_VALUE)
             r->ts_duration = MPMAX(0, r->ts_range[1] - r->ts_range[0]);
-        if (!num_packets || in->seeking)
+        if (!num_packets || atomic_load(&in->seeking))
             r->ts_duration = 0;
         return DEMUXER_CTRL_OK;
     }
@@ -1297,7 +1808,9 @@ static int cached_demux_control(struct demux_internal *in, int cmd, void *arg)
         *(struct mp_nav_event **)arg = in->nav_event;
         in->nav_event = NULL;
         return DEMUXER_CTRL_OK;
-
+    case DEMUXER_CTRL_GET_LOCK_CONTENTION:
+        *(int64_t *)arg = atomic_load(&in->lock_contended);
+        return DEMUXER_CTRL_OK;
     }
     return DEMUXER_CTRL_DONTKNOW;
 }
@@ -1306,10 +1819,20 @@ int demux_control(demuxer_t *demuxer, int cmd, void *arg)
 {
     struct demux_internal *in = demuxer->in;
 
+    // Statistics kept by demux.c, also without demuxer thread.
+    switch (cmd) {
+    case DEMUXER_CTRL_GET_CPU_TIME:
+        *(int64_t *)arg = atomic_load(&in->cpu_time);
+        return DEMUXER_CTRL_OK;
+    case DEMUXER_CTRL_GET_PACKETS_READ:
+        *(int64_t *)arg = atomic_load(&in->packets_read);
+        return DEMUXER_CTRL_OK;
+    }
+
     if (in->threading) {
-        pthread_mutex_lock(&in->lock);
+        lock_internal(in);
         int cr = cached_demux_control(in, cmd, arg);
-        pthread_mutex_unlock(&in->lock);
+        unlock_internal(in);
         if (cr != DEMUXER_CTRL_DONTKNOW)
             return cr;
     }
@@ -1354,12 +1877,12 @@ void demux_pause(demuxer_t *demuxer)
 
     MP_VERBOSE(in, "pause demux thread\n");
 
-    pthread_mutex_lock(&in->lock);
+    lock_internal(in);
     in->thread_request_pause++;
     pthread_cond_signal(&in->wakeup);
     while (!in->thread_paused)
         pthread_cond_wait(&in->wakeup, &in->lock);
-    pthread_mutex_unlock(&in->lock);
+    unlock_internal(in);
 }
 
 void demux_unpause(demuxer_t *demuxer)
@@ -1370,11 +1893,11 @@ void demux_unpause(demuxer_t *demuxer)
     if (!in->threading)
         return;
 
-    pthread_mutex_lock(&in->lock);
+    lock_internal(in);
     assert(in->thread_request_pause > 0);
     in->thread_request_pause--;
     pthread_cond_signal(&in->wakeup);
-    pthread_mutex_unlock(&in->lock);
+    unlock_internal(in);
 }
 
 struct demux_chapter *demux_copy_chapter_data(struct demux_chapter *c, int num)
@@ -57,6 +57,9 @@ enum demux_ctrl {
     DEMUXER_CTRL_GET_READER_STATE,
     DEMUXER_CTRL_GET_NAV_EVENT,
     DEMUXER_CTRL_GET_BITRATE_STATS, // double[STREAM_TYPE_COUNT]
+    DEMUXER_CTRL_GET_LOCK_CONTENTION, // int64_t*
+    DEMUXER_CTRL_GET_CPU_TIME,      // int64_t* (microseconds)
+    DEMUXER_CTRL_GET_PACKETS_READ,  // int64_t*
 };
 
 struct demux_ctrl_reader_state {
@@ -222,6 +225,10 @@ typedef struct demuxer {
 
     struct demux_internal *in; // internal to demux.c
 
+    // Demuxer implementations should allocate packets from this pool
+    // (new_pooled_demux_packet*()). Thread-safe.
+    struct demux_packet_pool *packet_pool;
+
     // Since the demuxer can run in its own thread, and the stream is not
     // thread-safe, only the demuxer is allowed to access the stream directly.
     // You can freely use demux_stream_control() to send STREAM_CTRLs, or use
@@ -242,6 +249,7 @@ struct demux_packet *demux_read_packet(struct sh_stream *sh);
 int demux_read_packet_async(struct sh_stream *sh, struct demux_packet **out_pkt);
 bool demux_stream_is_selected(struct sh_stream *stream);
 double demux_get_next_pts(struct sh_stream *sh);
+double demux_get_reader_pts(struct sh_stream *sh);
 bool demux_has_packet(struct sh_stream *sh);
 struct demux_packet *demux_read_any_packet(struct demuxer *demuxer);
 
@@ -258,6 +266,15 @@ void demux_set_wakeup_cb(struct demuxer *demuxer, void (*cb)(void *ctx), void *c
 void demux_flush(struct demuxer *demuxer);
 int demux_seek(struct demuxer *demuxer, double rel_seek_secs, int flags);
 
+struct demux_seek_cache_state {
+    int64_t bytes, max_bytes;
+    int64_t hits, misses;
+    double start, end;      // time range seekable from cache (or NOPTS)
+};
+
+void demux_get_seek_cache_state(struct demuxer *demuxer,
+                                struct demux_seek_cache_state *s);
+
 int demux_control(struct demuxer *demuxer, int cmd, void *arg);
 
 void demuxer_switch_track(struct demuxer *demuxer, enum stream_type type,
@@ -217,13 +217,13 @@ static int d_fill_buffer(demuxer_t *demuxer)
 
     add_streams(demuxer);
     if (pkt->stream >= p->num_streams) { // out of memory?
-        talloc_free(pkt);
+        free_demux_packet(pkt);
         return 0;
     }
 
     struct sh_stream *sh = p->streams[pkt->stream];
     if (!demux_stream_is_selected(sh)) {
-        talloc_free(pkt);
+        free_demux_packet(pkt);
         return 1;
     }
 
@@ -831,7 +831,8 @@ static int demux_lavf_fill_buffer(demuxer_t *demux)
         return 1; // don't signal EOF if skipping a packet
     }
 
-    struct demux_packet *dp = new_demux_packet_from_avpacket(pkt);
+    struct demux_packet *dp =
+        new_pooled_demux_packet_from_avpacket(demux->packet_pool, pkt);
     if (!dp) {
         av_free_packet(pkt);
         return 1;
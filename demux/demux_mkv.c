@@ -50,6 +50,7 @@
 #include "demux.h"
 #include "stheader.h"
 #include "ebml.h"
+#include "index_cache.h"
 #include "matroska.h"
 #include "codec_tags.h"
 #include "video/img_fourcc.h"
@@ -154,6 +155,16 @@ typedef struct mkv_index {
     uint64_t filepos; // position of the cluster which contains the packet
 } mkv_index_t;
 
+// The index entries of a single track, sorted for binary search. These are
+// copies of the entries in mkv_demuxer.indexes. Entries added in order are
+// appended; otherwise the lists are rebuilt on the next lookup.
+struct mkv_index_list {
+    int tnum;
+    mkv_index_t *by_time;       // sorted by timecode, then filepos
+    mkv_index_t *by_pos;        // sorted by filepos
+    size_t num;
+};
+
 typedef struct mkv_demuxer {
     int64_t segment_start, segment_end;
 
@@ -173,6 +184,10 @@ typedef struct mkv_demuxer {
     mkv_index_t *indexes;
     size_t num_indexes;
     bool index_complete;
+    struct mkv_index_list *index_lists;
+    int num_index_lists;
+    bool index_lists_valid;
+    size_t num_cached_indexes;  // number of entries loaded from the cache
     uint64_t deferred_cues;
 
     struct header_elem {
@@ -665,6 +680,91 @@ static int demux_mkv_read_tracks(demuxer_t *demuxer)
     return 0;
 }
 
+static int index_time_compare(const void *p1, const void *p2)
+{
+    const mkv_index_t *i1 = p1, *i2 = p2;
+    if (i1->timecode != i2->timecode)
+        return i1->timecode > i2->timecode ? 1 : -1;
+    if (i1->filepos != i2->filepos)
+        return i1->filepos > i2->filepos ? 1 : -1;
+    return 0;
+}
+
+static int index_pos_compare(const void *p1, const void *p2)
+{
+    const mkv_index_t *i1 = p1, *i2 = p2;
+    if (i1->filepos != i2->filepos)
+        return i1->filepos > i2->filepos ? 1 : -1;
+    if (i1->timecode != i2->timecode)
+        return i1->timecode > i2->timecode ? 1 : -1;
+    return 0;
+}
+
+// Split the index into sorted per-track lists, if it changed.
+static void update_index_lists(struct demuxer *demuxer)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    if (mkv_d->index_lists_valid)
+        return;
+
+    talloc_free(mkv_d->index_lists);
+    mkv_d->index_lists = NULL;
+    mkv_d->num_index_lists = 0;
+
+    for (size_t i = 0; i < mkv_d->num_indexes; i++) {
+        mkv_index_t *entry = &mkv_d->indexes[i];
+        struct mkv_index_list *list = NULL;
+        for (int n = 0; n < mkv_d->num_index_lists; n++) {
+            if (mkv_d->index_lists[n].tnum == entry->tnum) {
+                list = &mkv_d->index_lists[n];
+                break;
+            }
+        }
+        if (!list) {
+            MP_TARRAY_APPEND(mkv_d, mkv_d->index_lists, mkv_d->num_index_lists,
+                             (struct mkv_index_list){ .tnum = entry->tnum });
+            list = &mkv_d->index_lists[mkv_d->num_index_lists - 1];
+        }
+        MP_TARRAY_APPEND(mkv_d->index_lists, list->by_time, list->num, *entry);
+    }
+
+    for (int n = 0; n < mkv_d->num_index_lists; n++) {
+        struct mkv_index_list *list = &mkv_d->index_lists[n];
+        qsort(list->by_time, list->num, sizeof(mkv_index_t), index_time_compare);
+        list->by_pos = talloc_memdup(mkv_d->index_lists, list->by_time,
+                                     list->num * sizeof(mkv_index_t));
+        qsort(list->by_pos, list->num, sizeof(mkv_index_t), index_pos_compare);
+    }
+
+    mkv_d->index_lists_valid = true;
+}
+
+// Add the entry to the valid per-track lists, if it sorts last in both (as
+// with entries found while demuxing). Returns false if the lists need to be
+// rebuilt.
+static bool index_lists_append(mkv_demuxer_t *mkv_d, mkv_index_t *entry)
+{
+    struct mkv_index_list *list = NULL;
+    for (int n = 0; n < mkv_d->num_index_lists; n++) {
+        if (mkv_d->index_lists[n].tnum == entry->tnum) {
+            list = &mkv_d->index_lists[n];
+            break;
+        }
+    }
+    if (!list)
+        return false;
+    if (list->num &&
+        (index_time_compare(entry, &list->by_time[list->num - 1]) < 0 ||
+         index_pos_compare(entry, &list->by_pos[list->num - 1]) < 0))
+        return false;
+    MP_TARRAY_GROW(mkv_d->index_lists, list->by_time, list->num);
+    MP_TARRAY_GROW(mkv_d->index_lists, list->by_pos, list->num);
+    list->by_time[list->num] = *entry;
+    list->by_pos[list->num] = *entry;
+    list->num++;
+    return true;
+}
+
 static void cue_index_add(demuxer_t *demuxer, int track_id, uint64_t filepos,
                           uint64_t timecode, uint64_t duration)
 {
@@ -672,7 +772,8 @@ static void cue_index_add(demuxer_t *demuxer, int track_id, uint64_t filepos,
 
     MP_TARRAY_GROW(mkv_d, mkv_d->indexes, mkv_d->num_indexes);
 
-    mkv_d->indexes[mkv_d->num_indexes] = (mkv_index_t) {
+    mkv_index_t *entry = &mkv_d->indexes[mkv_d->num_indexes];
+    *entry = (mkv_index_t) {
         .tnum = track_id,
         .filepos = filepos,
         .timecode = timecode,
@@ -680,6 +781,52 @@ static void cue_index_add(demuxer_t *demuxer, int track_id, uint64_t filepos,
     };
 
     mkv_d->num_indexes++;
+    if (mkv_d->index_lists_valid && !index_lists_append(mkv_d, entry))
+        mkv_d->index_lists_valid = false;
+}
+
+static struct mkv_index_list *get_index_list(struct demuxer *demuxer, int tnum)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    update_index_lists(demuxer);
+    for (int n = 0; n < mkv_d->num_index_lists; n++) {
+        if (mkv_d->index_lists[n].tnum == tnum)
+            return &mkv_d->index_lists[n];
+    }
+    return NULL;
+}
+
+// Return the index of the first entry in list->by_time with
+// timecode * scale >= ts (or > ts if upper is set).
+static size_t index_time_bound(struct mkv_index_list *list, int64_t ts,
+                               uint64_t scale, bool upper)
+{
+    size_t lo = 0, hi = list->num;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int64_t t = list->by_time[mid].timecode * scale;
+        if (upper ? t <= ts : t < ts) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Return the index of the first entry in list->by_pos with filepos >= pos.
+static size_t index_pos_bound(struct mkv_index_list *list, uint64_t pos)
+{
+    size_t lo = 0, hi = list->num;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (list->by_pos[mid].filepos < pos) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
 }
 
 static void add_block_position(demuxer_t *demuxer, struct mkv_track *track,
@@ -703,6 +850,76 @@ static void add_block_position(demuxer_t *demuxer, struct mkv_track *track,
     track->last_index_entry = mkv_d->num_indexes - 1;
 }
 
+// Identifies the segment and the units of the index entries for the index
+// cache.
+static char *get_index_cache_id(void *ta_parent, struct demuxer *demuxer)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    char *id = talloc_strdup(ta_parent, "mkv ");
+    for (int i = 0; i < 16; i++) {
+        id = talloc_asprintf_append(id, "%02x",
+                                    demuxer->matroska_data.uid.segment[i]);
+    }
+    return talloc_asprintf_append(id, " %"PRIu64" %"PRId64, mkv_d->tc_scale,
+                                  mkv_d->segment_start);
+}
+
+// If the file has no cues, use the index saved by a previous run (if any),
+// and continue building it on the fly from where it ended.
+static void load_cached_index(struct demuxer *demuxer)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    if (mkv_d->index_complete || mkv_d->deferred_cues ||
+        demuxer->opts->index_mode != 1)
+        return;
+
+    void *tmp = talloc_new(NULL);
+    struct demux_index_entry *entries;
+    int num_entries;
+    if (demux_index_cache_load(demuxer, get_index_cache_id(tmp, demuxer),
+                               tmp, &entries, &num_entries))
+    {
+        for (int n = 0; n < num_entries; n++) {
+            struct demux_index_entry *e = &entries[n];
+            struct mkv_track *track = NULL;
+            for (int i = 0; i < mkv_d->num_tracks; i++) {
+                if (mkv_d->tracks[i]->tnum == e->track)
+                    track = mkv_d->tracks[i];
+            }
+            if (e->ts < 0 || e->duration < 0 || e->pos < mkv_d->segment_start)
+                continue;
+            add_block_position(demuxer, track, e->pos, e->ts, e->duration);
+        }
+        mkv_d->num_cached_indexes = mkv_d->num_indexes;
+    }
+    talloc_free(tmp);
+}
+
+// Save the index built on the fly, if it was extended.
+static void save_cached_index(struct demuxer *demuxer)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    if (mkv_d->index_complete || mkv_d->deferred_cues ||
+        mkv_d->num_indexes <= mkv_d->num_cached_indexes)
+        return;
+
+    void *tmp = talloc_new(NULL);
+    struct demux_index_entry *entries =
+        talloc_array(tmp, struct demux_index_entry, mkv_d->num_indexes);
+    for (size_t n = 0; n < mkv_d->num_indexes; n++) {
+        mkv_index_t *index = &mkv_d->indexes[n];
+        entries[n] = (struct demux_index_entry){
+            .track = index->tnum,
+            .ts = index->timecode,
+            .duration = index->duration,
+            .pos = index->filepos,
+        };
+    }
+    demux_index_cache_save(demuxer, get_index_cache_id(tmp, demuxer),
+                           entries, MPMIN(mkv_d->num_indexes, INT_MAX));
+    talloc_free(tmp);
+}
+
 static int demux_mkv_read_cues(demuxer_t *demuxer)
 {
     struct MPOpts *opts = demuxer->opts;
@@ -723,6 +940,7 @@ static int demux_mkv_read_cues(demuxer_t *demuxer)
         return -1;
 
     mkv_d->num_indexes = 0;
+    mkv_d->index_lists_valid = false;
     mkv_d->index_has_durations = false;
 
     for (int i = 0; i < cues.n_cue_point; i++) {
@@ -1850,6 +2068,8 @@ static int demux_mkv_open(demuxer_t *demuxer, enum demux_check check)
     if (demuxer->opts->mkv_probe_duration)
         probe_last_timestamp(demuxer);
 
+    load_cached_index(demuxer);
+
     return 0;
 }
 
@@ -1983,7 +2203,7 @@ static void handle_realvideo(demuxer_t *demuxer, mkv_track_t *track,
     demux_packet_t *dp;
     int64_t timestamp = mkv_d->last_pts * 1000;
 
-    dp = new_demux_packet_from(data.start, data.len);
+    dp = new_pooled_demux_packet_from(demuxer->packet_pool, data.start, data.len);
     if (!dp)
         return;
 
@@ -2102,8 +2322,9 @@ static void handle_realaudio(demuxer_t *demuxer, mkv_track_t *track,
                 goto error;
             // Release all the audio packets
             for (int x = 0; x < sph * w / apk_usize; x++) {
-                dp = new_demux_packet_from(track->audio_buf + x * apk_usize,
-                                           apk_usize);
+                dp = new_pooled_demux_packet_from(demuxer->packet_pool,
+                                                  track->audio_buf + x * apk_usize,
+                                                  apk_usize);
                 if (!dp)
                     goto error;
                 /* Put timestamp only on packets that correspond to original
@@ -2116,7 +2337,7 @@ static void handle_realaudio(demuxer_t *demuxer, mkv_track_t *track,
             }
         }
     } else { // Not a codec that requires reordering
-        dp = new_demux_packet_from(buffer, size);
+        dp = new_pooled_demux_packet_from(demuxer->packet_pool, buffer, size);
         if (!dp)
             goto error;
         if (track->ra_pts == mkv_d->last_pts && !mkv_d->a_skip_to_keyframe)
@@ -2329,13 +2550,21 @@ static int read_block(demuxer_t *demuxer, int64_t end, struct block_info *block)
     length = ebml_read_length(s);
     if (length > 500000000 || stream_tell(s) + length > (uint64_t)end)
         goto exit;
-    block->alloc = malloc(length + AV_LZO_INPUT_PADDING);
-    if (!block->alloc)
-        goto exit;
-    block->data = (bstr){block->alloc, length};
     block->filepos = stream_tell(s);
-    if (stream_read(s, block->data.start, block->data.len) != block->data.len)
-        goto exit;
+    // Parse the block in place if the file is memory-mapped. (The data is
+    // read-only; bstr just has no const variant.)
+    const unsigned char *mapped =
+        stream_read_mapped(s, length, AV_LZO_INPUT_PADDING);
+    if (mapped) {
+        block->data = (bstr){(unsigned char *)mapped, length};
+    } else {
+        block->alloc = malloc(length + AV_LZO_INPUT_PADDING);
+        if (!block->alloc)
+            goto exit;
+        block->data = (bstr){block->alloc, length};
+        if (stream_read(s, block->data.start, block->data.len) != block->data.len)
+            goto exit;
+    }
 
     // Parse header of the Block element
     /* first byte(s): track num */
@@ -2436,7 +2665,8 @@ static int handle_block(demuxer_t *demuxer, struct block_info *block_info)
                 bstr buffer;
                 while (raw.start && mkv_parse_packet(track, &raw, &buffer)) {
                     demux_packet_t *dp =
-                        new_demux_packet_from(buffer.start, buffer.len);
+                        new_pooled_demux_packet_from(demuxer->packet_pool,
+                                                     buffer.start, buffer.len);
                     if (!dp)
                         break;
                     dp->keyframe = keyframe;
@@ -2707,11 +2937,25 @@ static struct mkv_index *seek_with_cues(struct demuxer *demuxer, int seek_id,
         min_diff = -min_diff;
     min_diff = FFMAX(min_diff, 1);
 
-    for (size_t i = 0; i < mkv_d->num_indexes; i++) {
-        if (seek_id < 0 || mkv_d->indexes[i].tnum == seek_id) {
+    update_index_lists(demuxer);
+    for (int n = 0; n < mkv_d->num_index_lists; n++) {
+        struct mkv_index_list *list = &mkv_d->index_lists[n];
+        if (seek_id >= 0 && list->tnum != seek_id)
+            continue;
+        // Only the entries right before and after the target can be the
+        // closest ones. (Subtracting 1 from 0 wraps, and is skipped.)
+        size_t lb = index_time_bound(list, target_timecode, mkv_d->tc_scale, false);
+        size_t ub = index_time_bound(list, target_timecode, mkv_d->tc_scale, true);
+        size_t candidates[4] = {lb, ub, lb - 1, ub - 1};
+        for (int c = 0; c < 4; c++) {
+            if (candidates[c] >= list->num)
+                continue;
+            // Prefer the first of the entries with the same timecode.
+            uint64_t tc = list->by_time[candidates[c]].timecode;
+            struct mkv_index *cur =
+                &list->by_time[index_time_bound(list, tc, 1, false)];
             int64_t diff =
-                target_timecode -
-                (int64_t) (mkv_d->indexes[i].timecode * mkv_d->tc_scale);
+                target_timecode - (int64_t) (cur->timecode * mkv_d->tc_scale);
             if (flags & SEEK_BACKWARD)
                 diff = -diff;
             if (diff <= 0) {
@@ -2720,7 +2964,7 @@ static struct mkv_index *seek_with_cues(struct demuxer *demuxer, int seek_id,
             } else if (diff >= min_diff)
                 continue;
             min_diff = diff;
-            index = mkv_d->indexes + i;
+            index = cur;
         }
     }
 
@@ -2734,10 +2978,14 @@ static struct mkv_index *seek_with_cues(struct demuxer *demuxer, int seek_id,
             uint64_t min_tc = pre < index->timecode ? index->timecode - pre : 0;
             uint64_t prev_target = 0;
             uint64_t prev_tc = 0;
-            for (size_t i = 0; i < mkv_d->num_indexes; i++) {
-                if (seek_id < 0 || mkv_d->indexes[i].tnum == seek_id) {
-                    struct mkv_index *cur = &mkv_d->indexes[i];
-                    if (cur->timecode <= min_tc && cur->timecode >= prev_tc) {
+            for (int n = 0; n < mkv_d->num_index_lists; n++) {
+                struct mkv_index_list *list = &mkv_d->index_lists[n];
+                if (seek_id >= 0 && list->tnum != seek_id)
+                    continue;
+                size_t i = index_time_bound(list, min_tc, 1, true);
+                if (i > 0) {
+                    struct mkv_index *cur = &list->by_time[i - 1];
+                    if (cur->timecode >= prev_tc) {
                         prev_tc = cur->timecode;
                         prev_target = cur->filepos;
                     }
@@ -2746,16 +2994,21 @@ static struct mkv_index *seek_with_cues(struct demuxer *demuxer, int seek_id,
             if (mkv_d->index_has_durations) {
                 // Find the earliest cluster that is not before prev_target,
                 // but contains subtitle packets overlapping with the cluster
-                // at seek_pos.
+                // at seek_pos. Only the clusters between the two positions
+                // need to be checked.
                 uint64_t target = seek_pos;
-                for (size_t i = 0; i < mkv_d->num_indexes; i++) {
-                    struct mkv_index *cur = &mkv_d->indexes[i];
-                    if (cur->timecode <= index->timecode &&
-                        cur->timecode + cur->duration > index->timecode &&
-                        cur->filepos >= prev_target &&
-                        cur->filepos < target)
+                for (int n = 0; n < mkv_d->num_index_lists; n++) {
+                    struct mkv_index_list *list = &mkv_d->index_lists[n];
+                    for (size_t i = index_pos_bound(list, prev_target);
+                         i < list->num && list->by_pos[i].filepos < target; i++)
                     {
-                        target = cur->filepos;
+                        struct mkv_index *cur = &list->by_pos[i];
+                        if (cur->timecode <= index->timecode &&
+                            cur->timecode + cur->duration > index->timecode)
+                        {
+                            target = cur->filepos;
+                            break;
+                        }
                     }
                 }
                 prev_target = target;
@@ -2832,14 +3085,12 @@ static void demux_mkv_seek(demuxer_t *demuxer, double rel_seek_secs, int flags)
 
         mkv_index_t *index = NULL;
         if (mkv_d->index_complete) {
-            for (size_t i = 0; i < mkv_d->num_indexes; i++) {
-                if (mkv_d->indexes[i].tnum == v_tnum) {
-                    if ((index == NULL)
-                        || ((mkv_d->indexes[i].filepos >= target_filepos)
-                            && ((index->filepos < target_filepos)
-                                || (mkv_d->indexes[i].filepos < index->filepos))))
-                        index = &mkv_d->indexes[i];
-                }
+            // First cluster at or after the target; if there is none, use the
+            // first cluster.
+            struct mkv_index_list *list = get_index_list(demuxer, v_tnum);
+            if (list && list->num) {
+                size_t i = index_pos_bound(list, target_filepos);
+                index = &list->by_pos[i < list->num ? i : 0];
             }
         }
 
@@ -2890,11 +3141,9 @@ static void probe_last_timestamp(struct demuxer *demuxer)
 
     // Find last cluster that still has video packets
     int64_t target = 0;
-    for (size_t i = 0; i < mkv_d->num_indexes; i++) {
-        struct mkv_index *cur = &mkv_d->indexes[i];
-        if (cur->tnum == v_tnum)
-            target = MPMAX(target, cur->filepos);
-    }
+    struct mkv_index_list *list = get_index_list(demuxer, v_tnum);
+    if (list && list->num)
+        target = list->by_pos[list->num - 1].filepos;
     if (!target)
         return;
 
@@ -2946,6 +3195,7 @@ static void mkv_free(struct demuxer *demuxer)
     struct mkv_demuxer *mkv_d = demuxer->priv;
     if (!mkv_d)
         return;
+    save_cached_index(demuxer);
     mkv_seek_reset(demuxer);
     for (int i = 0; i < mkv_d->num_tracks; i++)
         demux_mkv_free_trackentry(mkv_d->tracks[i]);
@@ -30,6 +30,7 @@
 #include <assert.h>
 
 #include <libavutil/intfloat.h>
+#include <libavutil/intreadwrite.h>
 #include <libavutil/common.h>
 #include "talloc.h"
 #include "ebml.h"
@@ -57,10 +58,59 @@ bool ebml_is_mkv_level1_id(uint32_t id)
 }
 
 /*
- * Read: the element content data ID.
- * Return: the ID.
+ * The functions reading from the stream decode from the stream buffer
+ * directly if enough data is buffered (or can be peeked), instead of reading
+ * byte by byte. Near EOF, or on invalid data, they fall back to reading bytes
+ * one by one, which has the exact EOF behavior callers expect.
  */
-uint32_t ebml_read_id(stream_t *s)
+
+// Return a window of up to len bytes at the current stream position, without
+// consuming them.
+static inline bstr peek_window(stream_t *s, int len)
+{
+    if (s->buf_len - s->buf_pos >= len)
+        return (bstr){&s->buffer[s->buf_pos], len};
+    return stream_peek(s, len);
+}
+
+// Consume len bytes returned by peek_window().
+static inline void skip_window(stream_t *s, int len)
+{
+    if (s->buf_len - s->buf_pos >= len) {
+        s->buf_pos += len;
+    } else {
+        stream_skip(s, len);
+    }
+}
+
+// Return the size of an EBML variable length number from its first byte
+// (1-8), or 0 if the byte can't start one.
+static inline int vint_size(uint8_t first)
+{
+    return first ? 8 - av_log2(first) : 0;
+}
+
+// Read size big endian bytes. avail is the number of readable bytes at data.
+static inline uint64_t read_be(const uint8_t *data, int size, size_t avail)
+{
+    if (avail >= 8)
+        return AV_RB64(data) >> (64 - 8 * size);
+    uint64_t r = 0;
+    for (int n = 0; n < size; n++)
+        r = (r << 8) | data[n];
+    return r;
+}
+
+// Decode a variable length unsigned number of the given size (without the
+// length marker). Return EBML_UINT_INVALID if all bits are set ("unknown").
+static inline uint64_t vint_value(const uint8_t *data, int size, size_t avail)
+{
+    uint64_t mask = (1ULL << (7 * size)) - 1;
+    uint64_t r = read_be(data, size, avail) & mask;
+    return r == mask ? EBML_UINT_INVALID : r;
+}
+
+static uint32_t read_id_slow(stream_t *s)
 {
     int i, len_mask = 0x80;
     uint32_t id;
@@ -74,35 +124,36 @@ uint32_t ebml_read_id(stream_t *s)
     return id;
 }
 
+/*
+ * Read: the element content data ID.
+ * Return: the ID.
+ */
+uint32_t ebml_read_id(stream_t *s)
+{
+    bstr w = peek_window(s, 4);
+    int size = w.len ? vint_size(w.start[0]) : 0;
+    if (size < 1 || size > 4 || size > w.len)
+        return read_id_slow(s);
+    uint32_t id = read_be(w.start, size, w.len);
+    skip_window(s, size);
+    return id;
+}
+
 /*
  * Read a variable length unsigned int.
  */
 uint64_t ebml_read_vlen_uint(bstr *buffer)
 {
-    int i, j, num_ffs = 0, len_mask = 0x80;
-    uint64_t num;
-
     if (buffer->len == 0)
         return EBML_UINT_INVALID;
-
-    for (i = 0, num = buffer->start[0]; i < 8 && !(num & len_mask); i++)
-        len_mask >>= 1;
-    if (i >= 8)
+    int size = vint_size(buffer->start[0]);
+    if (!size || size > buffer->len)
         return EBML_UINT_INVALID;
-    j = i + 1;
-    if ((int) (num &= (len_mask - 1)) == len_mask - 1)
-        num_ffs++;
-    if (j > buffer->len)
+    uint64_t num = vint_value(buffer->start, size, buffer->len);
+    if (num == EBML_UINT_INVALID)
         return EBML_UINT_INVALID;
-    for (int n = 0; n < i; n++) {
-        num = (num << 8) | buffer->start[n + 1];
-        if ((num & 0xFF) == 0xFF)
-            num_ffs++;
-    }
-    if (j == num_ffs)
-        return EBML_UINT_INVALID;
-    buffer->start += j;
-    buffer->len -= j;
+    buffer->start += size;
+    buffer->len -= size;
     return num;
 }
 
@@ -124,10 +175,7 @@ int64_t ebml_read_vlen_int(bstr *buffer)
     return unum - ((1 << ((7 * l) - 1)) - 1);
 }
 
-/*
- * Read: element content length.
- */
-uint64_t ebml_read_length(stream_t *s)
+static uint64_t read_length_slow(stream_t *s)
 {
     int i, j, num_ffs = 0, len_mask = 0x80;
     uint64_t len;
@@ -151,6 +199,20 @@ uint64_t ebml_read_length(stream_t *s)
     return len;
 }
 
+/*
+ * Read: element content length.
+ */
+uint64_t ebml_read_length(stream_t *s)
+{
+    bstr w = peek_window(s, 8);
+    int size = w.len ? vint_size(w.start[0]) : 0;
+    if (!size || size > w.len)
+        return read_length_slow(s);
+    uint64_t len = vint_value(w.start, size, w.len);
+    skip_window(s, size);
+    return len;
+}
+
 /*
  * Read the next element as an unsigned int.
  */
@@ -162,6 +224,13 @@ uint64_t ebml_read_uint(stream_t *s)
     if (len == EBML_UINT_INVALID || len < 1 || len > 8)
         return EBML_UINT_INVALID;
 
+    bstr w = peek_window(s, len);
+    if (w.len >= len) {
+        value = read_be(w.start, len, w.len);
+        skip_window(s, len);
+        return value;
+    }
+
     while (len--)
         value = (value << 8) | stream_read_char(s);
 
@@ -181,6 +250,16 @@ int64_t ebml_read_int(stream_t *s)
     if (len == EBML_UINT_INVALID || len < 1 || len > 8)
         return EBML_INT_INVALID;
 
+    bstr w = peek_window(s, len);
+    if (w.len >= len) {
+        value = read_be(w.start, len, w.len);
+        skip_window(s, len);
+        // Sign extend.
+        if (len < 8 && (value & (1ULL << (8 * len - 1))))
+            value |= ~0ULL << (8 * len);
+        return (int64_t)value;
+    }
+
     len--;
     l = stream_read_char(s);
     if (l & 0x80)
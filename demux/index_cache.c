@@ -0,0 +1,243 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Persistent seek indexes, for files which contain no index (or only an
+ * incomplete one), and where the demuxer builds it while reading the file.
+ *
+ * Each file gets its own index file in the cache directory. Its name is the
+ * MD5 of the absolute path (or URL) and the demuxer's ID string. The format
+ * is:
+ *
+ *   "mpvindex"  magic
+ *   u32         version (1)
+ *   u32         length of the ID string, followed by the string bytes
+ *   i64         size of the indexed file
+ *   i64         modification time of the indexed file (0 if unknown)
+ *   u32         number of entries
+ *   entries:    i64 track, i64 ts, i64 duration, i64 pos
+ *
+ * All integers are little endian. If the indexed file changed size or
+ * modification time, the index is ignored (and replaced on the next save).
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libavutil/md5.h>
+#include <libavutil/intreadwrite.h>
+
+#include "talloc.h"
+#include "common/common.h"
+#include "common/msg.h"
+#include "options/options.h"
+#include "options/path.h"
+#include "osdep/io.h"
+#include "stream/stream.h"
+#include "demux.h"
+#include "index_cache.h"
+
+#define INDEX_VERSION 1
+#define HEADER_SIZE (8 + 4 + 4)
+#define ENTRY_SIZE (4 * 8)
+// Sanity limit, so broken files don't make us allocate huge amounts of memory.
+#define MAX_ENTRIES (64 * 1024 * 1024 / ENTRY_SIZE)
+
+struct file_id {
+    int64_t size;
+    int64_t mtime;
+};
+
+static char *get_index_filename(void *ta_parent, struct demuxer *demuxer,
+                                const char *id)
+{
+    struct MPOpts *opts = demuxer->opts;
+    if (!opts->index_cache_dir || !opts->index_cache_dir[0])
+        return NULL;
+    const char *url = demuxer->stream->url;
+    if (!url)
+        return NULL;
+
+    char *res = NULL;
+    void *tmp = talloc_new(NULL);
+    const char *realpath = url;
+    if (!mp_is_url(bstr0(url))) {
+        char *cwd = mp_getcwd(tmp);
+        if (!cwd)
+            goto exit;
+        realpath = mp_path_join(tmp, bstr0(cwd), bstr0(url));
+    }
+    char *key = talloc_asprintf(tmp, "%s\n%s", realpath, id);
+    uint8_t md5[16];
+    av_md5_sum(md5, key, strlen(key));
+    char *name = talloc_strdup(tmp, "");
+    for (int i = 0; i < 16; i++)
+        name = talloc_asprintf_append(name, "%02X", md5[i]);
+
+    char *dir = mp_get_user_path(tmp, demuxer->global, opts->index_cache_dir);
+    if (dir)
+        res = mp_path_join(ta_parent, bstr0(dir), bstr0(name));
+
+exit:
+    talloc_free(tmp);
+    return res;
+}
+
+static bool get_file_id(struct demuxer *demuxer, struct file_id *fid)
+{
+    *fid = (struct file_id){0};
+    if (stream_control(demuxer->stream, STREAM_CTRL_GET_SIZE, &fid->size) < 1 ||
+        fid->size <= 0)
+        return false;
+    const char *url = demuxer->stream->url;
+    struct stat st;
+    if (!mp_is_url(bstr0(url)) && stat(url, &st) == 0)
+        fid->mtime = st.st_mtime;
+    return true;
+}
+
+bool demux_index_cache_load(struct demuxer *demuxer, const char *id,
+                            void *ta_parent, struct demux_index_entry **entries,
+                            int *num_entries)
+{
+    *entries = NULL;
+    *num_entries = 0;
+
+    struct file_id fid;
+    if (!get_file_id(demuxer, &fid))
+        return false;
+    char *filename = get_index_filename(NULL, demuxer, id);
+    if (!filename)
+        return false;
+
+    bool ok = false;
+    struct demux_index_entry *res = NULL;
+    uint8_t buf[HEADER_SIZE + 2 * 8 + 4];
+    size_t id_len = strlen(id);
+    char *file_id_str = NULL;
+    FILE *f = fopen(filename, "rb");
+    if (!f)
+        goto done;
+
+    if (fread(buf, HEADER_SIZE, 1, f) != 1 || memcmp(buf, "mpvindex", 8) ||
+        AV_RL32(buf + 8) != INDEX_VERSION || AV_RL32(buf + 12) != id_len)
+        goto done;
+    file_id_str = talloc_size(NULL, id_len + 1);
+    if (fread(file_id_str, id_len, 1, f) != 1 || memcmp(file_id_str, id, id_len))
+        goto done;
+    if (fread(buf, 2 * 8 + 4, 1, f) != 1)
+        goto done;
+    if ((int64_t)AV_RL64(buf) != fid.size || (int64_t)AV_RL64(buf + 8) != fid.mtime)
+    {
+        MP_VERBOSE(demuxer, "Cached index is for a different file version.\n");
+        goto done;
+    }
+    uint32_t num = AV_RL32(buf + 16);
+    if (num > MAX_ENTRIES)
+        goto done;
+
+    res = talloc_array(ta_parent, struct demux_index_entry, num);
+    for (uint32_t n = 0; n < num; n++) {
+        uint8_t e[ENTRY_SIZE];
+        if (fread(e, ENTRY_SIZE, 1, f) != 1)
+            goto done;
+        res[n] = (struct demux_index_entry){
+            .track = AV_RL64(e + 0),
+            .ts = AV_RL64(e + 8),
+            .duration = AV_RL64(e + 16),
+            .pos = AV_RL64(e + 24),
+        };
+        if (res[n].pos < 0 || res[n].pos >= fid.size)
+            goto done;
+    }
+
+    MP_VERBOSE(demuxer, "Loaded %u index entries from '%s'.\n",
+               (unsigned)num, filename);
+    *entries = res;
+    *num_entries = num;
+    ok = true;
+
+done:
+    if (!ok)
+        talloc_free(res);
+    if (f)
+        fclose(f);
+    talloc_free(file_id_str);
+    talloc_free(filename);
+    return ok;
+}
+
+void demux_index_cache_save(struct demuxer *demuxer, const char *id,
+                            struct demux_index_entry *entries, int num_entries)
+{
+    struct file_id fid;
+    if (num_entries <= 0 || num_entries > MAX_ENTRIES ||
+        !get_file_id(demuxer, &fid))
+        return;
+    struct MPOpts *opts = demuxer->opts;
+    char *filename = get_index_filename(NULL, demuxer, id);
+    if (!filename)
+        return;
+
+    char *dir = mp_get_user_path(NULL, demuxer->global, opts->index_cache_dir);
+    mp_mkdirp(dir);
+    talloc_free(dir);
+
+    // Write to a temporary file, and rename it when complete, so that other
+    // instances (or a crash) never see a partially written index.
+    char *tmpname = talloc_asprintf(filename, "%s.%d.tmp", filename,
+                                    (int)getpid());
+    FILE *f = fopen(tmpname, "wb");
+    if (!f) {
+        MP_WARN(demuxer, "Can't write index to '%s'.\n", tmpname);
+        goto done;
+    }
+
+    uint8_t buf[HEADER_SIZE + 2 * 8 + 4];
+    size_t id_len = strlen(id);
+    memcpy(buf, "mpvindex", 8);
+    AV_WL32(buf + 8, INDEX_VERSION);
+    AV_WL32(buf + 12, id_len);
+    fwrite(buf, HEADER_SIZE, 1, f);
+    fwrite(id, id_len, 1, f);
+    AV_WL64(buf, fid.size);
+    AV_WL64(buf + 8, fid.mtime);
+    AV_WL32(buf + 16, num_entries);
+    fwrite(buf, 2 * 8 + 4, 1, f);
+    for (int n = 0; n < num_entries; n++) {
+        uint8_t e[ENTRY_SIZE];
+        AV_WL64(e + 0, entries[n].track);
+        AV_WL64(e + 8, entries[n].ts);
+        AV_WL64(e + 16, entries[n].duration);
+        AV_WL64(e + 24, entries[n].pos);
+        fwrite(e, ENTRY_SIZE, 1, f);
+    }
+
+    bool failed = ferror(f);
+    if (fclose(f) || failed || rename(tmpname, filename)) {
+        MP_WARN(demuxer, "Error writing index to '%s'.\n", filename);
+        remove(tmpname);
+        goto done;
+    }
+    MP_VERBOSE(demuxer, "Saved %d index entries to '%s'.\n",
+               num_entries, filename);
+
+done:
+    talloc_free(filename);
+}
@@ -0,0 +1,49 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPV_DEMUX_INDEX_CACHE_H
+#define MPV_DEMUX_INDEX_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct demuxer;
+
+// A seek point. The meaning of the timestamps is up to the demuxer (e.g.
+// Matroska timecodes).
+struct demux_index_entry {
+    int64_t track;
+    int64_t ts;
+    int64_t duration;
+    int64_t pos;        // byte position to start reading at
+};
+
+// Load a seek index previously saved with demux_index_cache_save() for the
+// same file. "id" is a demuxer specific string, which must match the one used
+// for saving (it should include the demuxer name, and whatever else changes
+// the meaning of the entries). Returns false if the cache is disabled, or no
+// valid index was found.
+bool demux_index_cache_load(struct demuxer *demuxer, const char *id,
+                            void *ta_parent, struct demux_index_entry **entries,
+                            int *num_entries);
+
+// Write the index to the cache directory (if enabled), replacing any index
+// saved before for the file.
+void demux_index_cache_save(struct demuxer *demuxer, const char *id,
+                            struct demux_index_entry *entries, int num_entries);
+
+#endif
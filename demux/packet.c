@@ -18,6 +18,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <libavcodec/avcodec.h>
 #include <libavutil/intreadwrite.h>
@@ -29,41 +30,237 @@
 
 #include "packet.h"
 
+// Packet structs and payload buffers are recycled through a per-demuxer pool.
+// Both can outlive the demuxer (decoders keep packets and buffer references
+// around), so the pool is reference counted: the demuxer and every packet or
+// buffer handed out hold a reference.
+
+#define POOL_MIN_CLASS_SHIFT 12     // smallest size class is 4 KB
+#define POOL_NUM_CLASSES 11         // largest size class is 4 MB
+#define POOL_MAX_FREE_PACKETS 256
+#define POOL_MAX_FREE_BUFFERS 16    // per size class
+
+struct pool_class {
+    struct demux_packet_pool *pool;
+    int size;                       // allocation size, including padding
+    uint8_t **free;
+    int num_free;
+};
+
+struct demux_packet_pool {
+    pthread_mutex_t lock;
+    // -- protected by lock
+    int refcount;
+    bool destroyed;
+    struct demux_packet **free;
+    int num_free;
+    struct pool_class classes[POOL_NUM_CLASSES];
+    struct demux_packet_pool_stats stats;
+};
+
+// The AVPacket is part of the same allocation as the demux_packet.
+struct packet_alloc {
+    struct demux_packet dp; // must be first
+    AVPacket avpkt;
+};
+
+struct demux_packet_pool *demux_packet_pool_create(void)
+{
+    struct demux_packet_pool *pool = talloc_zero(NULL, struct demux_packet_pool);
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->refcount = 1;
+    pool->free = talloc_array(pool, struct demux_packet *, POOL_MAX_FREE_PACKETS);
+    for (int n = 0; n < POOL_NUM_CLASSES; n++) {
+        struct pool_class *c = &pool->classes[n];
+        c->pool = pool;
+        c->size = (1 << (POOL_MIN_CLASS_SHIFT + n)) + FF_INPUT_BUFFER_PADDING_SIZE;
+        c->free = talloc_array(pool, uint8_t *, POOL_MAX_FREE_BUFFERS);
+    }
+    return pool;
+}
+
+static void pool_ref(struct demux_packet_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->refcount++;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void pool_unref(struct demux_packet_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    assert(pool->refcount > 0);
+    bool dead = --pool->refcount == 0;
+    pthread_mutex_unlock(&pool->lock);
+    if (!dead)
+        return;
+
+    for (int n = 0; n < pool->num_free; n++)
+        talloc_free(pool->free[n]);
+    for (int n = 0; n < POOL_NUM_CLASSES; n++) {
+        struct pool_class *c = &pool->classes[n];
+        for (int i = 0; i < c->num_free; i++)
+            av_free(c->free[i]);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    talloc_free(pool);
+}
+
+// Drop the owner's reference. Packets still in use stay valid, and are freed
+// normally when they are released.
+void demux_packet_pool_destroy(struct demux_packet_pool *pool)
+{
+    if (!pool)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->destroyed = true;
+    pthread_mutex_unlock(&pool->lock);
+    pool_unref(pool);
+}
+
+void demux_packet_pool_get_stats(struct demux_packet_pool *pool,
+                                 struct demux_packet_pool_stats *st)
+{
+    *st = (struct demux_packet_pool_stats){0};
+    if (!pool)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    *st = pool->stats;
+    st->free_packets = pool->num_free;
+    for (int n = 0; n < POOL_NUM_CLASSES; n++)
+        st->free_buffers += pool->classes[n].num_free;
+    pthread_mutex_unlock(&pool->lock);
+}
+
 static void packet_destroy(void *ptr)
 {
     struct demux_packet *dp = ptr;
     av_packet_unref(dp->avpacket);
+    if (dp->pool)
+        pool_unref(dp->pool);
 }
 
-// This actually preserves only data and side data, not PTS/DTS/pos/etc.
-// It also allows avpkt->data==NULL with avpkt->size!=0 - the libavcodec API
-// does not allow it, but we do it to simplify new_demux_packet().
-struct demux_packet *new_demux_packet_from_avpacket(struct AVPacket *avpkt)
+static struct demux_packet *alloc_packet(struct demux_packet_pool *pool)
 {
-    if (avpkt->size > 1000000000)
-        return NULL;
-    struct demux_packet *dp = talloc(NULL, struct demux_packet);
-    talloc_set_destructor(dp, packet_destroy);
+    struct demux_packet *dp = NULL;
+    if (pool) {
+        pthread_mutex_lock(&pool->lock);
+        if (pool->num_free) {
+            dp = pool->free[--pool->num_free];
+            pool->stats.hits++;
+        } else {
+            pool->stats.misses++;
+        }
+        pool->refcount++;
+        pthread_mutex_unlock(&pool->lock);
+    }
+    if (!dp) {
+        struct packet_alloc *alloc = talloc(NULL, struct packet_alloc);
+        talloc_set_destructor(alloc, packet_destroy);
+        dp = &alloc->dp;
+    }
+    struct packet_alloc *alloc = (struct packet_alloc *)dp;
     *dp = (struct demux_packet) {
         .pts = MP_NOPTS_VALUE,
         .dts = MP_NOPTS_VALUE,
         .duration = -1,
         .pos = -1,
         .stream = -1,
-        .avpacket = talloc_zero(dp, AVPacket),
+        .avpacket = &alloc->avpkt,
+        .pool = pool,
     };
+    *dp->avpacket = (AVPacket){0};
     av_init_packet(dp->avpacket);
+    return dp;
+}
+
+static void buffer_free(void *opaque, uint8_t *data)
+{
+    struct pool_class *c = opaque;
+    struct demux_packet_pool *pool = c->pool;
+    pthread_mutex_lock(&pool->lock);
+    if (!pool->destroyed && c->num_free < POOL_MAX_FREE_BUFFERS) {
+        c->free[c->num_free++] = data;
+        data = NULL;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    av_free(data);
+    pool_unref(pool);
+}
+
+// Return a buffer with room for len bytes, plus input padding.
+static AVBufferRef *alloc_buffer(struct demux_packet_pool *pool, size_t len)
+{
+    size_t size = len + FF_INPUT_BUFFER_PADDING_SIZE;
+    struct pool_class *c = NULL;
+    for (int n = 0; pool && n < POOL_NUM_CLASSES; n++) {
+        if (size <= pool->classes[n].size) {
+            c = &pool->classes[n];
+            break;
+        }
+    }
+    if (!c) {
+        if (pool) {
+            pthread_mutex_lock(&pool->lock);
+            pool->stats.buffer_misses++;
+            pthread_mutex_unlock(&pool->lock);
+        }
+        return av_buffer_alloc(size);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    uint8_t *data = c->num_free ? c->free[--c->num_free] : NULL;
+    if (data) {
+        pool->stats.buffer_hits++;
+    } else {
+        pool->stats.buffer_misses++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!data)
+        data = av_malloc(c->size);
+    AVBufferRef *buf = NULL;
+    if (data) {
+        pool_ref(pool);
+        buf = av_buffer_create(data, c->size, buffer_free, c, 0);
+        if (!buf) {
+            av_free(data);
+            pool_unref(pool);
+        }
+    }
+    return buf;
+}
+
+// This actually preserves only data and side data, not PTS/DTS/pos/etc.
+// It also allows avpkt->data==NULL with avpkt->size!=0 - the libavcodec API
+// does not allow it, but we do it to simplify new_demux_packet().
+// pool can be NULL, in which case nothing is recycled.
+struct demux_packet *new_pooled_demux_packet_from_avpacket(
+    struct demux_packet_pool *pool, struct AVPacket *avpkt)
+{
+    if (avpkt->size > 1000000000)
+        return NULL;
+    struct demux_packet *dp = alloc_packet(pool);
     int r = -1;
-    if (avpkt->data) {
+    if (avpkt->data && avpkt->buf) {
         // We hope that this function won't need/access AVPacket input padding,
         // because otherwise new_demux_packet_from() wouldn't work.
         r = av_packet_ref(dp->avpacket, avpkt);
     } else {
-        r = av_new_packet(dp->avpacket, avpkt->size);
+        // Not refcounted (or no data at all): copy into a pooled buffer.
+        AVPacket *pkt = dp->avpacket;
+        pkt->buf = alloc_buffer(pool, avpkt->size);
+        if (pkt->buf) {
+            pkt->data = pkt->buf->data;
+            pkt->size = avpkt->size;
+            if (avpkt->data)
+                memcpy(pkt->data, avpkt->data, pkt->size);
+            memset(pkt->data + pkt->size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+            r = av_packet_copy_props(pkt, avpkt);
+        }
     }
     if (r < 0) {
-        *dp->avpacket = (AVPacket){0};
-        talloc_free(dp);
+        free_demux_packet(dp);
         return NULL;
     }
     dp->buffer = dp->avpacket->data;
@@ -72,20 +269,37 @@ struct demux_packet *new_demux_packet_from_avpacket(struct AVPacket *avpkt)
 }
 
 // Input data doesn't need to be padded.
-struct demux_packet *new_demux_packet_from(void *data, size_t len)
+struct demux_packet *new_pooled_demux_packet_from(struct demux_packet_pool *pool,
+                                                  void *data, size_t len)
 {
     if (len > INT_MAX)
         return NULL;
     AVPacket pkt = { .data = data, .size = len };
-    return new_demux_packet_from_avpacket(&pkt);
+    return new_pooled_demux_packet_from_avpacket(pool, &pkt);
 }
 
-struct demux_packet *new_demux_packet(size_t len)
+struct demux_packet *new_pooled_demux_packet(struct demux_packet_pool *pool,
+                                             size_t len)
 {
     if (len > INT_MAX)
         return NULL;
     AVPacket pkt = { .data = NULL, .size = len };
-    return new_demux_packet_from_avpacket(&pkt);
+    return new_pooled_demux_packet_from_avpacket(pool, &pkt);
+}
+
+struct demux_packet *new_demux_packet_from_avpacket(struct AVPacket *avpkt)
+{
+    return new_pooled_demux_packet_from_avpacket(NULL, avpkt);
+}
+
+struct demux_packet *new_demux_packet_from(void *data, size_t len)
+{
+    return new_pooled_demux_packet_from(NULL, data, len);
+}
+
+struct demux_packet *new_demux_packet(size_t len)
+{
+    return new_pooled_demux_packet(NULL, len);
 }
 
 void demux_packet_shorten(struct demux_packet *dp, size_t len)
@@ -95,28 +309,62 @@ void demux_packet_shorten(struct demux_packet *dp, size_t len)
     memset(dp->buffer + dp->len, 0, FF_INPUT_BUFFER_PADDING_SIZE);
 }
 
+// Release a packet. Pooled packets are kept for reuse. Using talloc_free()
+// on a packet is also allowed, but never recycles it.
 void free_demux_packet(struct demux_packet *dp)
 {
+    struct demux_packet_pool *pool = dp ? dp->pool : NULL;
+    if (pool) {
+        av_packet_unref(dp->avpacket);
+        dp->pool = NULL;
+        // The user might have reparented it (e.g. ad_lavc.c), or allocated
+        // things on it; these must not survive into the packet's next use.
+        talloc_steal(NULL, dp);
+        talloc_free_children(dp);
+        bool recycled = false;
+        pthread_mutex_lock(&pool->lock);
+        if (!pool->destroyed && pool->num_free < POOL_MAX_FREE_PACKETS) {
+            pool->free[pool->num_free++] = dp;
+            recycled = true;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        pool_unref(pool);
+        if (recycled)
+            return;
+    }
     talloc_free(dp);
 }
 
-struct demux_packet *demux_copy_packet(struct demux_packet *dp)
+// Like demux_copy_packet(), but also copies the demuxer-side metadata (pos,
+// keyframe flag, stream index), and allocates from the given pool (can be
+// NULL). The payload is shared by reference if possible.
+struct demux_packet *demux_copy_packet_pooled(struct demux_packet_pool *pool,
+                                              struct demux_packet *dp)
 {
     struct demux_packet *new = NULL;
     if (dp->avpacket) {
-        new = new_demux_packet_from_avpacket(dp->avpacket);
+        new = new_pooled_demux_packet_from_avpacket(pool, dp->avpacket);
     } else {
         // Some packets might be not created by new_demux_packet*().
-        new = new_demux_packet_from(dp->buffer, dp->len);
+        new = new_pooled_demux_packet_from(pool, dp->buffer, dp->len);
     }
     if (!new)
         return NULL;
     new->pts = dp->pts;
     new->dts = dp->dts;
     new->duration = dp->duration;
+    new->pos = dp->pos;
+    new->demux_time = dp->demux_time;
+    new->keyframe = dp->keyframe;
+    new->stream = dp->stream;
     return new;
 }
 
+struct demux_packet *demux_copy_packet(struct demux_packet *dp)
+{
+    return demux_copy_packet_pooled(NULL, dp);
+}
+
 int demux_packet_set_padding(struct demux_packet *dp, int start, int end)
 {
 #if HAVE_AVFRAME_SKIP_SAMPLES
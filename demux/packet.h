@@ -30,19 +30,41 @@ typedef struct demux_packet {
     double dts;
     double duration;
     int64_t pos; // position in source file byte stream
+    int64_t demux_time; // mp_time_us() when added to the packet queue
     unsigned char *buffer;
     bool keyframe;
     int stream; // source stream index
     struct demux_packet *next;
     struct AVPacket *avpacket;   // keep the buffer allocation
+    struct demux_packet_pool *pool; // if allocated from a pool
 } demux_packet_t;
 
+struct demux_packet_pool_stats {
+    int64_t hits, misses;               // recycled packet structs
+    int64_t buffer_hits, buffer_misses; // recycled payload buffers
+    int free_packets, free_buffers;     // currently held for reuse
+};
+
+struct demux_packet_pool *demux_packet_pool_create(void);
+void demux_packet_pool_destroy(struct demux_packet_pool *pool);
+void demux_packet_pool_get_stats(struct demux_packet_pool *pool,
+                                 struct demux_packet_pool_stats *st);
+
+struct demux_packet *new_pooled_demux_packet(struct demux_packet_pool *pool,
+                                             size_t len);
+struct demux_packet *new_pooled_demux_packet_from(struct demux_packet_pool *pool,
+                                                  void *data, size_t len);
+struct demux_packet *new_pooled_demux_packet_from_avpacket(
+    struct demux_packet_pool *pool, struct AVPacket *avpkt);
+
 struct demux_packet *new_demux_packet(size_t len);
 struct demux_packet *new_demux_packet_from_avpacket(struct AVPacket *avpkt);
 struct demux_packet *new_demux_packet_from(void *data, size_t len);
 void demux_packet_shorten(struct demux_packet *dp, size_t len);
 void free_demux_packet(struct demux_packet *dp);
 struct demux_packet *demux_copy_packet(struct demux_packet *dp);
+struct demux_packet *demux_copy_packet_pooled(struct demux_packet_pool *pool,
+                                              struct demux_packet *dp);
 
 int demux_packet_set_padding(struct demux_packet *dp, int start, int end);
 
@@ -162,6 +162,13 @@ const struct mp_cmd_def mp_cmds[] = {
 
   { MP_CMD_DROP_BUFFERS, "drop_buffers", },
 
+  { MP_CMD_TRACE, "trace", {
+      ARG_CHOICE(({"start", 0},
+                  {"stop", 1},
+                  {"write", 2})),
+      OARG_STRING(""),
+  }},
+
   { MP_CMD_AF, "af", { ARG_STRING, ARG_STRING } },
   { MP_CMD_AO_RELOAD, "ao_reload", },
 
@@ -83,6 +83,8 @@ enum mp_command_type {
 
     MP_CMD_DROP_BUFFERS,
 
+    MP_CMD_TRACE,
+
     /// Audio Filter commands
     MP_CMD_AF,
     MP_CMD_AO_RELOAD,
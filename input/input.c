@@ -45,6 +45,7 @@
 #include "osdep/threads.h"
 #include "osdep/timer.h"
 #include "common/msg.h"
+#include "common/trace.h"
 #include "common/global.h"
 #include "options/m_config.h"
 #include "options/m_option.h"
@@ -849,10 +850,12 @@ void mp_input_wait(struct input_ctx *ictx, double seconds)
         seconds = -1;
     if (seconds > 0) {
         MP_STATS(ictx, "start sleep");
+        MP_TRACE_BEGIN(ictx, "sleep");
         struct timespec ts =
             mp_time_us_to_timespec(mp_add_timeout(mp_time_us(), seconds));
         sem_timedwait(&ictx->wakeup, &ts);
         MP_STATS(ictx, "end sleep");
+        MP_TRACE_END(ictx, "sleep");
     }
 }
 
@@ -18,16 +18,22 @@
 #include <pthread.h>
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <unistd.h>
 
 #include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 
+#include <libavutil/intreadwrite.h>
+
 #include "config.h"
 
+#include "osdep/atomics.h"
 #include "osdep/io.h"
 #include "osdep/threads.h"
 
@@ -38,11 +44,15 @@
 #include "libmpv/client.h"
 #include "misc/bstr.h"
 #include "misc/json.h"
+#include "misc/msgpack.h"
 #include "options/m_option.h"
 #include "options/options.h"
 #include "options/path.h"
 #include "player/client.h"
 
+// All clients are served by a single thread (ipc_thread()), which polls the
+// client sockets, the listening socket, and a wakeup pipe signaled by the
+// client API wakeup callbacks of all clients.
 struct mp_ipc_ctx {
     struct mp_log *log;
     struct mp_client_api *client_api;
@@ -50,19 +60,64 @@ struct mp_ipc_ctx {
 
     pthread_t thread;
     int death_pipe[2];
+    int wakeup_pipe[2];
+
+    // -- accessed by the IPC thread only (after it was started)
+    struct client_arg **clients;
+    int num_clients;
+    int client_num;     // for client names
+    int listen_fd;
+    bool terminate;
 };
 
 struct client_arg {
+    struct mp_ipc_ctx *ipc;
     struct mp_log *log;
     struct mpv_handle *client;
 
     char *client_name;
     int client_fd;
     bool close_client_fd;
+    // The fd is inherited (stdin), and its flags are shared with other
+    // processes, so it's left in blocking mode, and read once per poll().
+    bool blocking;
 
     bool writable;
+
+    // Use length-prefixed MessagePack messages instead of JSON lines.
+    // want_binary is set by the "set_protocol" command, and applied after
+    // the reply to it was sent.
+    bool binary, want_binary;
+
+    // Set by the client API wakeup callback (from any thread).
+    atomic_bool need_events;
+
+    bool dead;
+
+    bstr in_buf;
+
+    // Messages waiting to be sent. The first out_pos bytes of out_msgs[0]
+    // were already sent.
+    bstr *out_msgs;
+    int num_out_msgs;
+    size_t out_pos;
+    size_t out_bytes;       // sum of unsent bytes
+
+    bool dropping;          // out_bytes went above MAX_QUEUED_BYTES
+    int64_t queued_events;
+    int64_t dropped_events;
 };
 
+// Size of a single read() from the client socket.
+#define READ_SIZE (64 * 1024)
+
+// Maximum size of a single binary message (excluding the length prefix).
+#define MAX_BINARY_MSG (64 * 1024 * 1024)
+
+// If more data than this is waiting to be sent to a client, events for it are
+// dropped, and no further commands are read from it until it catches up.
+#define MAX_QUEUED_BYTES (4 * 1024 * 1024)
+
 static mpv_node *mpv_node_map_get(mpv_node *src, const char *key)
 {
     if (src->format != MPV_FORMAT_NODE_MAP)
@@ -215,45 +270,55 @@ static void mpv_event_to_node(void *ta_parent, mpv_event *event, mpv_node *dst)
     }
 }
 
-static char *json_encode_event(mpv_event *event)
+// Serialize a message in the protocol currently used by the client. The
+// result is allocated under ta_parent.
+static bstr encode_msg(struct client_arg *arg, void *ta_parent, mpv_node *node)
 {
-    void *ta_parent = talloc_new(NULL);
+    if (arg->binary) {
+        bstr msg = {0};
+        bstr_xappend(ta_parent, &msg, (bstr){(unsigned char[4]){0}, 4});
+        if (msgpack_write(&msg, node) < 0 || msg.len - 4 > MAX_BINARY_MSG)
+            return (bstr){0};
+        AV_WB32(msg.start, msg.len - 4);
+        return msg;
+    }
+
+    char *output = talloc_strdup(ta_parent, "");
+    if (json_write(&output, node) < 0)
+        return (bstr){0};
+    output = ta_talloc_strdup_append(output, "\n");
+    return bstr0(output);
+}
+
+static bstr encode_event(struct client_arg *arg, void *ta_parent,
+                         mpv_event *event)
+{
+    void *tmp = talloc_new(NULL);
     mpv_node event_node = {.format = MPV_FORMAT_NODE_MAP, .u.list = NULL};
 
-    mpv_event_to_node(ta_parent, event, &event_node);
+    mpv_event_to_node(tmp, event, &event_node);
 
-    char *output = talloc_strdup(NULL, "");
-    json_write(&output, &event_node);
-    output = ta_talloc_strdup_append(output, "\n");
+    bstr output = encode_msg(arg, ta_parent, &event_node);
 
-    talloc_free(ta_parent);
+    talloc_free(tmp);
 
     return output;
 }
 
-// Function is allowed to modify src[n].
-static char *json_execute_command(struct client_arg *arg, void *ta_parent,
-                                  char *src)
+// Run the command message in msg_node, and add the reply to reply_node (which
+// must be a MPV_FORMAT_NODE_MAP).
+static void execute_command(struct client_arg *arg, void *ta_parent,
+                            mpv_node *msg_node, mpv_node *reply_node)
 {
     int rc;
     const char *cmd = NULL;
 
-    mpv_node msg_node;
-    mpv_node reply_node = {.format = MPV_FORMAT_NODE_MAP, .u.list = NULL};
-
-    rc = json_parse(ta_parent, &msg_node, &src, 3);
-    if (rc < 0) {
-        MP_ERR(arg, "malformed JSON received\n");
+    if (msg_node->format != MPV_FORMAT_NODE_MAP) {
         rc = MPV_ERROR_INVALID_PARAMETER;
         goto error;
     }
 
-    if (msg_node.format != MPV_FORMAT_NODE_MAP) {
-        rc = MPV_ERROR_INVALID_PARAMETER;
-        goto error;
-    }
-
-    mpv_node *cmd_node = mpv_node_map_get(&msg_node, "command");
+    mpv_node *cmd_node = mpv_node_map_get(msg_node, "command");
     if (!cmd_node ||
         (cmd_node->format != MPV_FORMAT_NODE_ARRAY) ||
         !cmd_node->u.list->num)
@@ -272,15 +337,15 @@ static char *json_execute_command(struct client_arg *arg, void *ta_parent,
 
     if (!strcmp("client_name", cmd)) {
         const char *client_name = mpv_client_name(arg->client);
-        mpv_node_map_add_string(ta_parent, &reply_node, "data", client_name);
+        mpv_node_map_add_string(ta_parent, reply_node, "data", client_name);
         rc = MPV_ERROR_SUCCESS;
     } else if (!strcmp("get_time_us", cmd)) {
         int64_t time_us = mpv_get_time_us(arg->client);
-        mpv_node_map_add_int64(ta_parent, &reply_node, "data", time_us);
+        mpv_node_map_add_int64(ta_parent, reply_node, "data", time_us);
         rc = MPV_ERROR_SUCCESS;
     } else if (!strcmp("get_version", cmd)) {
         int64_t ver = mpv_client_api_version();
-        mpv_node_map_add_int64(ta_parent, &reply_node, "data", ver);
+        mpv_node_map_add_int64(ta_parent, reply_node, "data", ver);
         rc = MPV_ERROR_SUCCESS;
     } else if (!strcmp("get_property", cmd)) {
         mpv_node result_node;
@@ -298,7 +363,7 @@ static char *json_execute_command(struct client_arg *arg, void *ta_parent,
         rc = mpv_get_property(arg->client, cmd_node->u.list->values[1].u.string,
                               MPV_FORMAT_NODE, &result_node);
         if (rc >= 0) {
-            mpv_node_map_add(ta_parent, &reply_node, "data", &result_node);
+            mpv_node_map_add(ta_parent, reply_node, "data", &result_node);
             mpv_free_node_contents(&result_node);
         }
     } else if (!strcmp("get_property_string", cmd)) {
@@ -315,9 +380,9 @@ static char *json_execute_command(struct client_arg *arg, void *ta_parent,
         char *result = mpv_get_property_string(arg->client,
                                         cmd_node->u.list->values[1].u.string);
         if (!result) {
-            mpv_node_map_add_null(ta_parent, &reply_node, "data");
+            mpv_node_map_add_null(ta_parent, reply_node, "data");
         } else {
-            mpv_node_map_add_string(ta_parent, &reply_node, "data", result);
+            mpv_node_map_add_string(ta_parent, reply_node, "data", result);
             mpv_free(result);
         }
     } else if (!strcmp("set_property", cmd)) {
@@ -418,6 +483,37 @@ static char *json_execute_command(struct client_arg *arg, void *ta_parent,
 
         rc = mpv_request_log_messages(arg->client,
                                       cmd_node->u.list->values[1].u.string);
+    } else if (!strcmp("get_client_stats", cmd)) {
+        mpv_node stats = {.format = MPV_FORMAT_NODE_MAP, .u.list = NULL};
+        mpv_node_map_add_int64(ta_parent, &stats, "queued-events",
+                               arg->queued_events);
+        mpv_node_map_add_int64(ta_parent, &stats, "dropped-events",
+                               arg->dropped_events);
+        mpv_node_map_add_int64(ta_parent, &stats, "queued-bytes",
+                               arg->out_bytes);
+        mpv_node_map_add(ta_parent, reply_node, "data", &stats);
+        rc = MPV_ERROR_SUCCESS;
+    } else if (!strcmp("set_protocol", cmd)) {
+        if (cmd_node->u.list->num != 2) {
+            rc = MPV_ERROR_INVALID_PARAMETER;
+            goto error;
+        }
+
+        if (cmd_node->u.list->values[1].format != MPV_FORMAT_STRING) {
+            rc = MPV_ERROR_INVALID_PARAMETER;
+            goto error;
+        }
+
+        char *name = cmd_node->u.list->values[1].u.string;
+        if (!strcmp(name, "json")) {
+            arg->want_binary = false;
+        } else if (!strcmp(name, "msgpack")) {
+            arg->want_binary = true;
+        } else {
+            rc = MPV_ERROR_INVALID_PARAMETER;
+            goto error;
+        }
+        rc = MPV_ERROR_SUCCESS;
     } else if (!strcmp("suspend", cmd)) {
         mpv_suspend(arg->client);
         rc = MPV_ERROR_SUCCESS;
@@ -462,17 +558,50 @@ static char *json_execute_command(struct client_arg *arg, void *ta_parent,
 
         rc = mpv_command_node(arg->client, cmd_node, &result_node);
         if (rc >= 0)
-            mpv_node_map_add(ta_parent, &reply_node, "data", &result_node);
+            mpv_node_map_add(ta_parent, reply_node, "data", &result_node);
     }
 
 error:
-    mpv_node_map_add_string(ta_parent, &reply_node, "error", mpv_error_string(rc));
+    mpv_node_map_add_string(ta_parent, reply_node, "error", mpv_error_string(rc));
+}
 
-    char *output = talloc_strdup(ta_parent, "");
-    json_write(&output, &reply_node);
-    output = ta_talloc_strdup_append(output, "\n");
+// Function is allowed to modify src[n].
+static bstr json_execute_command(struct client_arg *arg, void *ta_parent,
+                                 char *src)
+{
+    mpv_node msg_node;
+    mpv_node reply_node = {.format = MPV_FORMAT_NODE_MAP, .u.list = NULL};
 
-    return output;
+    if (json_parse(ta_parent, &msg_node, &src, 3) < 0) {
+        MP_ERR(arg, "malformed JSON received\n");
+        mpv_node_map_add_string(ta_parent, &reply_node, "error",
+                            mpv_error_string(MPV_ERROR_INVALID_PARAMETER));
+    } else {
+        execute_command(arg, ta_parent, &msg_node, &reply_node);
+    }
+
+    return encode_msg(arg, ta_parent, &reply_node);
+}
+
+static bstr binary_execute_command(struct client_arg *arg, void *ta_parent,
+                                   bstr src)
+{
+    mpv_node msg_node;
+    mpv_node reply_node = {.format = MPV_FORMAT_NODE_MAP, .u.list = NULL};
+
+    if (msgpack_parse(ta_parent, &msg_node, &src, 3) < 0 || src.len) {
+        MP_ERR(arg, "malformed MessagePack message received\n");
+        mpv_node_map_add_string(ta_parent, &reply_node, "error",
+                            mpv_error_string(MPV_ERROR_INVALID_PARAMETER));
+    } else if (msg_node.format == MPV_FORMAT_STRING) {
+        // Same as non-JSON text commands.
+        mpv_command_string(arg->client, msg_node.u.string);
+        return (bstr){0};
+    } else {
+        execute_command(arg, ta_parent, &msg_node, &reply_node);
+    }
+
+    return encode_msg(arg, ta_parent, &reply_node);
 }
 
 static char *text_execute_command(struct client_arg *arg, void *tmp, char *src)
@@ -482,175 +611,261 @@ static char *text_execute_command(struct client_arg *arg, void *tmp, char *src)
     return NULL;
 }
 
-static int ipc_write(int fd, const char *buf, size_t count)
+static void queue_msg(struct client_arg *arg, bstr msg)
+{
+    talloc_steal(arg, msg.start);
+    MP_TARRAY_APPEND(arg, arg->out_msgs, arg->num_out_msgs, msg);
+    arg->out_bytes += msg.len;
+}
+
+// Send as much of the queued output as possible without blocking.
+// Returns false on fatal errors.
+static bool flush_output(struct client_arg *arg)
 {
-    while (count > 0) {
-        ssize_t rc = write(fd, buf, count);
-        if (rc <= 0) {
-            if (rc == 0)
-                return -1;
+    while (arg->num_out_msgs) {
+        struct iovec iov[64];
+        int num = MPMIN(arg->num_out_msgs, MP_ARRAY_SIZE(iov));
+        for (int n = 0; n < num; n++) {
+            iov[n] = (struct iovec){
+                .iov_base = arg->out_msgs[n].start,
+                .iov_len = arg->out_msgs[n].len,
+            };
+        }
+        iov[0].iov_base = (char *)iov[0].iov_base + arg->out_pos;
+        iov[0].iov_len -= arg->out_pos;
 
+        ssize_t rc = writev(arg->client_fd, iov, num);
+        if (rc < 0) {
             if (errno == EINTR)
                 continue;
 
             if (errno == EAGAIN)
-                return 0;
+                return true;
+
+            MP_ERR(arg, "Write error (%s)\n", mp_strerror(errno));
+            return false;
+        }
 
-            return rc;
+        arg->out_bytes -= rc;
+
+        size_t written = rc;
+        int done = 0;
+        while (done < num && written >= iov[done].iov_len) {
+            written -= iov[done].iov_len;
+            talloc_free(arg->out_msgs[done].start);
+            arg->out_pos = 0;
+            done++;
         }
+        arg->out_pos += written;
+
+        arg->num_out_msgs -= done;
+        memmove(&arg->out_msgs[0], &arg->out_msgs[done],
+                arg->num_out_msgs * sizeof(arg->out_msgs[0]));
+    }
 
-        count -= rc;
-        buf   += rc;
+    if (arg->dropping) {
+        MP_WARN(arg, "Client caught up, %"PRId64" events were dropped.\n",
+                arg->dropped_events);
+        arg->dropping = false;
     }
 
-    return 0;
+    return true;
 }
 
-static void *client_thread(void *p)
+// Return the length of the next complete message at the start of buf
+// (including the terminator or length prefix), 0 if it's incomplete, or -1
+// on errors.
+static ssize_t next_message_len(struct client_arg *arg, bstr buf)
 {
-    pthread_detach(pthread_self());
+    if (arg->binary) {
+        if (buf.len < 4)
+            return 0;
+        uint32_t len = AV_RB32(buf.start);
+        if (len > MAX_BINARY_MSG) {
+            MP_ERR(arg, "Message too large (%"PRIu32" bytes)\n", len);
+            return -1;
+        }
+        return buf.len - 4 >= len ? 4 + len : 0;
+    }
 
-    int rc;
+    int end = bstrchr(buf, '\n');
+    return end < 0 ? 0 : end + 1;
+}
 
-    struct client_arg *arg = p;
-    bstr client_msg = { talloc_strdup(NULL, ""), 0 };
+// Execute all complete messages in buf, and remove them from it.
+// Returns false on fatal errors.
+static bool handle_input(struct client_arg *arg, bstr *buf)
+{
+    size_t pos = 0;
+    bool ok = true;
+
+    while (ok) {
+        bstr rest = bstr_cut(*buf, pos);
+        ssize_t len = next_message_len(arg, rest);
+        if (len <= 0) {
+            ok = len == 0;
+            break;
+        }
+        pos += len;
+
+        void *tmp = talloc_new(NULL);
+        bstr reply_msg = {0};
 
-    mpthread_set_name(arg->client_name);
+        if (arg->binary) {
+            bstr msg = bstr_splice(rest, 4, len);
+            reply_msg = binary_execute_command(arg, tmp, msg);
+        } else {
+            // Parse the line in place.
+            char *line0 = rest.start;
+            line0[len - 1] = '\0';
+
+            json_skip_whitespace(&line0);
+
+            if (line0[0] == '\0' || line0[0] == '#') {
+                // skip
+            } else if (line0[0] == '{') {
+                reply_msg = json_execute_command(arg, tmp, line0);
+            } else {
+                text_execute_command(arg, tmp, line0);
+            }
+        }
 
-    int pipe_fd = mpv_get_wakeup_pipe(arg->client);
-    if (pipe_fd < 0) {
-        MP_ERR(arg, "Could not get wakeup pipe\n");
-        goto done;
+        if (reply_msg.len && arg->writable)
+            queue_msg(arg, reply_msg);
+
+        // A protocol switch takes effect after the reply to it.
+        arg->binary = arg->want_binary;
+
+        talloc_free(tmp);
     }
 
-    MP_INFO(arg, "Client connected\n");
+    memmove(buf->start, buf->start + pos, buf->len - pos);
+    buf->len -= pos;
+    return ok;
+}
 
-    struct pollfd fds[2] = {
-        {.events = POLLIN, .fd = pipe_fd},
-        {.events = POLLIN, .fd = arg->client_fd},
-    };
+// Read and execute commands until the socket would block, or until the client
+// has too much unsent output.
+static void read_client(struct client_arg *arg)
+{
+    while (arg->out_bytes <= MAX_QUEUED_BYTES) {
+        MP_TARRAY_GROW(arg, arg->in_buf.start, arg->in_buf.len + READ_SIZE);
 
-    fcntl(arg->client_fd, F_SETFL, fcntl(arg->client_fd, F_GETFL, 0) | O_NONBLOCK);
+        ssize_t bytes = read(arg->client_fd, arg->in_buf.start + arg->in_buf.len,
+                             READ_SIZE);
+        if (bytes < 0) {
+            if (errno == EINTR)
+                continue;
 
-    while (1) {
-        rc = poll(fds, 2, -1);
-        if (rc < 0) {
-            MP_ERR(arg, "Poll error\n");
-            continue;
+            if (errno == EAGAIN)
+                break;
+
+            MP_ERR(arg, "Read error (%s)\n", mp_strerror(errno));
+            arg->dead = true;
+            break;
         }
 
-        if (fds[0].revents & POLLIN) {
-            char discard[100];
-            read(pipe_fd, discard, sizeof(discard));
+        if (bytes == 0) {
+            MP_INFO(arg, "Client disconnected\n");
+            arg->dead = true;
+            break;
+        }
 
-            while (1) {
-                mpv_event *event = mpv_wait_event(arg->client, 0);
+        arg->in_buf.len += bytes;
 
-                if (event->event_id == MPV_EVENT_NONE)
-                    break;
+        if (!handle_input(arg, &arg->in_buf)) {
+            arg->dead = true;
+            break;
+        }
 
-                if (event->event_id == MPV_EVENT_SHUTDOWN)
-                    goto done;
+        if (arg->blocking)
+            break;
+    }
+}
 
-                if (!arg->writable)
-                    continue;
+static void read_events(struct client_arg *arg)
+{
+    while (1) {
+        mpv_event *event = mpv_wait_event(arg->client, 0);
 
-                char *event_msg = json_encode_event(event);
-                if (!event_msg) {
-                    MP_ERR(arg, "Encoding error\n");
-                    goto done;
-                }
+        if (event->event_id == MPV_EVENT_NONE)
+            break;
 
-                rc = ipc_write(arg->client_fd, event_msg, strlen(event_msg));
-                talloc_free(event_msg);
-                if (rc < 0) {
-                    MP_ERR(arg, "Write error\n");
-                    goto done;
-                }
-            }
+        if (event->event_id == MPV_EVENT_SHUTDOWN) {
+            arg->dead = true;
+            break;
         }
 
-        if (fds[1].revents & POLLIN) {
-            while (1) {
-                char buf[128];
-                bstr append = { buf, 0 };
-
-                ssize_t bytes = read(arg->client_fd, buf, sizeof(buf));
-                if (bytes < 0) {
-                    if (errno == EAGAIN)
-                        break;
-
-                    MP_ERR(arg, "Read error (%s)\n", mp_strerror(errno));
-                    goto done;
-                }
-
-                if (bytes == 0) {
-                    MP_INFO(arg, "Client disconnected\n");
-                    goto done;
-                }
-
-                append.len = bytes;
-
-                bstr_xappend(NULL, &client_msg, append);
-
-                while (bstrchr(client_msg, '\n') != -1) {
-                    void *tmp = talloc_new(NULL);
-                    bstr rest;
-                    bstr line = bstr_getline(client_msg, &rest);
-                    char *line0 = bstrto0(tmp, line);
-                    talloc_steal(tmp, client_msg.start);
-                    client_msg = bstrdup(NULL, rest);
-
-                    json_skip_whitespace(&line0);
-
-                    char *reply_msg = NULL;
-                    if (line0[0] == '\0' || line0[0] == '#') {
-                        // skip
-                    } else if (line0[0] == '{') {
-                        reply_msg = json_execute_command(arg, tmp, line0);
-                    } else {
-                        reply_msg = text_execute_command(arg, tmp, line0);
-                    }
-
-                    if (reply_msg && arg->writable) {
-                        rc = ipc_write(arg->client_fd, reply_msg,
-                                       strlen(reply_msg));
-                        if (rc < 0) {
-                            MP_ERR(arg, "Write error (%s)\n", mp_strerror(errno));
-                            talloc_free(tmp);
-                            goto done;
-                        }
-                    }
-
-                    talloc_free(tmp);
-                }
-            }
+        if (!arg->writable)
+            continue;
+
+        // Don't let a client that doesn't read its socket accumulate an
+        // unbounded amount of data.
+        if (arg->out_bytes > MAX_QUEUED_BYTES) {
+            if (!arg->dropping)
+                MP_WARN(arg, "Client is not reading, dropping events.\n");
+            arg->dropping = true;
+            arg->dropped_events++;
+            continue;
         }
+
+        bstr event_msg = encode_event(arg, arg, event);
+        if (!event_msg.len) {
+            MP_ERR(arg, "Encoding error\n");
+            arg->dead = true;
+            break;
+        }
+
+        queue_msg(arg, event_msg);
+        arg->queued_events++;
     }
+}
 
-done:
-    if (client_msg.len > 0)
-        MP_WARN(arg, "Ignoring unterminated command on disconnect.\n");
-    talloc_free(client_msg.start);
-    if (arg->close_client_fd)
-        close(arg->client_fd);
-    mpv_detach_destroy(arg->client);
-    talloc_free(arg);
-    return NULL;
+// Called by the client API, with internal locks held.
+static void wakeup_cb(void *p)
+{
+    struct client_arg *arg = p;
+    atomic_store(&arg->need_events, true);
+    write(arg->ipc->wakeup_pipe[1], &(char){0}, 1);
 }
 
 static void ipc_start_client(struct mp_ipc_ctx *ctx, struct client_arg *client)
 {
-    client->client = mp_new_client(ctx->client_api, client->client_name),
-    client->log    = mp_client_get_log(client->client);
-
-    pthread_t client_thr;
-    if (pthread_create(&client_thr, NULL, client_thread, client)) {
-        mpv_detach_destroy(client->client);
+    client->ipc    = ctx;
+    client->client = mp_new_client(ctx->client_api, client->client_name);
+    if (!client->client) {
         if (client->close_client_fd)
             close(client->client_fd);
         talloc_free(client);
+        return;
+    }
+    client->log    = mp_client_get_log(client->client);
+    atomic_store(&client->need_events, true);
+
+    if (!client->blocking) {
+        fcntl(client->client_fd, F_SETFL,
+              fcntl(client->client_fd, F_GETFL, 0) | O_NONBLOCK);
     }
+
+    mpv_set_wakeup_callback(client->client, wakeup_cb, client);
+
+    MP_INFO(client, "Client connected\n");
+
+    MP_TARRAY_APPEND(ctx, ctx->clients, ctx->num_clients, client);
+}
+
+static void ipc_destroy_client(struct mp_ipc_ctx *ctx, int index)
+{
+    struct client_arg *client = ctx->clients[index];
+    MP_TARRAY_REMOVE_AT(ctx->clients, ctx->num_clients, index);
+
+    if (client->in_buf.len > 0)
+        MP_WARN(client, "Ignoring unterminated command on disconnect.\n");
+    if (client->close_client_fd)
+        close(client->client_fd);
+    // Makes sure wakeup_cb() isn't called anymore.
+    mpv_detach_destroy(client->client);
+    talloc_free(client);
 }
 
 static void ipc_start_client_json(struct mp_ipc_ctx *ctx, int id, int fd)
@@ -693,6 +908,7 @@ static void ipc_start_client_text(struct mp_ipc_ctx *ctx, const char *path)
         .client_name = "input-file",
         .client_fd   = client_fd,
         .close_client_fd = close_client_fd,
+        .blocking    = !close_client_fd,
 
         .writable = false,
     };
@@ -700,29 +916,25 @@ static void ipc_start_client_text(struct mp_ipc_ctx *ctx, const char *path)
     ipc_start_client(ctx, client);
 }
 
-static void *ipc_thread(void *p)
+static int ipc_listen(struct mp_ipc_ctx *arg)
 {
     int rc;
 
     int ipc_fd;
     struct sockaddr_un ipc_un;
 
-    struct mp_ipc_ctx *arg = p;
-
-    mpthread_set_name("ipc socket listener");
-
     MP_INFO(arg, "Starting IPC master\n");
 
     ipc_fd = socket(AF_UNIX, SOCK_STREAM, 0);
     if (ipc_fd < 0) {
         MP_ERR(arg, "Could not create IPC socket\n");
-        goto done;
+        goto error;
     }
 
     size_t path_len = strlen(arg->path);
     if (path_len >= sizeof(ipc_un.sun_path) - 1) {
         MP_ERR(arg, "Could not create IPC socket\n");
-        goto done;
+        goto error;
     }
 
     ipc_un.sun_family = AF_UNIX,
@@ -739,47 +951,115 @@ static void *ipc_thread(void *p)
     rc = bind(ipc_fd, (struct sockaddr *) &ipc_un, addr_len);
     if (rc < 0) {
         MP_ERR(arg, "Could not bind IPC socket\n");
-        goto done;
+        goto error;
     }
 
     rc = listen(ipc_fd, 10);
     if (rc < 0) {
         MP_ERR(arg, "Could not listen on IPC socket\n");
-        goto done;
+        goto error;
     }
 
-    int client_num = 0;
+    return ipc_fd;
 
-    struct pollfd fds[2] = {
-        {.events = POLLIN, .fd = arg->death_pipe[0]},
-        {.events = POLLIN, .fd = ipc_fd},
-    };
+error:
+    if (ipc_fd >= 0)
+        close(ipc_fd);
+    return -1;
+}
 
-    while (1) {
-        rc = poll(fds, 2, -1);
+static void *ipc_thread(void *p)
+{
+    int rc;
+
+    struct mp_ipc_ctx *arg = p;
+
+    mpthread_set_name("ipc");
+
+    if (arg->path && arg->path[0])
+        arg->listen_fd = ipc_listen(arg);
+
+    struct pollfd *fds = NULL;
+    int num_fds = 0;
+
+    // After mp_stop_ipc(), keep serving the remaining clients until they
+    // receive MPV_EVENT_SHUTDOWN (which happens after mp_stop_ipc()).
+    while (!arg->terminate || arg->num_clients) {
+        num_fds = 0;
+        struct pollfd fd_death = {.events = POLLIN, .fd = arg->death_pipe[0]};
+        MP_TARRAY_APPEND(arg, fds, num_fds, fd_death);
+        struct pollfd fd_wakeup = {.events = POLLIN, .fd = arg->wakeup_pipe[0]};
+        MP_TARRAY_APPEND(arg, fds, num_fds, fd_wakeup);
+        struct pollfd fd_listen = {.events = POLLIN, .fd = arg->listen_fd};
+        MP_TARRAY_APPEND(arg, fds, num_fds, fd_listen);
+
+        int num_clients = arg->num_clients;
+        for (int n = 0; n < num_clients; n++) {
+            struct client_arg *client = arg->clients[n];
+            struct pollfd fd = {.fd = client->client_fd};
+            if (client->out_bytes <= MAX_QUEUED_BYTES)
+                fd.events |= POLLIN;
+            if (client->num_out_msgs)
+                fd.events |= POLLOUT;
+            MP_TARRAY_APPEND(arg, fds, num_fds, fd);
+        }
+
+        rc = poll(fds, num_fds, -1);
         if (rc < 0) {
-            MP_ERR(arg, "Poll error\n");
+            if (errno != EINTR)
+                MP_ERR(arg, "Poll error\n");
             continue;
         }
 
-        if (fds[0].revents & POLLIN)
-            goto done;
+        if (fds[0].revents & POLLIN) {
+            char discard[100];
+            read(arg->death_pipe[0], discard, sizeof(discard));
+            arg->terminate = true;
+            if (arg->listen_fd >= 0)
+                close(arg->listen_fd);
+            arg->listen_fd = -1;
+        }
 
         if (fds[1].revents & POLLIN) {
-            int client_fd = accept(ipc_fd, NULL, NULL);
+            char discard[100];
+            while (read(arg->wakeup_pipe[0], discard, sizeof(discard)) > 0) {}
+        }
+
+        if (arg->listen_fd >= 0 && (fds[2].revents & POLLIN)) {
+            int client_fd = accept(arg->listen_fd, NULL, NULL);
             if (client_fd < 0) {
                 MP_ERR(arg, "Could not accept IPC client\n");
-                goto done;
+            } else {
+                ipc_start_client_json(arg, arg->client_num++, client_fd);
+            }
+        }
+
+        for (int n = 0; n < num_clients; n++) {
+            struct client_arg *client = arg->clients[n];
+            short revents = fds[3 + n].revents;
+            if (revents & (POLLIN | POLLHUP | POLLERR))
+                read_client(client);
+        }
+
+        for (int n = 0; n < arg->num_clients; n++) {
+            struct client_arg *client = arg->clients[n];
+            if (atomic_load(&client->need_events)) {
+                atomic_store(&client->need_events, false);
+                read_events(client);
             }
+            if (client->num_out_msgs && !flush_output(client))
+                client->dead = true;
+        }
 
-            ipc_start_client_json(arg, client_num++, client_fd);
+        for (int n = arg->num_clients - 1; n >= 0; n--) {
+            if (arg->clients[n]->dead)
+                ipc_destroy_client(arg, n);
         }
     }
 
-done:
-    if (ipc_fd >= 0)
-        close(ipc_fd);
-
+    if (arg->listen_fd >= 0)
+        close(arg->listen_fd);
+    arg->listen_fd = -1;
     return NULL;
 }
 
@@ -794,16 +1074,21 @@ struct mp_ipc_ctx *mp_init_ipc(struct mp_client_api *client_api,
         .client_api = client_api,
         .path       = mp_get_user_path(arg, global, opts->ipc_path),
         .death_pipe = {-1, -1},
+        .wakeup_pipe = {-1, -1},
+        .listen_fd  = -1,
     };
     char *input_file = mp_get_user_path(arg, global, opts->input_file);
 
-    if (input_file && *input_file)
-        ipc_start_client_text(arg, input_file);
+    if (mp_make_wakeup_pipe(arg->death_pipe) < 0)
+        goto out;
 
-    if (!opts->ipc_path || !*opts->ipc_path)
+    if (mp_make_wakeup_pipe(arg->wakeup_pipe) < 0)
         goto out;
 
-    if (mp_make_wakeup_pipe(arg->death_pipe) < 0)
+    if (input_file && *input_file)
+        ipc_start_client_text(arg, input_file);
+
+    if ((!opts->ipc_path || !*opts->ipc_path) && !arg->num_clients)
         goto out;
 
     if (pthread_create(&arg->thread, NULL, ipc_thread, arg))
@@ -812,21 +1097,39 @@ struct mp_ipc_ctx *mp_init_ipc(struct mp_client_api *client_api,
     return arg;
 
 out:
+    while (arg->num_clients)
+        ipc_destroy_client(arg, arg->num_clients - 1);
     close(arg->death_pipe[0]);
     close(arg->death_pipe[1]);
+    close(arg->wakeup_pipe[0]);
+    close(arg->wakeup_pipe[1]);
     talloc_free(arg);
     return NULL;
 }
 
-void mp_uninit_ipc(struct mp_ipc_ctx *arg)
+// Stop accepting new clients. The IPC thread keeps serving the connected
+// clients until they receive MPV_EVENT_SHUTDOWN, and exits after that.
+void mp_stop_ipc(struct mp_ipc_ctx *arg)
 {
     if (!arg)
         return;
 
     write(arg->death_pipe[1], &(char){0}, 1);
+}
+
+// Must be called after all clients were shut down, because the IPC thread
+// waits for its clients to go away.
+void mp_uninit_ipc(struct mp_ipc_ctx *arg)
+{
+    if (!arg)
+        return;
+
+    mp_stop_ipc(arg);
     pthread_join(arg->thread, NULL);
 
     close(arg->death_pipe[0]);
     close(arg->death_pipe[1]);
+    close(arg->wakeup_pipe[0]);
+    close(arg->wakeup_pipe[1]);
     talloc_free(arg);
 }
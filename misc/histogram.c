@@ -0,0 +1,107 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+
+#include <libavutil/common.h>
+
+#include "talloc.h"
+#include "common/common.h"
+#include "osdep/atomics.h"
+#include "histogram.h"
+
+// Each power of 2 is split into 2^SUB_BITS buckets. Values below 2^SUB_BITS
+// get a bucket each.
+#define SUB_BITS 4
+#define SUB_COUNT (1 << SUB_BITS)
+#define NUM_BUCKETS ((32 - SUB_BITS) * SUB_COUNT)
+
+struct mp_histogram {
+    atomic_ullong count;
+    atomic_llong max;
+    atomic_ullong buckets[NUM_BUCKETS];
+};
+
+static int value_to_bucket(uint32_t v)
+{
+    if (v < SUB_COUNT)
+        return v;
+    int e = av_log2(v);
+    return (e - SUB_BITS + 1) * SUB_COUNT + (v >> (e - SUB_BITS)) - SUB_COUNT;
+}
+
+// Middle of the value range covered by the bucket.
+static int64_t bucket_to_value(int b)
+{
+    if (b < SUB_COUNT)
+        return b;
+    int shift = b / SUB_COUNT - 1;
+    int64_t low = (int64_t)(b % SUB_COUNT + SUB_COUNT) << shift;
+    return low + ((1LL << shift) >> 1);
+}
+
+struct mp_histogram *mp_histogram_new(void *talloc_ctx)
+{
+    struct mp_histogram *h = talloc_zero(talloc_ctx, struct mp_histogram);
+    atomic_store(&h->count, 0);
+    atomic_store(&h->max, 0);
+    for (int n = 0; n < NUM_BUCKETS; n++)
+        atomic_store(&h->buckets[n], 0);
+    return h;
+}
+
+void mp_histogram_add(struct mp_histogram *h, int64_t value)
+{
+    value = MPCLAMP(value, 0, INT32_MAX);
+    atomic_fetch_add(&h->buckets[value_to_bucket(value)], 1);
+    atomic_fetch_add(&h->count, 1);
+    long long max = atomic_load(&h->max);
+    while (value > max && !atomic_compare_exchange_strong(&h->max, &max, value))
+        ;
+}
+
+uint64_t mp_histogram_count(struct mp_histogram *h)
+{
+    return atomic_load(&h->count);
+}
+
+int64_t mp_histogram_percentile(struct mp_histogram *h, double fraction)
+{
+    // The buckets are read one by one while values are being added, so use
+    // their sum, instead of the count, which might not match.
+    uint64_t buckets[NUM_BUCKETS];
+    uint64_t total = 0;
+    for (int n = 0; n < NUM_BUCKETS; n++) {
+        buckets[n] = atomic_load(&h->buckets[n]);
+        total += buckets[n];
+    }
+    if (!total)
+        return 0;
+    uint64_t rank = MPMAX(ceil(MPCLAMP(fraction, 0, 1) * total), 1);
+    uint64_t sum = 0;
+    for (int n = 0; n < NUM_BUCKETS; n++) {
+        sum += buckets[n];
+        if (sum >= rank)
+            return MPMIN(bucket_to_value(n), mp_histogram_max(h));
+    }
+    return mp_histogram_max(h);
+}
+
+int64_t mp_histogram_max(struct mp_histogram *h)
+{
+    return atomic_load(&h->max);
+}
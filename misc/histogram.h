@@ -0,0 +1,52 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPV_MP_HISTOGRAM_H
+#define MPV_MP_HISTOGRAM_H
+
+#include <stdint.h>
+
+/**
+ * Histogram of non-negative integer values with logarithmic buckets (with a
+ * relative error of at most 1/32). Adding values and reading percentiles
+ * don't take locks, and can be done from any thread. Values larger than
+ * INT32_MAX are clamped.
+ */
+
+struct mp_histogram;
+
+struct mp_histogram *mp_histogram_new(void *talloc_ctx);
+
+void mp_histogram_add(struct mp_histogram *h, int64_t value);
+
+/**
+ * Number of values added so far.
+ */
+uint64_t mp_histogram_count(struct mp_histogram *h);
+
+/**
+ * Return the approximate value below which the given fraction (0-1) of the
+ * values are. Returns 0 if the histogram is empty.
+ */
+int64_t mp_histogram_percentile(struct mp_histogram *h, double fraction);
+
+/**
+ * Largest value added so far (exact).
+ */
+int64_t mp_histogram_max(struct mp_histogram *h);
+
+#endif
@@ -0,0 +1,312 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* MessagePack parser/writer, mapping to and from mpv_node.
+ *
+ * Only the subset of MessagePack that can be represented by mpv_node is
+ * supported: nil, booleans, integers (unsigned integers above INT64_MAX are
+ * rejected), floats, strings, arrays, and maps with string keys. The parser
+ * also accepts the bin types as strings. Extension types are not supported.
+ *
+ * Strings can't contain 0 bytes, because mpv_node uses 0-terminated strings.
+ * The parser cuts them off at the first 0 byte.
+ *
+ * The writer always uses the shortest representation for integers, strings
+ * and lists, and writes doubles as float 64.
+ *
+ * Also see: https://github.com/msgpack/msgpack/blob/master/spec.md
+ */
+
+#include <string.h>
+#include <limits.h>
+#include <inttypes.h>
+
+#include <libavutil/intreadwrite.h>
+
+#include "common/common.h"
+#include "misc/bstr.h"
+
+#include "msgpack.h"
+
+static bool read_bytes(bstr *src, int len, unsigned char **data)
+{
+    if (len < 0 || src->len < len)
+        return false;
+    *data = src->start;
+    *src = bstr_cut(*src, len);
+    return true;
+}
+
+// Read an unsigned big endian integer with 1, 2, 4 or 8 bytes.
+static bool read_uint(bstr *src, int bytes, uint64_t *out)
+{
+    unsigned char *p;
+    if (!read_bytes(src, bytes, &p))
+        return false;
+    switch (bytes) {
+    case 1: *out = p[0]; break;
+    case 2: *out = AV_RB16(p); break;
+    case 4: *out = AV_RB32(p); break;
+    case 8: *out = AV_RB64(p); break;
+    }
+    return true;
+}
+
+static int read_str(void *ta_parent, char **dst, bstr *src, uint64_t len)
+{
+    unsigned char *data;
+    if (len > INT_MAX || !read_bytes(src, len, &data))
+        return -1;
+    *dst = talloc_strndup(ta_parent, (char *)data, len);
+    return 0;
+}
+
+static int read_list(void *ta_parent, struct mpv_node *dst, bstr *src,
+                     uint64_t num, bool is_map, int max_depth)
+{
+    // Every element needs at least 1 byte; avoid huge allocations for broken
+    // input.
+    if (num > src->len)
+        return -1;
+    struct mpv_node_list *list = talloc_zero(ta_parent, struct mpv_node_list);
+    list->values = talloc_array(list, struct mpv_node, num);
+    if (is_map)
+        list->keys = talloc_array(list, char *, num);
+    for (list->num = 0; list->num < num; list->num++) {
+        if (is_map) {
+            struct mpv_node key;
+            if (msgpack_parse(list, &key, src, max_depth) < 0)
+                return -1;
+            if (key.format != MPV_FORMAT_STRING)
+                return -1; // key is not a string
+            list->keys[list->num] = key.u.string;
+        }
+        if (msgpack_parse(ta_parent, &list->values[list->num], src, max_depth) < 0)
+            return -1;
+    }
+    dst->format = is_map ? MPV_FORMAT_NODE_MAP : MPV_FORMAT_NODE_ARRAY;
+    dst->u.list = list;
+    return 0;
+}
+
+/* Parse a single MessagePack object from *src, and write the result into *dst.
+ * max_depth limits the recursion and tree depth.
+ * Returns:
+ *   0: success, *dst is valid, *src is advanced past the object
+ *  -1: failure, *dst is invalid, there may be dead allocs under ta_parent
+ *      (ta_free_children(ta_parent) is the only way to free them)
+ * Unlike json_parse(), the input is not modified, and all strings in *dst
+ * are allocated under ta_parent.
+ */
+int msgpack_parse(void *ta_parent, struct mpv_node *dst, bstr *src,
+                  int max_depth)
+{
+    max_depth -= 1;
+    if (max_depth < 0)
+        return -1;
+
+    unsigned char *p;
+    if (!read_bytes(src, 1, &p))
+        return -1; // early EOF
+    unsigned char c = p[0];
+
+    uint64_t u;
+    if (c <= 0x7f) { // positive fixint
+        dst->format = MPV_FORMAT_INT64;
+        dst->u.int64 = c;
+        return 0;
+    } else if (c >= 0xe0) { // negative fixint
+        dst->format = MPV_FORMAT_INT64;
+        dst->u.int64 = (int8_t)c;
+        return 0;
+    } else if (c >= 0x80 && c <= 0x8f) {
+        return read_list(ta_parent, dst, src, c & 0xf, true, max_depth);
+    } else if (c >= 0x90 && c <= 0x9f) {
+        return read_list(ta_parent, dst, src, c & 0xf, false, max_depth);
+    } else if (c >= 0xa0 && c <= 0xbf) {
+        dst->format = MPV_FORMAT_STRING;
+        return read_str(ta_parent, &dst->u.string, src, c & 0x1f);
+    }
+
+    switch (c) {
+    case 0xc0:
+        dst->format = MPV_FORMAT_NONE;
+        return 0;
+    case 0xc2:
+    case 0xc3:
+        dst->format = MPV_FORMAT_FLAG;
+        dst->u.flag = c == 0xc3;
+        return 0;
+    case 0xc4: case 0xc5: case 0xc6: // bin 8/16/32
+    case 0xd9: case 0xda: case 0xdb: // str 8/16/32
+        if (!read_uint(src, 1 << ((c - (c >= 0xd9 ? 0xd9 : 0xc4))), &u))
+            return -1;
+        dst->format = MPV_FORMAT_STRING;
+        return read_str(ta_parent, &dst->u.string, src, u);
+    case 0xca: { // float 32
+        if (!read_uint(src, 4, &u))
+            return -1;
+        union { uint32_t i; float f; } v = { .i = u };
+        dst->format = MPV_FORMAT_DOUBLE;
+        dst->u.double_ = v.f;
+        return 0;
+    }
+    case 0xcb: { // float 64
+        if (!read_uint(src, 8, &u))
+            return -1;
+        union { uint64_t i; double f; } v = { .i = u };
+        dst->format = MPV_FORMAT_DOUBLE;
+        dst->u.double_ = v.f;
+        return 0;
+    }
+    case 0xcc: case 0xcd: case 0xce: case 0xcf: // uint 8/16/32/64
+        if (!read_uint(src, 1 << (c - 0xcc), &u) || u > INT64_MAX)
+            return -1;
+        dst->format = MPV_FORMAT_INT64;
+        dst->u.int64 = u;
+        return 0;
+    case 0xd0: case 0xd1: case 0xd2: case 0xd3: { // int 8/16/32/64
+        int bytes = 1 << (c - 0xd0);
+        if (!read_uint(src, bytes, &u))
+            return -1;
+        // sign extend
+        int shift = 64 - bytes * 8;
+        dst->format = MPV_FORMAT_INT64;
+        dst->u.int64 = (int64_t)(u << shift) >> shift;
+        return 0;
+    }
+    case 0xdc: case 0xdd: // array 16/32
+        if (!read_uint(src, c == 0xdc ? 2 : 4, &u))
+            return -1;
+        return read_list(ta_parent, dst, src, u, false, max_depth);
+    case 0xde: case 0xdf: // map 16/32
+        if (!read_uint(src, c == 0xde ? 2 : 4, &u))
+            return -1;
+        return read_list(ta_parent, dst, src, u, true, max_depth);
+    }
+    return -1; // unsupported type
+}
+
+static void append_byte(bstr *b, unsigned char c)
+{
+    bstr_xappend(NULL, b, (bstr){&c, 1});
+}
+
+static void append_uint(bstr *b, unsigned char type, int bytes, uint64_t v)
+{
+    unsigned char buf[9] = {type};
+    switch (bytes) {
+    case 1: buf[1] = v; break;
+    case 2: AV_WB16(buf + 1, v); break;
+    case 4: AV_WB32(buf + 1, v); break;
+    case 8: AV_WB64(buf + 1, v); break;
+    }
+    bstr_xappend(NULL, b, (bstr){buf, bytes + 1});
+}
+
+// Write a type byte with the length of a str/array/map. fix is the type byte
+// for the "fix" variant (if fix_max is not 0), type16 the type byte for the
+// 16 bit variant (type32 is assumed to follow it).
+static void append_len(bstr *b, unsigned char fix, uint64_t fix_max,
+                       unsigned char type8, unsigned char type16, uint64_t len)
+{
+    if (len <= fix_max) {
+        append_byte(b, fix | len);
+    } else if (type8 && len <= UINT8_MAX) {
+        append_uint(b, type8, 1, len);
+    } else if (len <= UINT16_MAX) {
+        append_uint(b, type16, 2, len);
+    } else {
+        append_uint(b, type16 + 1, 4, len);
+    }
+}
+
+static void append_int(bstr *b, int64_t v)
+{
+    if (v >= 0 && v <= 0x7f) {
+        append_byte(b, v);
+    } else if (v < 0 && v >= -32) {
+        append_byte(b, (uint8_t)v);
+    } else if (v >= INT8_MIN && v <= INT8_MAX) {
+        append_uint(b, 0xd0, 1, (uint8_t)v);
+    } else if (v >= INT16_MIN && v <= INT16_MAX) {
+        append_uint(b, 0xd1, 2, (uint16_t)v);
+    } else if (v >= INT32_MIN && v <= INT32_MAX) {
+        append_uint(b, 0xd2, 4, (uint32_t)v);
+    } else {
+        append_uint(b, 0xd3, 8, v);
+    }
+}
+
+static void append_str(bstr *b, const char *str)
+{
+    size_t len = strlen(str);
+    append_len(b, 0xa0, 31, 0xd9, 0xda, len);
+    bstr_xappend(NULL, b, (bstr){(unsigned char *)str, len});
+}
+
+static int msgpack_append(bstr *b, const struct mpv_node *src)
+{
+    switch (src->format) {
+    case MPV_FORMAT_NONE:
+        append_byte(b, 0xc0);
+        return 0;
+    case MPV_FORMAT_FLAG:
+        append_byte(b, src->u.flag ? 0xc3 : 0xc2);
+        return 0;
+    case MPV_FORMAT_INT64:
+        append_int(b, src->u.int64);
+        return 0;
+    case MPV_FORMAT_DOUBLE: {
+        union { double f; uint64_t i; } v = { .f = src->u.double_ };
+        append_uint(b, 0xcb, 8, v.i);
+        return 0;
+    }
+    case MPV_FORMAT_STRING:
+        append_str(b, src->u.string);
+        return 0;
+    case MPV_FORMAT_NODE_ARRAY:
+    case MPV_FORMAT_NODE_MAP: {
+        struct mpv_node_list *list = src->u.list;
+        bool is_map = src->format == MPV_FORMAT_NODE_MAP;
+        int num = list ? list->num : 0;
+        if (is_map) {
+            append_len(b, 0x80, 15, 0, 0xde, num);
+        } else {
+            append_len(b, 0x90, 15, 0, 0xdc, num);
+        }
+        for (int n = 0; n < num; n++) {
+            if (is_map)
+                append_str(b, list->keys[n]);
+            if (msgpack_append(b, &list->values[n]) < 0)
+                return -1;
+        }
+        return 0;
+    }
+    }
+    return -1; // unknown format
+}
+
+/* Write the contents of *src as MessagePack, and append it to *dst.
+ * dst->start must be NULL or a talloc allocation; it's extended with
+ * ta_realloc() as needed.
+ * Returns: 0 on success, <0 on failure.
+ */
+int msgpack_write(bstr *dst, struct mpv_node *src)
+{
+    return msgpack_append(dst, src);
+}
@@ -80,28 +80,72 @@ static bool translate_legacy_property(struct mp_log *log, const char *name,
     return true;
 }
 
-static struct m_property *m_property_list_find(const struct m_property *list,
-                                                     const char *name)
+struct m_property_table {
+    const struct m_property *list;
+    int *slots;             // index into list, or -1 if the slot is unused
+    unsigned mask;          // number of slots - 1 (power of 2)
+};
+
+// FNV-1a
+static unsigned hash_name(bstr name)
+{
+    uint32_t h = 2166136261u;
+    for (int n = 0; n < name.len; n++)
+        h = (h ^ name.start[n]) * 16777619u;
+    return h;
+}
+
+// Build an open addressing hash table over a (static) property list, so that
+// looking up properties doesn't require scanning the whole list. The list is
+// referenced, and must stay valid as long as the table is used.
+struct m_property_table *m_property_table_create(void *ta_parent,
+                                                 const struct m_property *list)
+{
+    struct m_property_table *t = talloc_zero(ta_parent, struct m_property_table);
+    t->list = list;
+    int num = 0;
+    while (list && list[num].name)
+        num++;
+    unsigned size = 16;
+    while (size < num * 2)
+        size *= 2;
+    t->mask = size - 1;
+    t->slots = talloc_array(t, int, size);
+    for (int n = 0; n < size; n++)
+        t->slots[n] = -1;
+    for (int n = 0; n < num; n++) {
+        bstr name = bstr0(list[n].name);
+        // With duplicate names, the first entry wins (like a linear search).
+        if (m_property_table_find(t, name) >= 0)
+            continue;
+        unsigned i = hash_name(name) & t->mask;
+        while (t->slots[i] >= 0)
+            i = (i + 1) & t->mask;
+        t->slots[i] = n;
+    }
+    return t;
+}
+
+int m_property_table_find(const struct m_property_table *t, bstr name)
 {
-    for (int n = 0; list && list[n].name; n++) {
-        if (strcmp(list[n].name, name) == 0)
-            return (struct m_property *)&list[n];
+    for (unsigned i = hash_name(name) & t->mask; t->slots[i] >= 0;
+         i = (i + 1) & t->mask)
+    {
+        if (bstr_equals0(name, t->list[t->slots[i]].name))
+            return t->slots[i];
     }
-    return NULL;
+    return -1;
 }
 
-static int do_action(const struct m_property *prop_list, const char *name,
+static int do_action(const struct m_property_table *props, const char *name,
                      int action, void *arg, void *ctx)
 {
     const char *sep;
-    struct m_property *prop;
+    int index;
     struct m_property_action_arg ka;
     if ((sep = strchr(name, '/')) && sep[1]) {
-        int len = sep - name;
-        char base[len + 1];
-        memcpy(base, name, len);
-        base[len] = 0;
-        prop = m_property_list_find(prop_list, base);
+        bstr base = bstr_splice(bstr0(name), 0, sep - name);
+        index = m_property_table_find(props, base);
         ka = (struct m_property_action_arg) {
             .key = sep + 1,
             .action = action,
@@ -110,14 +154,15 @@ static int do_action(const struct m_property *prop_list, const char *name,
         action = M_PROPERTY_KEY_ACTION;
         arg = &ka;
     } else
-        prop = m_property_list_find(prop_list, name);
-    if (!prop)
+        index = m_property_table_find(props, bstr0(name));
+    if (index < 0)
         return M_PROPERTY_UNKNOWN;
+    struct m_property *prop = (struct m_property *)&props->list[index];
     return prop->call(ctx, prop, action, arg);
 }
 
 // (as a hack, log can be NULL on read-only paths)
-int m_property_do(struct mp_log *log, const struct m_property *prop_list,
+int m_property_do(struct mp_log *log, const struct m_property_table *prop_list,
                   const char *in_name, int action, void *arg, void *ctx)
 {
     union m_option_value val = {0};
@@ -257,7 +302,7 @@ static void m_property_unkey(int *action, void **arg)
     }
 }
 
-static int m_property_do_bstr(const struct m_property *prop_list, bstr name,
+static int m_property_do_bstr(const struct m_property_table *prop_list, bstr name,
                               int action, void *arg, void *ctx)
 {
     char name0[64];
@@ -274,7 +319,7 @@ static void append_str(char **s, int *len, bstr append)
     *len = *len + append.len;
 }
 
-static int expand_property(const struct m_property *prop_list, char **ret,
+static int expand_property(const struct m_property_table *prop_list, char **ret,
                            int *ret_len, bstr prop, bool silent_error, void *ctx)
 {
     bool cond_yes = bstr_eatstart0(&prop, "?");
@@ -305,7 +350,7 @@ static int expand_property(const struct m_property *prop_list, char **ret,
     return skip;
 }
 
-char *m_properties_expand_string(const struct m_property *prop_list,
+char *m_properties_expand_string(const struct m_property_table *prop_list,
                                  const char *str0, void *ctx)
 {
     char *ret = NULL;
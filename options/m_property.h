@@ -129,11 +129,22 @@ struct m_property {
     void *priv;
 };
 
+// Hash table for looking up properties by name. Created once for a static
+// property list (terminated by an entry with name==NULL).
+struct m_property_table;
+struct m_property_table *m_property_table_create(void *ta_parent,
+                                                 const struct m_property *list);
+
+// Return the index of the property with the given name in the list the table
+// was created from, or -1 if there is no such property. This does no prefix
+// or sub-property handling.
+int m_property_table_find(const struct m_property_table *t, bstr name);
+
 // Access a property.
 // action: one of m_property_action
 // ctx: opaque value passed through to property implementation
 // returns: one of mp_property_return
-int m_property_do(struct mp_log *log, const struct m_property* prop_list,
+int m_property_do(struct mp_log *log, const struct m_property_table *prop_list,
                   const char* property_name, int action, void* arg, void *ctx);
 
 // Given a path of the form "a/b/c", this function will set *prefix to "a",
@@ -158,7 +169,7 @@ void m_properties_print_help_list(struct mp_log *log,
 // STR is recursively expanded using the same rules.
 // "$$" can be used to escape "$", and "$}" to escape "}".
 // "$>" disables parsing of "$" for the rest of the string.
-char* m_properties_expand_string(const struct m_property *prop_list,
+char* m_properties_expand_string(const struct m_property_table *prop_list,
                                  const char *str, void *ctx);
 
 // Trivial helpers for implementing properties.
@@ -185,6 +196,8 @@ struct m_sub_property {
 // Convenience macros which can be used as part of a sub_property entry.
 #define SUB_PROP_INT(i) \
     .type = {.type = CONF_TYPE_INT}, .value = {.int_ = (i)}
+#define SUB_PROP_INT64(i) \
+    .type = {.type = CONF_TYPE_INT64}, .value = {.int64 = (i)}
 #define SUB_PROP_STR(s) \
     .type = {.type = CONF_TYPE_STRING}, .value = {.string = (char *)(s)}
 #define SUB_PROP_FLOAT(f) \
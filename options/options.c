@@ -108,6 +108,7 @@ const m_option_t mp_opts[] = {
     OPT_GENERAL(char*, "msg-level", msglevels, CONF_GLOBAL|CONF_PRE_PARSE,
                 .type = &m_option_type_msglevels),
     OPT_STRING("dump-stats", dump_stats, CONF_GLOBAL | CONF_PRE_PARSE),
+    OPT_STRING("trace-file", trace_file, CONF_GLOBAL),
     OPT_FLAG("msg-color", msg_color, CONF_GLOBAL | CONF_PRE_PARSE),
     OPT_FLAG("msg-module", msg_module, CONF_GLOBAL),
     OPT_FLAG("msg-time", msg_time, CONF_GLOBAL),
@@ -146,6 +147,8 @@ const m_option_t mp_opts[] = {
     OPT_INTRANGE("cache-seek-min", stream_cache.seek_min, 0, 0, 0x7fffffff),
     OPT_STRING("cache-file", stream_cache.file, M_OPT_FILE),
     OPT_INTRANGE("cache-file-size", stream_cache.file_max, 0, 0, 0x7fffffff),
+    OPT_STRING("cache-file-dir", stream_cache.file_dir, M_OPT_FILE),
+    OPT_INTRANGE("cache-file-dir-size", stream_cache.file_dir_max, 0, 0, 0x7fffffff),
 
 #if HAVE_DVDREAD || HAVE_DVDNAV
     OPT_STRING("dvd-device", dvd_device, M_OPT_FILE),
@@ -192,6 +195,7 @@ const m_option_t mp_opts[] = {
                 {"always", 2})),
 
     OPT_CHOICE("index", index_mode, 0, ({"default", 1}, {"recreate", 0})),
+    OPT_STRING("index-cache-dir", index_cache_dir, 0),
 
     // select audio/video/subtitle stream
     OPT_TRACKCHOICE("aid", audio_id),
@@ -227,6 +231,7 @@ const m_option_t mp_opts[] = {
     OPT_DOUBLE("demuxer-readahead-secs", demuxer_min_secs, M_OPT_MIN, .min = 0),
     OPT_INTRANGE("demuxer-readahead-packets", demuxer_min_packs, 0, 0, MAX_PACKS),
     OPT_INTRANGE("demuxer-readahead-bytes", demuxer_min_bytes, 0, 0, MAX_PACK_BYTES),
+    OPT_INTRANGE("demuxer-seek-cache-bytes", demuxer_seek_cache_bytes, 0, 0, INT_MAX),
 
     OPT_DOUBLE("cache-secs", demuxer_min_secs_cache, M_OPT_MIN, .min = 0),
     OPT_FLAG("cache-pause", cache_pausing, 0),
@@ -387,6 +392,8 @@ const m_option_t mp_opts[] = {
                 {"weak", -1})),
     OPT_DOUBLE("audio-buffer", audio_buffer, M_OPT_MIN | M_OPT_MAX,
                .min = 0, .max = 10),
+    OPT_DOUBLE("ad-queue-secs", ad_queue_secs, M_OPT_MIN | M_OPT_MAX,
+               .min = 0, .max = 10),
 
     OPT_GEOMETRY("geometry", vo.geometry, 0),
     OPT_SIZE_BOX("autofit", vo.autofit, 0),
@@ -484,11 +491,15 @@ const m_option_t mp_opts[] = {
                 {"decoder+vo", 3})),
 
     OPT_DOUBLE("display-fps", frame_drop_fps, M_OPT_MIN, .min = 0),
+    OPT_INTRANGE("vo-queue-frames", vo_queue_frames, 0, 1, 32),
+    OPT_INTRANGE("vd-queue-frames", vd_queue_frames, 0, 0, 64),
 
     OPT_FLAG("untimed", untimed, M_OPT_FIXED),
+    OPT_FLAG("benchmark", benchmark, M_OPT_FIXED),
 
     OPT_STRING("stream-capture", stream_capture, M_OPT_FIXED | M_OPT_FILE),
     OPT_STRING("stream-dump", stream_dump, M_OPT_FIXED | M_OPT_FILE),
+    OPT_FLAG("stream-mmap", stream_mmap, 0),
 
     OPT_FLAG("stop-playback-on-init-failure", stop_playback_on_init_failure, 0),
 
@@ -578,7 +589,6 @@ const m_option_t mp_opts[] = {
     OPT_REMOVED("ass-bottom-margin", "use --vf=sub=bottom:top"),
     OPT_REPLACED("ass", "sub-ass"),
     OPT_REPLACED("audiofile", "audio-file"),
-    OPT_REMOVED("benchmark", "use --untimed (no stats)"),
     OPT_REMOVED("capture", "use --stream-capture=<filename>"),
     OPT_REMOVED("channels", "use --audio-channels (changed semantics)"),
     OPT_REPLACED("cursor-autohide-delay", "cursor-autohide"),
@@ -717,6 +727,7 @@ const struct MPOpts mp_default_opts = {
         .initial = 0,
         .seek_min = 500,
         .file_max = 1024 * 1024,
+        .file_dir_max = 10 * 1024 * 1024,
     },
     .demuxer_thread = 1,
     .demuxer_min_packs = 0,
@@ -733,6 +744,7 @@ const struct MPOpts mp_default_opts = {
     .user_pts_assoc_mode = 1,
     .initial_audio_sync = 1,
     .frame_dropping = 1,
+    .vo_queue_frames = 1,
     .term_osd = 2,
     .term_osd_bar_chars = "[-+-]",
     .consolecontrols = 1,
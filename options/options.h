@@ -47,12 +47,15 @@ struct mp_cache_opts {
     int seek_min;
     char *file;
     int file_max;
+    char *file_dir;
+    int file_dir_max;
 };
 
 typedef struct MPOpts {
     int use_terminal;
     char *msglevels;
     char *dump_stats;
+    char *trace_file;
     int verbose;
     int msg_color;
     int msg_module;
@@ -79,6 +82,7 @@ typedef struct MPOpts {
     float softvol_max;
     int gapless_audio;
     double audio_buffer;
+    double ad_queue_secs;
 
     mp_vo_opts vo;
     int allow_win_drag;
@@ -113,8 +117,10 @@ typedef struct MPOpts {
     int osd_duration;
     int osd_fractions;
     int untimed;
+    int benchmark;
     char *stream_capture;
     char *stream_dump;
+    int stream_mmap;
     int stop_playback_on_init_failure;
     int loop_times;
     int loop_file;
@@ -146,6 +152,8 @@ typedef struct MPOpts {
     int autosync;
     int frame_dropping;
     double frame_drop_fps;
+    int vo_queue_frames;
+    int vd_queue_frames;
     int term_osd;
     int term_osd_bar;
     char *term_osd_bar_chars;
@@ -197,6 +205,7 @@ typedef struct MPOpts {
     int demuxer_min_packs;
     int demuxer_min_bytes;
     double demuxer_min_secs;
+    int demuxer_seek_cache_bytes;
     char *audio_demuxer_name;
     char *sub_demuxer_name;
     int mkv_subtitle_preroll;
@@ -211,6 +220,7 @@ typedef struct MPOpts {
 
     double force_fps;
     int index_mode;
+    char *index_cache_dir;
 
     struct mp_chmap audio_output_channels;
     int audio_output_format;
@@ -41,6 +41,16 @@ typedef struct { volatile unsigned long long v; } atomic_ullong;
 #define ATOMIC_VAR_INIT(x) \
     {.v = (x)}
 
+// Fences are always full barriers; the order is ignored.
+typedef enum {
+    memory_order_relaxed,
+    memory_order_consume,
+    memory_order_acquire,
+    memory_order_release,
+    memory_order_acq_rel,
+    memory_order_seq_cst,
+} memory_order;
+
 #if HAVE_ATOMIC_BUILTINS
 
 #define atomic_load(p) \
@@ -52,6 +62,8 @@ typedef struct { volatile unsigned long long v; } atomic_ullong;
 #define atomic_compare_exchange_strong(a, b, c) \
     __atomic_compare_exchange_n(&(a)->v, b, c, 0, __ATOMIC_SEQ_CST, \
     __ATOMIC_SEQ_CST)
+#define atomic_thread_fence(order) \
+    __atomic_thread_fence(__ATOMIC_SEQ_CST)
 
 #elif HAVE_SYNC_BUILTINS
 
@@ -67,6 +79,8 @@ typedef struct { volatile unsigned long long v; } atomic_ullong;
        bool ok_ = val_ == *(old);       \
        if (!ok_) *(old) = val_;         \
        ok_; })
+#define atomic_thread_fence(order) \
+    __sync_synchronize()
 
 #else
 
@@ -77,6 +91,7 @@ typedef struct { volatile unsigned long long v; } atomic_ullong;
 #define atomic_fetch_add(a, b) (((a)->v += (b)) - (b))
 #define atomic_compare_exchange_strong(p, old, new) \
     ((p)->v == *(old) ? ((p)->v = (new), 1) : (*(old) = (p)->v, 0))
+#define atomic_thread_fence(order) ((void)0)
 
 #undef HAVE_ATOMICS
 #define HAVE_ATOMICS 0
@@ -21,6 +21,7 @@
 #include <time.h>
 #include <math.h>
 #include <sys/time.h>
+#include <mach/mach.h>
 #include <mach/mach_time.h>
 
 #include "config.h"
@@ -41,6 +42,20 @@ uint64_t mp_raw_time_us(void)
     return mach_absolute_time() * timebase_ratio * 1e6;
 }
 
+int64_t mp_thread_cpu_time_us(void)
+{
+    thread_basic_info_data_t info;
+    mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+    mach_port_t thread = mach_thread_self();
+    kern_return_t r = thread_info(thread, THREAD_BASIC_INFO,
+                                  (thread_info_t)&info, &count);
+    mach_port_deallocate(mach_task_self(), thread);
+    if (r != KERN_SUCCESS)
+        return 0;
+    return (info.user_time.seconds + info.system_time.seconds) * 1000000LL +
+           info.user_time.microseconds + info.system_time.microseconds;
+}
+
 void mp_raw_time_init(void)
 {
     struct mach_timebase_info timebase;
@@ -62,6 +62,21 @@ uint64_t mp_raw_time_us(void)
 }
 #endif
 
+#if defined(_POSIX_THREAD_CPUTIME) && _POSIX_THREAD_CPUTIME >= 0
+int64_t mp_thread_cpu_time_us(void)
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+        return 0;
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+#else
+int64_t mp_thread_cpu_time_us(void)
+{
+    return 0;
+}
+#endif
+
 void mp_raw_time_init(void)
 {
 }
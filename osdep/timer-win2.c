@@ -43,6 +43,17 @@ uint64_t mp_raw_time_us(void)
     return tv.tv_sec * 1000000LL + tv.tv_usec;
 }
 
+int64_t mp_thread_cpu_time_us(void)
+{
+    FILETIME create, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &create, &exit, &kernel, &user))
+        return 0;
+    // In 100ns units.
+    uint64_t k = ((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+    uint64_t u = ((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime;
+    return (k + u) / 10;
+}
+
 static void restore_timer(void)
 {
     // The MSDN documents that begin/end "must" be matched. This satisfies
@@ -38,6 +38,8 @@
 #include "audio/filter/af.h"
 #include "audio/out/ao.h"
 #include "demux/demux.h"
+#include "input/input.h"
+#include "osdep/timer.h"
 #include "video/decode/dec_video.h"
 
 #include "core.h"
@@ -60,10 +62,8 @@ static int try_filter(struct MPContext *mpctx,
     return 1;
 }
 
-static int recreate_audio_filters(struct MPContext *mpctx)
+static int recreate_audio_filters_locked(struct MPContext *mpctx)
 {
-    assert(mpctx->d_audio);
-
     struct MPOpts *opts = mpctx->opts;
     struct af_stream *afs = mpctx->d_audio->afilter;
 
@@ -109,19 +109,32 @@ static int recreate_audio_filters(struct MPContext *mpctx)
     return 0;
 }
 
+static int recreate_audio_filters(struct MPContext *mpctx)
+{
+    assert(mpctx->d_audio);
+
+    struct af_stream *afs = mpctx->d_audio->afilter;
+    af_lock(afs);
+    int r = recreate_audio_filters_locked(mpctx);
+    af_unlock(afs);
+    return r;
+}
+
 int reinit_audio_filters(struct MPContext *mpctx)
 {
     struct dec_audio *d_audio = mpctx->d_audio;
     if (!d_audio)
         return 0;
 
-    af_uninit(mpctx->d_audio->afilter);
-    if (af_init(mpctx->d_audio->afilter) < 0)
-        return -1;
-    if (recreate_audio_filters(mpctx) < 0)
-        return -1;
+    struct af_stream *afs = d_audio->afilter;
+    af_lock(afs);
+    af_uninit(afs);
+    int r = 1;
+    if (af_init(afs) < 0 || recreate_audio_filters_locked(mpctx) < 0)
+        r = -1;
+    af_unlock(afs);
 
-    return 1;
+    return r;
 }
 
 void set_playback_speed(struct MPContext *mpctx, double new_speed)
@@ -146,10 +159,15 @@ void reset_audio_state(struct MPContext *mpctx)
     if (mpctx->ao_buffer)
         mp_audio_buffer_clear(mpctx->ao_buffer);
     mpctx->audio_status = mpctx->d_audio ? STATUS_SYNCING : STATUS_EOF;
+    mpctx->audio_drain_time = 0;
+    mpctx->audio_short_cause = -1;
 }
 
 void uninit_audio_out(struct MPContext *mpctx)
 {
+    // The decoder thread writes audio in the AO format.
+    if (mpctx->d_audio)
+        audio_stop_thread(mpctx->d_audio);
     if (mpctx->ao) {
         // Note: with gapless_audio, stop_play is not correctly set
         if (mpctx->opts->gapless_audio || mpctx->stop_play == AT_END_OF_FILE)
@@ -175,6 +193,12 @@ void uninit_audio_chain(struct MPContext *mpctx)
     }
 }
 
+static void wakeup_audio(void *ctx)
+{
+    struct MPContext *mpctx = ctx;
+    mp_input_wakeup(mpctx->input);
+}
+
 void reinit_audio_chain(struct MPContext *mpctx)
 {
     struct MPOpts *opts = mpctx->opts;
@@ -192,6 +216,7 @@ void reinit_audio_chain(struct MPContext *mpctx)
         mpctx->d_audio->log = mp_log_new(mpctx->d_audio, mpctx->log, "!ad");
         mpctx->d_audio->global = mpctx->global;
         mpctx->d_audio->opts = opts;
+        mpctx->d_audio->measure_cpu = opts->benchmark;
         mpctx->d_audio->header = sh;
         mpctx->d_audio->pool = mp_audio_pool_create(mpctx->d_audio);
         mpctx->d_audio->afilter = af_new(mpctx->global);
@@ -209,6 +234,9 @@ void reinit_audio_chain(struct MPContext *mpctx)
     }
     assert(mpctx->d_audio);
 
+    // The filter chain is reconfigured below.
+    audio_stop_thread(mpctx->d_audio);
+
     struct mp_audio in_format = mpctx->d_audio->decode_format;
 
     if (!mp_audio_config_valid(&in_format)) {
@@ -286,6 +314,16 @@ void reinit_audio_chain(struct MPContext *mpctx)
 
     set_playback_speed(mpctx, opts->playback_speed);
 
+    // The decoder thread reads packets concurrently with the playloop, which
+    // works only if the demuxer runs in its own thread.
+    if (opts->ad_queue_secs > 0 && opts->demuxer_thread &&
+        track->demuxer == mpctx->demuxer)
+    {
+        if (!audio_start_thread(mpctx->d_audio, opts->ad_queue_secs,
+                                wakeup_audio, mpctx))
+            MP_WARN(mpctx, "Could not start audio decoder thread.\n");
+    }
+
     return;
 
 init_error:
@@ -304,31 +342,14 @@ double written_audio_pts(struct MPContext *mpctx)
     if (!d_audio)
         return MP_NOPTS_VALUE;
 
-    struct mp_audio in_format = d_audio->decode_format;
-
-    if (!mp_audio_config_valid(&in_format) || d_audio->afilter->initialized < 1)
-        return MP_NOPTS_VALUE;
-
-    // first calculate the end pts of audio that has been output by decoder
-    double a_pts = d_audio->pts;
+    // First get the end pts of audio that has been output by the decoder,
+    // minus decoded but not filtered data. Data buffered in audio filters
+    // (and the decoder thread) is measured in seconds of "missing" output.
+    double buffered_output;
+    double a_pts = audio_get_pts(d_audio, &buffered_output);
     if (a_pts == MP_NOPTS_VALUE)
         return MP_NOPTS_VALUE;
 
-    // d_audio->pts is the timestamp of the latest input packet with
-    // known pts that the decoder has decoded. d_audio->pts_bytes is
-    // the amount of bytes the decoder has written after that timestamp.
-    a_pts += d_audio->pts_offset / (double)in_format.rate;
-
-    // Now a_pts hopefully holds the pts for end of audio from decoder.
-    // Subtract data in buffers between decoder and audio out.
-
-    // Decoded but not filtered
-    if (d_audio->waiting)
-        a_pts -= d_audio->waiting->samples / (double)in_format.rate;
-
-    // Data buffered in audio filters, measured in seconds of "missing" output
-    double buffered_output = af_calc_delay(d_audio->afilter);
-
     // Data that was ready for ao but was buffered because ao didn't fully
     // accept everything to internal buffers yet
     buffered_output += mp_audio_buffer_seconds(mpctx->ao_buffer);
@@ -435,6 +456,25 @@ static bool get_sync_samples(struct MPContext *mpctx, int *skip)
     return true;
 }
 
+// Count an underrun if the AO played out everything written to it since the
+// last call. The cause is the reason the last decoder read returned too little
+// data, or if there was none, the playloop not running in time.
+static void check_underrun(struct MPContext *mpctx)
+{
+    if (mpctx->audio_status != STATUS_PLAYING || mpctx->paused) {
+        mpctx->audio_drain_time = 0;
+        return;
+    }
+    if (!mpctx->audio_drain_time || mp_time_us() < mpctx->audio_drain_time)
+        return;
+    int cause = mpctx->audio_short_cause;
+    if (cause < 0)
+        cause = UNDERRUN_PLAYLOOP;
+    mpctx->audio_underruns[cause]++;
+    mpctx->audio_drain_time = 0;
+    MP_VERBOSE(mpctx, "Audio underrun.\n");
+}
+
 static void do_fill_audio_out_buffers(struct MPContext *mpctx, double endpts)
 {
     struct MPOpts *opts = mpctx->opts;
@@ -451,6 +491,8 @@ static void do_fill_audio_out_buffers(struct MPContext *mpctx, double endpts)
         return;
 
     if (d_audio->afilter->initialized < 1 || !mpctx->ao) {
+        // reinit_audio_chain() starts the decoder thread again.
+        audio_stop_thread(d_audio);
         // Probe the initial audio format. Returns AD_OK (and does nothing) if
         // the format is already known.
         int r = initial_audio_decode(mpctx->d_audio);
@@ -484,6 +526,8 @@ static void do_fill_audio_out_buffers(struct MPContext *mpctx, double endpts)
     if (!mpctx->paused)
         playsize = ao_get_space(mpctx->ao);
 
+    check_underrun(mpctx);
+
     int skip = 0;
     bool sync_known = get_sync_samples(mpctx, &skip);
     if (skip > 0) {
@@ -493,21 +537,33 @@ static void do_fill_audio_out_buffers(struct MPContext *mpctx, double endpts)
     }
 
     int status = AD_OK;
-    if (playsize > mp_audio_buffer_samples(mpctx->ao_buffer)) {
+    if (d_audio->thread) {
+        // Always called, because it also lets the thread continue reading.
+        status = audio_read_decoded(d_audio, mpctx->ao_buffer, playsize);
+    } else if (playsize > mp_audio_buffer_samples(mpctx->ao_buffer)) {
         status = audio_decode(d_audio, mpctx->ao_buffer, playsize);
-        if (status == AD_WAIT)
+    }
+    mpctx->audio_short_cause = -1;
+    if (status == AD_WAIT) {
+        struct audio_decode_stats s;
+        bool demux_waiting = !audio_get_thread_stats(d_audio, &s) || s.waiting;
+        mpctx->audio_short_cause = demux_waiting ? UNDERRUN_DEMUX
+                                                 : UNDERRUN_DECODE;
+        // The decoder thread might have returned some data; play it.
+        if (!d_audio->thread || mpctx->audio_status != STATUS_PLAYING)
             return;
-        if (status == AD_NEW_FMT) {
-            /* The format change isn't handled too gracefully. A more precise
-             * implementation would require draining buffered old-format audio
-             * while displaying video, then doing the output format switch.
-             */
-            if (mpctx->opts->gapless_audio < 1)
-                uninit_audio_out(mpctx);
-            reinit_audio_chain(mpctx);
-            mpctx->sleeptime = 0;
-            return; // retry on next iteration
-        }
+        status = AD_OK;
+    }
+    if (status == AD_NEW_FMT) {
+        /* The format change isn't handled too gracefully. A more precise
+         * implementation would require draining buffered old-format audio
+         * while displaying video, then doing the output format switch.
+         */
+        if (mpctx->opts->gapless_audio < 1)
+            uninit_audio_out(mpctx);
+        reinit_audio_chain(mpctx);
+        mpctx->sleeptime = 0;
+        return; // retry on next iteration
     }
 
     // If EOF was reached before, but now something can be decoded, try to
@@ -591,6 +647,11 @@ static void do_fill_audio_out_buffers(struct MPContext *mpctx, double endpts)
     assert(played >= 0 && played <= data.samples);
     mp_audio_buffer_skip(mpctx->ao_buffer, played);
 
+    if (played > 0 && !ao_untimed(mpctx->ao)) {
+        mpctx->audio_drain_time =
+            mp_time_us() + ao_get_delay(mpctx->ao) * 1e6;
+    }
+
     mpctx->audio_status = STATUS_PLAYING;
     if (audio_eof) {
         mpctx->audio_status = STATUS_DRAINING;
@@ -63,11 +63,21 @@ struct mp_client_api {
     struct mpv_handle **clients;
     int num_clients;
     uint64_t event_masks;   // combined events of all clients, or 0 if unknown
+    // Observed properties of all clients, indexed by property ID + 1 (unknown
+    // properties have the ID -1).
+    struct observer_list *observers;
+    int num_observers;
+};
+
+struct observer_list {
+    struct observe_property **props;
+    int num_props;
 };
 
 struct observe_property {
     char *name;
     int id;                 // ==mp_get_property_id(name)
+    int index;              // position in mpv_handle.properties
     uint64_t event_mask;    // ==mp_get_property_event_mask(name)
     int64_t reply_id;
     mpv_format format;
@@ -128,6 +138,8 @@ struct mpv_handle {
 
 static bool gen_property_change_event(struct mpv_handle *ctx);
 static void notify_property_events(struct mpv_handle *ctx, uint64_t event_mask);
+static void remove_observer(struct mp_client_api *clients,
+                            struct observe_property *prop);
 
 void mp_clients_init(struct MPContext *mpctx)
 {
@@ -378,6 +390,8 @@ void mpv_detach_destroy(mpv_handle *ctx)
     for (int n = 0; n < clients->num_clients; n++) {
         if (clients->clients[n] == ctx) {
             MP_TARRAY_REMOVE_AT(clients->clients, clients->num_clients, n);
+            for (int i = 0; i < ctx->num_properties; i++)
+                remove_observer(clients, ctx->properties[i]);
             while (ctx->num_events) {
                 talloc_free(ctx->events[ctx->first_event].data);
                 ctx->first_event = (ctx->first_event + 1) % ctx->max_events;
@@ -1292,6 +1306,35 @@ static void property_free(void *p)
     }
 }
 
+// Called with clients->lock held.
+static void add_observer(struct mp_client_api *clients,
+                         struct observe_property *prop)
+{
+    int slot = prop->id + 1;
+    if (slot >= clients->num_observers) {
+        clients->observers = talloc_realloc(clients, clients->observers,
+                                            struct observer_list, slot + 1);
+        for (int n = clients->num_observers; n <= slot; n++)
+            clients->observers[n] = (struct observer_list){0};
+        clients->num_observers = slot + 1;
+    }
+    struct observer_list *list = &clients->observers[slot];
+    MP_TARRAY_APPEND(clients, list->props, list->num_props, prop);
+}
+
+// Called with clients->lock held.
+static void remove_observer(struct mp_client_api *clients,
+                            struct observe_property *prop)
+{
+    struct observer_list *list = &clients->observers[prop->id + 1];
+    for (int n = 0; n < list->num_props; n++) {
+        if (list->props[n] == prop) {
+            MP_TARRAY_REMOVE_AT(list->props, list->num_props, n);
+            break;
+        }
+    }
+}
+
 int mpv_observe_property(mpv_handle *ctx, uint64_t userdata,
                          const char *name, mpv_format format)
 {
@@ -1301,6 +1344,8 @@ int mpv_observe_property(mpv_handle *ctx, uint64_t userdata,
     if (format == MPV_FORMAT_OSD_STRING)
         return MPV_ERROR_PROPERTY_FORMAT;
 
+    struct mp_client_api *clients = ctx->clients;
+    pthread_mutex_lock(&clients->lock);
     pthread_mutex_lock(&ctx->lock);
     struct observe_property *prop = talloc_ptrtype(ctx, prop);
     talloc_set_destructor(prop, property_free);
@@ -1308,6 +1353,7 @@ int mpv_observe_property(mpv_handle *ctx, uint64_t userdata,
         .client = ctx,
         .name = talloc_strdup(prop, name),
         .id = mp_get_property_id(name),
+        .index = ctx->num_properties,
         .event_mask = mp_get_property_event_mask(name),
         .reply_id = userdata,
         .format = format,
@@ -1315,15 +1361,19 @@ int mpv_observe_property(mpv_handle *ctx, uint64_t userdata,
         .need_new_value = true,
     };
     MP_TARRAY_APPEND(ctx, ctx->properties, ctx->num_properties, prop);
+    add_observer(clients, prop);
     ctx->property_event_masks |= prop->event_mask;
     ctx->lowest_changed = 0;
     pthread_mutex_unlock(&ctx->lock);
+    pthread_mutex_unlock(&clients->lock);
     invalidate_global_event_mask(ctx);
     return 0;
 }
 
 int mpv_unobserve_property(mpv_handle *ctx, uint64_t userdata)
 {
+    struct mp_client_api *clients = ctx->clients;
+    pthread_mutex_lock(&clients->lock);
     pthread_mutex_lock(&ctx->lock);
     ctx->property_event_masks = 0;
     int count = 0;
@@ -1340,24 +1390,28 @@ int mpv_unobserve_property(mpv_handle *ctx, uint64_t userdata)
                 talloc_steal(ctx->cur_event, prop);
             }
             MP_TARRAY_REMOVE_AT(ctx->properties, ctx->num_properties, n);
+            remove_observer(clients, prop);
             count++;
         }
         if (!prop->dead)
             ctx->property_event_masks |= prop->event_mask;
     }
+    for (int n = 0; n < ctx->num_properties; n++)
+        ctx->properties[n]->index = n;
     ctx->lowest_changed = 0;
     pthread_mutex_unlock(&ctx->lock);
+    pthread_mutex_unlock(&clients->lock);
     invalidate_global_event_mask(ctx);
     return count;
 }
 
-static void mark_property_changed(struct mpv_handle *client, int index)
+static void mark_property_changed(struct mpv_handle *client,
+                                  struct observe_property *prop)
 {
-    struct observe_property *prop = client->properties[index];
     if (!prop->changed && !prop->need_new_value) {
         prop->changed = true;
         prop->need_new_value = prop->format != 0;
-        client->lowest_changed = MPMIN(client->lowest_changed, index);
+        client->lowest_changed = MPMIN(client->lowest_changed, prop->index);
     }
 }
 
@@ -1369,16 +1423,18 @@ void mp_client_property_change(struct MPContext *mpctx, const char *name)
 
     pthread_mutex_lock(&clients->lock);
 
-    for (int n = 0; n < clients->num_clients; n++) {
-        struct mpv_handle *client = clients->clients[n];
-        pthread_mutex_lock(&client->lock);
-        for (int i = 0; i < client->num_properties; i++) {
-            if (client->properties[i]->id == id)
-                mark_property_changed(client, i);
+    // Only the properties observed under this ID need to be looked at.
+    if (id + 1 < clients->num_observers) {
+        struct observer_list *list = &clients->observers[id + 1];
+        for (int n = 0; n < list->num_props; n++) {
+            struct observe_property *prop = list->props[n];
+            struct mpv_handle *client = prop->client;
+            pthread_mutex_lock(&client->lock);
+            mark_property_changed(client, prop);
+            if (client->lowest_changed < client->num_properties)
+                wakeup_client(client);
+            pthread_mutex_unlock(&client->lock);
         }
-        if (client->lowest_changed < client->num_properties)
-            wakeup_client(client);
-        pthread_mutex_unlock(&client->lock);
     }
 
     pthread_mutex_unlock(&clients->lock);
@@ -1390,46 +1446,64 @@ static void notify_property_events(struct mpv_handle *ctx, uint64_t event_mask)
 {
     for (int i = 0; i < ctx->num_properties; i++) {
         if (ctx->properties[i]->event_mask & event_mask)
-            mark_property_changed(ctx, i);
+            mark_property_changed(ctx, ctx->properties[i]);
     }
     if (ctx->lowest_changed < ctx->num_properties)
         wakeup_client(ctx);
 }
 
-static void update_prop(void *p)
+// A set of observed properties of a client, whose values are retrieved with
+// a single dispatch call.
+struct update_batch {
+    struct mpv_handle *ctx;
+    struct observe_property **props;
+    int num_props;
+};
+
+static void update_props(void *p)
 {
-    struct observe_property *prop = p;
-    struct mpv_handle *ctx = prop->client;
+    struct update_batch *batch = p;
+    struct mpv_handle *ctx = batch->ctx;
 
-    const struct m_option *type = get_mp_type_get(prop->format);
-    union m_option_value val = {0};
+    union m_option_value *vals =
+        talloc_zero_array(batch, union m_option_value, batch->num_props);
+    int *status = talloc_array(batch, int, batch->num_props);
 
-    struct getproperty_request req = {
-        .mpctx = ctx->mpctx,
-        .name = prop->name,
-        .format = prop->format,
-        .data = &val,
-    };
-
-    getproperty_fn(&req);
+    for (int n = 0; n < batch->num_props; n++) {
+        struct observe_property *prop = batch->props[n];
+        struct getproperty_request req = {
+            .mpctx = ctx->mpctx,
+            .name = prop->name,
+            .format = prop->format,
+            .data = &vals[n],
+        };
+        getproperty_fn(&req);
+        status[n] = req.status;
+    }
 
     pthread_mutex_lock(&ctx->lock);
-    ctx->properties_updating--;
-    prop->updating = false;
-    m_option_free(type, &prop->new_value);
-    prop->new_value_valid = req.status >= 0;
-    if (prop->new_value_valid)
-        memcpy(&prop->new_value, &val, type->type->size);
-    if (prop->user_value_valid != prop->new_value_valid) {
-        prop->changed = true;
-    } else if (prop->user_value_valid && prop->new_value_valid) {
-        if (!compare_value(&prop->user_value, &prop->new_value, prop->format))
+    for (int n = 0; n < batch->num_props; n++) {
+        struct observe_property *prop = batch->props[n];
+        const struct m_option *type = get_mp_type_get(prop->format);
+        ctx->properties_updating--;
+        prop->updating = false;
+        m_option_free(type, &prop->new_value);
+        prop->new_value_valid = status[n] >= 0;
+        if (prop->new_value_valid)
+            memcpy(&prop->new_value, &vals[n], type->type->size);
+        if (prop->user_value_valid != prop->new_value_valid) {
             prop->changed = true;
+        } else if (prop->user_value_valid && prop->new_value_valid) {
+            if (!compare_value(&prop->user_value, &prop->new_value, prop->format))
+                prop->changed = true;
+        }
+        if (prop->dead)
+            talloc_steal(ctx->cur_event, prop);
     }
-    if (prop->dead)
-        talloc_steal(ctx->cur_event, prop);
     wakeup_client(ctx);
     pthread_mutex_unlock(&ctx->lock);
+
+    talloc_free(batch);
 }
 
 // Set ctx->cur_event to a generated property change event, if there is any
@@ -1440,36 +1514,52 @@ static bool gen_property_change_event(struct mpv_handle *ctx)
         return false;
     int start = ctx->lowest_changed;
     ctx->lowest_changed = ctx->num_properties;
+
+    // Retrieve the values of all changed properties at once, instead of
+    // interrupting the playback thread for each property separately. Once
+    // they're updated, the change events are returned back to back.
+    struct update_batch *batch = NULL;
+    for (int n = start; n < ctx->num_properties; n++) {
+        struct observe_property *prop = ctx->properties[n];
+        if (prop->changed && prop->need_new_value && prop->format) {
+            prop->need_new_value = false;
+            prop->changed = false;
+            prop->updating = true;
+            if (!batch) {
+                batch = talloc_ptrtype(NULL, batch);
+                *batch = (struct update_batch){ .ctx = ctx };
+            }
+            MP_TARRAY_APPEND(batch, batch->props, batch->num_props, prop);
+        }
+    }
+    if (batch) {
+        ctx->properties_updating += batch->num_props;
+        mp_dispatch_enqueue(ctx->mpctx->dispatch, update_props, batch);
+    }
+
     for (int n = start; n < ctx->num_properties; n++) {
         struct observe_property *prop = ctx->properties[n];
         if ((prop->changed || prop->updating) && n < ctx->lowest_changed)
             ctx->lowest_changed = n;
         if (prop->changed) {
-            bool get_value = prop->need_new_value;
             prop->need_new_value = false;
             prop->changed = false;
-            if (prop->format && get_value) {
-                ctx->properties_updating++;
-                prop->updating = true;
-                mp_dispatch_enqueue(ctx->mpctx->dispatch, update_prop, prop);
-            } else {
-                const struct m_option *type = get_mp_type_get(prop->format);
-                prop->user_value_valid = prop->new_value_valid;
-                if (prop->new_value_valid)
-                    m_option_copy(type, &prop->user_value, &prop->new_value);
-                ctx->cur_property_event = (struct mpv_event_property){
-                    .name = prop->name,
-                    .format = prop->user_value_valid ? prop->format : 0,
-                };
-                if (prop->user_value_valid)
-                    ctx->cur_property_event.data = &prop->user_value;
-                *ctx->cur_event = (struct mpv_event){
-                    .event_id = MPV_EVENT_PROPERTY_CHANGE,
-                    .reply_userdata = prop->reply_id,
-                    .data = &ctx->cur_property_event,
-                };
-                return true;
-            }
+            const struct m_option *type = get_mp_type_get(prop->format);
+            prop->user_value_valid = prop->new_value_valid;
+            if (prop->new_value_valid)
+                m_option_copy(type, &prop->user_value, &prop->new_value);
+            ctx->cur_property_event = (struct mpv_event_property){
+                .name = prop->name,
+                .format = prop->user_value_valid ? prop->format : 0,
+            };
+            if (prop->user_value_valid)
+                ctx->cur_property_event.data = &prop->user_value;
+            *ctx->cur_event = (struct mpv_event){
+                .event_id = MPV_EVENT_PROPERTY_CHANGE,
+                .reply_userdata = prop->reply_id,
+                .data = &ctx->cur_property_event,
+            };
+            return true;
         }
     }
     return false;
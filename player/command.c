@@ -43,6 +43,7 @@
 #include "demux/demux.h"
 #include "demux/stheader.h"
 #include "common/playlist.h"
+#include "common/trace.h"
 #include "sub/osd.h"
 #include "sub/dec_sub.h"
 #include "options/m_option.h"
@@ -60,6 +61,7 @@
 #include "audio/decode/dec_audio.h"
 #include "options/path.h"
 #include "screenshot.h"
+#include "misc/histogram.h"
 #ifndef __MINGW32__
 #include <sys/wait.h>
 #endif
@@ -544,6 +546,48 @@ static int mp_property_vo_drop_frame_count(void *ctx, struct m_property *prop,
     return m_property_int_ro(action, arg, vo_get_drop_count(mpctx->video_out));
 }
 
+/// Latency percentiles of the displayed frames, per stage (RO)
+static int mp_property_frame_latency(void *ctx, struct m_property *prop,
+                                     int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    if (!mpctx->d_video || !mpctx->video_out)
+        return M_PROPERTY_UNAVAILABLE;
+
+#define STAGE_KEYS(s) {s "-p50", s "-p95", s "-p99", s "-max", s "-count"}
+    static const char *const keys[VO_LATENCY_COUNT][5] = {
+        [VO_LATENCY_DEMUX]      = STAGE_KEYS("demux"),
+        [VO_LATENCY_DECODE]     = STAGE_KEYS("decode"),
+        [VO_LATENCY_FILTER]     = STAGE_KEYS("filter"),
+        [VO_LATENCY_QUEUE]      = STAGE_KEYS("queue"),
+        [VO_LATENCY_DISPLAY]    = STAGE_KEYS("display"),
+        [VO_LATENCY_TOTAL]      = STAGE_KEYS("total"),
+    };
+#undef STAGE_KEYS
+
+    struct m_sub_property props[VO_LATENCY_COUNT * 5 + 1] = {{0}};
+    int num = 0;
+    for (int n = 0; n < VO_LATENCY_COUNT; n++) {
+        struct mp_histogram *h = vo_get_latency(mpctx->video_out, n);
+        uint64_t count = mp_histogram_count(h);
+        // In milliseconds.
+        double values[] = {
+            mp_histogram_percentile(h, 0.50) / 1000.0,
+            mp_histogram_percentile(h, 0.95) / 1000.0,
+            mp_histogram_percentile(h, 0.99) / 1000.0,
+            mp_histogram_max(h) / 1000.0,
+        };
+        for (int i = 0; i < 4; i++) {
+            props[num++] = (struct m_sub_property){keys[n][i],
+                SUB_PROP_DOUBLE(values[i]), .unavailable = !count};
+        }
+        props[num++] = (struct m_sub_property){keys[n][4],
+            SUB_PROP_INT64(count)};
+    }
+
+    return m_property_read_sub(props, action, arg);
+}
+
 /// Current position in percent (RW)
 static int mp_property_percent_pos(void *ctx, struct m_property *prop,
                                    int action, void *arg)
@@ -1006,6 +1050,11 @@ static int mp_property_angle(void *ctx, struct m_property *prop,
         if (angle < 0 || angle > angles)
             return M_PROPERTY_ERROR;
 
+        if (mpctx->d_video)
+            video_quiesce_decoding(mpctx->d_video);
+        if (mpctx->d_audio)
+            audio_quiesce_decoding(mpctx->d_audio);
+
         demux_pause(demuxer);
         demux_flush(demuxer);
         ris = demux_stream_control(demuxer, STREAM_CTRL_SET_ANGLE, &angle);
@@ -1349,6 +1398,36 @@ static int mp_property_cache_idle(void *ctx, struct m_property *prop,
     return m_property_flag_ro(action, arg, !!idle);
 }
 
+static int get_cache_range_entry(int item, int action, void *arg, void *ctx)
+{
+    struct stream_cache_ranges *r = ctx;
+    struct m_sub_property props[] = {
+        {"start",       SUB_PROP_INT64(r->ranges[item].start)},
+        {"end",         SUB_PROP_INT64(r->ranges[item].end)},
+        {0}
+    };
+
+    return m_property_read_sub(props, action, arg);
+}
+
+static int mp_property_cache_ranges(void *ctx, struct m_property *prop,
+                                    int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    if (!mpctx->demuxer)
+        return M_PROPERTY_UNAVAILABLE;
+
+    struct stream_cache_ranges r = {0};
+    if (demux_stream_control(mpctx->demuxer, STREAM_CTRL_GET_CACHE_RANGES,
+                             &r) != STREAM_OK)
+        return M_PROPERTY_UNAVAILABLE;
+
+    int res = m_property_read_list(action, arg, r.num_ranges,
+                                   get_cache_range_entry, &r);
+    talloc_free(r.ranges);
+    return res;
+}
+
 static int mp_property_demuxer_cache_duration(void *ctx, struct m_property *prop,
                                               int action, void *arg)
 {
@@ -1380,6 +1459,71 @@ static int mp_property_demuxer_cache_idle(void *ctx, struct m_property *prop,
     return m_property_flag_ro(action, arg, s.idle);
 }
 
+static int mp_property_demuxer_packet_pool(void *ctx, struct m_property *prop,
+                                           int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    if (!mpctx->demuxer || !mpctx->demuxer->packet_pool)
+        return M_PROPERTY_UNAVAILABLE;
+
+    struct demux_packet_pool_stats s;
+    demux_packet_pool_get_stats(mpctx->demuxer->packet_pool, &s);
+
+    struct m_sub_property props[] = {
+        {"hits",            SUB_PROP_INT64(s.hits)},
+        {"misses",          SUB_PROP_INT64(s.misses)},
+        {"buffer-hits",     SUB_PROP_INT64(s.buffer_hits)},
+        {"buffer-misses",   SUB_PROP_INT64(s.buffer_misses)},
+        {"free-packets",    SUB_PROP_INT(s.free_packets)},
+        {"free-buffers",    SUB_PROP_INT(s.free_buffers)},
+        {0}
+    };
+
+    return m_property_read_sub(props, action, arg);
+}
+
+static int mp_property_demuxer_lock_contention(void *ctx,
+                                               struct m_property *prop,
+                                               int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    if (!mpctx->demuxer)
+        return M_PROPERTY_UNAVAILABLE;
+
+    int64_t count = 0;
+    if (demux_control(mpctx->demuxer, DEMUXER_CTRL_GET_LOCK_CONTENTION,
+                      &count) < 1)
+        return M_PROPERTY_UNAVAILABLE;
+
+    return m_property_int64_ro(action, arg, count);
+}
+
+static int mp_property_demuxer_seek_cache(void *ctx, struct m_property *prop,
+                                          int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    if (!mpctx->demuxer)
+        return M_PROPERTY_UNAVAILABLE;
+
+    struct demux_seek_cache_state s;
+    demux_get_seek_cache_state(mpctx->demuxer, &s);
+    if (!s.max_bytes)
+        return M_PROPERTY_UNAVAILABLE;
+
+    bool have_range = s.start != MP_NOPTS_VALUE;
+    struct m_sub_property props[] = {
+        {"bytes",           SUB_PROP_INT64(s.bytes)},
+        {"max-bytes",       SUB_PROP_INT64(s.max_bytes)},
+        {"hits",            SUB_PROP_INT64(s.hits)},
+        {"misses",          SUB_PROP_INT64(s.misses)},
+        {"start",           SUB_PROP_DOUBLE(s.start), .unavailable = !have_range},
+        {"end",             SUB_PROP_DOUBLE(s.end), .unavailable = !have_range},
+        {0}
+    };
+
+    return m_property_read_sub(props, action, arg);
+}
+
 static int mp_property_paused_for_cache(void *ctx, struct m_property *prop,
                                         int action, void *arg)
 {
@@ -1595,14 +1739,39 @@ static int mp_property_audio_bitrate(void *ctx, struct m_property *prop,
     return m_property_int_ro(action, arg, mpctx->d_audio->bitrate);
 }
 
+static int mp_property_audio_underruns(void *ctx, struct m_property *prop,
+                                       int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    if (!mpctx->d_audio)
+        return M_PROPERTY_UNAVAILABLE;
+    struct audio_decode_stats s = {0};
+    bool threaded = audio_get_thread_stats(mpctx->d_audio, &s);
+
+    int64_t *count = mpctx->audio_underruns;
+    struct m_sub_property props[] = {
+        {"demux",       SUB_PROP_INT64(count[UNDERRUN_DEMUX])},
+        {"decode",      SUB_PROP_INT64(count[UNDERRUN_DECODE])},
+        {"playloop",    SUB_PROP_INT64(count[UNDERRUN_PLAYLOOP])},
+        {"buffered",    SUB_PROP_DOUBLE(s.buffered), .unavailable = !threaded},
+        {"target",      SUB_PROP_DOUBLE(s.target), .unavailable = !threaded},
+        {0}
+    };
+
+    return m_property_read_sub(props, action, arg);
+}
+
 /// Samplerate (RO)
 static int mp_property_samplerate(void *ctx, struct m_property *prop,
                                   int action, void *arg)
 {
     MPContext *mpctx = ctx;
     struct mp_audio fmt = {0};
-    if (mpctx->d_audio)
+    if (mpctx->d_audio) {
+        af_lock(mpctx->d_audio->afilter);
         fmt = mpctx->d_audio->decode_format;
+        af_unlock(mpctx->d_audio->afilter);
+    }
     if (!fmt.rate)
         return M_PROPERTY_UNAVAILABLE;
     if (action == M_PROPERTY_PRINT) {
@@ -1618,8 +1787,11 @@ static int mp_property_channels(void *ctx, struct m_property *prop,
 {
     MPContext *mpctx = ctx;
     struct mp_audio fmt = {0};
-    if (mpctx->d_audio)
+    if (mpctx->d_audio) {
+        af_lock(mpctx->d_audio->afilter);
         fmt = mpctx->d_audio->decode_format;
+        af_unlock(mpctx->d_audio->afilter);
+    }
     if (!fmt.channels.num)
         return M_PROPERTY_UNAVAILABLE;
     switch (action) {
@@ -2594,6 +2766,29 @@ static int mp_property_fps(void *ctx, struct m_property *prop,
     return m_property_float_ro(action, arg, fps);
 }
 
+static int mp_property_video_decode_queue(void *ctx, struct m_property *prop,
+                                          int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    struct dec_video *d_video = mpctx->d_video;
+    struct video_decode_stats s;
+    if (!d_video || !video_get_thread_stats(d_video, &s))
+        return M_PROPERTY_UNAVAILABLE;
+
+    double filter_time = d_video->filter_time_us / 1e6 /
+                         MPMAX(d_video->num_filtered, 1);
+    struct m_sub_property props[] = {
+        {"frames",          SUB_PROP_INT(s.queued)},
+        {"max-frames",      SUB_PROP_INT(s.max_queued)},
+        {"decode-time",     SUB_PROP_DOUBLE(s.decode_time)},
+        {"queue-time",      SUB_PROP_DOUBLE(s.queue_time)},
+        {"filter-time",     SUB_PROP_DOUBLE(filter_time)},
+        {0}
+    };
+
+    return m_property_read_sub(props, action, arg);
+}
+
 static int mp_property_vf_fps(void *ctx, struct m_property *prop,
                               int action, void *arg)
 {
@@ -2988,6 +3183,47 @@ static int mp_property_af(void *ctx, struct m_property *prop,
     return property_filter(prop, action, arg, ctx, STREAM_AUDIO);
 }
 
+static struct af_instance *get_af_entry(struct af_stream *s, int item)
+{
+    struct af_instance *af = s->first->next;
+    for (int n = 0; n < item && af != s->last; n++)
+        af = af->next;
+    return af;
+}
+
+static int get_af_timing_entry(int item, int action, void *arg, void *ctx)
+{
+    struct af_stream *s = ctx;
+    struct af_instance *af = get_af_entry(s, item);
+    struct m_sub_property props[] = {
+        {"name",        SUB_PROP_STR(af->info->name)},
+        {"label",       SUB_PROP_STR(af->label), .unavailable = !af->label},
+        {"auto",        SUB_PROP_FLAG(af->auto_inserted)},
+        {"time",        SUB_PROP_DOUBLE(af->time_us / 1e6)},
+        {"calls",       SUB_PROP_INT64(af->num_calls)},
+        {"samples",     SUB_PROP_INT64(af->num_samples)},
+        {0}
+    };
+
+    return m_property_read_sub(props, action, arg);
+}
+
+static int mp_property_af_timing(void *ctx, struct m_property *prop,
+                                 int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    if (!mpctx->d_audio || !mpctx->d_audio->afilter)
+        return M_PROPERTY_UNAVAILABLE;
+    struct af_stream *s = mpctx->d_audio->afilter;
+    af_lock(s);
+    int count = 0;
+    for (struct af_instance *af = s->first->next; af != s->last; af = af->next)
+        count++;
+    int r = m_property_read_list(action, arg, count, get_af_timing_entry, s);
+    af_unlock(s);
+    return r;
+}
+
 static int mp_property_ab_loop(void *ctx, struct m_property *prop,
                                int action, void *arg)
 {
@@ -3231,6 +3467,7 @@ static const struct m_property mp_properties[] = {
     {"total-avsync-change", mp_property_total_avsync_change},
     {"drop-frame-count", mp_property_drop_frame_cnt},
     {"vo-drop-frame-count", mp_property_vo_drop_frame_count},
+    {"frame-latency", mp_property_frame_latency},
     {"percent-pos", mp_property_percent_pos},
     {"time-start", mp_property_time_start},
     {"time-pos", mp_property_time_pos},
@@ -3258,8 +3495,12 @@ static const struct m_property mp_properties[] = {
     {"cache-used", mp_property_cache_used},
     {"cache-size", mp_property_cache_size},
     {"cache-idle", mp_property_cache_idle},
+    {"cache-ranges", mp_property_cache_ranges},
     {"demuxer-cache-duration", mp_property_demuxer_cache_duration},
     {"demuxer-cache-idle", mp_property_demuxer_cache_idle},
+    {"demuxer-packet-pool", mp_property_demuxer_packet_pool},
+    {"demuxer-lock-contention", mp_property_demuxer_lock_contention},
+    {"demuxer-seek-cache", mp_property_demuxer_seek_cache},
     {"cache-buffering-state", mp_property_cache_buffering},
     {"paused-for-cache", mp_property_paused_for_cache},
     {"pts-association-mode", mp_property_generic_option},
@@ -3284,6 +3525,7 @@ static const struct m_property mp_properties[] = {
     {"audio-format", mp_property_audio_format},
     {"audio-codec", mp_property_audio_codec},
     {"audio-bitrate", mp_property_audio_bitrate},
+    {"audio-underruns", mp_property_audio_underruns},
     {"audio-samplerate", mp_property_samplerate},
     {"audio-channels", mp_property_channels},
     {"aid", mp_property_audio},
@@ -3328,6 +3570,7 @@ static const struct m_property mp_properties[] = {
     {"vo-configured", mp_property_vo_configured},
     {"fps", mp_property_fps},
     {"estimated-vf-fps", mp_property_vf_fps},
+    {"video-decode-queue", mp_property_video_decode_queue},
     {"video-aspect", mp_property_aspect},
     {"vid", mp_property_video},
     {"program", mp_property_program},
@@ -3357,6 +3600,7 @@ static const struct m_property mp_properties[] = {
 
     {"vf", mp_property_vf},
     {"af", mp_property_af},
+    {"af-timing", mp_property_af_timing},
 
     {"video-rotate", video_simple_refresh_property},
 
@@ -3453,8 +3697,7 @@ static bool match_property(const char *a, const char *b)
     return strncmp(a, b, MPMIN(len_a, len_b)) == 0;
 }
 
-// Return a bitset of events which change the property.
-uint64_t mp_get_property_event_mask(const char *name)
+static uint64_t find_property_event_mask(const char *name)
 {
     uint64_t mask = 0;
     for (int n = 0; n < MP_ARRAY_SIZE(mp_event_property_change); n++) {
@@ -3467,9 +3710,7 @@ uint64_t mp_get_property_event_mask(const char *name)
     return mask;
 }
 
-// Return an ID for the property. It might not be unique, but is good enough
-// for property change handling. Return -1 if property unknown.
-int mp_get_property_id(const char *name)
+static int find_property_id(const char *name)
 {
     for (int n = 0; mp_properties[n].name; n++) {
         if (match_property(mp_properties[n].name, name))
@@ -3478,6 +3719,55 @@ int mp_get_property_id(const char *name)
     return -1;
 }
 
+// Lookup tables for mp_properties[], built on first use. They're never
+// changed after that, so they can be accessed from any thread.
+static pthread_once_t property_tables_once = PTHREAD_ONCE_INIT;
+static struct m_property_table *property_table;
+static int *property_ids;                   // indexed like mp_properties[]
+static uint64_t *property_event_masks;      // indexed like mp_properties[]
+
+static void init_property_tables(void)
+{
+    property_table = m_property_table_create(NULL, mp_properties);
+    int num = 0;
+    while (mp_properties[num].name)
+        num++;
+    property_ids = talloc_array(property_table, int, num);
+    property_event_masks = talloc_array(property_table, uint64_t, num);
+    for (int n = 0; n < num; n++) {
+        property_ids[n] = find_property_id(mp_properties[n].name);
+        property_event_masks[n] = find_property_event_mask(mp_properties[n].name);
+    }
+}
+
+static struct m_property_table *get_property_table(void)
+{
+    pthread_once(&property_tables_once, init_property_tables);
+    return property_table;
+}
+
+// Return the index of the top-level property in mp_properties[], or -1.
+static int lookup_property(const char *name)
+{
+    bstr prefix = bstr_splice(bstr0(name), 0, prefix_len(name));
+    return m_property_table_find(get_property_table(), prefix);
+}
+
+// Return a bitset of events which change the property.
+uint64_t mp_get_property_event_mask(const char *name)
+{
+    int n = lookup_property(name);
+    return n >= 0 ? property_event_masks[n] : find_property_event_mask(name);
+}
+
+// Return an ID for the property. It might not be unique, but is good enough
+// for property change handling. Return -1 if property unknown.
+int mp_get_property_id(const char *name)
+{
+    int n = lookup_property(name);
+    return n >= 0 ? property_ids[n] : find_property_id(name);
+}
+
 static bool is_property_set(int action, void *val)
 {
     switch (action) {
@@ -3498,7 +3788,8 @@ static bool is_property_set(int action, void *val)
 int mp_property_do(const char *name, int action, void *val,
                    struct MPContext *ctx)
 {
-    int r = m_property_do(ctx->log, mp_properties, name, action, val, ctx);
+    int r = m_property_do(ctx->log, get_property_table(), name, action, val,
+                          ctx);
     if (r == M_PROPERTY_OK && is_property_set(action, val))
         mp_notify_property(ctx, (char *)name);
     return r;
@@ -3506,7 +3797,7 @@ int mp_property_do(const char *name, int action, void *val,
 
 char *mp_property_expand_string(struct MPContext *mpctx, const char *str)
 {
-    return m_properties_expand_string(mp_properties, str, mpctx);
+    return m_properties_expand_string(get_property_table(), str, mpctx);
 }
 
 // Before expanding properties, parse C-style escapes like "\n"
@@ -4540,12 +4831,35 @@ int run_command(MPContext *mpctx, mp_cmd_t *cmd)
     }
 
     case MP_CMD_DROP_BUFFERS: {
-        reset_audio_state(mpctx);
-        reset_video_state(mpctx);
+        // The decoder threads must not read packets while they're flushed;
+        // resetting the decoders restarts them.
+        if (mpctx->d_video)
+            video_quiesce_decoding(mpctx->d_video);
+        if (mpctx->d_audio)
+            audio_quiesce_decoding(mpctx->d_audio);
 
         if (mpctx->demuxer)
             demux_flush(mpctx->demuxer);
 
+        reset_audio_state(mpctx);
+        reset_video_state(mpctx);
+
+        break;
+    }
+
+    case MP_CMD_TRACE: {
+        struct mp_trace *trace = mp_msg_get_trace(mpctx->global);
+        char *filename = cmd->args[1].v.s;
+        if (!trace)
+            return -1;
+        if (cmd->args[0].v.i == 0)
+            mp_trace_start(trace);
+        if (cmd->args[0].v.i == 1)
+            mp_trace_stop(trace);
+        if (filename[0] && mp_trace_write(trace, filename) < 0) {
+            MP_ERR(mpctx, "Failed to write trace file '%s'\n", filename);
+            return -1;
+        }
         break;
     }
 
@@ -129,6 +129,14 @@ enum playback_status {
     STATUS_EOF,         // playback has ended, or is disabled
 };
 
+// Why the audio output ran out of data (see audio.c).
+enum audio_underrun_cause {
+    UNDERRUN_DEMUX,     // the decoder was waiting for demuxer packets
+    UNDERRUN_DECODE,    // decoding and filtering was too slow
+    UNDERRUN_PLAYLOOP,  // audio was available, but not written in time
+    UNDERRUN_COUNT,
+};
+
 #define NUM_PTRACKS 2
 
 typedef struct MPContext {
@@ -183,6 +191,8 @@ typedef struct MPContext {
 
     // Current file statistics
     int64_t shown_vframes, shown_aframes;
+    // For --benchmark: wall time and VO CPU time at playback start
+    int64_t benchmark_start, benchmark_vo_cpu_time;
 
     struct stream *stream; // stream that was initially opened
     struct demuxer **sources;
@@ -221,6 +231,11 @@ typedef struct MPContext {
     struct ao *ao;
     struct mp_audio *ao_decoder_fmt; // for weak gapless audio check
     struct mp_audio_buffer *ao_buffer;  // queued audio; passed to ao_play() later
+    // mp_time_us() at which the AO plays out the audio written so far, or 0
+    int64_t audio_drain_time;
+    // Why the last read from the decoder returned too little data, or -1
+    int audio_short_cause;
+    int64_t audio_underruns[UNDERRUN_COUNT];
 
     struct vo *video_out;
     // next_frame[0] is the next frame, next_frame[1] the one after that.
@@ -254,10 +269,11 @@ typedef struct MPContext {
     // video frame is shown.
     double last_av_difference;
     /* timestamp of video frame currently visible on screen
-     * (or at least queued to be flipped by VO) */
+     * (frames queued ahead of it don't count; see vo_get_current_pts()) */
     double video_pts;
     double last_seek_pts;
-    // Mostly unused; for proper audio resync on speed changes.
+    // Timestamp of the frame queued to the VO next (or last). Used for the
+    // frame duration, and for proper audio resync on speed changes.
     double video_next_pts;
     // As video_pts, but is not reset when seeking away. (For the very short
     // period of time until a new frame is decoded and shown.)
@@ -405,7 +421,7 @@ void mp_print_version(struct mp_log *log, int always);
 
 // misc.c
 double get_start_time(struct MPContext *mpctx);
-double get_main_demux_pts(struct MPContext *mpctx);
+double get_main_demux_pts(struct MPContext *mpctx, bool decoders_quiesced);
 double get_track_video_offset(struct MPContext *mpctx, struct track *track);
 double rel_time_to_abs(struct MPContext *mpctx, struct m_rel_time t);
 double get_play_end_pts(struct MPContext *mpctx);
@@ -419,6 +435,8 @@ void stream_dump(struct MPContext *mpctx);
 int mpctx_run_non_blocking(struct MPContext *mpctx, void (*thread_fn)(void *arg),
                            void *thread_arg);
 struct mpv_global *create_sub_global(struct MPContext *mpctx);
+void benchmark_start(struct MPContext *mpctx);
+void benchmark_report(struct MPContext *mpctx);
 
 // osd.c
 void set_osd_bar(struct MPContext *mpctx, int type,
@@ -220,7 +220,7 @@ void reselect_demux_streams(struct MPContext *mpctx)
                 need_init_seek(track->demuxer);
             demuxer_select_track(track->demuxer, track->stream, track->selected);
             if (need_init) {
-                double pts = get_main_demux_pts(mpctx);
+                double pts = get_main_demux_pts(mpctx, false);
                 if (pts != MP_NOPTS_VALUE)
                     demux_seek(track->demuxer, pts, SEEK_ABSOLUTE);
             }
@@ -912,6 +912,8 @@ static void play_current_file(struct MPContext *mpctx)
     mpctx->filename = NULL;
     mpctx->shown_aframes = 0;
     mpctx->shown_vframes = 0;
+    for (int n = 0; n < UNDERRUN_COUNT; n++)
+        mpctx->audio_underruns[n] = 0;
     mpctx->last_vo_pts = MP_NOPTS_VALUE;
     mpctx->last_chapter_seek = -2;
     mpctx->last_chapter_pts = MP_NOPTS_VALUE;
@@ -1159,11 +1161,16 @@ goto_reopen_demuxer: ;
 
     playback_start = mp_time_sec();
     mpctx->error_playing = 0;
+    if (opts->benchmark)
+        benchmark_start(mpctx);
     while (!mpctx->stop_play)
         run_playloop(mpctx);
 
     MP_VERBOSE(mpctx, "EOF code: %d  \n", mpctx->stop_play);
 
+    if (opts->benchmark)
+        benchmark_report(mpctx);
+
 terminate_playback:
 
     if (mpctx->stop_play == PT_RELOAD_DEMUXER) {
@@ -45,6 +45,7 @@
 #include "options/parse_configfile.h"
 #include "options/parse_commandline.h"
 #include "common/playlist.h"
+#include "common/trace.h"
 #include "options/options.h"
 #include "input/input.h"
 
@@ -132,12 +133,16 @@ static void shutdown_clients(struct MPContext *mpctx)
 void mp_destroy(struct MPContext *mpctx)
 {
 #if !defined(__MINGW32__)
-    mp_uninit_ipc(mpctx->ipc_ctx);
-    mpctx->ipc_ctx = NULL;
+    mp_stop_ipc(mpctx->ipc_ctx);
 #endif
 
     shutdown_clients(mpctx);
 
+#if !defined(__MINGW32__)
+    mp_uninit_ipc(mpctx->ipc_ctx);
+    mpctx->ipc_ctx = NULL;
+#endif
+
     uninit_audio_out(mpctx);
     uninit_video_out(mpctx);
 
@@ -170,6 +175,13 @@ void mp_destroy(struct MPContext *mpctx)
     if (mpctx->autodetach)
         pthread_detach(pthread_self());
 
+    struct mp_trace *trace = mp_msg_get_trace(mpctx->global);
+    char *trace_file = mpctx->opts->trace_file;
+    if (trace && trace_file && trace_file[0]) {
+        if (mp_trace_write(trace, trace_file) < 0)
+            MP_ERR(mpctx, "Failed to write trace file '%s'\n", trace_file);
+    }
+
     mp_msg_uninit(mpctx->global);
     talloc_free(mpctx);
 }
@@ -386,6 +398,9 @@ int mp_initialize(struct MPContext *mpctx)
         if (mp_msg_open_stats_file(mpctx->global, opts->dump_stats) < 0)
             MP_ERR(mpctx, "Failed to open stats file '%s'\n", opts->dump_stats);
     }
+    struct mp_trace *trace = mp_msg_get_trace(mpctx->global);
+    if (trace && opts->trace_file && opts->trace_file[0])
+        mp_trace_start(trace);
     MP_STATS(mpctx, "start init");
 
     if (mpctx->opts->use_terminal && cas_terminal_owner(NULL, mpctx))
@@ -427,6 +442,19 @@ int mp_initialize(struct MPContext *mpctx)
     }
 #endif
 
+    if (opts->benchmark) {
+        m_config_set_option0(mpctx->mconfig, "vo", "null");
+        m_config_set_option0(mpctx->mconfig, "ao", "null:untimed");
+        m_config_set_option0(mpctx->mconfig, "untimed", "yes");
+        m_config_set_option0(mpctx->mconfig, "framedrop", "no");
+        m_config_set_option0(mpctx->mconfig, "fixed-vo", "yes");
+        m_config_set_option0(mpctx->mconfig, "keep-open", "no");
+        m_config_set_option0(mpctx->mconfig, "force-window", "no");
+        m_config_set_option0(mpctx->mconfig, "resume-playback", "no");
+        m_config_set_option0(mpctx->mconfig, "load-scripts", "no");
+        m_config_set_option0(mpctx->mconfig, "osc", "no");
+    }
+
     if (opts->consolecontrols && cas_terminal_owner(mpctx, mpctx))
         terminal_setup_getch(mpctx->input);
 
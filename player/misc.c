@@ -24,6 +24,10 @@
 #include "config.h"
 #include "talloc.h"
 
+#if HAVE_POSIX
+#include <sys/resource.h>
+#endif
+
 #include "osdep/io.h"
 #include "osdep/timer.h"
 #include "osdep/threads.h"
@@ -42,6 +46,8 @@
 #include "demux/demux.h"
 #include "stream/stream.h"
 #include "video/out/vo.h"
+#include "video/decode/dec_video.h"
+#include "audio/decode/dec_audio.h"
 
 #include "core.h"
 #include "command.h"
@@ -104,15 +110,34 @@ double get_play_end_pts(struct MPContext *mpctx)
     return end;
 }
 
-// Time used to seek external tracks to.
-double get_main_demux_pts(struct MPContext *mpctx)
+// Whether a decoder thread reads packets from the stream. Only that thread
+// may then peek into the stream's packet queue.
+static bool stream_has_decoder_thread(struct MPContext *mpctx,
+                                      struct sh_stream *stream)
+{
+    return (mpctx->d_video && mpctx->d_video->header == stream &&
+            mpctx->d_video->thread) ||
+           (mpctx->d_audio && mpctx->d_audio->header == stream &&
+            mpctx->d_audio->thread);
+}
+
+// Time used to seek external tracks to. Unless the caller has quiesced the
+// decoder threads, streams read by them are not peeked into.
+double get_main_demux_pts(struct MPContext *mpctx, bool decoders_quiesced)
 {
     double main_new_pos = MP_NOPTS_VALUE;
     if (mpctx->demuxer) {
         for (int n = 0; n < mpctx->demuxer->num_streams; n++) {
             struct sh_stream *stream = mpctx->demuxer->streams[n];
-            if (main_new_pos == MP_NOPTS_VALUE && stream->type != STREAM_SUB)
-                main_new_pos = demux_get_next_pts(stream);
+            if (main_new_pos == MP_NOPTS_VALUE && stream->type != STREAM_SUB) {
+                if (!decoders_quiesced &&
+                    stream_has_decoder_thread(mpctx, stream))
+                {
+                    main_new_pos = demux_get_reader_pts(stream);
+                } else {
+                    main_new_pos = demux_get_next_pts(stream);
+                }
+            }
         }
     }
     return main_new_pos;
@@ -307,3 +332,66 @@ done:
     pthread_mutex_destroy(&args.mutex);
     return success ? 0 : -1;
 }
+
+void benchmark_start(struct MPContext *mpctx)
+{
+    mpctx->benchmark_start = mp_time_us();
+    mpctx->benchmark_vo_cpu_time =
+        mpctx->video_out ? vo_get_render_cpu_time(mpctx->video_out) : 0;
+}
+
+// Print throughput and CPU time per stage since benchmark_start().
+void benchmark_report(struct MPContext *mpctx)
+{
+    double wall = MPMAX(mp_time_us() - mpctx->benchmark_start, 1) / 1e6;
+    MP_INFO(mpctx, "Benchmark: %.3f s, %"PRId64" video frames (%.2f fps), "
+            "%"PRId64" audio samples\n", wall, mpctx->shown_vframes,
+            mpctx->shown_vframes / wall, mpctx->shown_aframes);
+
+    char *line = talloc_strdup(NULL, "");
+    int64_t t = 0, packets = 0;
+    if (demux_control(mpctx->demuxer, DEMUXER_CTRL_GET_CPU_TIME, &t) > 0) {
+        line = talloc_asprintf_append(line, " demux %.3f", t / 1e6);
+        if (demux_control(mpctx->demuxer, DEMUXER_CTRL_GET_PACKETS_READ,
+                          &packets) > 0)
+        {
+            // Packets per second of demuxer CPU time, i.e. parsing speed.
+            MP_INFO(mpctx, "Demuxer: %"PRId64" packets (%.0f packets/s, "
+                    "%.0f per demuxer CPU second)\n", packets, packets / wall,
+                    packets / MPMAX(t / 1e6, 1e-6));
+        }
+    }
+    if (mpctx->d_video) {
+        struct dec_video *d_video = mpctx->d_video;
+        line = talloc_asprintf_append(line, " video-decode %.3f video-filter %.3f",
+                                      atomic_load(&d_video->decode_cpu_us) / 1e6,
+                                      d_video->filter_cpu_us / 1e6);
+    }
+    if (mpctx->video_out) {
+        t = vo_get_render_cpu_time(mpctx->video_out) -
+            mpctx->benchmark_vo_cpu_time;
+        line = talloc_asprintf_append(line, " vo %.3f", t / 1e6);
+    }
+    if (mpctx->d_audio) {
+        line = talloc_asprintf_append(line, " audio %.3f",
+                            atomic_load(&mpctx->d_audio->decode_cpu_us) / 1e6);
+    }
+    long rss = -1;
+#if HAVE_POSIX
+    // Note that these are for the whole process lifetime.
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        double cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+                     ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+        line = talloc_asprintf_append(line, " process %.3f", cpu);
+        rss = ru.ru_maxrss;
+#ifdef __APPLE__
+        rss /= 1024; // bytes instead of KiB
+#endif
+    }
+#endif
+    MP_INFO(mpctx, "CPU time (s):%s\n", line);
+    if (rss >= 0)
+        MP_INFO(mpctx, "Peak memory (RSS): %ld KiB\n", rss);
+    talloc_free(line);
+}
@@ -242,6 +242,14 @@ static int mp_seek(MPContext *mpctx, struct seek_params seek,
 
     if (hr_seek)
         demuxer_amount -= hr_seek_offset;
+
+    // The decoder threads must not read packets from the new position before
+    // the decoders are reset.
+    if (mpctx->d_video)
+        video_quiesce_decoding(mpctx->d_video);
+    if (mpctx->d_audio)
+        audio_quiesce_decoding(mpctx->d_audio);
+
     demux_seek(mpctx->demuxer, demuxer_amount, demuxer_style);
 
     // Seek external, extra files too:
@@ -250,7 +258,7 @@ static int mp_seek(MPContext *mpctx, struct seek_params seek,
         if (track->selected && track->is_external && track->demuxer) {
             double main_new_pos = seek.amount;
             if (seek.type != MPSEEK_ABSOLUTE)
-                main_new_pos = get_main_demux_pts(mpctx);
+                main_new_pos = get_main_demux_pts(mpctx, true);
             main_new_pos -= get_track_video_offset(mpctx, track);
             demux_seek(track->demuxer, main_new_pos, SEEK_ABSOLUTE | SEEK_BACKWARD);
         }
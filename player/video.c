@@ -36,6 +36,7 @@
 
 #include "audio/out/ao.h"
 #include "demux/demux.h"
+#include "input/input.h"
 #include "stream/stream.h"
 #include "sub/osd.h"
 #include "video/hwdec.h"
@@ -249,6 +250,12 @@ void uninit_video_chain(struct MPContext *mpctx)
     mp_notify(mpctx, MPV_EVENT_VIDEO_RECONFIG, NULL);
 }
 
+static void wakeup_video(void *ctx)
+{
+    struct MPContext *mpctx = ctx;
+    mp_input_wakeup(mpctx->input);
+}
+
 int reinit_video_chain(struct MPContext *mpctx)
 {
     struct MPOpts *opts = mpctx->opts;
@@ -287,6 +294,7 @@ int reinit_video_chain(struct MPContext *mpctx)
     d_video->global = mpctx->global;
     d_video->log = mp_log_new(d_video, mpctx->log, "!vd");
     d_video->opts = mpctx->opts;
+    d_video->measure_cpu = mpctx->opts->benchmark;
     d_video->header = sh;
     d_video->fps = sh->video->fps;
     d_video->vo = mpctx->video_out;
@@ -298,6 +306,16 @@ int reinit_video_chain(struct MPContext *mpctx)
     if (!video_init_best_codec(d_video, opts->video_decoders))
         goto err_out;
 
+    // The decoder thread reads packets concurrently with the playloop, which
+    // works only if the demuxer runs in its own thread.
+    if (opts->vd_queue_frames > 0 && !sh->attached_picture &&
+        opts->demuxer_thread && track->demuxer == mpctx->demuxer)
+    {
+        if (!video_start_thread(d_video, opts->vd_queue_frames, wakeup_video,
+                                mpctx))
+            MP_WARN(mpctx, "Could not start video decoder thread.\n");
+    }
+
     bool saver_state = opts->pause || !opts->stop_screensaver;
     vo_control(mpctx->video_out, saver_state ? VOCTRL_RESTORE_SCREENSAVER
                                              : VOCTRL_KILL_SCREENSAVER, NULL);
@@ -379,6 +397,27 @@ static int decode_image(struct MPContext *mpctx)
         return VD_EOF;
     }
 
+    bool hrseek = mpctx->hrseek_active && mpctx->video_status == STATUS_SYNCING;
+
+    if (d_video->thread) {
+        struct video_decode_params params = {
+            .pts_offset = mpctx->video_offset,
+            .framedrop = check_framedrop(mpctx),
+            .count_drops = mpctx->video_status == STATUS_PLAYING,
+            .hrseek_framedrop = hrseek && mpctx->hrseek_framedrop &&
+                                mpctx->opts->hr_seek_framedrop,
+            .hrseek_pts = mpctx->hrseek_pts,
+        };
+        int r = video_read_frame(d_video, &params, &d_video->waiting_decoded_mpi);
+        if (!params.hrseek_framedrop_active)
+            mpctx->hrseek_framedrop = false;
+        mpctx->dropped_frames_total += params.dropped;
+        mpctx->dropped_frames += params.dropped;
+        if (r == 0)
+            return VD_WAIT;
+        return r > 0 ? VD_PROGRESS : VD_EOF;
+    }
+
     struct demux_packet *pkt;
     if (demux_read_packet_async(d_video->header, &pkt) == 0)
         return VD_WAIT;
@@ -390,13 +429,13 @@ static int decode_image(struct MPContext *mpctx)
     {
         mpctx->hrseek_framedrop = false;
     }
-    bool hrseek = mpctx->hrseek_active && mpctx->video_status == STATUS_SYNCING;
     int framedrop_type = hrseek && mpctx->hrseek_framedrop ?
                          2 : check_framedrop(mpctx);
+    d_video->pts_offset = mpctx->video_offset;
     d_video->waiting_decoded_mpi =
         video_decode(d_video, pkt, framedrop_type);
     bool had_packet = !!pkt;
-    talloc_free(pkt);
+    free_demux_packet(pkt);
 
     if (had_packet && !d_video->waiting_decoded_mpi &&
         mpctx->video_status == STATUS_PLAYING)
@@ -459,7 +498,13 @@ static int video_filter(struct MPContext *mpctx, bool eof)
 
     // If something was decoded, and the filter chain is ready, filter it.
     if (!need_vf_reconfig && d_video->waiting_decoded_mpi) {
+        int64_t start = mp_time_us();
+        int64_t cpu_start = d_video->measure_cpu ? mp_thread_cpu_time_us() : 0;
         vf_filter_frame(vf, d_video->waiting_decoded_mpi);
+        d_video->filter_time_us += mp_time_us() - start;
+        if (d_video->measure_cpu)
+            d_video->filter_cpu_us += mp_thread_cpu_time_us() - cpu_start;
+        d_video->num_filtered++;
         d_video->waiting_decoded_mpi = NULL;
         return VD_PROGRESS;
     }
@@ -529,7 +574,7 @@ static void adjust_sync(struct MPContext *mpctx, double v_pts, double frame_time
 static bool have_new_frame(struct MPContext *mpctx)
 {
     bool need_2nd = !!(mpctx->opts->frame_dropping & 1) // we need the duration
-        && mpctx->video_pts != MP_NOPTS_VALUE; // ...except for the 1st frame
+        && vo_has_frame(mpctx->video_out); // ...except for the 1st frame
 
     return mpctx->next_frame[0] && (!need_2nd || mpctx->next_frame[1]);
 }
@@ -561,7 +606,7 @@ static int video_output_image(struct MPContext *mpctx, double endpts)
         mpctx->next_frame[1] = NULL;
 
         double pts = mpctx->next_frame[0]->pts;
-        double last_pts = mpctx->video_pts;
+        double last_pts = mpctx->video_next_pts; // the frame queued last
         if (last_pts == MP_NOPTS_VALUE)
             last_pts = pts;
         double frame_time = pts - last_pts;
@@ -593,6 +638,7 @@ static int video_output_image(struct MPContext *mpctx, double endpts)
             return r; // error
         struct mp_image *img = vf_read_output_frame(mpctx->d_video->vfilter);
         if (img) {
+            img->times.filter_end = mp_time_us();
             // Always add these; they make backstepping after seeking faster.
             add_frame_pts(mpctx, img->pts);
 
@@ -676,8 +722,8 @@ static void update_avsync_before_frame(struct MPContext *mpctx)
     }
 }
 
-// Update the A/V sync difference after a video frame has been shown.
-static void update_avsync_after_frame(struct MPContext *mpctx)
+// Update the A/V sync difference after a video frame has been queued.
+static void update_avsync_after_frame(struct MPContext *mpctx, double vpts)
 {
     mpctx->time_frame -= get_relative_time(mpctx);
     mpctx->last_av_difference = 0;
@@ -688,11 +734,11 @@ static void update_avsync_after_frame(struct MPContext *mpctx)
 
     double a_pos = playing_audio_pts(mpctx);
 
-    mpctx->last_av_difference = a_pos - mpctx->video_pts + mpctx->audio_delay;
+    mpctx->last_av_difference = a_pos - vpts + mpctx->audio_delay;
     if (mpctx->time_frame > 0)
         mpctx->last_av_difference +=
                 mpctx->time_frame * mpctx->opts->playback_speed;
-    if (a_pos == MP_NOPTS_VALUE || mpctx->video_pts == MP_NOPTS_VALUE)
+    if (a_pos == MP_NOPTS_VALUE || vpts == MP_NOPTS_VALUE)
         mpctx->last_av_difference = MP_NOPTS_VALUE;
     if (mpctx->last_av_difference > 0.5 && !mpctx->drop_message_shown) {
         MP_WARN(mpctx, "%s", av_desync_help_text);
@@ -700,6 +746,25 @@ static void update_avsync_after_frame(struct MPContext *mpctx)
     }
 }
 
+// Frames can be queued to the VO in advance, so the current video position is
+// whatever the VO has actually put on the screen.
+static void update_video_pts(struct MPContext *mpctx)
+{
+    double pts = vo_get_current_pts(mpctx->video_out);
+    if (pts == MP_NOPTS_VALUE || pts == mpctx->video_pts)
+        return;
+
+    mpctx->video_pts = pts;
+    mpctx->last_vo_pts = pts;
+    mpctx->playback_pts = pts;
+
+    mpctx->osd_force_update = true;
+    update_osd_msg(mpctx);
+    update_subtitles(mpctx);
+
+    mp_notify(mpctx, MPV_EVENT_TICK, NULL);
+}
+
 static void init_vo(struct MPContext *mpctx)
 {
     struct MPOpts *opts = mpctx->opts;
@@ -727,6 +792,8 @@ void write_video(struct MPContext *mpctx, double endpts)
     if (!mpctx->d_video)
         return;
 
+    update_video_pts(mpctx);
+
     // Actual playback starts when both audio and video are ready.
     if (mpctx->video_status == STATUS_READY)
         return;
@@ -811,13 +878,7 @@ void write_video(struct MPContext *mpctx, double endpts)
         duration = MPCLAMP(diff, 0, 10) * 1e6;
     }
 
-    mpctx->video_pts = mpctx->next_frame[0]->pts;
-    mpctx->last_vo_pts = mpctx->video_pts;
-    mpctx->playback_pts = mpctx->video_pts;
-
-    mpctx->osd_force_update = true;
-    update_osd_msg(mpctx);
-    update_subtitles(mpctx);
+    double vpts = mpctx->next_frame[0]->pts;
 
     vo_queue_frame(vo, mpctx->next_frame[0], pts, duration);
     mpctx->next_frame[0] = NULL;
@@ -828,11 +889,10 @@ void write_video(struct MPContext *mpctx, double endpts)
         // After a seek, make sure to wait until the first frame is visible.
         vo_wait_frame(vo);
     }
-    update_avsync_after_frame(mpctx);
+    update_video_pts(mpctx);
+    update_avsync_after_frame(mpctx, vpts);
     screenshot_flip(mpctx);
 
-    mp_notify(mpctx, MPV_EVENT_TICK, NULL);
-
     if (!mpctx->sync_audio_to_video)
         mpctx->video_status = STATUS_EOF;
 
@@ -36,9 +36,14 @@
 // Time in seconds the cache prints a new message at all.
 #define CACHE_NO_SPAM 5.0
 
+// The cache memory is split into blocks of this size. Each block caches a
+// contiguous byte range of the file, and blocks are evicted individually.
+#define BLOCK_SIZE (64 * 1024)
+
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -90,13 +95,16 @@ struct priv {
     // All the following members are shared between the threads.
     // You must lock the mutex to access them.
 
-    // Ringbuffer
-    int64_t min_filepos;    // range of file that is cached in the buffer
-    int64_t max_filepos;    // ... max_filepos being the last read position
-    bool eof;               // true if max_filepos = EOF
-    int64_t offset;         // buffer[WRAP(s->max_filepos - offset)] corresponds
-                            // to the byte at max_filepos (must be wrapped by
-                            // buffer_size)
+    // Block cache. Block n uses the memory at buffer + n * BLOCK_SIZE.
+    struct cache_block *blocks; // num_blocks entries
+    int num_blocks;
+    int *sorted;            // indexes of used blocks, sorted by file position
+    int num_sorted;
+    uint64_t use_counter;   // incremented on each block access (for LRU)
+    int64_t fill_pos;       // end of the data cached contiguously from
+                            // read_filepos (updated by the cache thread)
+    int64_t stream_filepos; // position of the underlying stream
+    bool eof;               // true if the last fill attempt hit EOF
 
     bool idle;              // cache thread has stopped reading
     int64_t reads;          // number of actual read attempts performed
@@ -115,6 +123,13 @@ struct priv {
     bool has_avseek;
 };
 
+struct cache_block {
+    int64_t pos;            // file position of the first byte in the block
+    int len;                // number of valid bytes
+    bool used;              // in s->sorted (len can be 0 while filling)
+    uint64_t last_use;      // value of s->use_counter on last access
+};
+
 enum {
     CACHE_INTERRUPTED = -1,
 
@@ -163,42 +178,143 @@ static int cache_wakeup_and_wait(struct priv *s, double *retry_time)
     return 0;
 }
 
+// Return the index into s->sorted of the last block starting at or before
+// pos, or -1 if there is none.
+static int find_sorted(struct priv *s, int64_t pos)
+{
+    int lo = 0, hi = s->num_sorted;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (s->blocks[s->sorted[mid]].pos <= pos) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo - 1;
+}
+
+// Return the index of the block containing the byte at pos, or -1.
+static int block_at(struct priv *s, int64_t pos)
+{
+    int i = find_sorted(s, pos);
+    if (i < 0)
+        return -1;
+    struct cache_block *b = &s->blocks[s->sorted[i]];
+    return pos < b->pos + b->len ? s->sorted[i] : -1;
+}
+
+// Return the end of the data cached contiguously starting at pos (pos itself
+// if nothing is cached there).
+static int64_t contiguous_end(struct priv *s, int64_t pos)
+{
+    for (int i = MPMAX(find_sorted(s, pos), 0); i < s->num_sorted; i++) {
+        struct cache_block *b = &s->blocks[s->sorted[i]];
+        if (b->pos > pos)
+            break;
+        pos = MPMAX(pos, b->pos + b->len);
+    }
+    return pos;
+}
+
+// Return the start of the data cached contiguously up to pos (pos itself if
+// nothing is cached right before it).
+static int64_t contiguous_start(struct priv *s, int64_t pos)
+{
+    for (int i = find_sorted(s, pos - 1); i >= 0; i--) {
+        struct cache_block *b = &s->blocks[s->sorted[i]];
+        if (b->pos + b->len < pos)
+            break;
+        pos = MPMIN(pos, b->pos);
+    }
+    return pos;
+}
+
+static void free_block(struct priv *s, int n)
+{
+    int i = find_sorted(s, s->blocks[n].pos);
+    assert(i >= 0 && s->sorted[i] == n);
+    MP_TARRAY_REMOVE_AT(s->sorted, s->num_sorted, i);
+    s->blocks[n] = (struct cache_block){0};
+}
+
+// Return the least recently used block that doesn't contain data between
+// read_filepos and fill_pos (the readahead), or -1 if there is none.
+static int find_lru_block(struct priv *s)
+{
+    int lru = -1;
+    for (int n = 0; n < s->num_blocks; n++) {
+        struct cache_block *b = &s->blocks[n];
+        if (!b->used)
+            continue;
+        if (b->pos + b->len > s->read_filepos && b->pos < s->fill_pos)
+            continue;
+        if (lru < 0 || b->last_use < s->blocks[lru].last_use)
+            lru = n;
+    }
+    return lru;
+}
+
+// Get an empty block for data starting at pos, evicting the least recently
+// used block if needed. Returns -1 if all blocks are in use by readahead.
+static int alloc_block(struct priv *s, int64_t pos)
+{
+    int n = -1;
+    if (s->num_sorted < s->num_blocks) {
+        for (n = 0; n < s->num_blocks; n++) {
+            if (!s->blocks[n].used)
+                break;
+        }
+    } else {
+        n = find_lru_block(s);
+        if (n < 0)
+            return -1;
+        MP_DBG(s, "Evicting block at %"PRId64".\n", s->blocks[n].pos);
+        free_block(s, n);
+    }
+    assert(n >= 0 && n < s->num_blocks);
+    s->blocks[n] = (struct cache_block){
+        .pos = pos,
+        .used = true,
+        .last_use = ++s->use_counter,
+    };
+    int i = find_sorted(s, pos) + 1;
+    memmove(&s->sorted[i + 1], &s->sorted[i],
+            (s->num_sorted - i) * sizeof(s->sorted[0]));
+    s->sorted[i] = n;
+    s->num_sorted++;
+    return n;
+}
+
 // Runs in the cache thread
 static void cache_drop_contents(struct priv *s)
 {
-    s->offset = s->min_filepos = s->max_filepos = s->read_filepos;
+    for (int n = 0; n < s->num_blocks; n++)
+        s->blocks[n] = (struct cache_block){0};
+    s->num_sorted = 0;
+    s->fill_pos = s->read_filepos;
     s->eof = false;
     s->start_pts = MP_NOPTS_VALUE;
 }
 
 // Copy at most dst_size from the cache at the given absolute file position pos.
 // Return number of bytes that could actually be read.
-// Does not advance the file position, or change anything else.
+// Does not advance the file position, or change anything else (except LRU
+// state).
 // Can be called from anywhere, as long as the mutex is held.
 static size_t read_buffer(struct priv *s, unsigned char *dst,
                           size_t dst_size, int64_t pos)
 {
     size_t read = 0;
     while (read < dst_size) {
-        if (pos >= s->max_filepos || pos < s->min_filepos)
+        int n = block_at(s, pos);
+        if (n < 0)
             break;
-        int64_t newb = s->max_filepos - pos; // new bytes in the buffer
-
-        int64_t bpos = pos - s->offset; // file pos to buffer memory pos
-        if (bpos < 0) {
-            bpos += s->buffer_size;
-        } else if (bpos >= s->buffer_size) {
-            bpos -= s->buffer_size;
-        }
-
-        if (newb > s->buffer_size - bpos)
-            newb = s->buffer_size - bpos; // handle wrap...
-
-        newb = MPMIN(newb, dst_size - read);
-
-        assert(newb >= 0 && read + newb <= dst_size);
-        assert(bpos >= 0 && bpos + newb <= s->buffer_size);
-        memcpy(&dst[read], &s->buffer[bpos], newb);
+        struct cache_block *b = &s->blocks[n];
+        int64_t offset = pos - b->pos;
+        size_t newb = MPMIN(b->len - offset, dst_size - read);
+        memcpy(&dst[read], &s->buffer[n * (int64_t)BLOCK_SIZE + offset], newb);
+        b->last_use = ++s->use_counter;
         read += newb;
         pos += newb;
     }
@@ -212,60 +328,71 @@ static bool cache_fill(struct priv *s)
     int64_t read = s->read_filepos;
     int len = 0;
 
-    // drop cache contents only if seeking backward or too much fwd.
-    // This is also done for on-disk files, since it loses the backseek cache.
-    // That in turn can cause major bandwidth increase and performance
-    // issues with e.g. mov or badly interleaved files
-    if (read < s->min_filepos || read > s->max_filepos + s->seek_limit) {
-        MP_VERBOSE(s, "Dropping cache at pos %"PRId64", "
-                   "cached range: %"PRId64"-%"PRId64".\n", read,
-                   s->min_filepos, s->max_filepos);
-        cache_drop_contents(s);
+    // Data that was cached earlier is kept (until it gets evicted), so seeking
+    // to any cached range, e.g. back to a previously read part of the file,
+    // doesn't require reading the data again.
+    s->fill_pos = contiguous_end(s, read);
+    int64_t pos = s->fill_pos;
+
+    // Unseekable streams can be read only linearly. Otherwise, if the reader
+    // is a bit ahead of the stream position, keep reading instead of seeking
+    // (mostly for network streams).
+    int64_t stream_pos = stream_tell(s->stream);
+    if (!s->seekable || (pos == read && stream_pos < read &&
+                         read - stream_pos <= s->seek_limit &&
+                         block_at(s, stream_pos) < 0))
+        pos = stream_pos;
+
+    // Number of bytes before the reader which should be preserved for backward
+    // seeks. The rest of the buffer can be used for readahead.
+    int64_t back = mp_clipi64(read - contiguous_start(s, read), 0, s->back_size);
+    if (s->buffer_size - (pos - read) - back < FILL_LIMIT) {
+        s->idle = true;
+        s->reads++; // don't stuck main thread
+        return false;
     }
 
-    if (stream_tell(s->stream) != s->max_filepos && s->seekable) {
+    if (pos != stream_pos) {
         MP_VERBOSE(s, "Seeking underlying stream: %"PRId64" -> %"PRId64"\n",
-                   stream_tell(s->stream), s->max_filepos);
-        stream_seek(s->stream, s->max_filepos);
-        if (stream_tell(s->stream) != s->max_filepos)
+                   stream_pos, pos);
+        stream_seek(s->stream, pos);
+        s->stream_filepos = stream_tell(s->stream);
+        if (s->stream_filepos != pos)
             goto done;
     }
 
-    // number of buffer bytes which should be preserved in backwards direction
-    int64_t back = mp_clipi64(read - s->min_filepos, 0, s->back_size);
-
-    // number of buffer bytes that are valid and can be read
-    int64_t newb = FFMAX(s->max_filepos - read, 0);
-
-    // max. number of bytes that can be written (starting from max_filepos)
-    int64_t space = s->buffer_size - (newb + back);
-
-    // offset into the buffer that maps to max_filepos
-    int pos = s->max_filepos - s->offset;
-    if (pos >= s->buffer_size)
-        pos -= s->buffer_size; // wrap-around
-
-    if (space < FILL_LIMIT) {
-        s->idle = true;
-        s->reads++; // don't stuck main thread
-        return false;
+    // Append to the block ending at pos, or start a new one.
+    int n = -1;
+    int i = find_sorted(s, pos);
+    if (i >= 0) {
+        struct cache_block *b = &s->blocks[s->sorted[i]];
+        if (b->pos + b->len == pos && b->len < BLOCK_SIZE)
+            n = s->sorted[i];
+    }
+    if (n < 0) {
+        n = alloc_block(s, pos);
+        if (n < 0) {
+            s->idle = true;
+            s->reads++;
+            return false;
+        }
+        i = find_sorted(s, pos);
     }
+    struct cache_block *b = &s->blocks[n];
 
-    // limit to end of buffer (without wrapping)
-    if (pos + space >= s->buffer_size)
-        space = s->buffer_size - pos;
+    // Don't overlap with the next block.
+    int64_t space = BLOCK_SIZE - b->len;
+    if (i + 1 < s->num_sorted)
+        space = MPMIN(space, s->blocks[s->sorted[i + 1]].pos - pos);
 
     // limit read size (or else would block and read the entire buffer in 1 call)
     space = FFMIN(space, s->stream->read_chunk);
 
-    // back+newb+space <= buffer_size
-    int64_t back2 = s->buffer_size - (space + newb); // max back size
-    if (s->min_filepos < (read - back2))
-        s->min_filepos = read - back2;
-
-    // The read call might take a long time and block, so drop the lock.
+    // The read call might take a long time and block, so drop the lock. The
+    // block can't go away, because only this thread modifies the blocks.
+    unsigned char *dst = &s->buffer[n * (int64_t)BLOCK_SIZE + b->len];
     pthread_mutex_unlock(&s->mutex);
-    len = stream_read_partial(s->stream, &s->buffer[pos], space);
+    len = stream_read_partial(s->stream, dst, space);
     pthread_mutex_lock(&s->mutex);
 
     // Do this after reading a block, because at least libdvdnav updates the
@@ -276,9 +403,12 @@ static bool cache_fill(struct priv *s)
             s->start_pts = pts;
     }
 
-    s->max_filepos += len;
-    if (pos + len == s->buffer_size)
-        s->offset += s->buffer_size; // wrap...
+    b->len += MPMAX(len, 0);
+    b->last_use = ++s->use_counter;
+    if (!b->len)
+        free_block(s, n);
+    s->stream_filepos = stream_tell(s->stream);
+    s->fill_pos = contiguous_end(s, read);
 
 done:
     s->eof = len <= 0;
@@ -295,50 +425,62 @@ done:
 // This is called both during init and at runtime.
 static int resize_cache(struct priv *s, int64_t size)
 {
-    int64_t min_size = FILL_LIMIT * 4;
-    int64_t max_size = ((size_t)-1) / 4;
+    int64_t min_size = BLOCK_SIZE * 4;
+    int64_t max_size = MPMIN(((size_t)-1) / 4, (int64_t)BLOCK_SIZE * (INT_MAX / 2));
     int64_t buffer_size = MPMIN(MPMAX(size, min_size), max_size);
+    int num_blocks = buffer_size / BLOCK_SIZE;
+    buffer_size = num_blocks * (int64_t)BLOCK_SIZE;
 
     unsigned char *buffer = malloc(buffer_size);
-    if (!buffer) {
+    struct cache_block *blocks = talloc_zero_array(s, struct cache_block, num_blocks);
+    int *sorted = talloc_array(s, int, num_blocks);
+    if (!buffer || !blocks || !sorted) {
         free(buffer);
+        talloc_free(blocks);
+        talloc_free(sorted);
         return STREAM_ERROR;
     }
 
+    int num = 0;
     if (s->buffer) {
-        // Copy & free the old ringbuffer data.
-        // If the buffer is too small, prefer to copy these regions:
-        // 1. Data starting from read_filepos, until cache end
-        size_t read_1 = read_buffer(s, buffer, buffer_size, s->read_filepos);
-        // 2. then data from before read_filepos until cache start
-        //    (this one needs to be copied to the end of the ringbuffer)
-        size_t read_2 = 0;
-        if (s->min_filepos < s->read_filepos) {
-            size_t copy_len = buffer_size - read_1;
-            copy_len = MPMIN(copy_len, s->read_filepos - s->min_filepos);
-            assert(copy_len + read_1 <= buffer_size);
-            read_2 = read_buffer(s, buffer + buffer_size - copy_len, copy_len,
-                                 s->read_filepos - copy_len);
-            // This shouldn't happen, unless copy_len was computed incorrectly.
-            assert(read_2 == copy_len);
+        // Copy the old blocks. If the buffer is too small, drop least recently
+        // used blocks, and then the readahead data farthest from the read
+        // position.
+        s->fill_pos = contiguous_end(s, s->read_filepos);
+        while (s->num_sorted > num_blocks) {
+            int n = find_lru_block(s);
+            if (n < 0)
+                n = s->sorted[s->num_sorted - 1];
+            free_block(s, n);
+        }
+        for (int i = 0; i < s->num_sorted; i++) {
+            int n = s->sorted[i];
+            blocks[num] = s->blocks[n];
+            memcpy(&buffer[num * (int64_t)BLOCK_SIZE],
+                   &s->buffer[n * (int64_t)BLOCK_SIZE], s->blocks[n].len);
+            sorted[num] = num;
+            num++;
         }
-        // Set it up such that read_1 is at buffer pos 0, and read_2 wraps
-        // around below it, so that it is located at the end of the buffer.
-        s->min_filepos = s->read_filepos - read_2;
-        s->max_filepos = s->read_filepos + read_1;
-        s->offset = s->max_filepos - read_1;
-    } else {
-        cache_drop_contents(s);
     }
 
+    bool had_buffer = !!s->buffer;
     free(s->buffer);
+    talloc_free(s->blocks);
+    talloc_free(s->sorted);
 
     s->buffer_size = buffer_size;
     s->back_size = buffer_size / 2;
     s->buffer = buffer;
+    s->blocks = blocks;
+    s->num_blocks = num_blocks;
+    s->sorted = sorted;
+    s->num_sorted = num;
     s->idle = false;
     s->eof = false;
 
+    if (!had_buffer)
+        cache_drop_contents(s);
+
     //make sure that we won't wait from cache_fill
     //more data than it is allowed to fill
     if (s->seek_limit > s->buffer_size - FILL_LIMIT)
@@ -374,8 +516,26 @@ static int cache_get_cached_control(stream_t *cache, int cmd, void *arg)
         *(int64_t *)arg = s->buffer_size;
         return STREAM_OK;
     case STREAM_CTRL_GET_CACHE_FILL:
-        *(int64_t *)arg = s->max_filepos - s->read_filepos;
+        *(int64_t *)arg = contiguous_end(s, s->read_filepos) - s->read_filepos;
+        return STREAM_OK;
+    case STREAM_CTRL_GET_CACHE_RANGES: {
+        struct stream_cache_ranges *r = arg;
+        *r = (struct stream_cache_ranges){0};
+        for (int i = 0; i < s->num_sorted; i++) {
+            struct cache_block *b = &s->blocks[s->sorted[i]];
+            if (!b->len)
+                continue;
+            struct stream_cache_range *last =
+                r->num_ranges ? &r->ranges[r->num_ranges - 1] : NULL;
+            if (last && last->end == b->pos) {
+                last->end += b->len;
+            } else {
+                struct stream_cache_range new = {b->pos, b->pos + b->len};
+                MP_TARRAY_APPEND(NULL, r->ranges, r->num_ranges, new);
+            }
+        }
         return STREAM_OK;
+    }
     case STREAM_CTRL_GET_CACHE_IDLE:
         *(int *)arg = s->idle;
         return STREAM_OK;
@@ -457,6 +617,7 @@ static void cache_execute_control(struct priv *s)
         cache_drop_contents(s);
     }
 
+    s->stream_filepos = stream_tell(s->stream);
     update_cached_controls(s);
     s->control = CACHE_CTRL_NONE;
     pthread_cond_signal(&s->wakeup);
@@ -511,7 +672,7 @@ static int cache_fill_buffer(struct stream *cache, char *buffer, int max_len)
             s->read_filepos += readb;
             if (readb > 0)
                 break;
-            if (s->eof && s->read_filepos >= s->max_filepos && s->reads >= retry)
+            if (s->eof && s->reads >= retry)
                 break;
             s->idle = false;
             if (cache_wakeup_and_wait(s, &retry_time) == CACHE_INTERRUPTED)
@@ -533,14 +694,16 @@ static int cache_seek(stream_t *cache, int64_t pos)
 
     pthread_mutex_lock(&s->mutex);
 
-    MP_DBG(s, "request seek: %" PRId64 " <= to=%" PRId64
-           " (cur=%" PRId64 ") <= %" PRId64 "  \n",
-           s->min_filepos, pos, s->read_filepos, s->max_filepos);
+    MP_DBG(s, "request seek: to=%" PRId64 " (cur=%" PRId64 ", "
+           "cached=%s)\n", pos, s->read_filepos,
+           block_at(s, pos) >= 0 ? "yes" : "no");
 
-    if (!s->seekable && pos > s->max_filepos) {
+    // Unseekable streams can only continue from the stream position, so the
+    // data up to it must be cached.
+    if (!s->seekable && pos > s->stream_filepos) {
         MP_ERR(s, "Attempting to seek past cached data in unseekable stream.\n");
         r = 0;
-    } else if (!s->seekable && pos < s->min_filepos) {
+    } else if (!s->seekable && contiguous_end(s, pos) < s->stream_filepos) {
         MP_ERR(s, "Attempting to seek before cached data in unseekable stream.\n");
         r = 0;
     } else {
@@ -649,6 +812,7 @@ int stream_cache_init(stream_t *cache, stream_t *stream,
         min = s->buffer_size - FILL_LIMIT;
 
     s->seekable = stream->seekable;
+    s->stream_filepos = stream_tell(stream);
 
     if (pthread_create(&s->cache_thread, NULL, cache_thread, s) != 0) {
         MP_ERR(s, "Starting cache thread failed.\n");
@@ -16,6 +16,18 @@
  */
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <libavutil/md5.h>
+#include <libavutil/intreadwrite.h>
+
+#include "config.h"
 
 #include "osdep/io.h"
 
@@ -23,18 +35,37 @@
 #include "common/msg.h"
 
 #include "options/options.h"
+#include "options/path.h"
 
 #include "stream.h"
 
 #define BLOCK_SIZE 1024LL
 #define BLOCK_ALIGN(p) ((p) & ~(BLOCK_SIZE - 1))
 
+// Persistent cache (--cache-file-dir): each stream has a data file and a
+// sidecar map file, named after the MD5 of the URL. The map file contains
+// a header followed by the block bitmap:
+//   8 bytes magic, 8 bytes block size, 8 bytes stream size,
+//   8 bytes bitmap size, bitmap
+#define MAP_MAGIC "mpvfc001"
+#define MAP_HEADER_SIZE 32
+
+// Write the map after this many new blocks (in addition to closing).
+#define MAP_SAVE_BLOCKS 4096
+
 struct priv {
     struct stream *original;
     FILE *cache_file;
     uint8_t *block_bits;    // 1 bit for each BLOCK_SIZE, whether block was read
+    size_t block_bits_size;
     int64_t size;           // currently known size
     int64_t max_size;       // max. size for block_bits and cache_file
+
+    // Persistent mode only.
+    char *data_path;
+    char *map_path;
+    int64_t stream_size;    // stream size the map is valid for
+    int new_blocks;         // blocks written since the map was last saved
 };
 
 static bool test_bit(struct priv *p, int64_t pos)
@@ -54,6 +85,205 @@ static void set_bit(struct priv *p, int64_t pos, bool bit)
     p->block_bits[block / 8] = (p->block_bits[block / 8] & ~m) | (bit ? m : 0);
 }
 
+// Lock or unlock (F_UNLCK) the whole file.
+static void lock_file(int fd, int type)
+{
+#if HAVE_POSIX
+    struct flock fl = {.l_type = type, .l_whence = SEEK_SET};
+    while (fcntl(fd, F_SETLKW, &fl) == -1 && errno == EINTR) {}
+#endif
+}
+
+static bool read_all(int fd, void *buf, size_t len)
+{
+    return lseek(fd, 0, SEEK_SET) == 0 && read(fd, buf, len) == (ssize_t)len;
+}
+
+// OR the bits stored in the map file into p->block_bits. Returns false if the
+// map is missing or belongs to a different stream version.
+static bool merge_map(struct priv *p, int fd)
+{
+    uint8_t hdr[MAP_HEADER_SIZE];
+    if (!read_all(fd, hdr, sizeof(hdr)))
+        return false;
+    if (memcmp(hdr, MAP_MAGIC, 8) != 0 || AV_RL64(hdr + 8) != BLOCK_SIZE ||
+        AV_RL64(hdr + 16) != p->stream_size)
+        return false;
+    size_t size = MPMIN(AV_RL64(hdr + 24), p->block_bits_size);
+    uint8_t *bits = talloc_size(NULL, size);
+    bool ok = read(fd, bits, size) == (ssize_t)size;
+    if (ok) {
+        for (size_t n = 0; n < size; n++)
+            p->block_bits[n] |= bits[n];
+    }
+    talloc_free(bits);
+    return ok;
+}
+
+// Write the bitmap to the map file, merged with the blocks other instances
+// have added to the same entry meanwhile.
+static void save_map(stream_t *s)
+{
+    struct priv *p = s->priv;
+    p->new_blocks = 0;
+
+    // If the entry was evicted by another instance, the data file is gone,
+    // and a new map would describe a file that doesn't exist.
+    struct stat st_path, st_fd;
+    if (stat(p->data_path, &st_path) != 0 ||
+        fstat(fileno(p->cache_file), &st_fd) != 0 ||
+        st_path.st_ino != st_fd.st_ino || st_path.st_dev != st_fd.st_dev)
+    {
+        MP_WARN(s, "Cache entry was removed, not updating it anymore.\n");
+        p->map_path = NULL;
+        return;
+    }
+
+    // Data must be on disk before the map claims it's there.
+    if (fflush(p->cache_file) != 0)
+        return;
+
+    int fd = open(p->map_path, O_RDWR | O_CREAT | O_CLOEXEC | O_BINARY, 0666);
+    if (fd < 0) {
+        MP_ERR(s, "Can't write cache map '%s'.\n", p->map_path);
+        return;
+    }
+    lock_file(fd, F_WRLCK);
+    merge_map(p, fd);
+    uint8_t hdr[MAP_HEADER_SIZE];
+    memcpy(hdr, MAP_MAGIC, 8);
+    AV_WL64(hdr + 8, BLOCK_SIZE);
+    AV_WL64(hdr + 16, p->stream_size);
+    AV_WL64(hdr + 24, p->block_bits_size);
+    if (lseek(fd, 0, SEEK_SET) != 0 ||
+        write(fd, hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr) ||
+        write(fd, p->block_bits, p->block_bits_size) != (ssize_t)p->block_bits_size)
+        MP_ERR(s, "Failed to write cache map '%s'.\n", p->map_path);
+    lock_file(fd, F_UNLCK);
+    close(fd);
+}
+
+struct cache_entry {
+    char *map_path, *data_path;
+    int64_t size;
+    time_t mtime;
+};
+
+static int compare_entry_age(const void *a, const void *b)
+{
+    const struct cache_entry *e1 = a, *e2 = b;
+    return e1->mtime < e2->mtime ? -1 : (e1->mtime > e2->mtime ? 1 : 0);
+}
+
+// Delete least recently used entries in dir until the total size is below
+// max_size. The entry named keep is never deleted.
+static void evict_entries(struct mp_log *log, const char *dir, const char *keep,
+                          int64_t max_size)
+{
+    void *tmp = talloc_new(NULL);
+    struct cache_entry *entries = NULL;
+    int num_entries = 0;
+    int64_t total = 0;
+
+    DIR *d = opendir(dir);
+    if (!d)
+        goto done;
+    struct dirent *ep;
+    while ((ep = readdir(d))) {
+        bstr name = bstr0(ep->d_name);
+        if (!bstr_endswith0(name, ".map"))
+            continue;
+        name = bstr_splice(name, 0, -4);
+        struct cache_entry e = {
+            .map_path = mp_path_join(tmp, bstr0(dir), bstr0(ep->d_name)),
+            .data_path = talloc_asprintf(tmp, "%s/%.*s.data", dir, BSTR_P(name)),
+        };
+        struct stat st;
+        if (stat(e.map_path, &st) != 0)
+            continue;
+        e.mtime = st.st_mtime;
+        if (stat(e.data_path, &st) == 0) {
+#if HAVE_POSIX
+            e.size = st.st_blocks * 512LL; // sparse files
+#else
+            e.size = st.st_size;
+#endif
+        }
+        total += e.size;
+        if (bstr_equals0(name, keep))
+            continue;
+        MP_TARRAY_APPEND(tmp, entries, num_entries, e);
+    }
+    closedir(d);
+
+    qsort(entries, num_entries, sizeof(entries[0]), compare_entry_age);
+    for (int n = 0; n < num_entries && total > max_size; n++) {
+        mp_verbose(log, "Removing cache entry '%s'.\n", entries[n].data_path);
+        unlink(entries[n].map_path);
+        unlink(entries[n].data_path);
+        total -= entries[n].size;
+    }
+
+done:
+    talloc_free(tmp);
+}
+
+// Open (or create) the persistent cache entry for the stream.
+static FILE *open_persistent(stream_t *cache, struct priv *p, stream_t *stream,
+                             struct mp_cache_opts *opts)
+{
+    if (stream_control(stream, STREAM_CTRL_GET_SIZE, &p->stream_size) != STREAM_OK
+        || p->stream_size <= 0)
+    {
+        MP_VERBOSE(cache, "Stream size unknown, not using persistent cache.\n");
+        return NULL;
+    }
+
+    char *dir = mp_get_user_path(p, cache->global, opts->file_dir);
+    mkdir(dir, 0700);
+
+    uint8_t md5[16];
+    av_md5_sum(md5, stream->url, strlen(stream->url));
+    char key[33];
+    for (int i = 0; i < 16; i++)
+        snprintf(key + i * 2, 3, "%02x", md5[i]);
+
+    p->data_path = talloc_asprintf(p, "%s/%s.data", dir, key);
+    p->map_path = talloc_asprintf(p, "%s/%s.map", dir, key);
+
+    int fd = open(p->data_path, O_RDWR | O_CREAT | O_CLOEXEC | O_BINARY, 0666);
+    FILE *file = fd >= 0 ? fdopen(fd, "rb+") : NULL;
+    if (!file) {
+        if (fd >= 0)
+            close(fd);
+        MP_ERR(cache, "can't open cache file '%s'\n", p->data_path);
+        return NULL;
+    }
+
+    p->size = MPMIN(p->max_size, p->stream_size);
+    int map_fd = open(p->map_path, O_RDONLY | O_CLOEXEC | O_BINARY);
+    if (map_fd >= 0) {
+        lock_file(map_fd, F_RDLCK);
+        if (merge_map(p, map_fd)) {
+            MP_VERBOSE(cache, "Resuming cache entry '%s'.\n", p->data_path);
+        } else {
+            MP_VERBOSE(cache, "Cache entry '%s' is outdated.\n", p->data_path);
+        }
+        lock_file(map_fd, F_UNLCK);
+        close(map_fd);
+    }
+
+    // This also overwrites an outdated map, and updates the entry's age for
+    // eviction.
+    p->cache_file = file;
+    save_map(cache);
+
+    if (p->map_path && opts->file_dir_max > 0)
+        evict_entries(cache->log, dir, key, opts->file_dir_max * 1024LL);
+
+    return file;
+}
+
 static int fill_buffer(stream_t *s, char *buffer, int max_len)
 {
     struct priv *p = s->priv;
@@ -70,6 +300,10 @@ static int fill_buffer(stream_t *s, char *buffer, int max_len)
         stream_control(s, STREAM_CTRL_GET_SIZE, &new_size);
         if (p->size >= 0 && new_size != p->size)
             set_bit(p, BLOCK_ALIGN(p->size), 0);
+        if (p->map_path && new_size != p->stream_size) {
+            MP_WARN(s, "Stream size changed, not updating cache entry.\n");
+            p->map_path = NULL;
+        }
         p->size = MPMIN(p->max_size, new_size);
     }
     int64_t aligned = BLOCK_ALIGN(s->pos);
@@ -90,6 +324,8 @@ static int fill_buffer(stream_t *s, char *buffer, int max_len)
         if (fwrite(tmp, r, 1, p->cache_file) != 1)
             return -1;
         set_bit(p, aligned, 1);
+        if (p->map_path && ++p->new_blocks >= MAP_SAVE_BLOCKS)
+            save_map(s);
     }
     if (fseeko(p->cache_file, s->pos, SEEK_SET))
         return -1;
@@ -115,6 +351,8 @@ static int control(stream_t *s, int cmd, void *arg)
 static void s_close(stream_t *s)
 {
     struct priv *p = s->priv;
+    if (p->map_path && p->new_blocks)
+        save_map(s);
     if (p->cache_file)
         fclose(p->cache_file);
     talloc_free(p);
@@ -124,7 +362,8 @@ static void s_close(stream_t *s)
 int stream_file_cache_init(stream_t *cache, stream_t *stream,
                            struct mp_cache_opts *opts)
 {
-    if (!opts->file || !opts->file[0] || opts->file_max < 1)
+    bool persistent = opts->file_dir && opts->file_dir[0];
+    if ((!persistent && (!opts->file || !opts->file[0])) || opts->file_max < 1)
         return 0;
 
     if (!stream->seekable) {
@@ -132,22 +371,34 @@ int stream_file_cache_init(stream_t *cache, stream_t *stream,
         return -1;
     }
 
-    bool use_anon_file = strcmp(opts->file, "TMP") == 0;
-    FILE *file = use_anon_file ? tmpfile() : fopen(opts->file, "wb+");
-    if (!file) {
-        MP_ERR(cache, "can't open cache file '%s'\n", opts->file);
-        return -1;
-    }
-
     struct priv *p = talloc_zero(NULL, struct priv);
-
-    cache->priv = p;
     p->original = stream;
-    p->cache_file = file;
     p->max_size = opts->file_max * 1024LL;
 
     // file_max can be INT_MAX, so this is at most about 256MB
-    p->block_bits = talloc_zero_size(p, (p->max_size / BLOCK_SIZE + 1) / 8 + 1);
+    p->block_bits_size = (p->max_size / BLOCK_SIZE + 1) / 8 + 1;
+    p->block_bits = talloc_zero_size(p, p->block_bits_size);
+
+    cache->priv = p;
+
+    FILE *file;
+    if (persistent) {
+        file = open_persistent(cache, p, stream, opts);
+        if (!file) {
+            talloc_free(p);
+            return 0;
+        }
+    } else {
+        bool use_anon_file = strcmp(opts->file, "TMP") == 0;
+        file = use_anon_file ? tmpfile() : fopen(opts->file, "wb+");
+        if (!file) {
+            MP_ERR(cache, "can't open cache file '%s'\n", opts->file);
+            talloc_free(p);
+            return -1;
+        }
+    }
+
+    p->cache_file = file;
 
     cache->seek = seek;
     cache->fill_buffer = fill_buffer;
@@ -579,6 +579,13 @@ struct bstr stream_peek(stream_t *s, int len)
 {
     assert(len >= 0);
     assert(len <= STREAM_MAX_BUFFER_SIZE);
+    if (s->buf_len - s->buf_pos < len && s->mapped_data) {
+        // Point into the mapping instead of refilling the buffer.
+        int64_t pos = stream_tell(s);
+        if (pos >= 0 && pos + len <= s->mapped_size)
+            return (bstr){.start = (unsigned char *)s->mapped_data + pos,
+                          .len = len};
+    }
     if (s->buf_len - s->buf_pos < len) {
         // Move to front to guarantee we really can read up to max size.
         int buf_valid = s->buf_len - s->buf_pos;
@@ -603,6 +610,23 @@ struct bstr stream_peek(stream_t *s, int len)
                   .len = FFMIN(len, s->buf_len - s->buf_pos)};
 }
 
+// If the stream is memory-mapped, return a pointer to the next len bytes and
+// skip them, without copying the data. padding bytes after the data are
+// guaranteed to be readable (but are not 0). The returned memory is read-only,
+// and stays valid until the stream is closed. Returns NULL (and doesn't change
+// the position) if the stream is not mapped or the data is not available this
+// way.
+const unsigned char *stream_read_mapped(stream_t *s, int64_t len, int padding)
+{
+    int64_t pos = stream_tell(s);
+    if (!s->mapped_data || s->capture_file || len < 0 || pos < 0 ||
+        pos + len + padding > s->mapped_size)
+        return NULL;
+    if (!stream_seek(s, pos + len) || stream_tell(s) != pos + len)
+        return NULL;
+    return s->mapped_data + pos;
+}
+
 int stream_write_buffer(stream_t *s, unsigned char *buf, int len)
 {
     int rd;
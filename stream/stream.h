@@ -73,6 +73,7 @@ enum stream_ctrl {
     STREAM_CTRL_GET_CACHE_FILL,
     STREAM_CTRL_GET_CACHE_IDLE,
     STREAM_CTRL_RESUME_CACHE,
+    STREAM_CTRL_GET_CACHE_RANGES,       // struct stream_cache_ranges*
 
     // stream_memory.c
     STREAM_CTRL_SET_CONTENTS,
@@ -145,6 +146,16 @@ struct stream_avseek {
     int flags;
 };
 
+struct stream_cache_range {
+    int64_t start, end;     // byte range [start, end)
+};
+
+// for STREAM_CTRL_GET_CACHE_RANGES
+struct stream_cache_ranges {
+    struct stream_cache_range *ranges;  // talloc'ed, sorted; caller frees
+    int num_ranges;
+};
+
 struct stream;
 typedef struct stream_info_st {
     const char *name;
@@ -211,6 +222,11 @@ typedef struct stream {
     struct stream *uncached_stream; // underlying stream for cache wrapper
     struct stream *source;
 
+    // If set, the file is memory-mapped (read-only): the byte at file
+    // position n is mapped_data[n], for n < mapped_size.
+    const unsigned char *mapped_data;
+    int64_t mapped_size;
+
     // Includes additional padding in case sizes get rounded up by sector size.
     unsigned char buffer[];
 } stream_t;
@@ -256,6 +272,7 @@ int stream_seek(stream_t *s, int64_t pos);
 int stream_read(stream_t *s, char *mem, int total);
 int stream_read_partial(stream_t *s, char *buf, int buf_size);
 struct bstr stream_peek(stream_t *s, int len);
+const unsigned char *stream_read_mapped(stream_t *s, int64_t len, int padding);
 void stream_drop_buffers(stream_t *s);
 
 struct mpv_global;
@@ -26,6 +26,11 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdint.h>
+
+#if HAVE_POSIX
+#include <sys/mman.h>
+#endif
 
 #include "osdep/io.h"
 
@@ -33,6 +38,7 @@
 #include "common/msg.h"
 #include "stream.h"
 #include "options/m_option.h"
+#include "options/options.h"
 #include "options/path.h"
 
 #if HAVE_BSD_FSTATFS
@@ -54,11 +60,97 @@
 #endif
 #endif
 
+// With --stream-mmap, ask the kernel to read ahead this much of the mapping.
+#define MAP_READAHEAD (8 * 1024 * 1024)
+
 struct priv {
     int fd;
     bool close;
+    // Used if the file is memory-mapped.
+    unsigned char *map;
+    int64_t map_size;
+    int64_t pos;            // read position (fd position is not used)
+    int64_t advised_start;  // last MADV_WILLNEED range
+    int64_t advised_end;
 };
 
+#if HAVE_POSIX
+static void map_advise(struct priv *p)
+{
+    // Issue a new hint after a seek, or when half of the previous readahead
+    // range was used up.
+    if (p->pos >= p->advised_start && p->pos < p->advised_end - MAP_READAHEAD / 2)
+        return;
+    long page = sysconf(_SC_PAGESIZE);
+    int64_t start = page > 0 ? p->pos / page * page : p->pos;
+    int64_t len = MPMIN(MAP_READAHEAD, p->map_size - start);
+    if (len > 0)
+        madvise(p->map + start, len, MADV_WILLNEED);
+    p->advised_start = start;
+    p->advised_end = start + MAP_READAHEAD;
+}
+
+static int fill_buffer_mapped(stream_t *s, char *buffer, int max_len)
+{
+    struct priv *p = s->priv;
+    int r;
+    if (p->pos < p->map_size) {
+        r = MPMIN(max_len, p->map_size - p->pos);
+        memcpy(buffer, p->map + p->pos, r);
+    } else {
+        // The file might have been appended to after mapping it.
+        r = pread(p->fd, buffer, max_len, p->pos);
+    }
+    if (r <= 0)
+        return -1;
+    p->pos += r;
+    map_advise(p);
+    return r;
+}
+
+static int seek_mapped(stream_t *s, int64_t newpos)
+{
+    struct priv *p = s->priv;
+    p->pos = newpos;
+    map_advise(p);
+    return 1;
+}
+
+// Map the whole file. Returns false if this is not possible; the stream
+// then works as usual.
+static bool map_file(stream_t *s)
+{
+    struct priv *p = s->priv;
+    struct stat st;
+    if (fstat(p->fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+        return false;
+    // Don't take up too much address space on 32 bit systems.
+    if (st.st_size > SIZE_MAX / 4)
+        return false;
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, p->fd, 0);
+    if (map == MAP_FAILED) {
+        MP_VERBOSE(s, "Could not map file: %s\n", mp_strerror(errno));
+        return false;
+    }
+    p->map = map;
+    p->map_size = st.st_size;
+    p->pos = 0;
+    p->advised_start = p->advised_end = -1;
+    map_advise(p);
+    s->mapped_data = p->map;
+    s->mapped_size = p->map_size;
+    s->fill_buffer = fill_buffer_mapped;
+    s->seek = seek_mapped;
+    MP_VERBOSE(s, "File is memory-mapped.\n");
+    return true;
+}
+#else
+static bool map_file(stream_t *s)
+{
+    return false;
+}
+#endif
+
 static int fill_buffer(stream_t *s, char *buffer, int max_len)
 {
     struct priv *p = s->priv;
@@ -107,6 +199,10 @@ static int control(stream_t *s, int cmd, void *arg)
 static void s_close(stream_t *s)
 {
     struct priv *p = s->priv;
+#if HAVE_POSIX
+    if (p->map)
+        munmap(p->map, p->map_size);
+#endif
     if (p->close && p->fd >= 0)
         close(p->fd);
 }
@@ -285,6 +381,10 @@ static int open_f(stream_t *stream)
     if (check_stream_network(stream))
         stream->streaming = true;
 
+    if (!write && priv->close && !stream->streaming && stream->seekable &&
+        stream->opts && stream->opts->stream_mmap)
+        map_file(stream);
+
     return STREAM_OK;
 }
 
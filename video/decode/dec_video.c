@@ -23,12 +23,17 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <pthread.h>
 
+#include "common/common.h"
 #include "common/msg.h"
+#include "common/trace.h"
 
 #include "osdep/timer.h"
+#include "osdep/threads.h"
 
 #include "stream/stream.h"
+#include "demux/demux.h"
 #include "demux/packet.h"
 
 #include "common/codecs.h"
@@ -56,9 +61,87 @@ const vd_functions_t * const mpcodecs_vd_drivers[] = {
     NULL
 };
 
+struct queued_frame {
+    struct mp_image *mpi;
+    int64_t time;               // time at which it was queued
+};
+
+struct video_decode_thread {
+    struct dec_video *d_video;
+    pthread_t thread;
+    // Held while the decoder (and the decoding state in dec_video) is used.
+    pthread_mutex_t decode_lock;
+
+    // --- The following fields are protected by lock
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    bool terminate;
+    bool active;                // decoding was requested since the last reset
+    bool eof;                   // decoder returned everything
+    bool waiting;               // last packet read returned nothing
+    uint64_t requests;          // incremented by each video_read_frame() call
+    uint64_t generation;        // incremented by each reset
+    struct video_decode_params params;
+    int dropped;
+
+    struct queued_frame *frames;
+    int num_frames;
+    int max_frames;
+
+    void (*wakeup_cb)(void *ctx);
+    void *wakeup_ctx;
+
+    int64_t decode_time_us, num_decoded;
+    int64_t queue_time_us, num_dequeued;
+};
+
+// Must be called with both decode_lock and lock held.
+static void reset_thread(struct video_decode_thread *t)
+{
+    for (int n = 0; n < t->num_frames; n++)
+        talloc_free(t->frames[n].mpi);
+    t->num_frames = 0;
+    t->generation++;
+    t->active = false;
+    t->eof = false;
+    t->waiting = false;
+    t->dropped = 0;
+}
+
+static int vd_control(struct dec_video *d_video, int cmd, void *arg)
+{
+    const struct vd_functions *vd = d_video->vd_driver;
+    if (vd)
+        return vd->control(d_video, cmd, arg);
+    return CONTROL_UNKNOWN;
+}
+
+// Make the decoder thread stop reading packets, and drop what it decoded. It
+// resumes with the next video_read_frame() call. Call this before seeking the
+// demuxer, so that no packet from after the seek is consumed (and discarded
+// by video_reset_decoding()) while the decoder still has the old state.
+void video_quiesce_decoding(struct dec_video *d_video)
+{
+    struct video_decode_thread *t = d_video->thread;
+    if (!t)
+        return;
+    pthread_mutex_lock(&t->decode_lock);
+    pthread_mutex_lock(&t->lock);
+    reset_thread(t);
+    pthread_mutex_unlock(&t->lock);
+    pthread_mutex_unlock(&t->decode_lock);
+}
+
 void video_reset_decoding(struct dec_video *d_video)
 {
-    video_vd_control(d_video, VDCTRL_RESET, NULL);
+    struct video_decode_thread *t = d_video->thread;
+    if (t) {
+        pthread_mutex_lock(&t->decode_lock);
+        pthread_mutex_lock(&t->lock);
+        reset_thread(t);
+        pthread_mutex_unlock(&t->lock);
+    }
+    vd_control(d_video, VDCTRL_RESET, NULL);
     if (d_video->vfilter && d_video->vfilter->initialized == 1)
         vf_seek_reset(d_video->vfilter);
     mp_image_unrefp(&d_video->waiting_decoded_mpi);
@@ -70,14 +153,25 @@ void video_reset_decoding(struct dec_video *d_video)
     d_video->codec_dts = MP_NOPTS_VALUE;
     d_video->sorted_pts = MP_NOPTS_VALUE;
     d_video->unsorted_pts = MP_NOPTS_VALUE;
+    if (t)
+        pthread_mutex_unlock(&t->decode_lock);
 }
 
 int video_vd_control(struct dec_video *d_video, int cmd, void *arg)
 {
-    const struct vd_functions *vd = d_video->vd_driver;
-    if (vd)
-        return vd->control(d_video, cmd, arg);
-    return CONTROL_UNKNOWN;
+    struct video_decode_thread *t = d_video->thread;
+    if (!t)
+        return vd_control(d_video, cmd, arg);
+    pthread_mutex_lock(&t->decode_lock);
+    int r = vd_control(d_video, cmd, arg);
+    // Frames decoded ahead still use the old (hardware) format.
+    if (cmd == VDCTRL_FORCE_HWDEC_FALLBACK && r == CONTROL_OK) {
+        pthread_mutex_lock(&t->lock);
+        reset_thread(t);
+        pthread_mutex_unlock(&t->lock);
+    }
+    pthread_mutex_unlock(&t->decode_lock);
+    return r;
 }
 
 int video_set_colors(struct dec_video *d_video, const char *item, int value)
@@ -115,8 +209,31 @@ int video_get_colors(struct dec_video *d_video, const char *item, int *value)
     return 0;
 }
 
+static void stop_thread(struct dec_video *d_video)
+{
+    struct video_decode_thread *t = d_video->thread;
+    if (!t)
+        return;
+    pthread_mutex_lock(&t->lock);
+    t->terminate = true;
+    pthread_cond_signal(&t->wakeup);
+    pthread_mutex_unlock(&t->lock);
+    pthread_join(t->thread, NULL);
+    pthread_mutex_lock(&t->decode_lock);
+    pthread_mutex_lock(&t->lock);
+    reset_thread(t);
+    pthread_mutex_unlock(&t->lock);
+    pthread_mutex_unlock(&t->decode_lock);
+    pthread_cond_destroy(&t->wakeup);
+    pthread_mutex_destroy(&t->lock);
+    pthread_mutex_destroy(&t->decode_lock);
+    talloc_free(t);
+    d_video->thread = NULL;
+}
+
 void video_uninit(struct dec_video *d_video)
 {
+    stop_thread(d_video);
     mp_image_unrefp(&d_video->waiting_decoded_mpi);
     if (d_video->vd_driver) {
         MP_VERBOSE(d_video, "Uninit video.\n");
@@ -310,13 +427,22 @@ struct mp_image *video_decode(struct dec_video *d_video,
     double prev_codec_dts = d_video->codec_dts;
 
     MP_STATS(d_video, "start decode video");
+    MP_TRACE_BEGIN(d_video, "decode video");
+    int64_t decode_start = mp_time_us();
+    int64_t cpu_start = d_video->measure_cpu ? mp_thread_cpu_time_us() : 0;
 
     struct mp_image *mpi = d_video->vd_driver->decode(d_video, packet, drop_frame);
 
+    if (d_video->measure_cpu) {
+        atomic_fetch_add(&d_video->decode_cpu_us,
+                         mp_thread_cpu_time_us() - cpu_start);
+    }
+
     MP_STATS(d_video, "end decode video");
 
     if (!mpi || drop_frame) {
         talloc_free(mpi);
+        MP_TRACE_END(d_video, "decode video");
         return NULL;            // error / skipped frame
     }
 
@@ -375,9 +501,189 @@ struct mp_image *video_decode(struct dec_video *d_video,
 
     mpi->pts = pts;
     d_video->decoded_pts = pts;
+    // With frame reordering, the packet is not necessarily the one the frame
+    // was decoded from, so the demux time is approximate.
+    mpi->times = (struct mp_frame_times){
+        .demux = packet ? packet->demux_time : 0,
+        .decode_start = decode_start,
+        .decode_end = mp_time_us(),
+        .trace_flow = mp_trace_pts_id(pts - d_video->pts_offset),
+    };
+    MP_TRACE_FLOW(d_video, STEP, "video frame", mpi->times.trace_flow);
+    MP_TRACE_END(d_video, "decode video");
     return mpi;
 }
 
+static void *decode_thread(void *ptr)
+{
+    struct video_decode_thread *t = ptr;
+    struct dec_video *d_video = t->d_video;
+
+    mpthread_set_name("vd");
+
+    pthread_mutex_lock(&t->lock);
+    uint64_t retry_request = 0;
+    while (!t->terminate) {
+        // If the demuxer had no packet, retry only after the next request
+        // (the player is woken up by the demuxer when new packets arrive).
+        if (!t->active || t->eof || t->num_frames >= t->max_frames ||
+            (t->waiting && t->requests == retry_request))
+        {
+            pthread_cond_wait(&t->wakeup, &t->lock);
+            continue;
+        }
+        uint64_t generation = t->generation;
+        retry_request = t->requests;
+        pthread_mutex_unlock(&t->lock);
+
+        pthread_mutex_lock(&t->decode_lock);
+        pthread_mutex_lock(&t->lock);
+        bool reset = t->generation != generation;
+        struct video_decode_params params = t->params;
+        pthread_mutex_unlock(&t->lock);
+
+        struct mp_image *mpi = NULL;
+        bool had_packet = false;
+        int r = 0;
+        int64_t decode_time = 0;
+        if (!reset) {
+            struct demux_packet *pkt;
+            r = demux_read_packet_async(d_video->header, &pkt);
+            if (r != 0) {
+                if (pkt && pkt->pts != MP_NOPTS_VALUE)
+                    pkt->pts += params.pts_offset;
+                if ((pkt && pkt->pts >= params.hrseek_pts - .005) ||
+                    d_video->has_broken_packet_pts)
+                    params.hrseek_framedrop_active = false;
+                int framedrop = params.hrseek_framedrop_active ?
+                                2 : params.framedrop;
+                int64_t start = mp_time_us();
+                d_video->pts_offset = params.pts_offset;
+                mpi = video_decode(d_video, pkt, framedrop);
+                decode_time = mp_time_us() - start;
+                had_packet = !!pkt;
+                free_demux_packet(pkt);
+            }
+        }
+        pthread_mutex_unlock(&t->decode_lock);
+
+        pthread_mutex_lock(&t->lock);
+        if (reset || t->generation != generation) {
+            talloc_free(mpi);
+            continue;
+        }
+        t->waiting = r == 0;
+        t->params.hrseek_framedrop_active = params.hrseek_framedrop_active;
+        if (r != 0) {
+            t->decode_time_us += decode_time;
+            t->num_decoded++;
+        }
+        if (mpi) {
+            MP_TARRAY_APPEND(t, t->frames, t->num_frames,
+                             (struct queued_frame){mpi, mp_time_us()});
+        } else if (had_packet && params.count_drops) {
+            t->dropped++;
+        }
+        t->eof = r < 0 && !mpi;
+        if (mpi || t->eof) {
+            pthread_mutex_unlock(&t->lock);
+            t->wakeup_cb(t->wakeup_ctx);
+            pthread_mutex_lock(&t->lock);
+        }
+    }
+    pthread_mutex_unlock(&t->lock);
+    return NULL;
+}
+
+// Start a thread that reads packets and decodes them in advance, keeping up
+// to max_queued decoded frames. wakeup_cb is called when a new frame is
+// available (or EOF is reached). The packets must be read from a demuxer
+// with a demuxer thread.
+// After this, video_read_frame() has to be used instead of video_decode().
+bool video_start_thread(struct dec_video *d_video, int max_queued,
+                        void (*wakeup_cb)(void *ctx), void *wakeup_ctx)
+{
+    assert(!d_video->thread);
+    struct video_decode_thread *t = talloc_ptrtype(d_video, t);
+    *t = (struct video_decode_thread) {
+        .d_video = d_video,
+        .max_frames = MPMAX(max_queued, 1),
+        .wakeup_cb = wakeup_cb,
+        .wakeup_ctx = wakeup_ctx,
+    };
+    pthread_mutex_init(&t->decode_lock, NULL);
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->wakeup, NULL);
+    if (pthread_create(&t->thread, NULL, decode_thread, t)) {
+        pthread_cond_destroy(&t->wakeup);
+        pthread_mutex_destroy(&t->lock);
+        pthread_mutex_destroy(&t->decode_lock);
+        talloc_free(t);
+        return false;
+    }
+    d_video->thread = t;
+    MP_VERBOSE(d_video, "Decoding up to %d frames ahead.\n", t->max_frames);
+    return true;
+}
+
+// Return a frame decoded by the decoder thread in *out_mpi.
+// Returns 1 if a frame was returned, 0 if no frame is available yet (the
+// wakeup callback will be called when it is), -1 on EOF.
+// Each call also lets the thread continue to read packets.
+int video_read_frame(struct dec_video *d_video,
+                     struct video_decode_params *params,
+                     struct mp_image **out_mpi)
+{
+    struct video_decode_thread *t = d_video->thread;
+    assert(t);
+    *out_mpi = NULL;
+
+    pthread_mutex_lock(&t->lock);
+    if (!t->active) {
+        t->active = true;
+        t->params.hrseek_framedrop_active = params->hrseek_framedrop;
+        t->params.hrseek_pts = params->hrseek_pts;
+    }
+    t->params.pts_offset = params->pts_offset;
+    t->params.framedrop = params->framedrop;
+    t->params.count_drops = params->count_drops;
+    t->requests++;
+    pthread_cond_signal(&t->wakeup);
+
+    int r = t->eof ? -1 : 0;
+    if (t->num_frames) {
+        struct queued_frame f = t->frames[0];
+        MP_TARRAY_REMOVE_AT(t->frames, t->num_frames, 0);
+        t->queue_time_us += mp_time_us() - f.time;
+        t->num_dequeued++;
+        *out_mpi = f.mpi;
+        r = 1;
+    }
+    params->hrseek_framedrop_active = t->params.hrseek_framedrop_active;
+    params->dropped = t->dropped;
+    t->dropped = 0;
+    pthread_mutex_unlock(&t->lock);
+    return r;
+}
+
+// Return false if there is no decoder thread.
+bool video_get_thread_stats(struct dec_video *d_video,
+                            struct video_decode_stats *stats)
+{
+    struct video_decode_thread *t = d_video->thread;
+    if (!t)
+        return false;
+    pthread_mutex_lock(&t->lock);
+    *stats = (struct video_decode_stats){
+        .queued = t->num_frames,
+        .max_queued = t->max_frames,
+        .decode_time = t->decode_time_us / 1e6 / MPMAX(t->num_decoded, 1),
+        .queue_time = t->queue_time_us / 1e6 / MPMAX(t->num_dequeued, 1),
+    };
+    pthread_mutex_unlock(&t->lock);
+    return true;
+}
+
 int video_reconfig_filters(struct dec_video *d_video,
                            const struct mp_image_params *params)
 {
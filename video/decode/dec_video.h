@@ -21,12 +21,37 @@
 
 #include <stdbool.h>
 
+#include "osdep/atomics.h"
 #include "demux/stheader.h"
 #include "video/hwdec.h"
 #include "video/mp_image.h"
 
 struct mp_decoder_list;
 struct vo;
+struct video_decode_thread;
+
+// Parameters and feedback for video_read_frame().
+struct video_decode_params {
+    // Set by the caller on each call.
+    double pts_offset;      // added to packet timestamps
+    int framedrop;          // drop_frame argument for video_decode()
+    bool count_drops;       // count frames dropped by the decoder
+    // Set by the caller, but used only on the first call after a reset. Frames
+    // are dropped in the decoder until a packet with pts >= hrseek_pts is read.
+    bool hrseek_framedrop;
+    double hrseek_pts;
+    // Set by video_read_frame().
+    bool hrseek_framedrop_active; // hrseek_framedrop still in effect
+    int dropped;            // number of frames dropped since the last call
+};
+
+// Statistics of the decoder thread, returned by video_get_thread_stats().
+struct video_decode_stats {
+    int queued;             // decoded frames currently queued
+    int max_queued;         // queue size
+    double decode_time;     // average time to decode a packet (seconds)
+    double queue_time;      // average time a frame spent in the queue
+};
 
 struct dec_video {
     struct mp_log *log;
@@ -71,13 +96,26 @@ struct dec_video {
 
     // Final PTS of previously decoded image
     double decoded_pts;
+    // Offset the caller added to the packet pts (to get back the demuxer pts).
+    double pts_offset;
 
     int bitrate;          // compressed bits/sec
     float fps;            // FPS from demuxer or from user override
     float initial_decoder_aspect;
 
+    // CPU time spent in the decoder (microseconds), only measured if
+    // measure_cpu is set (--benchmark)
+    bool measure_cpu;
+    atomic_llong decode_cpu_us;
+
+    // Decoder thread (if NULL, the caller decodes with video_decode())
+    struct video_decode_thread *thread;
+
     // State used only by player/video.c
     double last_pts;
+    int64_t filter_time_us;     // time spent filtering frames
+    int64_t filter_cpu_us;      // CPU time spent filtering frames
+    int64_t num_filtered;       // number of frames passed to the filters
 };
 
 struct mp_decoder_list *video_decoder_list(void);
@@ -90,8 +128,17 @@ struct mp_image *video_decode(struct dec_video *d_video,
                               struct demux_packet *packet,
                               int drop_frame);
 
+bool video_start_thread(struct dec_video *d_video, int max_queued,
+                        void (*wakeup_cb)(void *ctx), void *wakeup_ctx);
+int video_read_frame(struct dec_video *d_video,
+                     struct video_decode_params *params,
+                     struct mp_image **out_mpi);
+bool video_get_thread_stats(struct dec_video *d_video,
+                            struct video_decode_stats *stats);
+
 int video_get_colors(struct dec_video *d_video, const char *item, int *value);
 int video_set_colors(struct dec_video *d_video, const char *item, int value);
+void video_quiesce_decoding(struct dec_video *d_video);
 void video_reset_decoding(struct dec_video *d_video);
 int video_vd_control(struct dec_video *d_video, int cmd, void *arg);
 
@@ -34,6 +34,7 @@
 #include "video/fmt-conversion.h"
 
 #include "video/sws_utils.h"
+#include "video/kernel_scale.h"
 
 #include "video/csputils.h"
 #include "video/out/vo.h"
@@ -48,6 +49,7 @@ static struct vf_priv_s {
     struct mp_sws_context *sws;
     int noup;
     int accurate_rnd;
+    char *kernel;
 } const vf_priv_dflt = {
     0, 0,
     -1, -1,
@@ -303,6 +305,8 @@ static int reconfig(struct vf_instance *vf, struct mp_image_params *in,
     mp_sws_set_from_cmdline(vf->priv->sws, vf->chain->opts->vo.sws_opts);
     vf->priv->sws->flags |= vf->priv->v_chr_drop << SWS_SRC_V_CHR_DROP_SHIFT;
     vf->priv->sws->flags |= vf->priv->accurate_rnd * SWS_ACCURATE_RND;
+    if (vf->priv->kernel && vf->priv->kernel[0])
+        vf->priv->sws->kernel = mp_kscale_find_kernel(vf->priv->kernel);
     vf->priv->sws->src = *in;
     vf->priv->sws->dst = *out;
 
@@ -397,6 +401,7 @@ static const m_option_t vf_opts_fields[] = {
     OPT_INTRANGE("chr-drop", v_chr_drop, 0, 0, 3),
     OPT_INTRANGE("noup", noup, 0, 0, 2),
     OPT_FLAG("arnd", accurate_rnd, 0),
+    OPT_STRING_VALIDATE("kernel", kernel, 0, mp_kscale_validate_kernel_opt),
     {0}
 };
 
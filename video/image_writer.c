@@ -37,6 +37,7 @@
 #include "video/mp_image.h"
 #include "video/fmt-conversion.h"
 #include "video/sws_utils.h"
+#include "video/kernel_scale.h"
 
 #include "options/m_option.h"
 
@@ -65,6 +66,8 @@ const struct m_sub_options image_writer_conf = {
         OPT_INTRANGE("png-compression", png_compression, 0, 0, 9),
         OPT_INTRANGE("png-filter", png_filter, 0, 0, 5),
         OPT_STRING("format", format, 0),
+        OPT_STRING_VALIDATE("scale-kernel", scale_kernel, 0,
+                            mp_kscale_validate_kernel_opt),
         {0},
     },
     .size = sizeof(struct image_writer_opts),
@@ -296,7 +299,12 @@ int write_image(struct mp_image *image, const struct image_writer_opts *opts,
         }
         mp_image_copy_attributes(dst, image);
 
-        mp_image_swscale(dst, image, mp_sws_hq_flags);
+        struct mp_sws_context *sws = mp_sws_alloc(NULL);
+        sws->log = log;
+        sws->flags = mp_sws_hq_flags;
+        sws->kernel = mp_kscale_find_kernel(opts->scale_kernel);
+        mp_sws_scale(sws, dst, image);
+        talloc_free(sws);
 
         allocated_image = dst;
         image = dst;
@@ -0,0 +1,644 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Each plane is scaled in two passes: first horizontally, into rows of 16 bit
+ * intermediate values (with INTER_BITS fractional bits), then vertically. The
+ * weights for each output column/row are precomputed as 14 bit fixed point
+ * numbers. The output rows are split into one slice per thread. Each thread
+ * keeps the horizontally scaled source rows it needs for the vertical pass in
+ * a small ring buffer, so every source row is scaled horizontally only once
+ * per slice.
+ *
+ * Components are scaled independently, and chroma planes are scaled with
+ * their own size. For subsampled chroma, the sample positions are shifted
+ * according to the chroma location, so that chroma stays aligned with luma.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include <libavutil/common.h>
+#include <libavutil/cpu.h>
+
+#include "talloc.h"
+#include "common/common.h"
+#include "common/msg.h"
+#include "options/m_option.h"
+#include "osdep/numcores.h"
+#include "video/mp_image.h"
+#include "video/img_format.h"
+#include "video/csputils.h"
+#include "video/out/filter_kernels.h"
+#include "kernel_scale.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define KSCALE_X86 1
+#include <immintrin.h>
+#else
+#define KSCALE_X86 0
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define KSCALE_NEON 1
+#include <arm_neon.h>
+#else
+#define KSCALE_NEON 0
+#endif
+
+#define WEIGHT_BITS 14
+#define INTER_BITS 6
+#define MAX_TAPS 128
+#define MAX_THREADS 16
+
+// Weights for scaling one dimension of a plane.
+struct filter_table {
+    int src_size, dst_size;
+    double offset;          // added to the source position (in source pixels)
+    const struct filter_kernel *kernel;
+    int taps;
+    int taps_padded;        // taps rounded up to 8 (extra weights are 0)
+    int *start;             // [dst_size] first source pixel
+    int16_t *weights;       // [dst_size * taps_padded]
+};
+
+struct plane_job {
+    uint8_t *dst;
+    int dst_stride, dst_w, dst_h;
+    const uint8_t *src;
+    int src_stride, src_w;
+    int channels;
+    struct filter_table *h, *v;
+};
+
+// Per-thread buffers.
+struct scratch {
+    int16_t *ring;
+    const int16_t **rows;
+};
+
+struct worker {
+    struct mp_kscale *ks;
+    int index;
+    uint64_t last_job;      // ID of the last job run (or skipped)
+    pthread_t thread;
+};
+
+struct mp_kscale {
+    const struct filter_kernel *kernel;
+    int num_threads;
+
+    struct filter_table tables[MP_MAX_PLANES][2];
+
+    void (*hfilter1)(int16_t *dst, const uint8_t *src, int src_w,
+                     const struct filter_table *t);
+    void (*vfilter)(uint8_t *dst, const int16_t **rows, const int16_t *w,
+                    int taps, int n);
+
+    struct plane_job jobs[MP_MAX_PLANES];
+    int num_jobs;
+    struct scratch *scratch;        // [num_threads]
+
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;          // new job or termination (for workers)
+    pthread_cond_t done;            // all workers finished (for the caller)
+    uint64_t job_id;
+    int pending;
+    bool terminate;
+    struct worker *workers;         // [num_threads - 1]
+    int num_workers;
+};
+
+static void build_table(void *ta_parent, struct filter_table *t,
+                        const struct filter_kernel *kernel, int src, int dst,
+                        double offset)
+{
+    talloc_free(t->start);
+    talloc_free(t->weights);
+    *t = (struct filter_table){
+        .src_size = src,
+        .dst_size = dst,
+        .offset = offset,
+        .kernel = kernel,
+    };
+
+    int sizes[MAX_TAPS / 2 + 1];
+    for (int n = 0; n < MAX_TAPS / 2; n++)
+        sizes[n] = (n + 1) * 2;
+    sizes[MAX_TAPS / 2] = 0;
+
+    struct filter_kernel k = *kernel;
+    double inv_scale = src / (double)dst;
+    mp_init_filter(&k, sizes, inv_scale);
+
+    // Taps outside of the source are folded into the edge pixels, so there
+    // are never more taps than source pixels.
+    t->taps = MPMIN(k.size, src);
+    t->taps_padded = MP_ALIGN_UP(t->taps, 8);
+    t->start = talloc_array(ta_parent, int, dst);
+    t->weights = talloc_zero_array(ta_parent, int16_t, dst * t->taps_padded);
+
+    float w[MAX_TAPS];
+    double folded[MAX_TAPS];
+    for (int x = 0; x < dst; x++) {
+        double center = (x + 0.5) * inv_scale - 0.5 + offset;
+        double base = floor(center);
+        mp_compute_weights(&k, center - base, w);
+        int start = (int)base - k.size / 2 + 1;
+        int wstart = MPCLAMP(start, 0, src - t->taps);
+        for (int i = 0; i < t->taps; i++)
+            folded[i] = 0;
+        for (int i = 0; i < k.size; i++)
+            folded[MPCLAMP(start + i, 0, src - 1) - wstart] += w[i];
+
+        // Round to fixed point, and make the weights sum up to exactly 1.
+        int16_t *out = &t->weights[x * t->taps_padded];
+        int sum = 0, largest = 0;
+        for (int i = 0; i < t->taps; i++) {
+            out[i] = lrint(folded[i] * (1 << WEIGHT_BITS));
+            sum += out[i];
+            if (fabs(folded[i]) > fabs(folded[largest]))
+                largest = i;
+        }
+        out[largest] += (1 << WEIGHT_BITS) - sum;
+        t->start[x] = wstart;
+    }
+}
+
+// Offset (in source chroma pixels) to add to the sample positions computed as
+// if chroma were centered, for a plane subsampled by 1<<shift. cloc is the
+// chroma position as returned by mp_get_chroma_location() (-1 for left). The
+// chroma sample of output pixel x must be at the source position of the
+// corresponding luma pixel, which is cloc*(s-1)/2 luma pixels off center.
+static double chroma_offset(int shift, int cloc, int src, int dst)
+{
+    int s = 1 << shift;
+    return -cloc * (1.0 - src / (double)dst) * (s - 1) / (2.0 * s);
+}
+
+static inline int16_t hfilter_pixel(const uint8_t *src, const int16_t *w,
+                                    int taps, int channels)
+{
+    int sum = 1 << (WEIGHT_BITS - INTER_BITS - 1);
+    for (int i = 0; i < taps; i++)
+        sum += src[i * channels] * w[i];
+    return sum >> (WEIGHT_BITS - INTER_BITS);
+}
+
+static void hfilter_c(int16_t *dst, const uint8_t *src, int src_w,
+                      const struct filter_table *t, int channels)
+{
+    for (int x = 0; x < t->dst_size; x++) {
+        const uint8_t *s = src + t->start[x] * channels;
+        const int16_t *w = &t->weights[x * t->taps_padded];
+        for (int c = 0; c < channels; c++)
+            dst[x * channels + c] = hfilter_pixel(s + c, w, t->taps, channels);
+    }
+}
+
+static void hfilter1_c(int16_t *dst, const uint8_t *src, int src_w,
+                       const struct filter_table *t)
+{
+    hfilter_c(dst, src, src_w, t, 1);
+}
+
+static void vfilter_c(uint8_t *dst, const int16_t **rows, const int16_t *w,
+                      int taps, int n)
+{
+    for (int x = 0; x < n; x++) {
+        int sum = 1 << (WEIGHT_BITS + INTER_BITS - 1);
+        for (int i = 0; i < taps; i++)
+            sum += rows[i][x] * w[i];
+        dst[x] = av_clip_uint8(sum >> (WEIGHT_BITS + INTER_BITS));
+    }
+}
+
+// Handle the pixels from x on, which didn't fit into a full SIMD vector.
+static void vfilter_tail(uint8_t *dst, const int16_t **rows, const int16_t *w,
+                         int taps, int x, int n)
+{
+    const int16_t *tail[MAX_TAPS];
+    for (int i = 0; i < taps; i++)
+        tail[i] = rows[i] + x;
+    vfilter_c(dst + x, tail, w, taps, n - x);
+}
+
+#if KSCALE_X86
+
+// Horizontal filter for single component planes: the taps of an output pixel
+// are contiguous, so 8 of them are handled with one multiply-add.
+__attribute__((target("sse2")))
+static void hfilter1_sse2(int16_t *dst, const uint8_t *src, int src_w,
+                          const struct filter_table *t)
+{
+    __m128i zero = _mm_setzero_si128();
+    for (int x = 0; x < t->dst_size; x++) {
+        const uint8_t *s = src + t->start[x];
+        const int16_t *w = &t->weights[x * t->taps_padded];
+        if (t->start[x] + t->taps_padded > src_w) {
+            // Reading the padding taps would go past the end of the row.
+            dst[x] = hfilter_pixel(s, w, t->taps, 1);
+            continue;
+        }
+        __m128i acc = zero;
+        for (int i = 0; i < t->taps_padded; i += 8) {
+            __m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(s + i)),
+                                          zero);
+            acc = _mm_add_epi32(acc,
+                    _mm_madd_epi16(v, _mm_loadu_si128((const __m128i *)(w + i))));
+        }
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+        int sum = _mm_cvtsi128_si32(acc) + (1 << (WEIGHT_BITS - INTER_BITS - 1));
+        dst[x] = sum >> (WEIGHT_BITS - INTER_BITS);
+    }
+}
+
+// Pairs of taps are interleaved, so that one multiply-add applies 2 taps.
+__attribute__((target("sse2")))
+static void vfilter_sse2(uint8_t *dst, const int16_t **rows, const int16_t *w,
+                         int taps, int n)
+{
+    const __m128i bias = _mm_set1_epi32(1 << (WEIGHT_BITS + INTER_BITS - 1));
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        __m128i lo = bias, hi = bias;
+        int i = 0;
+        for (; i + 2 <= taps; i += 2) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(rows[i] + x));
+            __m128i b = _mm_loadu_si128((const __m128i *)(rows[i + 1] + x));
+            __m128i wv = _mm_set1_epi32((uint16_t)w[i] |
+                                        ((uint32_t)(uint16_t)w[i + 1] << 16));
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), wv));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), wv));
+        }
+        if (i < taps) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(rows[i] + x));
+            __m128i wv = _mm_set1_epi32((uint16_t)w[i]);
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, zero), wv));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, zero), wv));
+        }
+        lo = _mm_srai_epi32(lo, WEIGHT_BITS + INTER_BITS);
+        hi = _mm_srai_epi32(hi, WEIGHT_BITS + INTER_BITS);
+        __m128i p = _mm_packs_epi32(lo, hi);
+        _mm_storel_epi64((__m128i *)(dst + x), _mm_packus_epi16(p, p));
+    }
+    if (x < n)
+        vfilter_tail(dst, rows, w, taps, x, n);
+}
+
+__attribute__((target("avx2")))
+static void vfilter_avx2(uint8_t *dst, const int16_t **rows, const int16_t *w,
+                         int taps, int n)
+{
+    const __m256i bias = _mm256_set1_epi32(1 << (WEIGHT_BITS + INTER_BITS - 1));
+    const __m256i zero = _mm256_setzero_si256();
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        __m256i lo = bias, hi = bias;
+        int i = 0;
+        for (; i + 2 <= taps; i += 2) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(rows[i] + x));
+            __m256i b = _mm256_loadu_si256((const __m256i *)(rows[i + 1] + x));
+            __m256i wv = _mm256_set1_epi32((uint16_t)w[i] |
+                                           ((uint32_t)(uint16_t)w[i + 1] << 16));
+            lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), wv));
+            hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), wv));
+        }
+        if (i < taps) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(rows[i] + x));
+            __m256i wv = _mm256_set1_epi32((uint16_t)w[i]);
+            lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, zero), wv));
+            hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, zero), wv));
+        }
+        lo = _mm256_srai_epi32(lo, WEIGHT_BITS + INTER_BITS);
+        hi = _mm256_srai_epi32(hi, WEIGHT_BITS + INTER_BITS);
+        // The unpack/pack instructions work within 128 bit lanes; the result
+        // is in the 1st and 3rd 64 bit element.
+        __m256i p = _mm256_packs_epi32(lo, hi);
+        p = _mm256_permute4x64_epi64(_mm256_packus_epi16(p, p), 0x08);
+        _mm_storeu_si128((__m128i *)(dst + x), _mm256_castsi256_si128(p));
+    }
+    if (x < n)
+        vfilter_tail(dst, rows, w, taps, x, n);
+}
+
+#endif /* KSCALE_X86 */
+
+#if KSCALE_NEON
+
+static void vfilter_neon(uint8_t *dst, const int16_t **rows, const int16_t *w,
+                         int taps, int n)
+{
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        int32x4_t lo = vdupq_n_s32(1 << (WEIGHT_BITS + INTER_BITS - 1));
+        int32x4_t hi = lo;
+        for (int i = 0; i < taps; i++) {
+            int16x8_t a = vld1q_s16(rows[i] + x);
+            lo = vmlal_n_s16(lo, vget_low_s16(a), w[i]);
+            hi = vmlal_n_s16(hi, vget_high_s16(a), w[i]);
+        }
+        int16x8_t p = vcombine_s16(vqmovn_s32(vshrq_n_s32(lo, WEIGHT_BITS + INTER_BITS)),
+                                   vqmovn_s32(vshrq_n_s32(hi, WEIGHT_BITS + INTER_BITS)));
+        vst1_u8(dst + x, vqmovun_s16(p));
+    }
+    if (x < n)
+        vfilter_tail(dst, rows, w, taps, x, n);
+}
+
+#endif /* KSCALE_NEON */
+
+static void init_dsp(struct mp_kscale *ks)
+{
+    ks->hfilter1 = hfilter1_c;
+    ks->vfilter = vfilter_c;
+#if KSCALE_X86
+    int flags = av_get_cpu_flags();
+    if (flags & AV_CPU_FLAG_SSE2) {
+        ks->hfilter1 = hfilter1_sse2;
+        ks->vfilter = vfilter_sse2;
+    }
+    if (flags & AV_CPU_FLAG_AVX2)
+        ks->vfilter = vfilter_avx2;
+#elif KSCALE_NEON
+    ks->vfilter = vfilter_neon;
+#endif
+}
+
+static void scale_slice(struct mp_kscale *ks, struct scratch *sc,
+                        struct plane_job *job, int y0, int y1)
+{
+    struct filter_table *v = job->v;
+    int row_len = job->dst_w * job->channels;
+    int row_stride = MP_ALIGN_UP(row_len, 16);
+    int ring_size = v->taps;
+
+    // Row r of the source (scaled horizontally) is in slot r % ring_size.
+    // The start rows never decrease, so the slots of rows in [start, hi) still
+    // contain the rows scaled for the previous output row.
+    int hi = 0;
+    for (int y = y0; y < y1; y++) {
+        int start = v->start[y];
+        for (int r = MPMAX(start, hi); r < start + v->taps; r++) {
+            int16_t *slot = sc->ring + (r % ring_size) * row_stride;
+            const uint8_t *src = job->src + r * (ptrdiff_t)job->src_stride;
+            if (job->channels == 1) {
+                ks->hfilter1(slot, src, job->src_w, job->h);
+            } else {
+                hfilter_c(slot, src, job->src_w, job->h, job->channels);
+            }
+        }
+        hi = start + v->taps;
+        for (int i = 0; i < v->taps; i++)
+            sc->rows[i] = sc->ring + ((start + i) % ring_size) * row_stride;
+        ks->vfilter(job->dst + y * (ptrdiff_t)job->dst_stride, sc->rows,
+                    &v->weights[y * v->taps_padded], v->taps, row_len);
+    }
+}
+
+static void run_slice(struct mp_kscale *ks, int index)
+{
+    struct scratch *sc = &ks->scratch[index];
+    for (int n = 0; n < ks->num_jobs; n++) {
+        struct plane_job *job = &ks->jobs[n];
+        int y0 = job->dst_h * (int64_t)index / ks->num_threads;
+        int y1 = job->dst_h * (int64_t)(index + 1) / ks->num_threads;
+        if (y0 < y1)
+            scale_slice(ks, sc, job, y0, y1);
+    }
+}
+
+static void *worker_thread(void *p)
+{
+    struct worker *w = p;
+    struct mp_kscale *ks = w->ks;
+
+    pthread_mutex_lock(&ks->lock);
+    while (1) {
+        while (!ks->terminate && ks->job_id == w->last_job)
+            pthread_cond_wait(&ks->wakeup, &ks->lock);
+        if (ks->terminate)
+            break;
+        w->last_job = ks->job_id;
+        pthread_mutex_unlock(&ks->lock);
+
+        run_slice(ks, w->index);
+
+        pthread_mutex_lock(&ks->lock);
+        ks->pending--;
+        if (!ks->pending)
+            pthread_cond_signal(&ks->done);
+    }
+    pthread_mutex_unlock(&ks->lock);
+    return NULL;
+}
+
+static void stop_workers(struct mp_kscale *ks)
+{
+    pthread_mutex_lock(&ks->lock);
+    ks->terminate = true;
+    pthread_cond_broadcast(&ks->wakeup);
+    pthread_mutex_unlock(&ks->lock);
+    for (int n = 0; n < ks->num_workers; n++)
+        pthread_join(ks->workers[n].thread, NULL);
+    talloc_free(ks->workers);
+    ks->workers = NULL;
+    ks->num_workers = 0;
+    ks->terminate = false;
+}
+
+static void start_workers(struct mp_kscale *ks, int num_threads)
+{
+    stop_workers(ks);
+    ks->workers = talloc_zero_array(ks, struct worker, num_threads - 1);
+    for (int n = 0; n < num_threads - 1; n++) {
+        struct worker *w = &ks->workers[n];
+        w->ks = ks;
+        w->index = n + 1;
+        w->last_job = ks->job_id;
+        if (pthread_create(&w->thread, NULL, worker_thread, w))
+            break;
+        ks->num_workers++;
+    }
+    // If creating threads failed, do the remaining slices on fewer threads.
+    ks->num_threads = ks->num_workers + 1;
+
+    talloc_free(ks->scratch);
+    ks->scratch = talloc_zero_array(ks, struct scratch, ks->num_threads);
+}
+
+static void destroy_kscale(void *p)
+{
+    struct mp_kscale *ks = p;
+    stop_workers(ks);
+    pthread_mutex_destroy(&ks->lock);
+    pthread_cond_destroy(&ks->wakeup);
+    pthread_cond_destroy(&ks->done);
+}
+
+struct mp_kscale *mp_kscale_create(void *talloc_ctx)
+{
+    struct mp_kscale *ks = talloc_zero(talloc_ctx, struct mp_kscale);
+    pthread_mutex_init(&ks->lock, NULL);
+    pthread_cond_init(&ks->wakeup, NULL);
+    pthread_cond_init(&ks->done, NULL);
+    talloc_set_destructor(ks, destroy_kscale);
+    init_dsp(ks);
+    ks->kernel = mp_find_filter_kernel("bilinear_slow");
+    start_workers(ks, 1);
+    return ks;
+}
+
+void mp_kscale_configure(struct mp_kscale *ks,
+                         const struct filter_kernel *kernel, int threads)
+{
+    if (kernel)
+        ks->kernel = kernel;
+    if (threads <= 0)
+        threads = default_thread_count();
+    threads = MPCLAMP(threads, 1, MAX_THREADS);
+    if (threads != ks->num_threads)
+        start_workers(ks, threads);
+}
+
+bool mp_kscale_supported(int imgfmt)
+{
+    struct mp_imgfmt_desc desc = mp_imgfmt_get_desc(imgfmt);
+    if (!desc.id || (desc.flags & (MP_IMGFLAG_HWACCEL | MP_IMGFLAG_PAL)) ||
+        !(desc.flags & MP_IMGFLAG_BYTE_ALIGNED))
+        return false;
+    for (int p = 0; p < desc.num_planes; p++) {
+        if (desc.bpp[p] != desc.bytes[p] * 8)
+            return false;
+    }
+    // Planar formats with 8 bit per component.
+    if ((desc.flags & MP_IMGFLAG_PLANAR) && desc.bytes[0] == 1 &&
+        (!(desc.flags & MP_IMGFLAG_YUV_P) || desc.plane_bits == 8))
+    {
+        for (int p = 0; p < desc.num_planes; p++) {
+            if (desc.bytes[p] != 1)
+                return false;
+        }
+        return true;
+    }
+    // Packed formats, where each byte is a component of the same pixel.
+    switch (imgfmt) {
+    case IMGFMT_YA8:
+    case IMGFMT_NV12:
+    case IMGFMT_NV21:
+    case IMGFMT_ARGB:
+    case IMGFMT_BGRA:
+    case IMGFMT_ABGR:
+    case IMGFMT_RGBA:
+    case IMGFMT_BGR24:
+    case IMGFMT_RGB24:
+    case IMGFMT_0RGB:
+    case IMGFMT_BGR0:
+    case IMGFMT_0BGR:
+    case IMGFMT_RGB0:
+        return true;
+    }
+    return false;
+}
+
+void mp_kscale_scale(struct mp_kscale *ks, struct mp_image *dst,
+                     struct mp_image *src)
+{
+    assert(dst->imgfmt == src->imgfmt && mp_kscale_supported(src->imgfmt));
+
+    int cx, cy;
+    mp_get_chroma_location(src->params.chroma_location, &cx, &cy);
+
+    ks->num_jobs = 0;
+    int max_taps = 0, max_row = 0;
+    for (int p = 0; p < src->num_planes; p++) {
+        if (!dst->plane_w[p] || !dst->plane_h[p] || !src->plane_w[p] ||
+            !src->plane_h[p])
+            continue;
+        double ox = chroma_offset(src->fmt.xs[p], cx, src->plane_w[p],
+                                  dst->plane_w[p]);
+        double oy = chroma_offset(src->fmt.ys[p], cy, src->plane_h[p],
+                                  dst->plane_h[p]);
+        struct filter_table *h = &ks->tables[p][0], *v = &ks->tables[p][1];
+        if (h->src_size != src->plane_w[p] || h->dst_size != dst->plane_w[p] ||
+            h->offset != ox || h->kernel != ks->kernel)
+            build_table(ks, h, ks->kernel, src->plane_w[p], dst->plane_w[p], ox);
+        if (v->src_size != src->plane_h[p] || v->dst_size != dst->plane_h[p] ||
+            v->offset != oy || v->kernel != ks->kernel)
+            build_table(ks, v, ks->kernel, src->plane_h[p], dst->plane_h[p], oy);
+        ks->jobs[ks->num_jobs++] = (struct plane_job){
+            .dst = dst->planes[p],
+            .dst_stride = dst->stride[p],
+            .dst_w = dst->plane_w[p],
+            .dst_h = dst->plane_h[p],
+            .src = src->planes[p],
+            .src_stride = src->stride[p],
+            .src_w = src->plane_w[p],
+            .channels = src->fmt.bytes[p],
+            .h = h,
+            .v = v,
+        };
+        max_taps = MPMAX(max_taps, v->taps);
+        max_row = MPMAX(max_row, MP_ALIGN_UP(dst->plane_w[p] * src->fmt.bytes[p], 16));
+    }
+
+    for (int n = 0; n < ks->num_threads; n++) {
+        struct scratch *sc = &ks->scratch[n];
+        size_t size = max_taps * max_row * sizeof(int16_t);
+        if (talloc_get_size(sc->ring) < size)
+            sc->ring = talloc_realloc_size(ks->scratch, sc->ring, size);
+        if (talloc_get_size(sc->rows) < max_taps * sizeof(sc->rows[0]))
+            sc->rows = talloc_realloc(ks->scratch, sc->rows, const int16_t *, max_taps);
+    }
+
+    pthread_mutex_lock(&ks->lock);
+    ks->job_id++;
+    ks->pending = ks->num_workers;
+    pthread_cond_broadcast(&ks->wakeup);
+    pthread_mutex_unlock(&ks->lock);
+
+    run_slice(ks, 0);
+
+    pthread_mutex_lock(&ks->lock);
+    while (ks->pending)
+        pthread_cond_wait(&ks->done, &ks->lock);
+    pthread_mutex_unlock(&ks->lock);
+}
+
+int mp_kscale_validate_kernel_opt(struct mp_log *log, const struct m_option *opt,
+                                  struct bstr name, struct bstr param)
+{
+    if (bstr_equals0(param, "help")) {
+        mp_info(log, "Available kernels:\n");
+        for (int n = 0; mp_filter_kernels[n].name; n++)
+            mp_info(log, "    %s\n", mp_filter_kernels[n].name);
+        return M_OPT_EXIT - 1;
+    }
+    if (!param.len)
+        return 1;
+    char s[20];
+    snprintf(s, sizeof(s), "%.*s", BSTR_P(param));
+    return mp_find_filter_kernel(s) ? 1 : M_OPT_INVALID;
+}
+
+const struct filter_kernel *mp_kscale_find_kernel(const char *name)
+{
+    return name && name[0] ? mp_find_filter_kernel(name) : NULL;
+}
@@ -0,0 +1,57 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_KERNEL_SCALE_H
+#define MP_KERNEL_SCALE_H
+
+#include <stdbool.h>
+
+#include "misc/bstr.h"
+
+struct mp_image;
+struct mp_log;
+struct m_option;
+struct filter_kernel;
+
+// Separable CPU scaler using the filter kernels from filter_kernels.c. It
+// only scales, and doesn't convert between formats. The work is split into
+// horizontal slices, which are processed by worker threads.
+struct mp_kscale;
+
+struct mp_kscale *mp_kscale_create(void *talloc_ctx);
+
+// kernel: entry in mp_filter_kernels[]
+// threads: number of threads to use (0 for the number of CPUs)
+void mp_kscale_configure(struct mp_kscale *ks,
+                         const struct filter_kernel *kernel, int threads);
+
+// Whether the format can be scaled (8 bit per component formats).
+bool mp_kscale_supported(int imgfmt);
+
+// Scale src to dst. Both images must have the same, supported, format.
+void mp_kscale_scale(struct mp_kscale *ks, struct mp_image *dst,
+                     struct mp_image *src);
+
+// For OPT_STRING_VALIDATE() options selecting a kernel by name. The empty
+// string is accepted too (for "disabled"), and "help" lists the kernels.
+int mp_kscale_validate_kernel_opt(struct mp_log *log, const struct m_option *opt,
+                                  struct bstr name, struct bstr param);
+
+// Look up the kernel selected with such an option. Returns NULL if unset.
+const struct filter_kernel *mp_kscale_find_kernel(const char *name);
+
+#endif
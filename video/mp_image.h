@@ -102,6 +102,16 @@ typedef struct mp_image {
 
     /* only inside filter chain */
     double pts;
+    // mp_time_us() timestamps of the processing stages, for latency
+    // statistics (0 if unknown)
+    struct mp_frame_times {
+        int64_t demux;          // packet was demuxed
+        int64_t decode_start;
+        int64_t decode_end;
+        int64_t filter_end;     // frame left the filter chain
+        int64_t queue;          // frame was queued to the VO
+        int64_t trace_flow;     // mp_trace_pts_id() of the demuxer pts
+    } times;
     /* memory management */
     struct m_refcount *refcount;
     /* for private use */
@@ -21,6 +21,11 @@
  */
 
 #include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <libavutil/md5.h>
+#include <libavutil/mem.h>
 
 #include "talloc.h"
 
@@ -32,6 +37,11 @@
 #include "common/msg.h"
 #include "options/m_option.h"
 #include "options/path.h"
+#include "osdep/atomics.h"
+#include "osdep/io.h"
+#include "osdep/numcores.h"
+#include "osdep/threads.h"
+#include "osdep/timer.h"
 
 #include "gl_video.h"
 #include "gl_lcms.h"
@@ -66,7 +76,8 @@ const struct m_sub_options mp_icc_conf = {
     .opts = (const m_option_t[]) {
         OPT_STRING("icc-profile", profile, 0),
         OPT_FLAG("icc-profile-auto", profile_auto, 0),
-        OPT_STRING("icc-cache", cache, 0),
+        OPT_STRING("icc-cache-dir", cache_dir, 0),
+        OPT_REMOVED("icc-cache", "see icc-cache-dir"),
         OPT_INT("icc-intent", intent, 0),
         OPT_STRING_VALIDATE("3dlut-size", size_str, 0, validate_3dlut_size_opt),
         {0}
@@ -112,23 +123,173 @@ bool mp_icc_set_profile(struct mp_icc_opts *opts, char *profile)
 
 #define LUT3D_CACHE_HEADER "mpv 3dlut cache 1.0\n"
 
-struct lut3d *mp_load_icc(struct mp_icc_opts *opts, struct mp_log *log,
-                          struct mpv_global *global)
+// Maximum number of threads generating a LUT.
+#define MAX_THREADS 16
+
+// Everything needed to create a LUT. Copied from the options, so that it can
+// be done on another thread.
+struct lut3d_params {
+    char *profile;
+    char *cache_dir;
+    int intent;
+    int size[3];
+};
+
+static bool get_lut3d_params(void *talloc_ctx, struct mp_icc_opts *opts,
+                             struct lut3d_params *params)
 {
-    int s_r, s_g, s_b;
-    if (!parse_3dlut_size(opts->size_str, &s_r, &s_g, &s_b))
+    *params = (struct lut3d_params){
+        .profile = talloc_strdup(talloc_ctx, opts->profile),
+        .cache_dir = talloc_strdup(talloc_ctx, opts->cache_dir),
+        .intent = opts->intent,
+    };
+    return opts->profile && parse_3dlut_size(opts->size_str, &params->size[0],
+                                             &params->size[1], &params->size[2]);
+}
+
+// Returns the path of the file the LUT is cached in. The name is a hash of
+// the contents it depends on, so the directory can contain LUTs for any
+// number of profiles and settings.
+static char *get_cache_filename(void *talloc_ctx, struct lut3d_params *params,
+                                struct mpv_global *global, char *cache_info,
+                                struct bstr iccdata)
+{
+    if (!params->cache_dir || !params->cache_dir[0])
         return NULL;
 
-    if (!opts->profile)
+    struct AVMD5 *md5 = av_md5_alloc();
+    if (!md5)
         return NULL;
+    uint8_t hash[16];
+    av_md5_init(md5);
+    av_md5_update(md5, LUT3D_CACHE_HEADER, strlen(LUT3D_CACHE_HEADER));
+    av_md5_update(md5, cache_info, strlen(cache_info));
+    av_md5_update(md5, iccdata.start, iccdata.len);
+    av_md5_final(md5, hash);
+    av_free(md5);
+
+    char *name = talloc_strdup(NULL, "");
+    for (int i = 0; i < 16; i++)
+        name = talloc_asprintf_append(name, "%02X", hash[i]);
+
+    char *res = NULL;
+    char *dir = mp_get_user_path(NULL, global, params->cache_dir);
+    if (dir) {
+        mp_mkdirp(dir);
+        res = mp_path_join(talloc_ctx, bstr0(dir), bstr0(name));
+    }
+    talloc_free(dir);
+    talloc_free(name);
+    return res;
+}
+
+static void save_cache(struct mp_log *log, const char *fname, char *cache_info,
+                       uint16_t *output)
+{
+    // Write to a private file and rename it into place, so that other mpv
+    // instances sharing the cache directory never see a partial LUT.
+    static atomic_int tmp_count = ATOMIC_VAR_INIT(0);
+    char *tmpname = talloc_asprintf(NULL, "%s.%d-%d.tmp", fname, (int)getpid(),
+                                    atomic_fetch_add(&tmp_count, 1));
+    FILE *out = fopen(tmpname, "wb");
+    if (!out) {
+        mp_msg(log, MSGL_WARN, "Can't write 3D LUT cache to '%s'.\n", fname);
+        goto done;
+    }
+    fprintf(out, "%s%s", LUT3D_CACHE_HEADER, cache_info);
+    fwrite(output, talloc_get_size(output), 1, out);
+    bool failed = ferror(out);
+    if (fclose(out) || failed || rename(tmpname, fname)) {
+        mp_msg(log, MSGL_WARN, "Error writing 3D LUT cache to '%s'.\n", fname);
+        remove(tmpname);
+        goto done;
+    }
+    mp_msg(log, MSGL_V, "Saved 3D LUT cache to '%s'.\n", fname);
+done:
+    talloc_free(tmpname);
+}
+
+struct lut3d_slice {
+    cmsHTRANSFORM trafo;
+    uint16_t *output;
+    int size[3];
+    int b0, b1;             // range of the blue axis to transform
+    atomic_bool *cancel;
+    pthread_t thread;
+    bool threaded;
+};
+
+static void *lut3d_slice_thread(void *arg)
+{
+    struct lut3d_slice *sl = arg;
+    int s_r = sl->size[0], s_g = sl->size[1], s_b = sl->size[2];
+    // transform a (s_r)x(s_g)x(s_b) cube, with 3 components per channel
+    uint16_t *input = talloc_array(NULL, uint16_t, s_r * 3);
+    for (int b = sl->b0; b < sl->b1; b++) {
+        if (sl->cancel && atomic_load(sl->cancel))
+            break;
+        for (int g = 0; g < s_g; g++) {
+            for (int r = 0; r < s_r; r++) {
+                input[r * 3 + 0] = r * 65535 / (s_r - 1);
+                input[r * 3 + 1] = g * 65535 / (s_g - 1);
+                input[r * 3 + 2] = b * 65535 / (s_b - 1);
+            }
+            size_t base = (b * s_r * s_g + g * s_r) * 3;
+            cmsDoTransform(sl->trafo, input, sl->output + base, s_r);
+        }
+    }
+    talloc_free(input);
+    return NULL;
+}
+
+// Fill the LUT, with the cube split along the blue axis between threads.
+// lcms2 transforms are read-only after creation, and can be shared.
+static int generate_lut3d(cmsHTRANSFORM trafo, uint16_t *output, int size[3],
+                          atomic_bool *cancel)
+{
+    int num_threads = MPCLAMP(default_thread_count(), 1,
+                              MPMIN(size[2], MAX_THREADS));
+    struct lut3d_slice slices[MAX_THREADS];
+    for (int n = 0; n < num_threads; n++) {
+        slices[n] = (struct lut3d_slice){
+            .trafo = trafo,
+            .output = output,
+            .size = {size[0], size[1], size[2]},
+            .b0 = size[2] * n / num_threads,
+            .b1 = size[2] * (n + 1) / num_threads,
+            .cancel = cancel,
+        };
+    }
+    // The first slice is done on the calling thread, and so is any slice
+    // whose thread couldn't be created.
+    for (int n = 1; n < num_threads; n++) {
+        slices[n].threaded = !pthread_create(&slices[n].thread, NULL,
+                                             lut3d_slice_thread, &slices[n]);
+    }
+    for (int n = 0; n < num_threads; n++) {
+        if (!slices[n].threaded)
+            lut3d_slice_thread(&slices[n]);
+    }
+    for (int n = 1; n < num_threads; n++) {
+        if (slices[n].threaded)
+            pthread_join(slices[n].thread, NULL);
+    }
+    return num_threads;
+}
+
+static struct lut3d *load_lut3d(struct lut3d_params *params, struct mp_log *log,
+                                struct mpv_global *global, atomic_bool *cancel)
+{
+    int s_r = params->size[0], s_g = params->size[1], s_b = params->size[2];
 
     void *tmp = talloc_new(NULL);
     uint16_t *output = talloc_array(tmp, uint16_t, s_r * s_g * s_b * 3);
     struct lut3d *lut = NULL;
     cmsContext cms = NULL;
+    int64_t start = mp_time_us();
 
-    mp_msg(log, MSGL_INFO, "Opening ICC profile '%s'\n", opts->profile);
-    struct bstr iccdata = load_file(tmp, opts->profile, global);
+    mp_msg(log, MSGL_INFO, "Opening ICC profile '%s'\n", params->profile);
+    struct bstr iccdata = load_file(tmp, params->profile, global);
     if (!iccdata.len)
         goto error_exit;
 
@@ -137,22 +298,23 @@ struct lut3d *mp_load_icc(struct mp_icc_opts *opts, struct mp_log *log,
         // because we may change the parameter in the future or make it
         // customizable, same for the primaries.
         talloc_asprintf(tmp, "intent=%d, size=%dx%dx%d, gamma=2.4, prim=bt2020\n",
-                        opts->intent, s_r, s_g, s_b);
+                        params->intent, s_r, s_g, s_b);
 
     // check cache
-    if (opts->cache) {
-        mp_msg(log, MSGL_INFO, "Opening 3D LUT cache in file '%s'.\n",
-                   opts->cache);
-        struct bstr cachedata = load_file(tmp, opts->cache, global);
+    char *cache_file = get_cache_filename(tmp, params, global, cache_info,
+                                          iccdata);
+    if (cache_file) {
+        struct bstr cachedata = load_file(tmp, cache_file, global);
         if (bstr_eatstart(&cachedata, bstr0(LUT3D_CACHE_HEADER))
             && bstr_eatstart(&cachedata, bstr0(cache_info))
-            && bstr_eatstart(&cachedata, iccdata)
             && cachedata.len == talloc_get_size(output))
         {
             memcpy(output, cachedata.start, cachedata.len);
+            mp_msg(log, MSGL_V, "Loaded 3D LUT from cache '%s' in %.1f ms.\n",
+                   cache_file, (mp_time_us() - start) / 1000.0);
             goto done;
-        } else {
-            mp_msg(log, MSGL_WARN, "3D LUT cache invalid!\n");
+        } else if (cachedata.len) {
+            mp_msg(log, MSGL_WARN, "3D LUT cache '%s' invalid!\n", cache_file);
         }
     }
 
@@ -184,7 +346,7 @@ struct lut3d *mp_load_icc(struct mp_icc_opts *opts, struct mp_log *log,
     cmsFreeToneCurve(tonecurve);
     cmsHTRANSFORM trafo = cmsCreateTransformTHR(cms, vid_profile, TYPE_RGB_16,
                                                 profile, TYPE_RGB_16,
-                                                opts->intent,
+                                                params->intent,
                                                 cmsFLAGS_HIGHRESPRECALC);
     cmsCloseProfile(profile);
     cmsCloseProfile(vid_profile);
@@ -192,33 +354,21 @@ struct lut3d *mp_load_icc(struct mp_icc_opts *opts, struct mp_log *log,
     if (!trafo)
         goto error_exit;
 
-    // transform a (s_r)x(s_g)x(s_b) cube, with 3 components per channel
-    uint16_t *input = talloc_array(tmp, uint16_t, s_r * 3);
-    for (int b = 0; b < s_b; b++) {
-        for (int g = 0; g < s_g; g++) {
-            for (int r = 0; r < s_r; r++) {
-                input[r * 3 + 0] = r * 65535 / (s_r - 1);
-                input[r * 3 + 1] = g * 65535 / (s_g - 1);
-                input[r * 3 + 2] = b * 65535 / (s_b - 1);
-            }
-            size_t base = (b * s_r * s_g + g * s_r) * 3;
-            cmsDoTransform(trafo, input, output + base, s_r);
-        }
-    }
+    int64_t gen_start = mp_time_us();
+    int threads = generate_lut3d(trafo, output, params->size, cancel);
 
     cmsDeleteTransform(trafo);
 
-    if (opts->cache) {
-        char *fname = mp_get_user_path(NULL, global, opts->cache);
-        FILE *out = fopen(fname, "wb");
-        if (out) {
-            fprintf(out, "%s%s", LUT3D_CACHE_HEADER, cache_info);
-            fwrite(iccdata.start, iccdata.len, 1, out);
-            fwrite(output, talloc_get_size(output), 1, out);
-            fclose(out);
-        }
-        talloc_free(fname);
-    }
+    if (cancel && atomic_load(cancel))
+        goto error_exit;
+
+    int64_t end = mp_time_us();
+    mp_msg(log, MSGL_V, "Generated %dx%dx%d 3D LUT in %.1f ms (transform "
+           "setup %.1f ms, %d threads).\n", s_r, s_g, s_b,
+           (end - start) / 1000.0, (gen_start - start) / 1000.0, threads);
+
+    if (cache_file)
+        save_cache(log, cache_file, cache_info, output);
 
 done: ;
 
@@ -233,13 +383,96 @@ error_exit:
     if (cms)
         cmsDeleteContext(cms);
 
-    if (!lut)
+    if (!lut && !(cancel && atomic_load(cancel)))
         mp_msg(log, MSGL_FATAL, "Error loading ICC profile.\n");
 
     talloc_free(tmp);
     return lut;
 }
 
+struct mp_icc_loader {
+    struct mp_log *log;
+    struct mpv_global *global;
+    struct lut3d_params params;
+    void (*wakeup)(void *ctx);
+    void *wakeup_ctx;
+    pthread_t thread;
+    atomic_bool cancel;
+
+    pthread_mutex_t lock;
+    bool done;
+    struct lut3d *lut;
+};
+
+static void *loader_thread(void *arg)
+{
+    struct mp_icc_loader *l = arg;
+    mpthread_set_name("icc");
+
+    struct lut3d *lut = load_lut3d(&l->params, l->log, l->global, &l->cancel);
+
+    pthread_mutex_lock(&l->lock);
+    l->lut = lut;
+    l->done = true;
+    pthread_mutex_unlock(&l->lock);
+
+    if (l->wakeup)
+        l->wakeup(l->wakeup_ctx);
+    return NULL;
+}
+
+static void destroy_loader(void *ptr)
+{
+    struct mp_icc_loader *l = ptr;
+    atomic_store(&l->cancel, true);
+    pthread_join(l->thread, NULL);
+    talloc_free(l->lut);
+    pthread_mutex_destroy(&l->lock);
+}
+
+struct mp_icc_loader *mp_icc_loader_create(void *talloc_ctx,
+                                           struct mp_icc_opts *opts,
+                                           struct mp_log *log,
+                                           struct mpv_global *global,
+                                           void (*wakeup)(void *ctx),
+                                           void *wakeup_ctx)
+{
+    struct mp_icc_loader *l = talloc_ptrtype(talloc_ctx, l);
+    *l = (struct mp_icc_loader){
+        .log = log,
+        .global = global,
+        .wakeup = wakeup,
+        .wakeup_ctx = wakeup_ctx,
+    };
+    if (!get_lut3d_params(l, opts, &l->params)) {
+        talloc_free(l);
+        return NULL;
+    }
+    atomic_store(&l->cancel, false);
+    pthread_mutex_init(&l->lock, NULL);
+    if (pthread_create(&l->thread, NULL, loader_thread, l)) {
+        pthread_mutex_destroy(&l->lock);
+        talloc_free(l);
+        return NULL;
+    }
+    talloc_set_destructor(l, destroy_loader);
+    return l;
+}
+
+int mp_icc_loader_get(struct mp_icc_loader *l, struct lut3d **lut)
+{
+    *lut = NULL;
+    pthread_mutex_lock(&l->lock);
+    int r = 0;
+    if (l->done) {
+        *lut = l->lut;
+        l->lut = NULL;
+        r = *lut ? 1 : -1;
+    }
+    pthread_mutex_unlock(&l->lock);
+    return r;
+}
+
 #else /* HAVE_LCMS2 */
 
 const struct m_sub_options mp_icc_conf = {
@@ -253,11 +486,21 @@ bool mp_icc_set_profile(struct mp_icc_opts *opts, char *profile)
     return false;
 }
 
-struct lut3d *mp_load_icc(struct mp_icc_opts *opts, struct mp_log *log,
-                          struct mpv_global *global)
+struct mp_icc_loader *mp_icc_loader_create(void *talloc_ctx,
+                                           struct mp_icc_opts *opts,
+                                           struct mp_log *log,
+                                           struct mpv_global *global,
+                                           void (*wakeup)(void *ctx),
+                                           void *wakeup_ctx)
 {
     mp_msg(log, MSGL_FATAL, "LCMS2 support not compiled.\n");
     return NULL;
 }
 
+int mp_icc_loader_get(struct mp_icc_loader *l, struct lut3d **lut)
+{
+    *lut = NULL;
+    return -1;
+}
+
 #endif
@@ -8,7 +8,7 @@ extern const struct m_sub_options mp_icc_conf;
 struct mp_icc_opts {
     char *profile;
     int profile_auto;
-    char *cache;
+    char *cache_dir;
     char *size_str;
     int intent;
 };
@@ -17,7 +17,20 @@ struct lut3d;
 struct mp_log;
 struct mpv_global;
 bool mp_icc_set_profile(struct mp_icc_opts *opts, char *profile);
-struct lut3d *mp_load_icc(struct mp_icc_opts *opts, struct mp_log *log,
-                          struct mpv_global *global);
+
+// Creates the LUT for the profile set in opts on a separate thread (if it's
+// not cached, this can take a while). wakeup is called from that thread when
+// it's done. Returns NULL if the options are invalid. Freeing the loader with
+// talloc_free() aborts the generation.
+struct mp_icc_loader;
+struct mp_icc_loader *mp_icc_loader_create(void *talloc_ctx,
+                                           struct mp_icc_opts *opts,
+                                           struct mp_log *log,
+                                           struct mpv_global *global,
+                                           void (*wakeup)(void *ctx),
+                                           void *wakeup_ctx);
+// Returns 0 if the LUT is not ready yet, 1 if it is (*lut is set, and must be
+// freed by the caller), or -1 if loading failed. Returns it only once.
+int mp_icc_loader_get(struct mp_icc_loader *l, struct lut3d **lut);
 
 #endif
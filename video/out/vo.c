@@ -35,6 +35,7 @@
 #include "osdep/threads.h"
 #include "misc/dispatch.h"
 #include "misc/rendezvous.h"
+#include "misc/histogram.h"
 #include "options/options.h"
 #include "misc/bstr.h"
 #include "vo.h"
@@ -42,6 +43,7 @@
 #include "input/input.h"
 #include "options/m_config.h"
 #include "common/msg.h"
+#include "common/trace.h"
 #include "common/global.h"
 #include "video/mp_image.h"
 #include "video/vfcap.h"
@@ -112,6 +114,14 @@ const struct vo_driver *const video_out_drivers[] =
         NULL
 };
 
+// A frame queued for display.
+struct vo_frame {
+    struct mp_image *image;
+    int64_t pts;                    // realtime of intended display
+    int64_t duration;               // realtime frame duration (for framedrop)
+    bool held;                      // not to be rendered while paused
+};
+
 struct vo_internal {
     pthread_t thread;
     struct mp_dispatch_queue *dispatch;
@@ -136,15 +146,24 @@ struct vo_internal {
     int64_t flip_queue_offset; // queue flip events at most this much in advance
 
     int64_t drop_count;
+    bool measure_cpu;               // (--benchmark)
+    int64_t render_cpu_time;        // CPU time used for drawing and flipping
     bool dropped_frame;             // the previous frame was dropped
     struct mp_image *dropped_image; // used to possibly redraw the dropped frame
 
     int64_t wakeup_pts;             // time at which to pull frame from decoder
+    int64_t pause_start;            // time at which playback was paused
 
     bool rendering;                 // true if an image is being rendered
-    struct mp_image *frame_queued;  // the image that should be rendered
-    int64_t frame_pts;              // realtime of intended display
-    int64_t frame_duration;         // realtime frame duration (for framedrop)
+    struct vo_frame *frames;        // images that should be rendered, in order
+    int num_frames;
+    int64_t frame_pts;              // realtime of intended display (last frame)
+    int64_t frame_duration;         // realtime frame duration (last frame)
+    double current_pts;             // video pts of the frame on screen
+
+    // --- The following fields are thread-safe
+    // Latencies of the displayed frames in microseconds (for each stage)
+    struct mp_histogram *latency[VO_LATENCY_COUNT];
 
     // --- The following fields can be accessed from the VO thread only
     int64_t vsync_interval;
@@ -231,11 +250,15 @@ static struct vo *vo_create(bool probing, struct mpv_global *global,
     talloc_steal(vo, log);
     *vo->in = (struct vo_internal) {
         .dispatch = mp_dispatch_create(vo),
+        .measure_cpu = global->opts->benchmark,
+        .current_pts = MP_NOPTS_VALUE,
     };
     mp_make_wakeup_pipe(vo->in->wakeup_pipe);
     mp_dispatch_set_wakeup_fn(vo->in->dispatch, dispatch_wakeup_cb, vo);
     pthread_mutex_init(&vo->in->lock, NULL);
     pthread_cond_init(&vo->in->wakeup, NULL);
+    for (int n = 0; n < VO_LATENCY_COUNT; n++)
+        vo->in->latency[n] = mp_histogram_new(vo->in);
 
     mp_input_set_mouse_transform(vo->input_ctx, NULL, NULL);
     if (vo->driver->encode != !!vo->encode_lavc_ctx)
@@ -390,7 +413,10 @@ static void forget_frames(struct vo *vo)
     in->hasframe = false;
     in->hasframe_rendered = false;
     in->drop_count = 0;
-    mp_image_unrefp(&in->frame_queued);
+    for (int n = 0; n < in->num_frames; n++)
+        mp_image_unrefp(&in->frames[n].image);
+    in->num_frames = 0;
+    in->current_pts = MP_NOPTS_VALUE;
     mp_image_unrefp(&in->dropped_image);
 }
 
@@ -471,23 +497,31 @@ void vo_wakeup(struct vo *vo)
     pthread_mutex_unlock(&in->lock);
 }
 
-// Whether vo_queue_frame() can be called. If the VO is not ready yet, the
-// function will return false, and the VO will call the wakeup callback once
-// it's ready.
-// next_pts is the exact time when the next frame should be displayed. If the
-// VO is ready, but the time is too "early", return false, and call the wakeup
-// callback once the time is right.
+// Time at which rendering of a frame with the given display time can start.
+// Don't show the frame too early - it would basically freeze the display by
+// disallowing OSD redrawing or VO interaction.
+// Actually render the frame at earliest 50ms before target time.
+static int64_t render_start_time(struct vo *vo, int64_t pts)
+{
+    return pts - (uint64_t)(0.050 * 1e6) - vo->in->flip_queue_offset;
+}
+
+// Whether vo_queue_frame() can be called. If the VO is not ready yet (e.g.
+// the frame queue is full), the function will return false, and the VO will
+// call the wakeup callback once it's ready.
+// next_pts is the exact time when the next frame should be displayed. If no
+// other frame is queued (so the frame would be rendered right away), but the
+// time is too "early", return false, and call the wakeup callback once the
+// time is right. Otherwise, up to --vo-queue-frames frames can be queued in
+// advance.
 bool vo_is_ready_for_frame(struct vo *vo, int64_t next_pts)
 {
     struct vo_internal *in = vo->in;
     pthread_mutex_lock(&in->lock);
-    bool r = vo->config_ok && !in->frame_queued;
-    if (r) {
-        // Don't show the frame too early - it would basically freeze the
-        // display by disallowing OSD redrawing or VO interaction.
-        // Actually render the frame at earliest 50ms before target time.
-        next_pts -= (uint64_t)(0.050 * 1e6);
-        next_pts -= in->flip_queue_offset;
+    int max_frames = MPMAX(vo->global->opts->vo_queue_frames, 1);
+    bool r = vo->config_ok && in->num_frames < max_frames;
+    if (r && !in->num_frames) {
+        next_pts = render_start_time(vo, next_pts);
         int64_t now = mp_time_us();
         if (next_pts > now)
             r = false;
@@ -500,7 +534,7 @@ bool vo_is_ready_for_frame(struct vo *vo, int64_t next_pts)
     return r;
 }
 
-// Direct the VO thread to put the currently queued image on the screen.
+// Append the image to the queue of frames the VO thread puts on the screen.
 // vo_is_ready_for_frame() must have returned true before this call.
 // Ownership of the image is handed to the vo.
 void vo_queue_frame(struct vo *vo, struct mp_image *image,
@@ -508,23 +542,37 @@ void vo_queue_frame(struct vo *vo, struct mp_image *image,
 {
     struct vo_internal *in = vo->in;
     pthread_mutex_lock(&in->lock);
-    assert(vo->config_ok && !in->frame_queued);
+    assert(vo->config_ok);
     in->hasframe = true;
-    in->frame_queued = image;
+    image->times.queue = mp_time_us();
+    MP_TARRAY_APPEND(in, in->frames, in->num_frames, (struct vo_frame){
+        .image = image,
+        .pts = pts_us,
+        .duration = duration,
+    });
     in->frame_pts = pts_us;
     in->frame_duration = duration;
     in->wakeup_pts = in->frame_pts + MPMAX(duration, 0);
+    MP_TRACE_COUNTER(vo, "vo queued frames", in->num_frames);
     wakeup_locked(vo);
     pthread_mutex_unlock(&in->lock);
 }
 
+// Whether the first queued frame can't be rendered, because it was queued
+// before the player was paused. Must be called locked.
+static bool frames_held(struct vo *vo)
+{
+    struct vo_internal *in = vo->in;
+    return in->paused && in->num_frames && in->frames[0].held;
+}
+
 // If a frame is currently being rendered (or queued), wait until it's done.
-// Otherwise, return immediately.
+// Otherwise, return immediately. Frames held by pausing are not waited for.
 void vo_wait_frame(struct vo *vo)
 {
     struct vo_internal *in = vo->in;
     pthread_mutex_lock(&in->lock);
-    while (in->frame_queued || in->rendering)
+    while ((in->num_frames && !frames_held(vo)) || in->rendering)
         pthread_cond_wait(&in->wakeup, &in->lock);
     pthread_mutex_unlock(&in->lock);
 }
@@ -540,6 +588,22 @@ static int64_t prev_sync(struct vo *vo, int64_t ts)
     return ts - offset;
 }
 
+static void add_latency(struct vo *vo, struct mp_frame_times *t, int64_t flip)
+{
+    int64_t stages[VO_LATENCY_COUNT][2] = {
+        [VO_LATENCY_DEMUX]      = {t->demux, t->decode_start},
+        [VO_LATENCY_DECODE]     = {t->decode_start, t->decode_end},
+        [VO_LATENCY_FILTER]     = {t->decode_end, t->filter_end},
+        [VO_LATENCY_QUEUE]      = {t->filter_end, t->queue},
+        [VO_LATENCY_DISPLAY]    = {t->queue, flip},
+        [VO_LATENCY_TOTAL]      = {t->demux, flip},
+    };
+    for (int n = 0; n < VO_LATENCY_COUNT; n++) {
+        if (stages[n][0] && stages[n][1])
+            mp_histogram_add(vo->in->latency[n], stages[n][1] - stages[n][0]);
+    }
+}
+
 static bool render_frame(struct vo *vo)
 {
     struct vo_internal *in = vo->in;
@@ -548,22 +612,29 @@ static bool render_frame(struct vo *vo)
 
     pthread_mutex_lock(&in->lock);
 
-    int64_t pts = in->frame_pts;
-    int64_t duration = in->frame_duration;
-    struct mp_image *img = in->frame_queued;
-    if (!img) {
+    if (!in->num_frames || frames_held(vo) ||
+        render_start_time(vo, in->frames[0].pts) > mp_time_us())
+    {
         pthread_mutex_unlock(&in->lock);
         return false;
     }
 
+    int64_t pts = in->frames[0].pts;
+    int64_t duration = in->frames[0].duration;
+    struct mp_image *img = in->frames[0].image;
+    MP_TARRAY_REMOVE_AT(in->frames, in->num_frames, 0);
+
+    // Also if the frame is dropped: its display time has come.
+    in->current_pts = img->pts;
+
     mp_image_unrefp(&in->dropped_image);
 
     in->rendering = true;
-    in->frame_queued = NULL;
 
     // The next time a flip (probably) happens.
     int64_t next_vsync = prev_sync(vo, mp_time_us()) + in->vsync_interval;
-    int64_t end_time = pts + duration;
+    // If the next frame is already queued, its display time is known exactly.
+    int64_t end_time = in->num_frames ? in->frames[0].pts : pts + duration;
 
     if (!(vo->global->opts->frame_dropping & 1) || !in->hasframe_rendered ||
         vo->driver->untimed || vo->driver->encode)
@@ -583,11 +654,16 @@ static bool render_frame(struct vo *vo)
         mp_input_wakeup(vo->input_ctx); // core can queue new video now
 
         MP_STATS(vo, "start video");
+        MP_TRACE_BEGIN(vo, "video");
+        // draw_image() takes the image, so get these before.
+        int64_t flow_id = img->times.trace_flow;
+        struct mp_frame_times times = img->times;
+        int64_t cpu_start = in->measure_cpu ? mp_thread_cpu_time_us() : 0;
 
         vo->driver->draw_image(vo, img);
 
         int64_t target = pts - in->flip_queue_offset;
-        while (1) {
+        while (!vo->driver->untimed && !vo->global->opts->untimed) {
             int64_t now = mp_time_us();
             if (target <= now)
                 break;
@@ -607,14 +683,21 @@ static bool render_frame(struct vo *vo)
         if (in->last_flip < 0)
             in->last_flip = mp_time_us();
 
+        int64_t cpu_time = in->measure_cpu ?
+                           mp_thread_cpu_time_us() - cpu_start : 0;
+        add_latency(vo, &times, in->last_flip);
+
         long phase = in->last_flip % in->vsync_interval;
         MP_DBG(vo, "phase: %ld\n", phase);
         MP_STATS(vo, "value %ld phase", phase);
 
+        MP_TRACE_FLOW(vo, END, "video frame", flow_id);
         MP_STATS(vo, "end video");
+        MP_TRACE_END(vo, "video");
 
         pthread_mutex_lock(&in->lock);
         in->dropped_frame = drop;
+        in->render_cpu_time += cpu_time;
     }
 
     if (in->dropped_frame)
@@ -688,6 +771,10 @@ static void *vo_thread(void *ptr)
         int64_t now = mp_time_us();
         int64_t wait_until = now + (frame_shown ? 0 : (int64_t)1e9);
         pthread_mutex_lock(&in->lock);
+        if (in->num_frames && !frames_held(vo)) {
+            int64_t start = render_start_time(vo, in->frames[0].pts);
+            wait_until = MPMIN(wait_until, MPMAX(start, now));
+        }
         if (in->wakeup_pts) {
             if (in->wakeup_pts > now) {
                 wait_until = MPMIN(wait_until, in->wakeup_pts);
@@ -721,6 +808,22 @@ void vo_set_paused(struct vo *vo, bool paused)
         in->paused = paused;
         if (in->paused && in->dropped_frame)
             in->request_redraw = true;
+        // Frames queued in advance are kept until playback is resumed (except
+        // the next one, which is still shown, e.g. for frame stepping), and
+        // then delayed by the time playback was paused.
+        int64_t now = mp_time_us();
+        if (paused)
+            in->pause_start = now;
+        for (int n = paused ? 1 : 0; n < in->num_frames; n++) {
+            struct vo_frame *f = &in->frames[n];
+            if (!paused && f->held)
+                f->pts += now - in->pause_start;
+            f->held = paused;
+        }
+        if (!paused && in->num_frames) {
+            in->frame_pts = in->frames[in->num_frames - 1].pts;
+            wakeup_locked(vo);
+        }
     }
     pthread_mutex_unlock(&in->lock);
     vo_control(vo, paused ? VOCTRL_PAUSE : VOCTRL_RESUME, NULL);
@@ -734,6 +837,32 @@ int64_t vo_get_drop_count(struct vo *vo)
     return r;
 }
 
+// Video pts of the frame currently on screen (or MP_NOPTS_VALUE if none since
+// the last seek or reconfig). With --vo-queue-frames > 1, this lags behind the
+// frame queued last.
+double vo_get_current_pts(struct vo *vo)
+{
+    pthread_mutex_lock(&vo->in->lock);
+    double r = vo->in->current_pts;
+    pthread_mutex_unlock(&vo->in->lock);
+    return r;
+}
+
+// CPU time the VO thread used for rendering frames since the VO was created.
+int64_t vo_get_render_cpu_time(struct vo *vo)
+{
+    pthread_mutex_lock(&vo->in->lock);
+    int64_t r = vo->in->render_cpu_time;
+    pthread_mutex_unlock(&vo->in->lock);
+    return r;
+}
+
+// The returned histogram is valid until the VO is destroyed.
+struct mp_histogram *vo_get_latency(struct vo *vo, enum vo_latency_stage stage)
+{
+    return vo->in->latency[stage];
+}
+
 // Make the VO redraw the OSD at some point in the future.
 void vo_redraw(struct vo *vo)
 {
@@ -771,7 +900,7 @@ bool vo_still_displaying(struct vo *vo)
     pthread_mutex_lock(&vo->in->lock);
     int64_t now = mp_time_us();
     int64_t frame_end = in->frame_pts + MPMAX(in->frame_duration, 0);
-    bool working = now < frame_end || in->rendering || in->frame_queued;
+    bool working = now < frame_end || in->rendering || in->num_frames;
     pthread_mutex_unlock(&vo->in->lock);
     return working && in->hasframe;
 }
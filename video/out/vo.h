@@ -160,7 +160,19 @@ struct voctrl_screenshot_args {
 // VO does framedrop itself (vo_vdpau). Untimed/encoding VOs never drop.
 #define VO_CAP_FRAMEDROP 2
 
+// Stages of the frame latency statistics (see mp_image.times).
+enum vo_latency_stage {
+    VO_LATENCY_DEMUX,       // packet demuxed -> decoding started
+    VO_LATENCY_DECODE,      // decoding
+    VO_LATENCY_FILTER,      // decoded -> left the filter chain
+    VO_LATENCY_QUEUE,       // filtered -> queued to the VO
+    VO_LATENCY_DISPLAY,     // queued -> flipped
+    VO_LATENCY_TOTAL,       // packet demuxed -> flipped
+    VO_LATENCY_COUNT
+};
+
 struct vo;
+struct mp_histogram;
 struct osd_state;
 struct mp_image;
 struct mp_image_params;
@@ -316,6 +328,9 @@ void vo_seek_reset(struct vo *vo);
 void vo_destroy(struct vo *vo);
 void vo_set_paused(struct vo *vo, bool paused);
 int64_t vo_get_drop_count(struct vo *vo);
+double vo_get_current_pts(struct vo *vo);
+int64_t vo_get_render_cpu_time(struct vo *vo);
+struct mp_histogram *vo_get_latency(struct vo *vo, enum vo_latency_stage stage);
 int vo_query_format(struct vo *vo, int format);
 void vo_event(struct vo *vo, int event);
 int vo_query_and_reset_events(struct vo *vo, int events);
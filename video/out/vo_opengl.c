@@ -63,6 +63,9 @@ struct gl_priv {
     struct gl_hwdec *hwdec;
     struct mp_hwdec_info hwdec_info;
 
+    // Generates the 3D LUT in the background, if set.
+    struct mp_icc_loader *icc_loader;
+
     // Options
     struct gl_video_opts *renderer_opts;
     struct mp_icc_opts *icc_opts;
@@ -240,20 +243,48 @@ static void call_request_hwdec_api(struct mp_hwdec_info *info,
     vo_control(vo, VOCTRL_LOAD_HWDEC_API, (void *)api_name);
 }
 
+static void wakeup_icc_loader(void *ctx)
+{
+    vo_wakeup(ctx);
+}
+
+// The previous LUT (if any) stays in use until check_icc_loader() installs
+// the new one, so switching profiles doesn't flash uncorrected frames.
 static bool update_icc_profile(struct gl_priv *p)
 {
     struct mp_icc_opts *opts = p->icc_opts;
-    struct lut3d *lut3d = NULL;
-    if (opts->profile) {
-        lut3d = mp_load_icc(opts, p->vo->log, p->vo->global);
-        if (!lut3d)
+    talloc_free(p->icc_loader);
+    p->icc_loader = NULL;
+    if (!opts->profile) {
+        gl_video_set_lut3d(p->renderer, NULL);
+    } else {
+        p->icc_loader = mp_icc_loader_create(p, opts, p->vo->log,
+                                             p->vo->global, wakeup_icc_loader,
+                                             p->vo);
+        if (!p->icc_loader)
             return false;
     }
-    gl_video_set_lut3d(p->renderer, lut3d);
-    talloc_free(lut3d);
     return true;
 }
 
+// Called with the GL context locked.
+static void check_icc_loader(struct gl_priv *p)
+{
+    if (!p->icc_loader)
+        return;
+    struct lut3d *lut3d;
+    int r = mp_icc_loader_get(p->icc_loader, &lut3d);
+    if (r == 0)
+        return;
+    talloc_free(p->icc_loader);
+    p->icc_loader = NULL;
+    if (r > 0) {
+        gl_video_set_lut3d(p->renderer, lut3d);
+        p->vo->want_redraw = true;
+    }
+    talloc_free(lut3d);
+}
+
 static bool get_and_update_icc_profile(struct gl_priv *p)
 {
     if (!p->icc_opts->profile_auto)
@@ -380,6 +411,7 @@ static int control(struct vo *vo, uint32_t request, void *data)
         get_and_update_icc_profile(p);
         vo->want_redraw = true;
     }
+    check_icc_loader(p);
     vo_event(vo, events);
     mpgl_unlock(p->glctx);
 
@@ -390,6 +422,7 @@ static void uninit(struct vo *vo)
 {
     struct gl_priv *p = vo->priv;
 
+    talloc_free(p->icc_loader);
     gl_video_uninit(p->renderer);
     gl_hwdec_uninit(p->hwdec);
     mpgl_uninit(p->glctx);
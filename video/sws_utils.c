@@ -32,6 +32,7 @@
 #include "video/img_format.h"
 #include "fmt-conversion.h"
 #include "csputils.h"
+#include "kernel_scale.h"
 #include "common/msg.h"
 #include "video/filter/vf.h"
 
@@ -44,6 +45,8 @@ struct sws_opts {
     int chr_hshift;
     float chr_sharpen;
     float lum_sharpen;
+    char *kernel;
+    int kernel_threads;
 };
 
 #define OPT_BASE_STRUCT struct sws_opts
@@ -67,6 +70,8 @@ const struct m_sub_options sws_conf = {
         OPT_INT("chs", chr_hshift, 0),
         OPT_FLOATRANGE("ls", lum_sharpen, 0, -100.0, 100.0),
         OPT_FLOATRANGE("cs", chr_sharpen, 0, -100.0, 100.0),
+        OPT_STRING_VALIDATE("kernel", kernel, 0, mp_kscale_validate_kernel_opt),
+        OPT_INTRANGE("kernel-threads", kernel_threads, 0, 0, 16),
         {0}
     },
     .size = sizeof(struct sws_opts),
@@ -87,13 +92,24 @@ const int mp_sws_fast_flags = SWS_BILINEAR;
 void mp_sws_set_from_cmdline(struct mp_sws_context *ctx, struct sws_opts *opts)
 {
     sws_freeFilter(ctx->src_filter);
-    ctx->src_filter = sws_getDefaultFilter(opts->lum_gblur, opts->chr_gblur,
-                                           opts->lum_sharpen, opts->chr_sharpen,
-                                           opts->chr_hshift, opts->chr_vshift, 0);
+    ctx->src_filter = NULL;
+    // Identity filters would prevent using the kernel scaler alone.
+    if (opts->lum_gblur || opts->chr_gblur || opts->lum_sharpen ||
+        opts->chr_sharpen || opts->chr_hshift || opts->chr_vshift)
+    {
+        ctx->src_filter = sws_getDefaultFilter(opts->lum_gblur, opts->chr_gblur,
+                                               opts->lum_sharpen,
+                                               opts->chr_sharpen,
+                                               opts->chr_hshift,
+                                               opts->chr_vshift, 0);
+    }
     ctx->force_reload = true;
 
     ctx->flags = SWS_PRINT_INFO;
     ctx->flags |= opts->scaler;
+
+    ctx->kernel = mp_kscale_find_kernel(opts->kernel);
+    ctx->kernel_threads = opts->kernel_threads;
 }
 
 bool mp_sws_supported_format(int imgfmt)
@@ -124,7 +140,9 @@ static bool cache_valid(struct mp_sws_context *ctx)
            ctx->flags == old->flags &&
            ctx->brightness == old->brightness &&
            ctx->contrast == old->contrast &&
-           ctx->saturation == old->saturation;
+           ctx->saturation == old->saturation &&
+           ctx->kernel == old->kernel &&
+           ctx->kernel_threads == old->kernel_threads;
 }
 
 static void free_mp_sws(void *p)
@@ -169,13 +187,39 @@ int mp_sws_reinit(struct mp_sws_context *ctx)
         return 0;
 
     sws_freeContext(ctx->sws);
-    ctx->sws = sws_alloc_context();
-    if (!ctx->sws)
-        return -1;
+    ctx->sws = NULL;
 
     mp_image_params_guess_csp(src); // sanitize colorspace/colorlevels
     mp_image_params_guess_csp(dst);
 
+    // With the kernel scaler, libswscale converts the scaled image.
+    struct mp_image_params sws_src = *src;
+    ctx->use_kernel = ctx->kernel && mp_kscale_supported(src->imgfmt) &&
+                      (src->w != dst->w || src->h != dst->h);
+    ctx->kernel_only = false;
+    if (ctx->use_kernel) {
+        if (!ctx->kscale)
+            ctx->kscale = mp_kscale_create(ctx);
+        mp_kscale_configure(ctx->kscale, ctx->kernel, ctx->kernel_threads);
+        sws_src.w = dst->w;
+        sws_src.h = dst->h;
+        ctx->kernel_only = src->imgfmt == dst->imgfmt &&
+                           src->colorspace == dst->colorspace &&
+                           src->colorlevels == dst->colorlevels &&
+                           src->chroma_location == dst->chroma_location &&
+                           !ctx->src_filter && !ctx->dst_filter &&
+                           ctx->brightness == 0 &&
+                           ctx->contrast == 1 << 16 &&
+                           ctx->saturation == 1 << 16;
+        if (ctx->kernel_only)
+            goto done;
+    }
+    src = &sws_src;
+
+    ctx->sws = sws_alloc_context();
+    if (!ctx->sws)
+        return -1;
+
     struct mp_imgfmt_desc src_fmt = mp_imgfmt_get_desc(src->imgfmt);
     struct mp_imgfmt_desc dst_fmt = mp_imgfmt_get_desc(dst->imgfmt);
     if (!src_fmt.id || !dst_fmt.id)
@@ -243,6 +287,7 @@ int mp_sws_reinit(struct mp_sws_context *ctx)
     if (sws_init_context(ctx->sws, ctx->src_filter, ctx->dst_filter) < 0)
         return -1;
 
+done:
     ctx->force_reload = false;
     *ctx->cached = *ctx;
     return 1;
@@ -263,6 +308,27 @@ int mp_sws_scale(struct mp_sws_context *ctx, struct mp_image *dst,
         return r;
     }
 
+    if (ctx->use_kernel) {
+        struct mp_image *scaled = dst;
+        if (!ctx->kernel_only) {
+            struct mp_image *tmp = ctx->kscale_tmp;
+            if (!tmp || tmp->imgfmt != src->imgfmt || tmp->w != dst->w ||
+                tmp->h != dst->h)
+            {
+                talloc_free(tmp);
+                tmp = mp_image_alloc(src->imgfmt, dst->w, dst->h);
+                ctx->kscale_tmp = talloc_steal(ctx, tmp);
+                if (!tmp)
+                    return -1;
+            }
+            scaled = tmp;
+        }
+        mp_kscale_scale(ctx->kscale, scaled, src);
+        if (ctx->kernel_only)
+            return 0;
+        src = scaled;
+    }
+
     sws_scale(ctx->sws, (const uint8_t *const *) src->planes, src->stride,
               0, src->h, dst->planes, dst->stride);
     return 0;
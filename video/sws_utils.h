@@ -8,6 +8,8 @@
 struct mp_image;
 struct mp_csp_details;
 struct sws_opts;
+struct filter_kernel;
+struct mp_kscale;
 
 // libswscale currently requires 16 bytes alignment for row pointers and
 // strides. Otherwise, it will print warnings and use slow codepaths.
@@ -33,6 +35,11 @@ struct mp_sws_context {
     int flags;
     int brightness, contrast, saturation;
     bool force_reload;
+    // If set, scaling is done with this filter kernel (see kernel_scale.h),
+    // and libswscale is used only for format conversion (if needed). This is
+    // ignored if the source format is not supported by the kernel scaler.
+    const struct filter_kernel *kernel;
+    int kernel_threads;     // 0 for the number of CPUs
     // These are also implicitly set by mp_sws_scale(), and thus optional.
     // Setting them before that call makes sense when using mp_sws_reinit().
     struct mp_image_params src, dst;
@@ -45,6 +52,10 @@ struct mp_sws_context {
 
     // Cached context (if any)
     struct SwsContext *sws;
+    struct mp_kscale *kscale;
+    struct mp_image *kscale_tmp;
+    // Whether the kernel scaler is used, and whether it does all the work.
+    bool use_kernel, kernel_only;
 
     // Contains parameters for which sws is valid
     struct mp_sws_context *cached;
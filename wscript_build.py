@@ -97,8 +97,7 @@ def build(ctx):
         ( "audio/filter/af_bs2b.c",              "libbs2b" ),
         ( "audio/filter/af_center.c" ),
         ( "audio/filter/af_channels.c" ),
-        ( "audio/filter/af_convert24.c" ),
-        ( "audio/filter/af_convertsignendian.c" ),
+        ( "audio/filter/af_convert.c" ),
         ( "audio/filter/af_delay.c" ),
         ( "audio/filter/af_drc.c" ),
         ( "audio/filter/af_dummy.c" ),
@@ -120,7 +119,9 @@ def build(ctx):
         ( "audio/filter/af_surround.c" ),
         ( "audio/filter/af_sweep.c" ),
         ( "audio/filter/af_volume.c" ),
+        ( "audio/filter/fftconv.c" ),
         ( "audio/filter/filter.c" ),
+        ( "audio/filter/sample_conv.c" ),
         ( "audio/filter/tools.c" ),
         ( "audio/filter/window.c" ),
         ( "audio/out/ao.c" ),
@@ -157,6 +158,7 @@ def build(ctx):
         ( "common/tags.c" ),
         ( "common/msg.c" ),
         ( "common/playlist.c" ),
+        ( "common/trace.c" ),
         ( "common/version.c" ),
 
         ## Demuxers
@@ -174,6 +176,7 @@ def build(ctx):
         ( "demux/demux_subreader.c" ),
         ( "demux/demux_tv.c",                    "tv" ),
         ( "demux/ebml.c" ),
+        ( "demux/index_cache.c" ),
         ( "demux/mf.c" ),
         ( "demux/packet.c" ),
 
@@ -192,7 +195,9 @@ def build(ctx):
         ( "misc/bstr.c" ),
         ( "misc/charset_conv.c" ),
         ( "misc/dispatch.c" ),
+        ( "misc/histogram.c" ),
         ( "misc/json.c" ),
+        ( "misc/msgpack.c" ),
         ( "misc/ring.c" ),
         ( "misc/rendezvous.c" ),
 
@@ -280,6 +285,7 @@ def build(ctx):
         ( "video/fmt-conversion.c" ),
         ( "video/image_writer.c" ),
         ( "video/img_format.c" ),
+        ( "video/kernel_scale.c" ),
         ( "video/mp_image.c" ),
         ( "video/mp_image_pool.c" ),
         ( "video/sws_utils.c" ),